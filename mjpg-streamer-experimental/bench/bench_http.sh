@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Runs mjpg_streamer with input_testpicture and output_http from a build
+# directory and measures it with http_load:
+#
+#   bench_http.sh BUILD_DIR [http_load options]
+#
+# The environment can change the setup:
+#
+#   BENCH_INPUT   options of input_testpicture ("-d 33 -r 640x480")
+#   BENCH_OUTPUT  options of output_http ("")
+#   BENCH_PORT    port of the server (8090)
+#   BENCH_ARGS    more http_load options, they override the arguments
+#
+
+BUILD=${1:?usage: $0 BUILD_DIR [http_load options]}
+shift
+
+BENCH_INPUT=${BENCH_INPUT:-"-d 33 -r 640x480"}
+BENCH_PORT=${BENCH_PORT:-8090}
+
+# every viewer needs a socket and a thread of the server
+ulimit -n "$(ulimit -H -n)" 2>/dev/null
+
+"$BUILD/mjpg_streamer" \
+    -i "$BUILD/plugins/input_testpicture/input_testpicture.so $BENCH_INPUT" \
+    -o "$BUILD/plugins/output_http/output_http.so -p $BENCH_PORT $BENCH_OUTPUT" \
+    >"$BUILD/bench_http.log" 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT INT TERM
+
+echo "input_testpicture $BENCH_INPUT, http_load $* $BENCH_ARGS"
+"$BUILD/bench/http_load" --port "$BENCH_PORT" --pid "$SERVER" --wait 10 "$@" $BENCH_ARGS
+STATUS=$?
+
+if ! kill -0 $SERVER 2>/dev/null; then
+    echo "mjpg_streamer died, see $BUILD/bench_http.log"
+    STATUS=1
+fi
+exit $STATUS
@@ -0,0 +1,776 @@
+/*******************************************************************************
+#                                                                              #
+#      Load generator for the HTTP output plugin of MJPG-streamer              #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Simulates many viewers of output_http: each client either streams
+ * ?action=stream or polls ?action=snapshot, optionally reading no faster than
+ * a given rate. The latency of a frame is the time from its capture
+ * (X-Capture-Monotonic) to the moment its last byte arrived, so the server
+ * has to run on the same host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define HEADER_SIZE 2048
+#define READ_SIZE (64*1024)
+#define TICK_MS 10
+
+/* the server closes a snapshot after the picture, the body ends there */
+#define UNTIL_EOF -1
+
+typedef enum {
+    STREAM,
+    SNAPSHOT
+} client_kind;
+
+typedef enum {
+    IDLE,           /* not connected */
+    CONNECTING,
+    HEADER,         /* reading a header block */
+    BODY            /* reading a picture */
+} client_state;
+
+typedef struct {
+    int fd;
+    client_kind kind;
+    client_state state;
+    int response;               /* the HTTP response header was read */
+    int armed;                  /* the socket is watched for input */
+    char header[HEADER_SIZE];
+    int header_length;
+    long remaining;             /* bytes of the current picture */
+    double capture;             /* CLOCK_MONOTONIC of the current picture */
+    unsigned long sequence, last_sequence;
+    unsigned long frames, skipped, bytes;
+    double tokens, refill;      /* token bucket of the read rate */
+    double retry;               /* when to connect again */
+} client;
+
+typedef struct {
+    pthread_t thread;
+    int epoll;
+    client *clients;
+    int count;
+    /* capture to delivery latencies of the frames in the measurement window */
+    float *latencies;
+    size_t latency_count, latency_capacity;
+    unsigned long errors, disconnects;
+} worker;
+
+/* settings, shared by all workers */
+static struct addrinfo *server;
+static char host[256] = "127.0.0.1";
+static char port[16] = "8080";
+static char *query = "";
+static int streams = 0, snapshots = 0, threads = 1;
+static double read_rate = 0;    /* bytes per second and client, 0 is unlimited */
+static double ramp = 1, warmup = 2, duration = 10;
+static double measure_start, measure_end;
+static volatile int stop = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+    "Usage: %s [options]\n\n" \
+    " [-H | --host ].........: host of the server (127.0.0.1)\n" \
+    " [-p | --port ].........: port of the server (8080)\n" \
+    " [-s | --streams ]......: clients reading ?action=stream\n" \
+    " [-n | --snapshots ]....: clients polling ?action=snapshot\n" \
+    " [-q | --query ]........: appended to the query, e.g. \"&fps=5\"\n" \
+    " [-r | --rate ].........: read at most this many kB/s per client\n" \
+    " [-j | --threads ]......: threads to run the clients (1)\n" \
+    " [-R | --ramp ].........: seconds to connect the clients (1)\n" \
+    " [-w | --warmup ].......: seconds after the ramp which are not measured (2)\n" \
+    " [-d | --duration ].....: seconds to measure (10)\n" \
+    " [-P | --pid ]..........: process id of the server, reports its CPU and memory\n" \
+    " [-W | --wait ].........: wait up to this many seconds for the server to listen\n", name);
+}
+
+/******************************************************************************
+Description.: starts to connect a client, the connection completes in the
+              event loop
+Input Value.: w is the worker of the client, c the client
+Return Value: -
+******************************************************************************/
+static void client_connect(worker *w, client *c)
+{
+    struct epoll_event ev;
+    int one = 1;
+
+    c->fd = socket(server->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(c->fd < 0) {
+        w->errors++;
+        c->state = IDLE;
+        c->retry = now() + 1;
+        return;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if(connect(c->fd, server->ai_addr, server->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        w->errors++;
+        close(c->fd);
+        c->fd = -1;
+        c->state = IDLE;
+        c->retry = now() + 1;
+        return;
+    }
+
+    c->state = CONNECTING;
+    c->response = 0;
+    c->header_length = 0;
+    c->armed = 1;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl(w->epoll, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+/******************************************************************************
+Description.: closes the connection of a client, it connects again later
+Input Value.: w is the worker of the client, c the client, delay in seconds
+Return Value: -
+******************************************************************************/
+static void client_close(worker *w, client *c, double delay)
+{
+    if(c->fd >= 0) {
+        epoll_ctl(w->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->state = IDLE;
+    c->retry = now() + delay;
+}
+
+/******************************************************************************
+Description.: sends the request once the connection is established
+Input Value.: w is the worker of the client, c the client
+Return Value: -
+******************************************************************************/
+static void client_request(worker *w, client *c)
+{
+    struct epoll_event ev;
+    char request[512];
+    int err = 0, len;
+    socklen_t errlen = sizeof(err);
+
+    if(getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err != 0) {
+        w->errors++;
+        client_close(w, c, 1);
+        return;
+    }
+
+    len = snprintf(request, sizeof(request), "GET /?action=%s%s HTTP/1.0\r\nHost: %s\r\n\r\n",
+                   c->kind == STREAM ? "stream" : "snapshot", query, host);
+    if(write(c->fd, request, len) != len) {
+        w->errors++;
+        client_close(w, c, 1);
+        return;
+    }
+
+    c->state = HEADER;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(w->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static double header_double(const char *header, const char *name)
+{
+    const char *value = strstr(header, name);
+
+    return value != NULL ? strtod(value + strlen(name), NULL) : 0;
+}
+
+/******************************************************************************
+Description.: records a completely received picture
+Input Value.: w is the worker of the client, c the client
+Return Value: -
+******************************************************************************/
+static void frame_done(worker *w, client *c)
+{
+    double t = now();
+
+    if(t < measure_start || t >= measure_end)
+        return;
+
+    if(c->kind == STREAM && c->last_sequence != 0 && c->sequence > c->last_sequence + 1)
+        c->skipped += c->sequence - c->last_sequence - 1;
+    c->last_sequence = c->sequence;
+    c->frames++;
+
+    if(c->capture <= 0)
+        return;
+
+    if(w->latency_count == w->latency_capacity) {
+        size_t capacity = w->latency_capacity ? 2 * w->latency_capacity : 65536;
+        float *tmp = realloc(w->latencies, capacity * sizeof(float));
+
+        if(tmp == NULL)
+            return;
+        w->latencies = tmp;
+        w->latency_capacity = capacity;
+    }
+    w->latencies[w->latency_count++] = (t - c->capture) * 1000;
+}
+
+/******************************************************************************
+Description.: evaluates a header block, the response of the server or the
+              header of a part of the multipart stream
+Input Value.: w is the worker of the client, c the client
+Return Value: 0 if ok, -1 if the server answered with an error
+******************************************************************************/
+static int header_done(worker *w, client *c)
+{
+    const char *length;
+
+    if(!c->response) {
+        if(strncmp(c->header, "HTTP/", 5) != 0 || strstr(c->header, " 200 ") == NULL)
+            return -1;
+        c->response = 1;
+        /* the parts of a stream have headers of their own */
+        if(c->kind == STREAM)
+            return 0;
+    }
+
+    c->capture = header_double(c->header, "X-Capture-Monotonic: ");
+    c->sequence = (unsigned long)header_double(c->header, "X-Frame-Sequence: ");
+    length = strstr(c->header, "Content-Length: ");
+    c->remaining = (length != NULL) ? strtol(length + 16, NULL, 10) : UNTIL_EOF;
+    c->state = BODY;
+
+    if(c->remaining == 0) {
+        frame_done(w, c);
+        c->state = HEADER;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: parses received bytes, the pictures themselves are dropped
+Input Value.: w is the worker of the client, c the client, data and size
+              of the received bytes
+Return Value: 0 if ok, -1 if the answer is not understood
+******************************************************************************/
+static int consume(worker *w, client *c, const char *data, long size)
+{
+    double t = now();
+
+    if(t >= measure_start && t < measure_end)
+        c->bytes += size;
+
+    while(size > 0) {
+        if(c->state == HEADER) {
+            int start = c->header_length > 3 ? c->header_length - 3 : 0;
+            int copy = size < HEADER_SIZE - 1 - c->header_length ? size : HEADER_SIZE - 1 - c->header_length;
+            char *end;
+
+            if(copy <= 0)
+                return -1;
+            memcpy(c->header + c->header_length, data, copy);
+            c->header_length += copy;
+            c->header[c->header_length] = '\0';
+
+            if((end = strstr(c->header + start, "\r\n\r\n")) == NULL) {
+                data += copy;
+                size -= copy;
+                continue;
+            }
+
+            /* only the bytes up to the end of the header belong to it */
+            copy -= c->header_length - (end + 4 - c->header);
+            *end = '\0';
+            data += copy;
+            size -= copy;
+            c->header_length = 0;
+            if(header_done(w, c) < 0)
+                return -1;
+        } else {
+            long part = size;
+
+            if(c->remaining != UNTIL_EOF) {
+                part = size < c->remaining ? size : c->remaining;
+                c->remaining -= part;
+                if(c->remaining == 0) {
+                    frame_done(w, c);
+                    c->state = HEADER;
+                }
+            }
+            data += part;
+            size -= part;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads what the server sent, as much as the read rate allows
+Input Value.: w is the worker of the client, c the client, buffer to read to
+Return Value: -
+******************************************************************************/
+static void client_read(worker *w, client *c, char *buffer)
+{
+    struct epoll_event ev;
+    double t;
+    long allowed;
+    ssize_t n;
+
+    while(1) {
+        allowed = READ_SIZE;
+
+        if(read_rate > 0) {
+            t = now();
+            c->tokens += (t - c->refill) * read_rate;
+            c->refill = t;
+            /* allow bursts of a tick */
+            if(c->tokens > read_rate * TICK_MS / 1000 + 1460)
+                c->tokens = read_rate * TICK_MS / 1000 + 1460;
+            if(c->tokens < 1) {
+                /* stop watching the socket until the bucket is refilled */
+                ev.events = 0;
+                ev.data.ptr = c;
+                epoll_ctl(w->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+                c->armed = 0;
+                return;
+            }
+            if(allowed > c->tokens)
+                allowed = c->tokens;
+        }
+
+        n = read(c->fd, buffer, allowed);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EINTR)
+                return;
+            w->disconnects++;
+            client_close(w, c, 1);
+            return;
+        }
+
+        if(n == 0) {
+            /* a snapshot ends with the connection, a stream must not end */
+            if(c->kind == SNAPSHOT && c->state == BODY) {
+                frame_done(w, c);
+                client_close(w, c, 0);
+                client_connect(w, c);
+            } else {
+                w->disconnects++;
+                client_close(w, c, 1);
+            }
+            return;
+        }
+
+        if(read_rate > 0)
+            c->tokens -= n;
+
+        if(consume(w, c, buffer, n) < 0) {
+            w->errors++;
+            client_close(w, c, 1);
+            return;
+        }
+    }
+}
+
+/******************************************************************************
+Description.: runs the clients of a worker until the measurement ends
+Input Value.: arg is the worker
+Return Value: NULL
+******************************************************************************/
+static void *worker_thread(void *arg)
+{
+    worker *w = arg;
+    struct epoll_event events[256];
+    struct epoll_event ev;
+    double start = now(), last_scan = 0, t;
+    char *buffer = malloc(READ_SIZE);
+    int i, n, connected = 0;
+
+    if(buffer == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        return NULL;
+    }
+
+    while(!stop && now() < measure_end) {
+        t = now();
+
+        /* connect the clients spread over the ramp to go easy on the backlog */
+        while(connected < w->count && (ramp <= 0 || connected < w->count * (t - start) / ramp)) {
+            client_connect(w, &w->clients[connected]);
+            connected++;
+        }
+
+        /* retry failed connections and resume throttled clients once a tick */
+        for(i = 0; t - last_scan >= TICK_MS / 1000.0 && i < connected; i++) {
+            client *c = &w->clients[i];
+
+            if(c->state == IDLE && c->retry <= t) {
+                client_connect(w, c);
+            } else if(c->fd >= 0 && !c->armed && (t - c->refill) * read_rate >= 1460) {
+                ev.events = EPOLLIN;
+                ev.data.ptr = c;
+                epoll_ctl(w->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+                c->armed = 1;
+            }
+        }
+
+        if(t - last_scan >= TICK_MS / 1000.0)
+            last_scan = t;
+
+        n = epoll_wait(w->epoll, events, sizeof(events) / sizeof(events[0]), TICK_MS);
+        for(i = 0; i < n; i++) {
+            client *c = events[i].data.ptr;
+
+            if(c->state == CONNECTING)
+                client_request(w, c);
+            else if(c->fd >= 0)
+                client_read(w, c, buffer);
+        }
+    }
+
+    for(i = 0; i < w->count; i++)
+        client_close(w, &w->clients[i], 0);
+    free(buffer);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: reads the CPU time and the memory of a process from /proc
+Input Value.: pid of the process, cpu receives the seconds of user and system
+              time, rss and peak the resident memory in kB, nthreads the
+              threads of the process
+Return Value: 0 if ok, -1 if the process does not exist
+******************************************************************************/
+static int process_stats(int pid, double *cpu, long *rss, long *peak, long *nthreads)
+{
+    char path[64], line[4096], *p;
+    unsigned long utime, stime;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if((f = fopen(path, "r")) == NULL)
+        return -1;
+    if(fgets(line, sizeof(line), f) == NULL || (p = strrchr(line, ')')) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    /* the fields after the name: state is field 3, utime 14, stime 15, threads 20 */
+    if(sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %ld",
+              &utime, &stime, nthreads) != 3)
+        return -1;
+    *cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if((f = fopen(path, "r")) == NULL)
+        return -1;
+    while(fgets(line, sizeof(line), f) != NULL) {
+        sscanf(line, "VmRSS: %ld", rss);
+        sscanf(line, "VmHWM: %ld", peak);
+    }
+    fclose(f);
+    return 0;
+}
+
+/******************************************************************************
+Description.: waits until the server accepts connections
+Input Value.: seconds to wait at most
+Return Value: 0 if the server listens, -1 if not
+******************************************************************************/
+static int wait_for_server(double seconds)
+{
+    double deadline = now() + seconds;
+    int fd;
+
+    while(now() < deadline) {
+        if((fd = socket(server->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+            return -1;
+        if(connect(fd, server->ai_addr, server->ai_addrlen) == 0) {
+            close(fd);
+            return 0;
+        }
+        close(fd);
+        usleep(100 * 1000);
+    }
+    return -1;
+}
+
+static int compare_float(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void handle_signal(int sig)
+{
+    stop = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"host", required_argument, 0, 'H'},
+        {"port", required_argument, 0, 'p'},
+        {"streams", required_argument, 0, 's'},
+        {"snapshots", required_argument, 0, 'n'},
+        {"query", required_argument, 0, 'q'},
+        {"rate", required_argument, 0, 'r'},
+        {"threads", required_argument, 0, 'j'},
+        {"ramp", required_argument, 0, 'R'},
+        {"warmup", required_argument, 0, 'w'},
+        {"duration", required_argument, 0, 'd'},
+        {"pid", required_argument, 0, 'P'},
+        {"wait", required_argument, 0, 'W'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    struct addrinfo hints;
+    struct rlimit limit;
+    struct rusage usage_start, usage_end;
+    worker *workers;
+    client *clients;
+    double server_cpu_start = 0, server_cpu_end = 0, wait = 0, measured, own_cpu;
+    double fps, fps_min = -1, fps_max = 0;
+    long rss = 0, peak = 0, nthreads = 0;
+    unsigned long frames = 0, skipped = 0, errors = 0, disconnects = 0, bytes = 0;
+    size_t latency_count = 0;
+    float *latencies;
+    int pid = 0, total, c, i, ret;
+
+    while((c = getopt_long(argc, argv, "H:p:s:n:q:r:j:R:w:d:P:W:h", long_options, NULL)) != -1) {
+        switch(c) {
+        case 'H':
+            snprintf(host, sizeof(host), "%s", optarg);
+            break;
+        case 'p':
+            snprintf(port, sizeof(port), "%s", optarg);
+            break;
+        case 's':
+            streams = atoi(optarg);
+            break;
+        case 'n':
+            snapshots = atoi(optarg);
+            break;
+        case 'q':
+            query = optarg;
+            break;
+        case 'r':
+            read_rate = atof(optarg) * 1000;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'R':
+            ramp = atof(optarg);
+            break;
+        case 'w':
+            warmup = atof(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'P':
+            pid = atoi(optarg);
+            break;
+        case 'W':
+            wait = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    total = streams + snapshots;
+    if(total <= 0 || threads < 1 || duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(threads > total)
+        threads = total;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if((ret = getaddrinfo(host, port, &hints, &server)) != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(ret));
+        return 1;
+    }
+
+    if(wait > 0 && wait_for_server(wait) < 0) {
+        fprintf(stderr, "the server %s:%s does not accept connections\n", host, port);
+        return 1;
+    }
+
+    /* every client needs a file descriptor */
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)total + 64)
+        fprintf(stderr, "warning: only %lu file descriptors for %d clients\n", (unsigned long)limit.rlim_cur, total);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    workers = calloc(threads, sizeof(worker));
+    clients = calloc(total, sizeof(client));
+    if(workers == NULL || clients == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        return 1;
+    }
+
+    /* interleave the kinds, so every worker gets its share of both */
+    for(i = 0; i < total; i++) {
+        clients[i].fd = -1;
+        clients[i].kind = (i * snapshots / total != (i + 1) * snapshots / total) ? SNAPSHOT : STREAM;
+        clients[i].refill = now();
+    }
+
+    for(i = 0; i < threads; i++) {
+        workers[i].clients = &clients[total * i / threads];
+        workers[i].count = total * (i + 1) / threads - total * i / threads;
+        workers[i].epoll = epoll_create1(EPOLL_CLOEXEC);
+        if(workers[i].epoll < 0) {
+            perror("epoll_create1");
+            return 1;
+        }
+    }
+
+    measure_start = now() + ramp + warmup;
+    measure_end = measure_start + duration;
+
+    for(i = 0; i < threads; i++) {
+        if(pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "could not start the worker threads\n");
+            return 1;
+        }
+    }
+
+    /* take the stats of the server and of ourselves around the measurement */
+    while(!stop && now() < measure_start)
+        usleep(10 * 1000);
+    getrusage(RUSAGE_SELF, &usage_start);
+    if(pid > 0 && process_stats(pid, &server_cpu_start, &rss, &peak, &nthreads) < 0) {
+        fprintf(stderr, "no process %d\n", pid);
+        pid = 0;
+    }
+    while(!stop && now() < measure_end)
+        usleep(10 * 1000);
+    measured = duration - (measure_end > now() ? measure_end - now() : 0);
+    getrusage(RUSAGE_SELF, &usage_end);
+    if(pid > 0 && process_stats(pid, &server_cpu_end, &rss, &peak, &nthreads) < 0)
+        pid = 0;
+
+    stop = 1;
+    for(i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        latency_count += workers[i].latency_count;
+        errors += workers[i].errors;
+        disconnects += workers[i].disconnects;
+    }
+
+    if(measured <= 0) {
+        fprintf(stderr, "interrupted before the measurement started\n");
+        return 1;
+    }
+
+    for(i = 0; i < total; i++) {
+        frames += clients[i].frames;
+        skipped += clients[i].skipped;
+        bytes += clients[i].bytes;
+        fps = clients[i].frames / measured;
+        if(fps_min < 0 || fps < fps_min)
+            fps_min = fps;
+        if(fps > fps_max)
+            fps_max = fps;
+    }
+
+    latencies = malloc((latency_count + 1) * sizeof(float));
+    if(latencies == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        return 1;
+    }
+    latency_count = 0;
+    for(i = 0; i < threads; i++) {
+        memcpy(latencies + latency_count, workers[i].latencies, workers[i].latency_count * sizeof(float));
+        latency_count += workers[i].latency_count;
+    }
+    qsort(latencies, latency_count, sizeof(float), compare_float);
+
+    own_cpu = (usage_end.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) +
+              (usage_end.ru_utime.tv_usec - usage_start.ru_utime.tv_usec) / 1e6 +
+              (usage_end.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) +
+              (usage_end.ru_stime.tv_usec - usage_start.ru_stime.tv_usec) / 1e6;
+
+    printf("clients.....: %d stream, %d snapshot, %lu errors, %lu disconnects\n",
+           streams, snapshots, errors, disconnects);
+    printf("frames......: %lu delivered, %lu skipped by the server, %.1f s measured\n",
+           frames, skipped, measured);
+    printf("fps.........: %.2f per client (min %.2f, max %.2f), %.1f total\n",
+           frames / measured / total, fps_min, fps_max, frames / measured);
+    printf("throughput..: %.2f MB/s\n", bytes / measured / 1e6);
+    if(latency_count > 0) {
+        printf("latency ms..: p50 %.2f p90 %.2f p99 %.2f max %.2f\n",
+               latencies[(latency_count - 1) / 2], latencies[(latency_count - 1) * 90 / 100],
+               latencies[(latency_count - 1) * 99 / 100], latencies[latency_count - 1]);
+    } else {
+        printf("latency ms..: no frames with X-Capture-Monotonic received\n");
+    }
+    if(pid > 0) {
+        double cpu = (server_cpu_end - server_cpu_start) / measured * 100;
+
+        printf("server......: cpu %.1f%% (%.4f%% per client), rss %.1f MB (peak %.1f MB), %ld threads\n",
+               cpu, cpu / total, rss / 1024.0, peak / 1024.0, nthreads);
+    }
+    printf("load gen....: cpu %.1f%%%s\n", own_cpu / measured * 100,
+           own_cpu / measured > threads * 0.9 ? ", saturated, use more --threads" : "");
+
+    for(i = 0; i < threads; i++) {
+        close(workers[i].epoll);
+        free(workers[i].latencies);
+    }
+    free(latencies);
+    free(workers);
+    free(clients);
+    freeaddrinfo(server);
+    return frames > 0 ? 0 : 1;
+}
@@ -0,0 +1,633 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * The configuration file given with --config lists inputs and outputs like
+ * -i and -o, together with values for their controls:
+ *
+ *   [input lobby]
+ *   plugin = input_uvc.so -d /dev/video0
+ *   parameters = -r 1280x720 -f 30
+ *   control Brightness = 140
+ *
+ *   [output]
+ *   plugin = output_http.so -p 8080
+ *
+ * On SIGHUP the file is read again and only the differences are applied:
+ * plugins whose parameters changed are loaded again, plugins which are gone
+ * are removed, new ones are added and changed control values are set while
+ * the plugins keep running. The plugins are changed with the commands of
+ * the plugin management, see control.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "utils.h"
+#include "mjpg_streamer.h"
+#include "control.h"
+#include "config.h"
+
+#define CONFIG_LINE 1024
+#define REPLY_LENGTH 4096
+
+/* the controls of a plugin are set once they show up, but not later than this */
+#define CONTROLS_TIMEOUT_MS 5000
+
+/* a control value of a plugin */
+typedef struct {
+    char *name;             // the name or the number of the control
+    int value;
+} config_control;
+
+/* an input or output of the configuration file */
+typedef struct {
+    char *key;              // matches the plugin of the old and the new file
+    char *label;            // the name of an input or NULL
+    char *spec;             // the specification like for -i and -o
+    config_control *controls;
+    int control_count;
+    int slot;               // the slot it is loaded into or -1
+    int kept;               // it kept running when the file was read again
+} config_plugin;
+
+typedef struct {
+    config_plugin *plugins[2];  // the inputs and the outputs
+    int count[2];
+} config;
+
+static globals *pglobal;
+static char *config_path;
+static config current;
+
+/******************************************************************************
+Description.: removes the white space at both ends of a string
+Input Value.: s is the string, it is changed
+Return Value: the start of the trimmed string
+******************************************************************************/
+static char *trim(char *s)
+{
+    char *end;
+
+    while(isspace((unsigned char)*s))
+        s++;
+    end = s + strlen(s);
+    while(end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+/******************************************************************************
+Description.: frees a configuration
+Input Value.: cfg is the configuration, it is emptied
+Return Value: -
+******************************************************************************/
+static void free_config(config *cfg)
+{
+    int k, i, j;
+
+    for(k = 0; k < 2; k++) {
+        for(i = 0; i < cfg->count[k]; i++) {
+            config_plugin *p = &cfg->plugins[k][i];
+
+            for(j = 0; j < p->control_count; j++)
+                free(p->controls[j].name);
+            free(p->controls);
+            free(p->key);
+            free(p->label);
+            free(p->spec);
+        }
+        free(cfg->plugins[k]);
+        cfg->plugins[k] = NULL;
+        cfg->count[k] = 0;
+    }
+}
+
+/******************************************************************************
+Description.: appends text to the specification of a plugin
+Input Value.: p is the plugin
+              text is the text, it is separated by a space
+Return Value: 0 if ok, -1 if there is not enough memory
+******************************************************************************/
+static int append_spec(config_plugin *p, const char *text)
+{
+    size_t length = (p->spec != NULL) ? strlen(p->spec) : 0;
+    char *spec = realloc(p->spec, length + strlen(text) + 2);
+
+    if(spec == NULL)
+        return -1;
+    if(length > 0)
+        spec[length++] = ' ';
+    strcpy(spec + length, text);
+    p->spec = spec;
+    return 0;
+}
+
+/******************************************************************************
+Description.: parses one line of the configuration file
+Input Value.: cfg is the configuration read so far
+              kind is 0 for inputs and 1 for outputs of the current section
+              or -1 before the first section
+              line is the trimmed line, it is changed
+Return Value: NULL if ok or an error message
+******************************************************************************/
+static const char *parse_line(config *cfg, int *kind, char *line)
+{
+    config_plugin *p;
+    char *key, *value, *end;
+
+    if(*line == '[') {
+        char *name;
+        int k, i, unnamed = 0;
+
+        if((end = strchr(line, ']')) == NULL || end[1] != '\0')
+            return "a section ends with \"]\"";
+        *end = '\0';
+        line = trim(line + 1);
+        name = line + strcspn(line, " \t");
+        if(*name != '\0')
+            *name++ = '\0';
+        name = trim(name);
+
+        if(strcmp(line, "input") == 0)
+            k = 0;
+        else if(strcmp(line, "output") == 0)
+            k = 1;
+        else
+            return "the sections are [input name] and [output name]";
+
+        p = realloc(cfg->plugins[k], (cfg->count[k] + 1) * sizeof(config_plugin));
+        if(p == NULL)
+            return "not enough memory";
+        cfg->plugins[k] = p;
+        p = &p[cfg->count[k]];
+        memset(p, 0, sizeof(*p));
+        p->slot = -1;
+        cfg->count[k]++;
+        *kind = k;
+
+        /* plugins without a name are matched by their position */
+        if(*name == '\0') {
+            char key[16];
+
+            for(i = 0; i < cfg->count[k] - 1; i++)
+                unnamed += (cfg->plugins[k][i].key[0] == '#');
+            snprintf(key, sizeof(key), "#%d", unnamed);
+            p->key = strdup(key);
+            return NULL;
+        }
+
+        for(i = 0; i < cfg->count[k] - 1; i++) {
+            if(strcmp(cfg->plugins[k][i].key, name) == 0)
+                return "the name is used twice";
+        }
+        p->key = strdup(name);
+        if(k == 0)
+            p->label = strdup(name);
+        return NULL;
+    }
+
+    if((value = strchr(line, '=')) == NULL)
+        return "expected \"key = value\"";
+    *value++ = '\0';
+    key = trim(line);
+    value = trim(value);
+
+    if(*kind < 0)
+        return "the first section must be [input] or [output]";
+    p = &cfg->plugins[*kind][cfg->count[*kind] - 1];
+
+    if(strcmp(key, "plugin") == 0) {
+        if(p->spec != NULL)
+            return "the plugin is given twice";
+        /* the name of an input is part of its specification like for -i */
+        if((p->spec = malloc(((p->label != NULL) ? strlen(p->label) + 1 : 0) + strlen(value) + 1)) == NULL)
+            return "not enough memory";
+        sprintf(p->spec, "%s%s%s", (p->label != NULL) ? p->label : "", (p->label != NULL) ? "=" : "", value);
+        return NULL;
+    }
+
+    if(strcmp(key, "parameters") == 0) {
+        if(p->spec == NULL)
+            return "the plugin must be given before its parameters";
+        return (append_spec(p, value) == 0) ? NULL : "not enough memory";
+    }
+
+    if(strncmp(key, "control", 7) == 0 && isspace((unsigned char)key[7])) {
+        config_control *c = realloc(p->controls, (p->control_count + 1) * sizeof(config_control));
+
+        if(c == NULL)
+            return "not enough memory";
+        p->controls = c;
+        c = &c[p->control_count];
+        c->value = strtol(value, &end, 0);
+        if(end == value || *end != '\0')
+            return "the value of a control is a number";
+        c->name = strdup(trim(key + 7));
+        p->control_count++;
+        return NULL;
+    }
+
+    return "unknown key, expected plugin, parameters or control";
+}
+
+/******************************************************************************
+Description.: reads and parses the configuration file
+Input Value.: path is the file
+              cfg receives the configuration
+Return Value: 0 if ok, -1 on error, cfg is empty then
+******************************************************************************/
+static int parse_file(const char *path, config *cfg)
+{
+    char buffer[CONFIG_LINE], *line;
+    const char *error = NULL;
+    int number = 0, kind = -1, k, i;
+    FILE *file;
+
+    memset(cfg, 0, sizeof(*cfg));
+    if((file = fopen(path, "r")) == NULL) {
+        LOG("could not open the configuration %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while(error == NULL && fgets(buffer, sizeof(buffer), file) != NULL) {
+        number++;
+        if(strchr(buffer, '\n') == NULL && !feof(file)) {
+            error = "the line is too long";
+            break;
+        }
+        /* comments start with "#" or ";" at the beginning of a line */
+        line = trim(buffer);
+        if(*line == '\0' || *line == '#' || *line == ';')
+            continue;
+        error = parse_line(cfg, &kind, line);
+    }
+    fclose(file);
+
+    for(k = 0; error == NULL && k < 2; k++) {
+        for(i = 0; i < cfg->count[k]; i++) {
+            if(cfg->plugins[k][i].spec == NULL) {
+                error = "a section has no plugin";
+                number = 0;
+            }
+        }
+    }
+
+    if(error != NULL) {
+        if(number > 0) {
+            LOG("error in the configuration %s, line %d: %s\n", path, number, error);
+        } else {
+            LOG("error in the configuration %s: %s\n", path, error);
+        }
+        free_config(cfg);
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads the configuration file at startup
+Input Value.: path is the file, it is read again from the same place on
+              SIGHUP, even if the working directory changed
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+int config_read(const char *path)
+{
+    if((config_path = realpath(path, NULL)) == NULL) {
+        LOG("could not open the configuration %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return parse_file(config_path, &current);
+}
+
+/******************************************************************************
+Description.: tells how many plugins the configuration has
+Input Value.: output is 1 for the outputs, 0 for the inputs
+Return Value: the number of plugins
+******************************************************************************/
+int config_count(int output)
+{
+    return current.count[output];
+}
+
+/******************************************************************************
+Description.: returns the specification of a plugin of the configuration
+Input Value.: output is 1 for the outputs, 0 for the inputs
+              i is the number of the plugin in the file
+Return Value: the specification like for -i or -o
+******************************************************************************/
+const char *config_spec(int output, int i)
+{
+    return current.plugins[output][i].spec;
+}
+
+/******************************************************************************
+Description.: tells the configuration where its plugins were loaded, they
+              follow the plugins of the command line in their order
+Input Value.: param are the globals
+              first_input, first_output are the slots of the first plugins
+Return Value: -
+******************************************************************************/
+void config_bind(globals *param, int first_input, int first_output)
+{
+    int i;
+
+    pglobal = param;
+
+    for(i = 0; i < current.count[0]; i++)
+        current.plugins[0][i].slot = first_input + i;
+    for(i = 0; i < current.count[1]; i++)
+        current.plugins[1][i].slot = first_output + i;
+}
+
+/******************************************************************************
+Description.: looks up a plugin of a configuration by its key
+Input Value.: cfg is the configuration
+              k is 0 for the inputs and 1 for the outputs
+              key is the key
+Return Value: the plugin or NULL
+******************************************************************************/
+static config_plugin *find_plugin(config *cfg, int k, const char *key)
+{
+    int i;
+
+    for(i = 0; i < cfg->count[k]; i++) {
+        if(strcmp(cfg->plugins[k][i].key, key) == 0)
+            return &cfg->plugins[k][i];
+    }
+    return NULL;
+}
+
+/******************************************************************************
+Description.: tells if a plugin of the configuration is still loaded, it may
+              have been removed or replaced with the plugin management
+Input Value.: k is 0 for the inputs and 1 for the outputs
+              p is the plugin
+Return Value: 1 if its slot holds the plugin
+******************************************************************************/
+static int plugin_loaded(int k, config_plugin *p)
+{
+    const char *spec;
+
+    if(p->slot < 0)
+        return 0;
+    if(k == 0) {
+        if(p->slot >= pglobal->incnt || pglobal->in[p->slot].state == PLUGIN_FREE)
+            return 0;
+        spec = pglobal->in[p->slot].spec;
+    } else {
+        if(p->slot >= pglobal->outcnt || pglobal->out[p->slot].state == PLUGIN_FREE)
+            return 0;
+        spec = pglobal->out[p->slot].spec;
+    }
+    return spec != NULL && strcmp(spec, p->spec) == 0;
+}
+
+/******************************************************************************
+Description.: looks up a control of a plugin by its name or number
+Input Value.: controls are the controls of the plugin, count their number
+              name is the name, case does not matter, or the number
+Return Value: the control or NULL
+******************************************************************************/
+static control *find_control(control *controls, int count, const char *name)
+{
+    char *end;
+    long id = strtol(name, &end, 0);
+    int i, by_id = (end != name && *end == '\0');
+
+    for(i = 0; controls != NULL && i < count; i++) {
+        if(by_id ? (controls[i].ctrl.id == (unsigned long)id) :
+                   (strcasecmp((const char *)controls[i].ctrl.name, name) == 0))
+            return &controls[i];
+    }
+    return NULL;
+}
+
+/******************************************************************************
+Description.: sets the controls of a plugin which are new or changed. The
+              controls of a camera only show up when it is open, so they are
+              waited for until the deadline.
+Input Value.: k is 0 for the inputs and 1 for the outputs
+              p is the plugin, old is how it was configured before or NULL
+              deadline is the CLOCK_MONOTONIC time to give up waiting
+Return Value: -
+******************************************************************************/
+static void set_controls(int k, config_plugin *p, config_plugin *old, const struct timespec *deadline)
+{
+    const char *kind = k ? "output" : "input";
+    struct timespec now;
+    char *done;
+    int i, pending = 0;
+
+    if(p->control_count == 0 || (done = calloc(p->control_count, 1)) == NULL)
+        return;
+
+    for(i = 0; i < p->control_count; i++) {
+        config_control *c = &p->controls[i];
+        int j;
+
+        for(j = 0; old != NULL && j < old->control_count; j++) {
+            if(strcmp(old->controls[j].name, c->name) == 0 && old->controls[j].value == c->value)
+                done[i] = 1;
+        }
+        pending += !done[i];
+    }
+
+    while(pending > 0) {
+        control *controls;
+        int count;
+        int (*cmd)(int, unsigned int, unsigned int, int, char *);
+
+        /* the plugin can not be removed while its controls are set */
+        control_lock();
+        if(!plugin_loaded(k, p)) {
+            control_unlock();
+            break;
+        }
+        controls = k ? pglobal->out[p->slot].out_parameters : pglobal->in[p->slot].in_parameters;
+        count = k ? pglobal->out[p->slot].parametercount : pglobal->in[p->slot].parametercount;
+        cmd = k ? pglobal->out[p->slot].cmd : pglobal->in[p->slot].cmd;
+
+        for(i = 0; i < p->control_count; i++) {
+            config_control *c = &p->controls[i];
+            control *found;
+
+            if(done[i] || (found = find_control(controls, count, c->name)) == NULL)
+                continue;
+            done[i] = 1;
+            pending--;
+            if(cmd != NULL && cmd(p->slot, found->ctrl.id, found->group, c->value, NULL) == 0) {
+                LOG("%s %d: %s = %d\n", kind, p->slot, found->ctrl.name, c->value);
+            } else {
+                LOG("%s %d: could not set %s to %d\n", kind, p->slot, found->ctrl.name, c->value);
+            }
+        }
+        control_unlock();
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(pending == 0 || now.tv_sec > deadline->tv_sec ||
+           (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec))
+            break;
+        usleep(10 * 1000);
+    }
+
+    for(i = 0; i < p->control_count; i++) {
+        if(!done[i]) {
+            LOG("%s %d has no control \"%s\"\n", kind, p->slot, p->controls[i].name);
+        }
+    }
+    free(done);
+}
+
+/******************************************************************************
+Description.: sets the controls of all plugins of the configuration
+Input Value.: old is the previous configuration or NULL to set all
+Return Value: -
+******************************************************************************/
+static void set_all_controls(config *old)
+{
+    struct timespec deadline;
+    config_plugin *p, *before;
+    int k, i;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += CONTROLS_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (CONTROLS_TIMEOUT_MS % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    for(k = 0; k < 2; k++) {
+        for(i = 0; i < current.count[k]; i++) {
+            p = &current.plugins[k][i];
+            /* a plugin which was loaded again starts with the values of its driver */
+            before = (old != NULL && p->kept) ? find_plugin(old, k, p->key) : NULL;
+            set_controls(k, p, before, &deadline);
+        }
+    }
+}
+
+/******************************************************************************
+Description.: sets the controls of the configuration after the start, when
+              the inputs published their first frame
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void config_apply_controls(void)
+{
+    if(pglobal != NULL)
+        set_all_controls(NULL);
+}
+
+/******************************************************************************
+Description.: executes a command of the plugin management and logs an error,
+              the caller holds the lock of control_lock()
+Input Value.: reply receives the reply, it has REPLY_LENGTH bytes
+              format and the arguments make the command
+Return Value: 0 on success
+******************************************************************************/
+static int run_command(char *reply, const char *format, const char *kind, const char *argument)
+{
+    char *command;
+    int result;
+
+    if((command = malloc(strlen(format) + strlen(kind) + strlen(argument) + 1)) == NULL)
+        return -1;
+    sprintf(command, format, kind, argument);
+    result = control_execute(command, reply, REPLY_LENGTH);
+    if(result != 0) {
+        LOG("configuration: \"%s\" failed: %s", command, reply);
+    }
+    free(command);
+    return result;
+}
+
+/******************************************************************************
+Description.: reads the configuration file again and applies the differences
+              to the running plugins, plugins which did not change keep
+              running without interruption
+Input Value.: -
+Return Value: 0 if ok, -1 if the file could not be read, the old
+              configuration stays in effect then
+******************************************************************************/
+int config_reload(void)
+{
+    static const char *kinds[] = { "input", "output" };
+    char reply[REPLY_LENGTH], number[16];
+    config next, old;
+    config_plugin *p, *n;
+    int k, i, slot;
+
+    if(config_path == NULL || pglobal == NULL) {
+        LOG("there is no configuration to reload, it is given with --config\n");
+        return -1;
+    }
+    if(parse_file(config_path, &next) != 0) {
+        LOG("the configuration was not changed\n");
+        return -1;
+    }
+    LOG("reloading the configuration %s\n", config_path);
+
+    /* no command of the socket changes the plugins between the comparison and the changes */
+    control_lock();
+    for(k = 0; k < 2; k++) {
+        /* the plugins which are gone or changed free their names first */
+        for(i = 0; i < current.count[k]; i++) {
+            p = &current.plugins[k][i];
+            n = find_plugin(&next, k, p->key);
+            if(!plugin_loaded(k, p))
+                continue;
+            if(n != NULL && strcmp(n->spec, p->spec) == 0) {
+                n->slot = p->slot;
+                n->kept = 1;
+                continue;
+            }
+            snprintf(number, sizeof(number), "%d", p->slot);
+            run_command(reply, "remove %s %s", kinds[k], number);
+        }
+
+        for(i = 0; i < next.count[k]; i++) {
+            n = &next.plugins[k][i];
+            if(n->slot >= 0)
+                continue;
+            if(run_command(reply, "add %s %s", kinds[k], n->spec) == 0 &&
+               sscanf(reply, "OK %*s %d", &slot) == 1)
+                n->slot = slot;
+        }
+    }
+    control_unlock();
+
+    old = current;
+    current = next;
+    set_all_controls(&old);
+    free_config(&old);
+    return 0;
+}
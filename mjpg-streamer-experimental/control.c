@@ -0,0 +1,431 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * The plugin management: commands like "add input lobby=input_uvc.so" load,
+ * start, stop and unload plugins while the program runs. They arrive through
+ * the UNIX socket given with --socket, one command per line, or through the
+ * "manage" action of output_http. Each command gets one reply, its last line
+ * starts with "OK" or "ERROR".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "utils.h"
+#include "mjpg_streamer.h"
+#include "control.h"
+
+#define COMMAND_LENGTH 1024
+#define REPLY_LENGTH 4096
+
+static globals *pglobal;
+
+/* only one command changes the plugins at a time */
+static pthread_mutex_t plugins_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int socket_fd = -1;
+static char *socket_path;
+
+static const char *usage =
+    "commands:\n"
+    "  list\n"
+    "  add input [name=]<input-plugin.so> [parameters]\n"
+    "  add output <output-plugin.so> [parameters]\n"
+    "  load input|output <specification as for add>\n"
+    "  start|stop|restart|unload|remove input <number or name>\n"
+    "  start|stop|restart|unload|remove output <number>\n";
+
+/******************************************************************************
+Description.: appends formatted text to a reply, it is cut off if it does
+              not fit
+Input Value.: reply is the reply, size its size
+              format is the format like for printf()
+Return Value: -
+******************************************************************************/
+static void reply_printf(char *reply, size_t size, const char *format, ...)
+{
+    size_t length = strnlen(reply, size);
+    va_list ap;
+
+    if(length + 1 >= size)
+        return;
+    va_start(ap, format);
+    vsnprintf(reply + length, size - length, format, ap);
+    va_end(ap);
+}
+
+/******************************************************************************
+Description.: names the state of a plugin slot
+Input Value.: state is the state
+Return Value: the name
+******************************************************************************/
+static const char *state_name(plugin_state state)
+{
+    switch(state) {
+    case PLUGIN_LOADED:
+        return "loaded";
+    case PLUGIN_RUNNING:
+        return "running";
+    case PLUGIN_STOPPED:
+        return "stopped";
+    default:
+        return "free";
+    }
+}
+
+/******************************************************************************
+Description.: looks up an output by its number
+Input Value.: s is the number
+Return Value: the number of the output or -1 if there is no such output
+******************************************************************************/
+static int find_output(const char *s)
+{
+    char *end;
+    long id;
+
+    if(*s < '0' || *s > '9')
+        return -1;
+    id = strtol(s, &end, 10);
+    if(*end != '\0' || id >= pglobal->outcnt || pglobal->out[id].state == PLUGIN_FREE)
+        return -1;
+    return (int)id;
+}
+
+/******************************************************************************
+Description.: lists the plugins, one line for each loaded plugin
+Input Value.: reply receives the list, size is its size
+Return Value: -
+******************************************************************************/
+static void list_plugins(char *reply, size_t size)
+{
+    int i;
+
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(pglobal->in[i].state != PLUGIN_FREE)
+            reply_printf(reply, size, "input %d %s %s\n", i,
+                         state_name(pglobal->in[i].state), pglobal->in[i].spec);
+    }
+    for(i = 0; i < pglobal->outcnt; i++) {
+        if(pglobal->out[i].state != PLUGIN_FREE)
+            reply_printf(reply, size, "output %d %s %s\n", i,
+                         state_name(pglobal->out[i].state), pglobal->out[i].spec);
+    }
+    reply_printf(reply, size, "OK %d input(s), %d output(s), %d and %d slots\n",
+                 pglobal->incnt, pglobal->outcnt, pglobal->inmax, pglobal->outmax);
+}
+
+/******************************************************************************
+Description.: loads a plugin into the first free slot and starts it if asked to
+Input Value.: output is 1 for an output plugin
+              spec is the specification like for -i or -o
+              start is 1 if the plugin should be started
+              reply receives the reply, size is its size
+Return Value: 0 on success
+******************************************************************************/
+static int add_plugin(int output, const char *spec, int start, char *reply, size_t size)
+{
+    const char *kind = output ? "output" : "input";
+    int max = output ? pglobal->outmax : pglobal->inmax;
+    int id;
+
+    for(id = 0; id < max; id++) {
+        if((output ? pglobal->out[id].state : pglobal->in[id].state) == PLUGIN_FREE)
+            break;
+    }
+    if(id == max) {
+        reply_printf(reply, size, "ERROR no free %s slot, reserve more with --reserve\n", kind);
+        return -1;
+    }
+
+    if((output ? load_output(id, spec) : load_input(id, spec)) != 0) {
+        reply_printf(reply, size, "ERROR could not load %s \"%s\", see the log\n", kind, spec);
+        return -1;
+    }
+    if(start && (output ? start_output(id) : start_input(id)) != 0) {
+        output ? unload_output(id) : unload_input(id);
+        reply_printf(reply, size, "ERROR could not start %s \"%s\", see the log\n", kind, spec);
+        return -1;
+    }
+
+    LOG("%s %s %d: %s\n", start ? "added" : "loaded", kind, id, spec);
+    reply_printf(reply, size, "OK %s %d\n", kind, id);
+    return 0;
+}
+
+/******************************************************************************
+Description.: keeps other commands from changing the plugins, while the
+              caller compares the plugins, runs several commands or calls
+              the cmd() function of a plugin, see globals.plugins_lock
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void control_lock(void)
+{
+    pthread_mutex_lock(&plugins_mutex);
+}
+
+void control_unlock(void)
+{
+    pthread_mutex_unlock(&plugins_mutex);
+}
+
+/******************************************************************************
+Description.: executes a command of the plugin management, the caller holds
+              the lock of control_lock()
+Input Value.: command is the command line, without the line feed
+              reply receives the reply, size is its size
+Return Value: 0 on success, -1 on error
+******************************************************************************/
+int control_execute(const char *command, char *reply, size_t size)
+{
+    char verb[16] = "", kind[16] = "";
+    const char *argument;
+    int output, id, result = -1, n = 0;
+
+    reply[0] = '\0';
+    if(sscanf(command, " %15s %15s %n", verb, kind, &n) < 1) {
+        reply_printf(reply, size, "%sERROR empty command\n", usage);
+        return -1;
+    }
+    argument = command + n;
+
+    if(strcmp(verb, "list") == 0) {
+        list_plugins(reply, size);
+        return 0;
+    }
+
+    if(strcmp(kind, "input") != 0 && strcmp(kind, "output") != 0) {
+        reply_printf(reply, size, "%sERROR unknown command \"%s\"\n", usage, command);
+        return -1;
+    }
+    output = (kind[0] == 'o');
+    if(n == 0 || *argument == '\0') {
+        reply_printf(reply, size, "ERROR \"%s %s\" needs an argument\n", verb, kind);
+        return -1;
+    }
+
+    if(strcmp(verb, "add") == 0 || strcmp(verb, "load") == 0) {
+        return add_plugin(output, argument, verb[0] == 'a', reply, size);
+    }
+
+    id = output ? find_output(argument) : find_input(pglobal, argument, strlen(argument));
+    if(id < 0) {
+        reply_printf(reply, size, "ERROR there is no %s \"%s\"\n", kind, argument);
+        return -1;
+    }
+
+    if(strcmp(verb, "start") == 0) {
+        result = output ? start_output(id) : start_input(id);
+    } else if(strcmp(verb, "stop") == 0) {
+        result = output ? stop_output(id) : stop_input(id);
+    } else if(strcmp(verb, "restart") == 0) {
+        output ? stop_output(id) : stop_input(id);
+        result = output ? start_output(id) : start_input(id);
+    } else if(strcmp(verb, "unload") == 0 || strcmp(verb, "remove") == 0) {
+        result = output ? unload_output(id) : unload_input(id);
+    } else {
+        reply_printf(reply, size, "%sERROR unknown command \"%s\"\n", usage, command);
+        return -1;
+    }
+
+    if(result == 0) {
+        LOG("%s %s %d\n", verb, kind, id);
+        reply_printf(reply, size, "OK %s %d %s\n", kind, id,
+                     state_name(output ? pglobal->out[id].state : pglobal->in[id].state));
+    } else {
+        reply_printf(reply, size, "ERROR could not %s %s %d, it is %s\n", verb, kind, id,
+                     state_name(output ? pglobal->out[id].state : pglobal->in[id].state));
+    }
+
+    return result;
+}
+
+/******************************************************************************
+Description.: executes a command of the plugin management
+Input Value.: command is the command line, without the line feed
+              reply receives the reply, size is its size
+Return Value: 0 on success, -1 on error
+******************************************************************************/
+int control_command(const char *command, char *reply, size_t size)
+{
+    int result;
+
+    pthread_mutex_lock(&plugins_mutex);
+    result = control_execute(command, reply, size);
+    pthread_mutex_unlock(&plugins_mutex);
+    return result;
+}
+
+/******************************************************************************
+Description.: answers the commands of one connection of the control socket
+Input Value.: arg is the file descriptor
+Return Value: always NULL
+******************************************************************************/
+static void *connection_thread(void *arg)
+{
+    int fd = (int)(long)arg;
+    char command[COMMAND_LENGTH], reply[REPLY_LENGTH], *end;
+    size_t level = 0;
+    ssize_t length;
+
+    while((length = read(fd, command + level, sizeof(command) - 1 - level)) > 0) {
+        level += length;
+        command[level] = '\0';
+
+        while((end = strchr(command, '\n')) != NULL) {
+            *end = '\0';
+            if(end > command && end[-1] == '\r')
+                end[-1] = '\0';
+            control_command(command, reply, sizeof(reply));
+            if(write(fd, reply, strlen(reply)) < 0)
+                goto out;
+
+            level -= end + 1 - command;
+            memmove(command, end + 1, level + 1);
+        }
+
+        if(level == sizeof(command) - 1) {
+            const char *error = "ERROR the command is too long\n";
+            if(write(fd, error, strlen(error)) < 0)
+                break;
+            level = 0;
+        }
+    }
+
+out:
+    close(fd);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: accepts the connections of the control socket
+Input Value.: arg is not used
+Return Value: always NULL
+******************************************************************************/
+static void *socket_thread(void *arg)
+{
+    pthread_t client;
+    int fd;
+
+    while(!pglobal->stop) {
+        if((fd = accept(socket_fd, NULL, NULL)) < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("accept");
+            break;
+        }
+        if(pthread_create(&client, NULL, connection_thread, (void *)(long)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(client);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: remembers the globals for the commands
+Input Value.: param are the globals
+Return Value: -
+******************************************************************************/
+void control_init(globals *param)
+{
+    pglobal = param;
+}
+
+/******************************************************************************
+Description.: opens the control socket, only the owner may connect because
+              it can load any library
+Input Value.: path is the file name of the socket
+Return Value: 0 on success
+******************************************************************************/
+int control_socket(const char *path)
+{
+    struct sockaddr_un address;
+    pthread_t thread;
+    mode_t mask;
+
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        LOG("the path of the control socket is too long: %s\n", path);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if((socket_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    /* a socket left over by a previous run is replaced */
+    unlink(path);
+    mask = umask(0077);
+    if(bind(socket_fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        umask(mask);
+        perror("bind");
+        close(socket_fd);
+        socket_fd = -1;
+        return -1;
+    }
+    umask(mask);
+    socket_path = strdup(path);
+
+    if(listen(socket_fd, 4) != 0 ||
+       pthread_create(&thread, NULL, socket_thread, NULL) != 0) {
+        perror("listen");
+        control_cleanup();
+        close(socket_fd);
+        socket_fd = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+
+    LOG("control socket...: %s\n", path);
+    return 0;
+}
+
+/******************************************************************************
+Description.: removes the control socket
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void control_cleanup(void)
+{
+    if(socket_path != NULL) {
+        unlink(socket_path);
+        free(socket_path);
+        socket_path = NULL;
+    }
+}
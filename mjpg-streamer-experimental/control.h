@@ -0,0 +1,40 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/* the life cycle of the plugins, see mjpg_streamer.c */
+int load_input(int id, const char *spec);
+int start_input(int id);
+int stop_input(int id);
+int unload_input(int id);
+int load_output(int id, const char *spec);
+int start_output(int id);
+int stop_output(int id);
+int unload_output(int id);
+
+/* the commands of the plugin management, see control.c */
+void control_init(globals *param);
+int control_command(const char *command, char *reply, size_t size);
+int control_execute(const char *command, char *reply, size_t size);
+void control_lock(void);
+void control_unlock(void);
+int control_socket(const char *path);
+void control_cleanup(void);
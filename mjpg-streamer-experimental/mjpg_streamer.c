@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <signal.h>
@@ -41,6 +42,9 @@
 
 #include "utils.h"
 #include "mjpg_streamer.h"
+#include "control.h"
+#include "threads.h"
+#include "config.h"
 
 /* globals */
 static globals global;
@@ -54,11 +58,22 @@ static void help(char *progname)
 {
     fprintf(stderr, "-----------------------------------------------------------------------\n");
     fprintf(stderr, "Usage: %s\n" \
-            "  -i | --input \"<input-plugin.so> [parameters]\"\n" \
+            "  -i | --input \"[name=]<input-plugin.so> [parameters]\"\n" \
             "  -o | --output \"<output-plugin.so> [parameters]\"\n" \
             " [-h | --help ]........: display this help\n" \
             " [-v | --version ].....: display version information\n" \
-            " [-b | --background]...: fork to the background, daemon mode\n", progname);
+            " [-b | --background]...: fork to the background, daemon mode\n" \
+            " [-r | --reserve ].....: free slots for inputs and outputs added later, default 8\n" \
+            " [-s | --socket ]......: UNIX socket to add and remove plugins while running\n" \
+            " [-c | --config ]......: file with inputs, outputs and control values,\n" \
+            "                         it is read again on SIGHUP\n", progname);
+    fprintf(stderr, "-----------------------------------------------------------------------\n");
+    fprintf(stderr, "The threads of every plugin accept these parameters:\n" \
+            " [--cpus ].............: CPUs the threads may run on, e.g. 2 or 0,2-3\n" \
+            " [--sched ]............: scheduling policy, other, batch, idle, fifo:<prio> or rr:<prio>\n" \
+            " [--nice ].............: nice value of the threads, -20 .. 19\n" \
+            " [--thread_name ]......: first part of the thread names, default the name\n" \
+            "                         of the input or in<number>/out<number>\n");
     fprintf(stderr, "-----------------------------------------------------------------------\n");
     fprintf(stderr, "Example #1:\n" \
             " To open an UVC webcam \"/dev/video1\" and stream it via HTTP:\n" \
@@ -72,6 +87,10 @@ static void help(char *progname)
             " To get help for a certain input plugin:\n" \
             "  %s -i \"input_uvc.so --help\"\n", progname);
     fprintf(stderr, "-----------------------------------------------------------------------\n");
+    fprintf(stderr, "Example #4:\n" \
+            " To name two webcams, e.g. for \"?action=stream&input=lobby\":\n" \
+            "  %s -i \"lobby=input_uvc.so -d /dev/video0\" -i \"door=input_uvc.so -d /dev/video1\"\n", progname);
+    fprintf(stderr, "-----------------------------------------------------------------------\n");
     fprintf(stderr, "In case the modules (=plugins) can not be found:\n" \
             " * Set the default search path for the modules with:\n" \
             "   export LD_LIBRARY_PATH=/path/to/plugins,\n" \
@@ -97,52 +116,37 @@ static void signal_handler(int sig)
     /* signal "stop" to threads */
     LOG("setting signal to stop\n");
     global.stop = 1;
+    control_cleanup();
     usleep(1000 * 1000);
 
     /* clean up threads */
     LOG("force cancellation of threads and cleanup resources\n");
     for(i = 0; i < global.incnt; i++) {
-        global.in[i].stop(i);
-        /*for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
-            if (global.in[i].param.argv[j] != NULL) {
-                free(global.in[i].param.argv[j]);
-            }
-        }*/
+        if(global.in[i].state == PLUGIN_RUNNING)
+            global.in[i].stop(i);
     }
 
     for(i = 0; i < global.outcnt; i++) {
-        global.out[i].stop(global.out[i].param.id);
-        pthread_cond_destroy(&global.in[i].db_update);
-        pthread_mutex_destroy(&global.in[i].db);
-        /*for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
-            if (global.out[i].param.argv[j] != NULL)
-                free(global.out[i].param.argv[j]);
-        }*/
+        if(global.out[i].state == PLUGIN_RUNNING)
+            global.out[i].stop(global.out[i].param.id);
     }
     usleep(1000 * 1000);
 
-    /* close handles of input plugins */
-    for(i = 0; i < global.incnt; i++) {
-        dlclose(global.in[i].handle);
+    /* close handles of input plugins, the output plugins stopped waiting for them */
+    for(i = 0; i < global.inmax; i++) {
+        pthread_cond_destroy(&global.in[i].db_update);
+        pthread_cond_destroy(&global.in[i].demand_update);
+        pthread_mutex_destroy(&global.in[i].db);
+        if(global.in[i].state != PLUGIN_FREE)
+            dlclose(global.in[i].handle);
     }
 
+    /* every output opened its own handle, even if the library is the same */
     for(i = 0; i < global.outcnt; i++) {
-        int j, skip = 0;
-        DBG("about to decrement usage counter for handle of %s, id #%02d, handle: %p\n", \
-            global.out[i].plugin, global.out[i].param.id, global.out[i].handle);
-
-        for(j=i+1; j<global.outcnt; j++) {
-          if ( global.out[i].handle == global.out[j].handle ) {
-            DBG("handles are pointing to the same destination (%p == %p)\n", global.out[i].handle, global.out[j].handle);
-            skip = 1;
-          }
-        }
-        if ( skip ) {
-          continue;
-        }
-
-        DBG("closing handle %p\n", global.out[i].handle);
-
+        if(global.out[i].state == PLUGIN_FREE)
+            continue;
+        DBG("closing handle %p of %s, id #%02d\n", global.out[i].handle,
+            global.out[i].plugin, global.out[i].param.id);
         dlclose(global.out[i].handle);
     }
     DBG("all plugin handles closed\n");
@@ -154,6 +158,55 @@ static void signal_handler(int sig)
     return;
 }
 
+/******************************************************************************
+Description.: splits the optional name off an input specification like
+              "lobby=input_uvc.so -d /dev/video0". Names consist of letters,
+              digits, "-" and "_" and must not be a plain number, because
+              numbers address the inputs by their position.
+Input Value.: spec is the argument of -i
+              label receives a copy of the name or NULL
+Return Value: the specification without the name
+******************************************************************************/
+static char *split_label(char *spec, char **label)
+{
+    size_t length = strcspn(spec, "= "), i;
+    int digits = 1;
+
+    *label = NULL;
+    if(spec[length] != '=' || length == 0)
+        return spec;
+
+    for(i = 0; i < length; i++) {
+        if(!isalnum((unsigned char)spec[i]) && spec[i] != '-' && spec[i] != '_')
+            return spec;
+        if(!isdigit((unsigned char)spec[i]))
+            digits = 0;
+    }
+    if(digits)
+        return spec;
+
+    *label = strndup(spec, length);
+    return spec + length + 1;
+}
+
+/******************************************************************************
+Description.: appends a plugin specification to a list which grows as needed
+Input Value.: list is the list, count the number of entries in it
+              spec is the specification
+Return Value: -
+******************************************************************************/
+static void add_plugin_spec(char ***list, int *count, const char *spec)
+{
+    char **tmp = realloc(*list, (*count + 1) * sizeof(char *));
+
+    if(tmp == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+    tmp[(*count)++] = strdup(spec);
+    *list = tmp;
+}
+
 static int split_parameters(char *parameter_string, int *argc, char **argv)
 {
     int count = 1;
@@ -184,6 +237,473 @@ static int split_parameters(char *parameter_string, int *argc, char **argv)
     return 1;
 }
 
+/******************************************************************************
+Description.: frees the controls and formats an input plugin published, with
+              the names of the menu items and the frame sizes. The threads of
+              the plugin have left and the caller holds the plugin lock, the
+              clients only read the tables while they hold it as well.
+Input Value.: in is the input
+Return Value: -
+******************************************************************************/
+static void free_input_tables(input *in)
+{
+    int i;
+
+    for(i = 0; i < in->parametercount; i++)
+        free(in->in_parameters[i].menuitems);
+    free(in->in_parameters);
+    in->in_parameters = NULL;
+    in->parametercount = 0;
+
+    for(i = 0; i < in->formatCount; i++)
+        free(in->in_formats[i].supportedResolutions);
+    free(in->in_formats);
+    in->in_formats = NULL;
+    in->formatCount = 0;
+}
+
+/******************************************************************************
+Description.: frees the arguments split_parameters() copied, argv[0] belongs
+              to the plugin
+Input Value.: argc and argv are the arguments
+Return Value: -
+******************************************************************************/
+static void free_parameters(int argc, char **argv)
+{
+    int i;
+
+    for(i = 1; i < argc && i < MAX_PLUGIN_ARGUMENTS; i++) {
+        free(argv[i]);
+        argv[i] = NULL;
+    }
+}
+
+/******************************************************************************
+Description.: opens the library of a plugin and looks up its functions
+Input Value.: file is the file name of the plugin
+              prefix is "input" or "output"
+              functions receives init, stop, run and cmd in this order
+Return Value: the handle of the library or NULL on error
+******************************************************************************/
+static void *open_plugin(const char *file, const char *prefix, void **functions)
+{
+    static const char *names[] = { "init", "stop", "run", "cmd" };
+    char symbol[32];
+    void *handle;
+    int i;
+
+    /*
+     * threads a plugin failed to stop may still run its code, so the library
+     * stays mapped even after the last dlclose()
+     */
+    handle = dlopen(file, RTLD_LAZY | RTLD_NODELETE);
+    if(!handle) {
+        LOG("ERROR: could not find %s plugin %s\n", prefix, file);
+        LOG("       Perhaps you want to adjust the search path with:\n");
+        LOG("       # export LD_LIBRARY_PATH=/path/to/plugin/folder\n");
+        LOG("       dlopen: %s\n", dlerror());
+        return NULL;
+    }
+
+    for(i = 0; i < LENGTH_OF(names); i++) {
+        snprintf(symbol, sizeof(symbol), "%s_%s", prefix, names[i]);
+        functions[i] = dlsym(handle, symbol);
+        /* the command function is optional */
+        if(functions[i] == NULL && i < 3) {
+            LOG("%s\n", dlerror());
+            dlclose(handle);
+            return NULL;
+        }
+    }
+
+    return handle;
+}
+
+/******************************************************************************
+Description.: loads an input plugin into a free slot and initializes it
+Input Value.: id is the slot
+              spec is the specification like for -i, "[name=]plugin.so [args]"
+Return Value: 0 if the plugin is loaded, 1 if init() returned an error or
+              -1 if the plugin could not be loaded
+******************************************************************************/
+int load_input(int id, const char *spec)
+{
+    input *in = &global.in[id];
+    char *args, *label;
+    void *functions[4];
+
+    if(id < 0 || id >= global.inmax || in->state != PLUGIN_FREE)
+        return -1;
+
+    if((in->spec = strdup(spec)) == NULL)
+        return -1;
+    args = split_label(in->spec, &label);
+    if(label != NULL && find_input(&global, label, strlen(label)) >= 0) {
+        LOG("ERROR: the name \"%s\" is used by input %d already\n", label,
+            find_input(&global, label, strlen(label)));
+        free(label);
+        free(in->spec);
+        in->spec = NULL;
+        return -1;
+    }
+
+    in->plugin = strndup(args, strcspn(args, " "));
+    in->handle = open_plugin(in->plugin, "input", functions);
+    if(in->handle == NULL) {
+        free(label);
+        free(in->plugin);
+        free(in->spec);
+        in->plugin = in->spec = NULL;
+        return -1;
+    }
+    in->init = functions[0];
+    in->stop = functions[1];
+    in->run = functions[2];
+    in->cmd = functions[3];
+    in->label = label;
+    in->context = NULL;
+    in->buf = NULL;
+    in->size = 0;
+
+    in->param.parameters = strchr(args, ' ');
+    memset(in->param.argv, 0, sizeof(in->param.argv));
+    in->param.argc = 0;
+    split_parameters(in->param.parameters, &in->param.argc, in->param.argv);
+    in->param.global = &global;
+    in->param.id = id;
+
+    if(thread_options(&in->threads, &in->param.argc, in->param.argv) != 0) {
+        in->state = PLUGIN_LOADED;
+        unload_input(id);
+        return -1;
+    }
+
+    if(in->init(&in->param, id)) {
+        LOG("input_init() return value signals to exit\n");
+        in->state = PLUGIN_LOADED;
+        unload_input(id);
+        return 1;
+    }
+
+    in->state = PLUGIN_LOADED;
+    in->generation++;
+    CONTROLS_CHANGED(in);
+    if(id >= global.incnt)
+        global.incnt = id + 1;
+    global.plugins_version++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts a loaded or stopped input plugin, a stopped plugin is
+              initialized again because stop() released its resources
+Input Value.: id is the slot
+Return Value: 0 on success
+******************************************************************************/
+int start_input(int id)
+{
+    input *in = &global.in[id];
+
+    if(in->state == PLUGIN_STOPPED) {
+        if(in->init(&in->param, id)) {
+            LOG("can not initialize input plugin %d again: %s\n", id, in->plugin);
+            return -1;
+        }
+        in->state = PLUGIN_LOADED;
+    }
+    if(in->state != PLUGIN_LOADED)
+        return -1;
+
+    syslog(LOG_INFO, "starting input plugin %s", in->plugin);
+    if(in->run(id)) {
+        LOG("can not run input plugin %d: %s\n", id, in->plugin);
+        return -1;
+    }
+    in->state = PLUGIN_RUNNING;
+    CONTROLS_CHANGED(in);
+    global.plugins_version++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops a running input plugin, the consumers keep waiting for
+              frames until it is started again
+Input Value.: id is the slot
+Return Value: 0 on success
+******************************************************************************/
+int stop_input(int id)
+{
+    input *in = &global.in[id];
+
+    if(in->state != PLUGIN_RUNNING)
+        return -1;
+
+    syslog(LOG_INFO, "stopping input plugin %s", in->plugin);
+    in->stop(id);
+    in->state = PLUGIN_STOPPED;
+
+    /* the plugin describes the camera again when it is started */
+    free_input_tables(in);
+
+    /* stop() waited for the threads of the plugin, they released the frame buffer */
+    pthread_mutex_lock(&in->db);
+    in->buf = NULL;
+    in->size = 0;
+    in->raw = 0;
+    pthread_cond_broadcast(&in->db_update);
+    pthread_mutex_unlock(&in->db);
+
+    CONTROLS_CHANGED(in);
+    global.plugins_version++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops an input plugin if it runs and frees its slot, clients
+              which still stream the input notice the new generation and leave
+Input Value.: id is the slot
+Return Value: 0 on success
+******************************************************************************/
+int unload_input(int id)
+{
+    input *in = &global.in[id];
+
+    if(id < 0 || id >= global.inmax || in->state == PLUGIN_FREE)
+        return -1;
+    stop_input(id);
+
+    syslog(LOG_INFO, "unloading input plugin %s", in->plugin);
+    pthread_mutex_lock(&in->db);
+    in->state = PLUGIN_FREE;
+    in->generation++;
+    in->buf = NULL;
+    in->size = 0;
+    in->raw = 0;
+    in->compress = NULL;
+    pthread_cond_broadcast(&in->db_update);
+    pthread_mutex_unlock(&in->db);
+
+    dlclose(in->handle);
+    free_parameters(in->param.argc, in->param.argv);
+    thread_settings_free(in->threads);
+    in->threads = NULL;
+    free(in->plugin);
+    free(in->label);
+    free(in->spec);
+    in->plugin = in->label = in->spec = NULL;
+    in->name = NULL;
+    in->handle = NULL;
+    in->context = NULL;
+    in->init = NULL;
+    in->stop = NULL;
+    in->run = NULL;
+    in->cmd = NULL;
+
+    /* a plugin which was never started may have published controls in init() */
+    free_input_tables(in);
+    CONTROLS_CHANGED(in);
+
+    while(global.incnt > 0 && global.in[global.incnt - 1].state == PLUGIN_FREE)
+        global.incnt--;
+    global.plugins_version++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: loads an output plugin into a free slot and initializes it
+Input Value.: id is the slot
+              spec is the specification like for -o, "plugin.so [args]"
+Return Value: 0 if the plugin is loaded, 1 if init() returned an error or
+              -1 if the plugin could not be loaded
+******************************************************************************/
+int load_output(int id, const char *spec)
+{
+    output *out = &global.out[id];
+    void *functions[4];
+
+    if(id < 0 || id >= global.outmax || out->state != PLUGIN_FREE)
+        return -1;
+
+    if((out->spec = strdup(spec)) == NULL)
+        return -1;
+    out->plugin = strndup(out->spec, strcspn(out->spec, " "));
+    out->handle = open_plugin(out->plugin, "output", functions);
+    if(out->handle == NULL) {
+        free(out->plugin);
+        free(out->spec);
+        out->plugin = out->spec = NULL;
+        return -1;
+    }
+    out->init = functions[0];
+    out->stop = functions[1];
+    out->run = functions[2];
+    out->cmd = functions[3];
+
+    out->param.parameters = strchr(out->spec, ' ');
+    memset(out->param.argv, 0, sizeof(out->param.argv));
+    out->param.argc = 0;
+    split_parameters(out->param.parameters, &out->param.argc, out->param.argv);
+    out->param.global = &global;
+    out->param.id = id;
+
+    if(thread_options(&out->threads, &out->param.argc, out->param.argv) != 0) {
+        out->state = PLUGIN_LOADED;
+        unload_output(id);
+        return -1;
+    }
+
+    if(out->init(&out->param, id)) {
+        LOG("output_init() return value signals to exit\n");
+        out->state = PLUGIN_LOADED;
+        unload_output(id);
+        return 1;
+    }
+
+    out->state = PLUGIN_LOADED;
+    CONTROLS_CHANGED(out);
+    if(id >= global.outcnt)
+        global.outcnt = id + 1;
+    global.plugins_version++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts a loaded or stopped output plugin
+Input Value.: id is the slot
+Return Value: 0 on success
+******************************************************************************/
+int start_output(int id)
+{
+    output *out = &global.out[id];
+
+    if(out->state == PLUGIN_STOPPED) {
+        if(out->init(&out->param, id)) {
+            LOG("can not initialize output plugin %d again: %s\n", id, out->plugin);
+            return -1;
+        }
+        out->state = PLUGIN_LOADED;
+    }
+    if(out->state != PLUGIN_LOADED)
+        return -1;
+
+    syslog(LOG_INFO, "starting output plugin: %s (ID: %02d)", out->plugin, out->param.id);
+    if(out->run(out->param.id)) {
+        LOG("can not run output plugin %d: %s\n", id, out->plugin);
+        return -1;
+    }
+    out->state = PLUGIN_RUNNING;
+    global.plugins_version++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops a running output plugin
+Input Value.: id is the slot
+Return Value: 0 on success
+******************************************************************************/
+int stop_output(int id)
+{
+    output *out = &global.out[id];
+
+    if(out->state != PLUGIN_RUNNING)
+        return -1;
+
+    syslog(LOG_INFO, "stopping output plugin: %s (ID: %02d)", out->plugin, out->param.id);
+    out->stop(out->param.id);
+    out->state = PLUGIN_STOPPED;
+    global.plugins_version++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops an output plugin if it runs and frees its slot
+Input Value.: id is the slot
+Return Value: 0 on success
+******************************************************************************/
+int unload_output(int id)
+{
+    output *out = &global.out[id];
+
+    if(id < 0 || id >= global.outmax || out->state == PLUGIN_FREE)
+        return -1;
+    stop_output(id);
+
+    syslog(LOG_INFO, "unloading output plugin: %s (ID: %02d)", out->plugin, out->param.id);
+    out->state = PLUGIN_FREE;
+    dlclose(out->handle);
+    free_parameters(out->param.argc, out->param.argv);
+    thread_settings_free(out->threads);
+    out->threads = NULL;
+    free(out->plugin);
+    free(out->spec);
+    out->plugin = out->spec = NULL;
+    out->name = NULL;
+    out->handle = NULL;
+    out->init = NULL;
+    out->stop = NULL;
+    out->run = NULL;
+    out->cmd = NULL;
+    out->parametercount = 0;
+    CONTROLS_CHANGED(out);
+
+    while(global.outcnt > 0 && global.out[global.outcnt - 1].state == PLUGIN_FREE)
+        global.outcnt--;
+    global.plugins_version++;
+    return 0;
+}
+
+/******************************************************************************
+Description.: milliseconds since a point in time of CLOCK_MONOTONIC
+Input Value.: since is the point in time
+Return Value: the elapsed milliseconds
+******************************************************************************/
+static long elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/******************************************************************************
+Description.: reports when the inputs published their first frame, which is
+              the end of the startup for the clients
+Input Value.: started is the time the program started
+              timeout is the number of seconds to wait for the frames
+Return Value: -
+******************************************************************************/
+static void report_first_frames(const struct timespec *started, int timeout)
+{
+    int *seen, pending, i;
+    long waited = 0;
+
+    seen = calloc(global.incnt + 1, sizeof(int));
+    if(seen == NULL)
+        return;
+
+    do {
+        pending = 0;
+        for(i = 0; i < global.incnt; i++) {
+            if(seen[i] || global.in[i].state != PLUGIN_RUNNING)
+                continue;
+            if(global.in[i].sequence > 0) {
+                seen[i] = 1;
+                LOG("startup: first frame of input %d after %ld ms\n", i, elapsed_ms(started));
+            } else {
+                pending++;
+            }
+        }
+        if(pending == 0)
+            break;
+        usleep(10 * 1000);
+        waited += 10;
+    } while(waited < timeout * 1000L);
+
+    if(pending > 0)
+        LOG("startup: %d input(s) published no frame within %d s\n", pending, timeout);
+    free(seen);
+}
+
 /******************************************************************************
 Description.:
 Input Value.:
@@ -192,12 +712,15 @@ Return Value:
 int main(int argc, char *argv[])
 {
     //char *input  = "input_uvc.so --resolution 640x480 --fps 5 --device /dev/video0";
-    char *input[MAX_INPUT_PLUGINS];
-    char *output[MAX_OUTPUT_PLUGINS];
-    int daemon = 0, i, j;
-    size_t tmp = 0;
+    char **input = NULL;
+    char **output = NULL;
+    char *socket_path = NULL, *config_file = NULL;
+    int daemon = 0, i, count, reserve = 8, first_input, first_output, sig;
+    sigset_t reload;
+    struct timespec started, phase;
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
 
-    output[0] = "output_http.so --port 8080";
     global.outcnt = 0;
     global.incnt = 0;
 
@@ -210,21 +733,24 @@ int main(int argc, char *argv[])
             {"output", required_argument, NULL, 'o'},
             {"version", no_argument, NULL, 'v'},
             {"background", no_argument, NULL, 'b'},
+            {"reserve", required_argument, NULL, 'r'},
+            {"socket", required_argument, NULL, 's'},
+            {"config", required_argument, NULL, 'c'},
             {NULL, 0, NULL, 0}
         };
 
-        c = getopt_long(argc, argv, "hi:o:vb", long_options, NULL);
+        c = getopt_long(argc, argv, "hi:o:vbr:s:c:", long_options, NULL);
 
         /* no more options to parse */
         if(c == -1) break;
 
         switch(c) {
         case 'i':
-            input[global.incnt++] = strdup(optarg);
+            add_plugin_spec(&input, &global.incnt, optarg);
             break;
 
         case 'o':
-            output[global.outcnt++] = strdup(optarg);
+            add_plugin_spec(&output, &global.outcnt, optarg);
             break;
 
         case 'v':
@@ -242,6 +768,22 @@ int main(int argc, char *argv[])
             daemon = 1;
             break;
 
+        case 'r':
+            reserve = atoi(optarg);
+            if(reserve < 0 || reserve > 1000) {
+                fprintf(stderr, "the number of free plugin slots must be between 0 and 1000\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 's':
+            socket_path = optarg;
+            break;
+
+        case 'c':
+            config_file = optarg;
+            break;
+
         case 'h': /* fall through */
         default:
             help(argv[0]);
@@ -249,6 +791,18 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* the plugins of the configuration file follow those of the command line */
+    first_input = global.incnt;
+    first_output = global.outcnt;
+    if(config_file != NULL) {
+        if(config_read(config_file) != 0)
+            exit(EXIT_FAILURE);
+        for(i = 0; i < config_count(0); i++)
+            add_plugin_spec(&input, &global.incnt, config_spec(0, i));
+        for(i = 0; i < config_count(1); i++)
+            add_plugin_spec(&output, &global.outcnt, config_spec(1, i));
+    }
+
     openlog("MJPG-streamer ", LOG_PID | LOG_CONS, LOG_USER);
     //openlog("MJPG-streamer ", LOG_PID|LOG_CONS|LOG_PERROR, LOG_USER);
     syslog(LOG_INFO, "starting application");
@@ -269,6 +823,16 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
+    /*
+     * SIGHUP asks to read the configuration file again. All threads inherit
+     * the blocked signal, so only the main thread receives it with sigwait().
+     * Without a configuration file SIGHUP keeps its default action.
+     */
+    sigemptyset(&reload);
+    sigaddset(&reload, SIGHUP);
+    if(config_file != NULL)
+        pthread_sigmask(SIG_BLOCK, &reload, NULL);
+
     /*
      * messages like the following will only be visible on your terminal
      * if not running in daemon mode
@@ -282,140 +846,120 @@ int main(int argc, char *argv[])
     /* check if at least one output plugin was selected */
     if(global.outcnt == 0) {
         /* no? Then use the default plugin instead */
-        global.outcnt = 1;
+        add_plugin_spec(&output, &global.outcnt, "output_http.so --port 8080");
     }
 
-    /* open input plugin */
-    for(i = 0; i < global.incnt; i++) {
+    /* the slots do not move, so the free ones are allocated right now */
+    global.inmax = global.incnt + reserve;
+    global.outmax = global.outcnt + reserve;
+    global.in = calloc(global.inmax, sizeof(global.in[0]));
+    global.out = calloc(global.outmax, sizeof(global.out[0]));
+    if((global.inmax > 0 && global.in == NULL) || global.out == NULL) {
+        LOG("could not allocate memory for the plugins\n");
+        closelog();
+        exit(EXIT_FAILURE);
+    }
+
+    /* the plugin threads place themselves as given with --cpus, --sched and --nice */
+    thread_init(&global);
+    global.thread_start = thread_start;
+    global.thread_list = thread_list;
+    global.plugins_lock = control_lock;
+    global.plugins_unlock = control_unlock;
+
+    for(i = 0; i < global.inmax; i++) {
         /* this mutex and the conditional variable are used to synchronize access to the global picture buffer */
         if(pthread_mutex_init(&global.in[i].db, NULL) != 0) {
             LOG("could not initialize mutex variable\n");
             closelog();
             exit(EXIT_FAILURE);
         }
-        if(pthread_cond_init(&global.in[i].db_update, NULL) != 0) {
+        if(pthread_cond_init(&global.in[i].db_update, NULL) != 0 ||
+           pthread_cond_init(&global.in[i].demand_update, NULL) != 0) {
             LOG("could not initialize condition variable\n");
             closelog();
             exit(EXIT_FAILURE);
         }
+    }
 
-        tmp = (size_t)(strchr(input[i], ' ') - input[i]);
-        global.in[i].stop      = 0;
-        global.in[i].context   = NULL;
-        global.in[i].buf       = NULL;
-        global.in[i].size      = 0;
-        global.in[i].plugin = (tmp > 0) ? strndup(input[i], tmp) : strdup(input[i]);
-        global.in[i].handle = dlopen(global.in[i].plugin, RTLD_LAZY);
-        if(!global.in[i].handle) {
-            LOG("ERROR: could not find input plugin\n");
-            LOG("       Perhaps you want to adjust the search path with:\n");
-            LOG("       # export LD_LIBRARY_PATH=/path/to/plugin/folder\n");
-            LOG("       dlopen: %s\n", dlerror());
-            closelog();
-            exit(EXIT_FAILURE);
-        }
-        global.in[i].init = dlsym(global.in[i].handle, "input_init");
-        if(global.in[i].init == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        global.in[i].stop = dlsym(global.in[i].handle, "input_stop");
-        if(global.in[i].stop == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        global.in[i].run = dlsym(global.in[i].handle, "input_run");
-        if(global.in[i].run == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        /* try to find optional command */
-        global.in[i].cmd = dlsym(global.in[i].handle, "input_cmd");
-
-        global.in[i].param.parameters = strchr(input[i], ' ');
-
-        for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
-            global.in[i].param.argv[j] = NULL;
-        }
-
-        split_parameters(global.in[i].param.parameters, &global.in[i].param.argc, global.in[i].param.argv);
-        global.in[i].param.global = &global;
-        global.in[i].param.id = i;
+    /*
+     * open input plugin, the plugins parse their options with getopt() so
+     * they are initialized one after another. Plugins with slow devices
+     * open them in their own thread when they are started.
+     */
+    clock_gettime(CLOCK_MONOTONIC, &phase);
+    count = global.incnt;
+    global.incnt = 0;
+    for(i = 0; i < count; i++) {
+        struct timespec begin;
 
-        if(global.in[i].init(&global.in[i].param, i)) {
-            LOG("input_init() return value signals to exit\n");
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        switch(load_input(i, input[i])) {
+        case 0:
+            break;
+        case 1:
             closelog();
             exit(0);
-        }
-    }
-
-    /* open output plugin */
-    for(i = 0; i < global.outcnt; i++) {
-        tmp = (size_t)(strchr(output[i], ' ') - output[i]);
-        global.out[i].plugin = (tmp > 0) ? strndup(output[i], tmp) : strdup(output[i]);
-        global.out[i].handle = dlopen(global.out[i].plugin, RTLD_LAZY);
-        if(!global.out[i].handle) {
-            LOG("ERROR: could not find output plugin %s\n", global.out[i].plugin);
-            LOG("       Perhaps you want to adjust the search path with:\n");
-            LOG("       # export LD_LIBRARY_PATH=/path/to/plugin/folder\n");
-            LOG("       dlopen: %s\n", dlerror());
+        default:
             closelog();
             exit(EXIT_FAILURE);
         }
-        global.out[i].init = dlsym(global.out[i].handle, "output_init");
-        if(global.out[i].init == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        global.out[i].stop = dlsym(global.out[i].handle, "output_stop");
-        if(global.out[i].stop == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-        global.out[i].run = dlsym(global.out[i].handle, "output_run");
-        if(global.out[i].run == NULL) {
-            LOG("%s\n", dlerror());
-            exit(EXIT_FAILURE);
-        }
-
-        /* try to find optional command */
-        global.out[i].cmd = dlsym(global.out[i].handle, "output_cmd");
-
-        global.out[i].param.parameters = strchr(output[i], ' ');
+        LOG("startup: input %d (%s) initialized in %ld ms\n", i, global.in[i].plugin, elapsed_ms(&begin));
+        free(input[i]);
+    }
 
-        for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
-            global.out[i].param.argv[j] = NULL;
-        }
-        split_parameters(global.out[i].param.parameters, &global.out[i].param.argc, global.out[i].param.argv);
+    /* open output plugin */
+    count = global.outcnt;
+    global.outcnt = 0;
+    for(i = 0; i < count; i++) {
+        struct timespec begin;
 
-        global.out[i].param.global = &global;
-        global.out[i].param.id = i;
-        if(global.out[i].init(&global.out[i].param, i)) {
-            LOG("output_init() return value signals to exit\n");
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        if(load_output(i, output[i]) != 0) {
             closelog();
             exit(EXIT_FAILURE);
         }
+        LOG("startup: output %d (%s) initialized in %ld ms\n", i, global.out[i].plugin, elapsed_ms(&begin));
+        free(output[i]);
     }
+    free(input);
+    free(output);
+    LOG("startup: plugins initialized in %ld ms\n", elapsed_ms(&phase));
 
     /* start to read the input, push pictures into global buffer */
+    clock_gettime(CLOCK_MONOTONIC, &phase);
     DBG("starting %d input plugin\n", global.incnt);
     for(i = 0; i < global.incnt; i++) {
-        syslog(LOG_INFO, "starting input plugin %s", global.in[i].plugin);
-        if(global.in[i].run(i)) {
-            LOG("can not run input plugin %d: %s\n", i, global.in[i].plugin);
+        if(start_input(i)) {
             closelog();
             return 1;
         }
     }
 
     DBG("starting %d output plugin(s)\n", global.outcnt);
-    for(i = 0; i < global.outcnt; i++) {
-        syslog(LOG_INFO, "starting output plugin: %s (ID: %02d)", global.out[i].plugin, global.out[i].param.id);
-        global.out[i].run(global.out[i].param.id);
+    for(i = 0; i < global.outcnt; i++)
+        start_output(i);
+    LOG("startup: plugins started in %ld ms, %ld ms since the program started\n",
+        elapsed_ms(&phase), elapsed_ms(&started));
+
+    /* plugins may be added and removed from now on */
+    control_init(&global);
+    global.manage = control_command;
+    if(socket_path != NULL && control_socket(socket_path) != 0) {
+        LOG("could not open the control socket %s\n", socket_path);
     }
 
-    /* wait for signals */
-    pause();
+    report_first_frames(&started, 10);
+    config_bind(&global, first_input, first_output);
+    config_apply_controls();
+
+    /* wait for signals, SIGINT ends the program in signal_handler() */
+    if(config_file == NULL)
+        pause();
+    while(config_file != NULL) {
+        if(sigwait(&reload, &sig) == 0)
+            config_reload();
+    }
 
     return 0;
 }
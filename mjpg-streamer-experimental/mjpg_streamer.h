@@ -24,14 +24,12 @@
 #define MJPG_STREAMER_H
 #define SOURCE_VERSION "2.0"
 
-/* FIXME take a look to the output_http clients thread marked with fixme if you want to set more then 10 plugins */
-#define MAX_INPUT_PLUGINS 10
-#define MAX_OUTPUT_PLUGINS 10
 #define MAX_PLUGIN_ARGUMENTS 32
 
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
 #include <pthread.h>
+#include <string.h>
 
 #ifdef DEBUG
 #define DBG(...) fprintf(stderr, " DBG(%s, %s(), %d): ", __FILE__, __FUNCTION__, __LINE__); fprintf(stderr, __VA_ARGS__)
@@ -41,6 +39,30 @@
 
 #define LOG(...) { char _bf[1024] = {0}; snprintf(_bf, sizeof(_bf)-1, __VA_ARGS__); fprintf(stderr, "%s", _bf); syslog(LOG_INFO, "%s", _bf); }
 
+/*
+ * signal readers of in_parameters/out_parameters (e.g. the cached JSON of the
+ * HTTP server) that a control of the plugin changed
+ */
+#define CONTROLS_CHANGED(plugin) __sync_add_and_fetch(&(plugin)->controls_version, 1)
+
+/*
+ * the life cycle of a plugin slot, plugins may be loaded into free slots and
+ * unloaded again while the program runs
+ */
+typedef enum {
+    PLUGIN_FREE = 0,
+    PLUGIN_LOADED,      // the library is loaded and init() succeeded
+    PLUGIN_RUNNING,
+    PLUGIN_STOPPED      // stop() released the resources, init() runs again on start
+} plugin_state;
+
+/*
+ * the CPUs, scheduling policy and nice value of the threads of a plugin,
+ * given with --cpus, --sched, --nice and --thread_name in its specification,
+ * only the core knows the details, see threads.c
+ */
+struct _thread_settings;
+
 #include "plugins/input.h"
 #include "plugins/output.h"
 
@@ -64,6 +86,16 @@ enum _cmd_group {
     IN_CMD_PWC =            4,
 };
 
+/* a thread of a plugin as listed by thread_list() of the globals */
+typedef struct _plugin_thread plugin_thread;
+struct _plugin_thread {
+    int tid;
+    char name[16];
+    int cpu;            // the CPU it ran on last
+    double cpu_time;    // seconds of CPU time used
+    double usage;       // percent of a CPU used since the previous listing
+};
+
 typedef struct _control control;
 struct _control {
     struct v4l2_queryctrl ctrl;
@@ -80,16 +112,73 @@ struct _control {
 struct _globals {
     int stop;
 
-    /* input plugin */
-    input in[MAX_INPUT_PLUGINS];
+    /*
+     * input plugins, allocated for as many as were given on the command line
+     * plus the free slots reserved with --reserve. The slots do not move,
+     * incnt is the highest slot in use + 1, some below may be free.
+     */
+    input *in;
     int incnt;
+    int inmax;
 
-    /* output plugin */
-    output out[MAX_OUTPUT_PLUGINS];
+    /* output plugins */
+    output *out;
     int outcnt;
+    int outmax;
 
-    /* pointer to control functions */
-    //int (*control)(int command, char *details);
+    unsigned int plugins_version; // incremented when a plugin is loaded or unloaded
+
+    /*
+     * executes a command line of the plugin management, e.g.
+     * "add input lobby=input_uvc.so -d /dev/video0", see control.c
+     * the reply is written to reply, the return value is 0 on success
+     */
+    int (*manage)(const char *command, char *reply, size_t size);
+
+    /*
+     * plugins_lock() keeps the plugins from being stopped, unloaded or
+     * replaced until plugins_unlock(), hold it while calling the cmd()
+     * function of a plugin
+     */
+    void (*plugins_lock)(void);
+    void (*plugins_unlock)(void);
+
+    /*
+     * every thread of a plugin calls thread_start() first, it is placed on
+     * the CPUs and gets the priority given for the plugin and a name like
+     * "in0/capture". thread_list() copies up to max of the threads of a
+     * plugin to list and returns how many it copied.
+     */
+    void (*thread_start)(command_dest dest, int id, const char *role);
+    int (*thread_list)(command_dest dest, int id, plugin_thread *list, int max);
 };
 
+/******************************************************************************
+Description.: looks up an input by its number or by the name it was given on
+              the command line, e.g. "2" or "lobby"
+Input Value.: pglobal holds the inputs
+              s is the number or name, it does not need to be terminated
+              length is the length of s
+Return Value: the number of the input or -1 if there is no such input or its
+              slot is free
+******************************************************************************/
+static inline int find_input(globals *pglobal, const char *s, size_t length)
+{
+    size_t i;
+    int id = 0;
+
+    for(i = 0; i < length && s[i] >= '0' && s[i] <= '9'; i++)
+        id = (id < pglobal->incnt) ? id * 10 + (s[i] - '0') : pglobal->incnt;
+    if(length > 0 && i == length)
+        return (id < pglobal->incnt && pglobal->in[id].state != PLUGIN_FREE) ? id : -1;
+
+    for(id = 0; id < pglobal->incnt; id++) {
+        if(pglobal->in[id].label != NULL &&
+           strlen(pglobal->in[id].label) == length &&
+           strncmp(pglobal->in[id].label, s, length) == 0)
+            return id;
+    }
+    return -1;
+}
+
 #endif
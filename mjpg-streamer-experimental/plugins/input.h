@@ -21,6 +21,8 @@
 *******************************************************************************/
 
 #include <syslog.h>
+#include <time.h>
+#include <sys/time.h>
 #include "../mjpg_streamer.h"
 #define INPUT_PLUGIN_PREFIX " i: "
 #define IPRINT(...) { char _bf[1024] = {0}; snprintf(_bf, sizeof(_bf)-1, __VA_ARGS__); fprintf(stderr, "%s", INPUT_PLUGIN_PREFIX); fprintf(stderr, "%s", _bf); syslog(LOG_INFO, "%s", _bf); }
@@ -54,13 +56,20 @@ typedef struct _input input;
 struct _input {
     char *plugin;
     char *name;
+    char *label;    // "lobby" of -i "lobby=input_uvc.so", NULL if not named
     void *handle;
+    char *spec;     // the argument of -i, param points into it
+
+    plugin_state state;
+    unsigned int generation;    // incremented when a plugin is loaded into the slot
+    struct _thread_settings *threads;
 
     input_parameter param; // this holds the command line arguments
 
     // input plugin parameters
     struct _control *in_parameters;
     int parametercount;
+    unsigned int controls_version; // incremented when a control or format changed
 
 
     struct v4l2_jpegcompression jpegcomp;
@@ -73,8 +82,30 @@ struct _input {
     unsigned char *buf;
     int size;
 
-    /* v4l2_buffer timestamp */
+    /*
+     * inputs which capture uncompressed pictures may publish them raw and
+     * set raw, the first consumer calls compress() through input_frame()
+     * and the others get the JPG from buf as usual
+     */
+    int raw;
+    int (*compress)(struct _input *in);
+    unsigned long encoded;      // frames compressed by compress()
+
+    /*
+     * every frame carries the time it was captured twice: the wall clock
+     * time for humans and the CLOCK_MONOTONIC time to measure intervals,
+     * the sequence number counts the published frames
+     */
     struct timeval timestamp;
+    struct timespec capture_time;
+    unsigned long sequence;
+
+    /*
+     * consumers which need frames right now, protected by db. Inputs may
+     * stop capturing while there is none and wait for demand_update.
+     */
+    int consumers;
+    pthread_cond_t demand_update;
 
     input_format *in_formats;
     int formatCount;
@@ -87,3 +118,60 @@ struct _input {
     int (*run)(int);
     int (*cmd)(int plugin, unsigned int control_id, unsigned int group, int value, char *value_str);
 };
+
+/******************************************************************************
+Description.: tells the input that a consumer starts or stops to need frames
+Input Value.: in is the input
+              delta is 1 for a new consumer and -1 for one which is done
+Return Value: -
+******************************************************************************/
+static inline void input_demand(input *in, int delta)
+{
+    pthread_mutex_lock(&in->db);
+    in->consumers += delta;
+    pthread_cond_broadcast(&in->demand_update);
+    pthread_mutex_unlock(&in->db);
+}
+
+/******************************************************************************
+Description.: makes sure buf holds the JPG of the current frame, consumers
+              call it with the db mutex held before they read buf and size
+Input Value.: in is the input
+Return Value: -
+******************************************************************************/
+static inline void input_frame(input *in)
+{
+    if(in->raw && in->compress != NULL) {
+        in->size = in->compress(in);
+        in->raw = 0;
+        in->encoded++;
+    }
+}
+
+/******************************************************************************
+Description.: stamps a fresh frame, must be called with the db mutex held
+              before db_update is signalled
+Input Value.: in is the input which published the frame
+              capture is the CLOCK_MONOTONIC time the frame was captured or
+              NULL if it was captured right now
+Return Value: -
+******************************************************************************/
+static inline void stamp_frame(input *in, const struct timespec *capture)
+{
+    struct timespec now, wall;
+    long long age;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    in->capture_time = (capture != NULL) ? *capture : now;
+
+    /* the wall clock time is derived, so that both stamps refer to the same moment */
+    age = (now.tv_sec - in->capture_time.tv_sec) * 1000000000LL + (now.tv_nsec - in->capture_time.tv_nsec);
+    if(age < 0)
+        age = 0;
+    age = (wall.tv_sec * 1000000000LL + wall.tv_nsec - age) / 1000;
+    in->timestamp.tv_sec = age / 1000000;
+    in->timestamp.tv_usec = age % 1000000;
+
+    in->sequence++;
+}
@@ -60,6 +60,7 @@ static read_mode mode = NewFilesOnly;
 /* global variables for this plugin */
 static int fd, rc, wd, size;
 static struct inotify_event *ev;
+static unsigned char first_run = 1;
 
 /*** plugin interface functions ***/
 int input_init(input_parameter *param, int id)
@@ -67,6 +68,16 @@ int input_init(input_parameter *param, int id)
     int i;
     plugin_number = id;
 
+    /* the library stays loaded, a restarted plugin starts from the defaults */
+    first_run = 1;
+    delay = 1.0;
+    free(folder);
+    folder = NULL;
+    free(filename);
+    filename = NULL;
+    rm = 0;
+    mode = NewFilesOnly;
+
     param->argv[0] = INPUT_PLUGIN_NAME;
 
     /* show all parameters for DBG purposes */
@@ -181,6 +192,7 @@ int input_stop(int id)
 {
     DBG("will cancel input thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -215,8 +227,6 @@ int input_run(int id)
         exit(EXIT_FAILURE);
     }
 
-    pthread_detach(worker);
-
     return 0;
 }
 
@@ -246,8 +256,8 @@ void *worker_thread(void *arg)
     int fileCount = 0;
     int currentFileNumber = 0;
     char hasJpgFile = 0;
-    struct timeval timestamp;
 
+    pglobal->thread_start(Dest_Input, plugin_number, "capture");
     if (mode == ExistingFiles) {
         fileCount = scandir(folder, &fileList, 0, alphasort);
         if (fileCount < 0) {
@@ -351,8 +361,7 @@ void *worker_thread(void *arg)
             break;
         }
 
-        gettimeofday(&timestamp, NULL);
-        pglobal->in[plugin_number].timestamp = timestamp;
+        stamp_frame(&pglobal->in[plugin_number], NULL);
         DBG("new frame copied (size: %d)\n", pglobal->in[plugin_number].size);
         /* signal fresh_frame */
         pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
@@ -387,8 +396,6 @@ thread_quit:
 
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
-
     if(!first_run) {
         DBG("already cleaned up resources\n");
         return;
@@ -400,6 +407,7 @@ void worker_cleanup(void *arg)
     if(pglobal->in[plugin_number].buf != NULL) free(pglobal->in[plugin_number].buf);
 
     free(ev);
+    ev = NULL;
 
     if (mode == NewFilesOnly) {
         rc = inotify_rm_watch(fd, wd);
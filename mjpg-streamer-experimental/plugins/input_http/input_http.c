@@ -45,6 +45,7 @@ static pthread_t   worker;
 static globals     *pglobal;
 static pthread_mutex_t controls_mutex;
 static int plugin_number;
+static unsigned char first_run = 1;
 
 void *worker_thread(void *);
 void worker_cleanup(void *);
@@ -66,6 +67,9 @@ int input_init(input_parameter *param, int plugin_no)
 {
     int i;
 
+    plugin_number = plugin_no;
+    /* the library stays loaded, a restarted plugin cleans up again */
+    first_run = 1;
     if(pthread_mutex_init(&controls_mutex, NULL) != 0) {
         IPRINT("could not initialize mutex variable\n");
         exit(EXIT_FAILURE);
@@ -100,6 +104,7 @@ int input_stop(int id)
 {
     DBG("will cancel input thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -121,7 +126,6 @@ int input_run(int id)
         fprintf(stderr, "could not start worker thread\n");
         exit(EXIT_FAILURE);
     }
-    pthread_detach(worker);
 
     return 0;
 }
@@ -133,6 +137,7 @@ void on_image_received(char * data, int length){
 
         pglobal->in[plugin_number].size = length;
         memcpy(pglobal->in[plugin_number].buf, data, pglobal->in[plugin_number].size);
+        stamp_frame(&pglobal->in[plugin_number], NULL);
 
         /* signal fresh_frame */
         pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
@@ -142,6 +147,7 @@ void on_image_received(char * data, int length){
 
 void *worker_thread(void *arg)
 {
+    pglobal->thread_start(Dest_Input, plugin_number, "capture");
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
@@ -163,8 +169,6 @@ Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
-
     if(!first_run) {
         DBG("already cleaned up resources\n");
         return;
@@ -66,6 +66,9 @@ typedef struct {
     filter_process_fn filter_process;
     filter_free_fn filter_free;
     
+    /* when set, the capture delivers the compressed MJPEG bitstream as-is */
+    bool passthrough;
+    
 } context;
 
 
@@ -79,6 +82,14 @@ static void null_filter(void* filter_ctx, Mat &src, Mat &dst) {
     dst = src;
 }
 
+/* a raw frame holds a JPEG if it is a single row of bytes starting with SOI */
+static bool is_jpeg_frame(const Mat &frame) {
+    return frame.type() == CV_8UC1 &&
+           (frame.rows == 1 || frame.cols == 1) &&
+           frame.total() > 2 &&
+           frame.data[0] == 0xFF && frame.data[1] == 0xD8;
+}
+
 static void help() {
     
     fprintf(stderr,
@@ -96,6 +107,8 @@ static void help() {
     fprintf(stderr,
     " [-f | --fps ]..........: frames per second\n" \
     " [-q | --quality ] .....: set quality of JPEG encoding\n" \
+    " [-nopt ]...............: disable MJPEG passthrough, always decode\n" \
+    "                          and reencode the frames\n" \
     " ---------------------------------------------------------------\n" \
     " Optional parameters (may not be supported by all cameras):\n\n"
     " [-br ].................: Set image brightness (integer)\n"\
@@ -139,6 +152,7 @@ int input_init(input_parameter *param, int plugin_no)
     const char * device = "default";
     const char *filter = NULL, *filter_args = "";
     int width = 640, height = 480, i, device_idx;
+    bool passthrough = true;
     
     input * in;
     context *pctx;
@@ -180,6 +194,7 @@ int input_init(input_parameter *param, int plugin_no)
             {"ex", required_argument, 0, 0},
             {"filter", required_argument, 0, 0},
             {"fargs", required_argument, 0, 0},
+            {"nopt", no_argument, 0, 0},
             {0, 0, 0, 0}
         };
     
@@ -243,6 +258,11 @@ int input_init(input_parameter *param, int plugin_no)
             filter_args = optarg;
             break;
             
+        /* nopt */
+        case 17:
+            passthrough = false;
+            break;
+            
         default:
             help();
             return 1;
@@ -324,8 +344,18 @@ int input_init(input_parameter *param, int plugin_no)
         pctx->filter_ctx = NULL;
         pctx->filter_process = null_filter;
         pctx->filter_free = NULL;
+        
+        /* nothing to do with the pixels, so ask the backend for the MJPEG
+           bitstream itself instead of decoding and encoding it again */
+        if (passthrough &&
+            pctx->capture.set(CAP_PROP_FOURCC, VideoWriter::fourcc('M', 'J', 'P', 'G')) &&
+            pctx->capture.set(CAP_PROP_FORMAT, -1)) {
+            pctx->passthrough = true;
+        }
     }
     
+    IPRINT("MJPEG passthrough : %s\n", pctx->passthrough ? "requested" : "disabled");
+    
     return 0;
     
 fatal_error:
@@ -345,8 +375,12 @@ int input_stop(int id)
     context *pctx = (context*)in->context;
     
     if (pctx != NULL) {
+        /* the cleanup frees the context, the thread must be known before */
+        pthread_t worker = pctx->worker;
+
         DBG("will cancel input thread\n");
-        pthread_cancel(pctx->worker);
+        pthread_cancel(worker);
+        pthread_join(worker, NULL);
     }
     return 0;
 }
@@ -369,7 +403,6 @@ int input_run(int id)
         fprintf(stderr, "could not start worker thread\n");
         exit(EXIT_FAILURE);
     }
-    pthread_detach(pctx->worker);
 
     return 0;
 }
@@ -379,6 +412,8 @@ void *worker_thread(void *arg)
     input * in = (input*)arg;
     context *pctx = (context*)in->context;
     context_settings *settings = (context_settings*)pctx->init_settings;
+
+    pglobal->thread_start(Dest_Input, in->param.id, "capture");
     
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, arg);
@@ -421,23 +456,45 @@ void *worker_thread(void *arg)
         src = pctx->filter_init_frame(pctx->filter_ctx);
     
     while (!pglobal->stop) {
+        struct timespec capture;
+        
         if (!pctx->capture.read(src))
             break; // TODO
-            
+        
+        // stamp the frame when it arrives, not after the filter ran
+        clock_gettime(CLOCK_MONOTONIC, &capture);
+        
+        if (pctx->passthrough && !is_jpeg_frame(src)) {
+            // the backend or the camera doesn't deliver MJPEG, fall back to
+            // decoding and reencoding the frames
+            IPRINT("MJPEG passthrough : not supported by the source, disabled\n");
+            pctx->passthrough = false;
+            pctx->capture.set(CAP_PROP_FORMAT, CV_8UC3);
+            pctx->capture.set(CAP_PROP_CONVERT_RGB, 1);
+            continue;
+        }
+        
         // call the filter function
-        pctx->filter_process(pctx->filter_ctx, src, dst);
+        if (!pctx->passthrough)
+            pctx->filter_process(pctx->filter_ctx, src, dst);
             
         /* copy JPG picture to global buffer */
         pthread_mutex_lock(&in->db);
         
-        // take whatever Mat it returns, and write it to jpeg buffer
-        imencode(".jpg", dst, jpeg_buffer, compression_params);
+        if (pctx->passthrough) {
+            // the frame already is a JPEG, just hand it over
+            jpeg_buffer.assign(src.data, src.data + src.total());
+        } else {
+            // take whatever Mat it returns, and write it to jpeg buffer
+            imencode(".jpg", dst, jpeg_buffer, compression_params);
+        }
         
         // TODO: what to do if imencode returns an error?
         
         // std::vector is guaranteed to be contiguous
         in->buf = &jpeg_buffer[0];
         in->size = jpeg_buffer.size();
+        stamp_frame(in, &capture);
         
         /* signal fresh_frame */
         pthread_cond_broadcast(&in->db_update);
@@ -38,6 +38,16 @@ GPContext* context;
 Camera* camera;
 char* selected_port;
 int delay;
+int pipelined;
+
+static int jpeg_buffer_size = 256 * 1024;
+
+// pipelined mode: the capture thread fills one file while the other one is published
+static CameraFile* files[2];
+static int pending = -1;
+static pthread_t publisher;
+static pthread_mutex_t pipe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipe_update = PTHREAD_COND_INITIALIZER;
 
 int input_init(input_parameter *param, int id)
 {
@@ -74,6 +84,7 @@ int input_init(input_parameter *param, int id)
 
 	selected_port = NULL;
 	delay = 0;
+	pipelined = 0;
 
 	param->argv[0] = INPUT_PLUGIN_NAME;
 
@@ -84,7 +95,7 @@ int input_init(input_parameter *param, int id)
 	}
 
 	optind = 1;
-	while((opt = getopt(param->argc, param->argv, "hu:d:")) != -1)
+	while((opt = getopt(param->argc, param->argv, "hu:d:p")) != -1)
 	{
 		switch(opt)
 		{
@@ -97,10 +108,13 @@ int input_init(input_parameter *param, int id)
 			case 'd':
 				selected_port = strdup(optarg);
 				break;
+			case 'p':
+				pipelined = 1;
+				break;
 		}
 	}
 
-	DBG("usleep: %d\n", delay); DBG("device: %s\n", selected_port);
+	DBG("usleep: %d\n", delay); DBG("device: %s\n", selected_port); DBG("pipelined: %d\n", pipelined);
 
 	return 0;
 }
@@ -109,6 +123,7 @@ int input_stop(int id)
 {
 	DBG("will cancel input thread\n");
 	pthread_cancel(thread);
+	pthread_join(thread, NULL);
 
 	return 0;
 }
@@ -124,6 +139,8 @@ void help()
 	" [-d X ]........: camera address in [usb:xxx,yyy] form; use\n"
 	"                  gphoto2 --auto-detect to get a list of\n"
 	"                  available cameras\n"
+	" [-p ]..........: pipelined capture, fetch the next preview while\n"
+	"                  the previous one is published\n"
 	" ---------------------------------------------------------------\n");
 }
 
@@ -212,18 +229,85 @@ int input_run(int id)
 		IPRINT("could not start worker thread\n");
 		exit(EXIT_FAILURE);
 	}
-	pthread_detach(thread);
 
 	return 0;
 }
 
+/* copies the preview in file to the global buffer and signals the fresh frame,
+   the buffer grows if the frame does not fit */
+static int publish_frame(CameraFile* file)
+{
+	int res;
+	unsigned long int xsize;
+	const char* xdata;
+
+	res = gp_file_get_data_and_size(file, &xdata, &xsize);
+	CAMERA_CHECK_GP(res, "gp_file_get_data_and_size");
+
+	pthread_mutex_lock(&global->in[plugin_id].db);
+	if(jpeg_buffer_size <= xsize) {
+		int new_size = xsize + xsize * 10/100;
+		unsigned char *tmp_buff = realloc(global->in[plugin_id].buf, new_size);
+		if(tmp_buff == NULL)
+		{
+			pthread_mutex_unlock(&global->in[plugin_id].db);
+			IPRINT(INPUT_PLUGIN_NAME " - could not allocate memory\n");
+			return 0;
+		}
+		DBG("Increased frame buffer to %d bytes.\n", new_size);
+		jpeg_buffer_size = new_size;
+		global->in[plugin_id].buf = tmp_buff;
+	}
+
+	memcpy(global->in[plugin_id].buf, xdata, xsize);
+	global->in[plugin_id].size = xsize;
+	DBG("Read %d bytes from camera.\n", global->in[plugin_id].size);
+	stamp_frame(&global->in[plugin_id], NULL);
+	pthread_cond_broadcast(&global->in[plugin_id].db_update);
+	pthread_mutex_unlock(&global->in[plugin_id].db);
+
+	return 1;
+}
+
+/* releases the pipe mutex if a thread gets cancelled while waiting */
+static void unlock_pipe(void* arg)
+{
+	pthread_mutex_unlock(&pipe_mutex);
+}
+
+/* pipelined mode: publishes the files handed over by the capture thread */
+void* publish(void* arg)
+{
+	int idx;
+
+	while(!global->stop)
+	{
+		pthread_mutex_lock(&pipe_mutex);
+		pthread_cleanup_push(unlock_pipe, NULL);
+		while(pending < 0 && !global->stop)
+			pthread_cond_wait(&pipe_update, &pipe_mutex);
+		idx = pending;
+		pthread_cleanup_pop(1);
+
+		if(idx >= 0)
+			publish_frame(files[idx]);
+
+		/* hand the file back to the capture thread */
+		pthread_mutex_lock(&pipe_mutex);
+		pending = -1;
+		pthread_cond_broadcast(&pipe_update);
+		pthread_mutex_unlock(&pipe_mutex);
+	}
+
+	return NULL;
+}
+
 void* capture(void* arg)
 {
 	int res;
-	int i = 0;
+	int i = 0, cur = 0;
 	CameraFile* file;
 
-	int jpeg_buffer_size = 256 * 1024;
 	global->in[plugin_id].buf = malloc(jpeg_buffer_size);
 	if(global->in[plugin_id].buf == NULL)
 	{
@@ -231,18 +315,34 @@ void* capture(void* arg)
 		return NULL;
 	}
 
+	/* the files are reused for every preview, the second one only in pipelined mode */
+	res = gp_file_new(&files[0]);
+	CAMERA_CHECK_GP(res, "gp_file_new");
+	if(pipelined)
+	{
+		res = gp_file_new(&files[1]);
+		CAMERA_CHECK_GP(res, "gp_file_new");
+		if(pthread_create(&publisher, 0, publish, NULL) != 0)
+		{
+			IPRINT(INPUT_PLUGIN_NAME " - could not start publisher thread\n");
+			return NULL;
+		}
+	}
+
 	pthread_cleanup_push(cleanup, NULL);
 	while(!global->stop)
 	{
 		unsigned long int xsize;
 		const char* xdata;
+
+		file = files[cur];
 		pthread_mutex_lock(&control_mutex);
-		res = gp_file_new(&file);
-		CAMERA_CHECK_GP(res, "gp_file_new");
+		gp_file_clean(file);
 		res = gp_camera_capture_preview(camera, file, context);
+		pthread_mutex_unlock(&control_mutex);
 		CAMERA_CHECK_GP(res, "gp_camera_capture_preview");
-		pthread_mutex_lock(&global->in[plugin_id].db);
 		res = gp_file_get_data_and_size(file, &xdata, &xsize);
+		CAMERA_CHECK_GP(res, "gp_file_get_data_and_size");
 		if(xsize == 0)
 		{
 			if(i++ > 3)
@@ -252,35 +352,33 @@ void* capture(void* arg)
 			}
 			int value = 0;
 			IPRINT("Read 0 bytes from camera; restarting it\n");
+			pthread_mutex_lock(&control_mutex);
 			camera_set("capture", &value);
 			sleep(3);
 			value = 1;
 			camera_set("capture", &value);
+			pthread_mutex_unlock(&control_mutex);
+			continue;
 		}
-		else
-			i = 0;
-		CAMERA_CHECK_GP(res, "gp_file_get_data_and_size");
+		i = 0;
 
-		if(jpeg_buffer_size <= xsize) {
-			jpeg_buffer_size = xsize + xsize * 10/100;
-			unsigned char *tmp_buff = realloc(global->in[plugin_id].buf,jpeg_buffer_size);
-			if(tmp_buff == NULL)
-			{
-				IPRINT(INPUT_PLUGIN_NAME " - could not allocate memory\n");
-				return NULL;
-			}
-			global->in[plugin_id].buf = tmp_buff;
+		if(pipelined)
+		{
+			/* wait until the previous file is published, then hand over this one
+			   and capture the next preview into the other file meanwhile */
+			pthread_mutex_lock(&pipe_mutex);
+			pthread_cleanup_push(unlock_pipe, NULL);
+			while(pending >= 0)
+				pthread_cond_wait(&pipe_update, &pipe_mutex);
+			pending = cur;
+			pthread_cond_broadcast(&pipe_update);
+			pthread_cleanup_pop(1);
+			cur ^= 1;
+		}
+		else if(!publish_frame(file))
+		{
+			return NULL;
 		}
-
-
-		memcpy(global->in[plugin_id].buf, xdata, xsize);
-		res = gp_file_unref(file);
-		pthread_mutex_unlock(&control_mutex);
-		CAMERA_CHECK_GP(res, "gp_file_unref");
-		global->in[plugin_id].size = xsize;
-		DBG("Read %d bytes from camera.\n", global->in[plugin_id].size);
-		pthread_cond_broadcast(&global->in[plugin_id].db_update);
-		pthread_mutex_unlock(&global->in[plugin_id].db);
 		usleep(delay);
 	}
 	pthread_cleanup_pop(1);
@@ -313,6 +411,13 @@ void cleanup(void *arg)
 	// TODO check to see if we have already cleaned up?
 
 	IPRINT("PTP2 capture - Cleaning up\n");
+	if(pipelined)
+	{
+		pthread_cancel(publisher);
+		pthread_join(publisher, NULL);
+		gp_file_unref(files[1]);
+	}
+	gp_file_unref(files[0]);
 	camera_set("capture", &value);
 	gp_camera_exit(camera, context);
 	gp_camera_unref(camera);
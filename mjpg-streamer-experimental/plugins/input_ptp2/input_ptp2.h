@@ -11,6 +11,7 @@ int input_cmd(int plugin, unsigned int control_id, unsigned int typecode, int va
 void help();
 int camera_set(char* name, void* value);
 void* capture(void* arg);
+void* publish(void* arg);
 void cleanup(void *arg);
 
 #endif /* INPUT_PTP2_H_ */
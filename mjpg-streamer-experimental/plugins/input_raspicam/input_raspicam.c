@@ -83,10 +83,9 @@ static int height = 480;
 static int quality = 85;
 static int usestills = 0;
 static int wantPreview = 0;
-static int wantTimestamp = 0;
 static RASPICAM_CAMERA_PARAMETERS c_params;
+static unsigned char first_run = 1;
 
-static struct timeval timestamp;
 
 /** Struct used to pass information in encoder port userdata to callback
  */
@@ -96,8 +95,14 @@ typedef struct
   VCOS_SEMAPHORE_T complete_semaphore; /// semaphore which is posted when we reach end of frame (indicates end of capture or fault)
   MMAL_POOL_T *pool; /// pointer to our state in case required in callback
   uint32_t offset;
+  unsigned char *staging; /// private buffer the chunks of a frame are assembled in
+  uint32_t staging_size; /// allocated size of the staging buffer
+  int drop_frame; /// set when a chunk of the current frame got lost
 } PORT_USERDATA;
 
+/// allocated size of the global frame buffer, it is swapped with the staging buffer
+static uint32_t published_size;
+
 
 
 /*** plugin interface functions ***/
@@ -119,6 +124,15 @@ int input_init(input_parameter *param, int plugin_no)
   param->argv[0] = INPUT_PLUGIN_NAME;
   plugin_number = plugin_no;
 
+  /* the library stays loaded, a restarted plugin starts from the defaults */
+  first_run = 1;
+  fps = 5;
+  width = 640;
+  height = 480;
+  quality = 85;
+  usestills = 0;
+  wantPreview = 0;
+
   //setup the camera control st
   raspicamcontrol_set_defaults(&c_params);
 
@@ -281,8 +295,7 @@ int input_init(input_parameter *param, int plugin_no)
         wantPreview = 1;
         break;
       case 26:
-        //timestamp
-        wantTimestamp = 1;
+        //timestamp, every frame is stamped now, kept for compatibility
         break;
       case 27:
         // use stats
@@ -334,6 +347,7 @@ int input_stop(int id)
 {
   DBG("will cancel input thread\n");
   pthread_cancel(worker);
+  pthread_join(worker, NULL);
 
   return 0;
 }
@@ -367,6 +381,61 @@ void print_mmal_status(MMAL_STATUS_T status)
   }
 }
 
+/******************************************************************************
+  Description.: appends a chunk of encoded data to the staging buffer, the
+                buffer is grown if the frame does not fit
+  Input Value.: pData holds the staging buffer, data/length is the chunk
+  Return Value: 0 if ok, -1 if the memory could not be allocated
+ ******************************************************************************/
+static int staging_append(PORT_USERDATA *pData, const uint8_t *data, uint32_t length)
+{
+  if (pData->offset + length > pData->staging_size)
+  {
+    uint32_t new_size = MAX(pData->staging_size * 2, pData->offset + length);
+    unsigned char *tmp = realloc(pData->staging, new_size);
+
+    if (tmp == NULL)
+      return -1;
+
+    DBG("increasing staging buffer to %u bytes\n", new_size);
+    pData->staging = tmp;
+    pData->staging_size = new_size;
+  }
+
+  memcpy(pData->staging + pData->offset, data, length);
+  pData->offset += length;
+  return 0;
+}
+
+/******************************************************************************
+  Description.: publishes the assembled frame by swapping the staging buffer
+                with the global buffer, so the lock is only held for the swap
+  Input Value.: pData holds the staging buffer
+  Return Value: -
+ ******************************************************************************/
+static void staging_publish(PORT_USERDATA *pData)
+{
+  unsigned char *tmp;
+  uint32_t tmp_size;
+
+  pthread_mutex_lock(&pglobal->in[plugin_number].db);
+
+  tmp = pglobal->in[plugin_number].buf;
+  tmp_size = published_size;
+  pglobal->in[plugin_number].buf = pData->staging;
+  pglobal->in[plugin_number].size = pData->offset;
+  published_size = pData->staging_size;
+  pData->staging = tmp;
+  pData->staging_size = tmp_size;
+
+  //Set frame timestamp
+  stamp_frame(&pglobal->in[plugin_number], NULL);
+
+  /* signal fresh_frame */
+  pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
+  pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+}
+
 /******************************************************************************
   Callback from mmal JPEG encoder
  ******************************************************************************/
@@ -379,43 +448,40 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
 
   if (pData)
   {
-    if (buffer->length)
+    if (buffer->length && !pData->drop_frame)
     {
       mmal_buffer_header_mem_lock(buffer);
 
       //fprintf(stderr, "The flags are %x of length %i offset %i\n", buffer->flags, buffer->length, pData->offset);
 
       //Write bytes
-      /* copy JPG picture to global buffer */
-      if(pData->offset == 0)
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
-
-      memcpy(pData->offset + pglobal->in[plugin_number].buf, buffer->data, buffer->length);
-      pData->offset += buffer->length;
+      /* assemble the JPG picture in the staging buffer, consumers are not blocked meanwhile */
+      if (staging_append(pData, buffer->data, buffer->length) != 0)
+      {
+        DBG("could not grow the staging buffer, dropping frame\n");
+        pData->drop_frame = 1;
+      }
       //fwrite(buffer->data, 1, buffer->length, pData->file_handle);
       mmal_buffer_header_mem_unlock(buffer);
     }
 
+    // a failed chunk spoils the whole frame
+    if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED)
+      pData->drop_frame = 1;
+
     // Now flag if we have completed
     if (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED))
     {
-      //set frame size
-      pglobal->in[plugin_number].size = pData->offset;
-
-      //Set frame timestamp
-      if(wantTimestamp)
-      {
-        gettimeofday(&timestamp, NULL);
-        pglobal->in[plugin_number].timestamp = timestamp;
-      }
+      if (!pData->drop_frame)
+        staging_publish(pData);
+      else
+        DBG("incomplete frame dropped\n");
 
       //mark frame complete
       complete = 1;
 
       pData->offset = 0;
-      /* signal fresh_frame */
-      pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-      pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+      pData->drop_frame = 0;
     }
   }
   else
@@ -485,7 +551,8 @@ static void camera_control_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
  ******************************************************************************/
 int input_run(int id)
 {
-  pglobal->in[id].buf = malloc(width * height * 3);
+  published_size = width * height * 3;
+  pglobal->in[id].buf = malloc(published_size);
   if (pglobal->in[id].buf == NULL)
   {
     fprintf(stderr, "could not allocate memory\n");
@@ -498,7 +565,6 @@ int input_run(int id)
     fprintf(stderr, "could not start worker thread\n");
     exit(EXIT_FAILURE);
   }
-  pthread_detach(worker);
 
   return 0;
 }
@@ -551,7 +617,7 @@ void help(void)
       " [-quality].............: set JPEG quality 0-100, default 85 \n"\
       " [-usestills]...........: uses stills mode instead of video mode \n"\
       " [-preview].............: Enable full screen preview\n"\
-      " [-timestamp]...........: Get timestamp for each frame\n"
+      " [-timestamp]...........: Ignored, every frame is stamped\n"
       " \n"\
       " -sh  : Set image sharpness (-100 to 100)\n"\
       " -co  : Set image contrast (-100 to 100)\n"\
@@ -583,6 +649,8 @@ void *worker_thread(void *arg)
 {
   int i = 0;
 
+  pglobal->thread_start(Dest_Input, plugin_number, "capture");
+
   /* set cleanup handler to cleanup allocated resources */
   pthread_cleanup_push(worker_cleanup, NULL);
   //Lets not let this thread be cancelled, it needs to clean up mmal on exit
@@ -928,6 +996,15 @@ void *worker_thread(void *arg)
   callback_data.file_handle = NULL;
   callback_data.pool = pool;
   callback_data.offset = 0;
+  callback_data.drop_frame = 0;
+  /* a frame spans several encoder buffers, start with room for a few and grow on demand */
+  callback_data.staging_size = encoder_output->buffer_size * encoder_output->buffer_num;
+  callback_data.staging = malloc(callback_data.staging_size);
+  if (callback_data.staging == NULL)
+  {
+    fprintf(stderr, "could not allocate memory\n");
+    exit(EXIT_FAILURE);
+  }
 
   vcos_assert(vcos_semaphore_create(&callback_data.complete_semaphore, "RaspiStill-sem", 0) == VCOS_SUCCESS);
 
@@ -1042,6 +1119,10 @@ void *worker_thread(void *arg)
 
   mmal_connection_destroy(encoder_connection);
 
+  // no more callbacks from here on, the staging buffer can go
+  free(callback_data.staging);
+  callback_data.staging = NULL;
+
   // Disable components
   if (encoder)
     mmal_component_disable(encoder);
@@ -1087,8 +1168,6 @@ void *worker_thread(void *arg)
  ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-  static unsigned char first_run = 1;
-
   if (!first_run)
   {
     DBG("already cleaned up resources\n");
@@ -33,6 +33,9 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <syslog.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
@@ -42,28 +45,32 @@
 
 #include "testpictures.h"
 
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#endif
+
 #define INPUT_PLUGIN_NAME "TESTPICTURE input plugin"
 
 /* private functions and variables to this plugin */
-static pthread_t   worker;
 static globals     *pglobal;
 static pthread_mutex_t controls_mutex;
-static int plugin_number;
 
 void *worker_thread(void *);
 void worker_cleanup(void *);
 void help(void);
 
-static int delay = 1000;
+/* text of the comment segment the latency probe inserts into every frame */
+#define PROBE_COMMENT "mjpg-streamer probe seq=%lu emitted=%ld.%06ld"
 
 /* details of converted JPG pictures */
 struct pic {
     const unsigned char *data;
-    const int size;
+    int size;
+    double interval;            /* seconds to the next picture of a recording, 0 if unknown */
 };
 
 /* lookup pictures by resolution */
-#define ENTRY(res, pic1, pic2) { res, { { pic1, sizeof(pic1) }, { pic2, sizeof(pic2) } } }
+#define ENTRY(res, pic1, pic2) { res, { { pic1, sizeof(pic1), 0 }, { pic2, sizeof(pic2), 0 } } }
 static struct pictures {
     const char *resolution;
     struct pic sequence[2];
@@ -74,7 +81,45 @@ static struct pictures {
     ENTRY("160x120", PIC_160x120_1, PIC_160x120_2)
 };
 
-struct pictures *pics;
+/*
+ * the state of one input, the plugin may be loaded for several inputs and
+ * each of them gets its own pictures and worker
+ */
+typedef struct {
+    int id;
+    pthread_t worker;
+    int cleaned_up;
+
+    int delay;
+    double fps;                 /* replaces the delay if set */
+    int burst;
+    int latency_probe;
+
+    /* settings of the synthesized pictures */
+    int generate;
+    int width, height;
+    int quality;
+    int pool_size;
+    int noise;
+
+    /* a recorded stream or a file of concatenated JPEGs to replay */
+    char *replay_file;
+
+    /* the pictures the worker cycles through */
+    const struct pictures *pics;
+    const struct pic *frames;
+    int frame_count;
+    int max_size;
+
+    /* synthesized or replayed pictures */
+    struct pic *pool;
+    int pool_count, pool_capacity;
+    void *recording;
+    size_t recording_size;
+} context;
+
+static int generate_pictures(context *pctx);
+static int load_recording(context *pctx, const char *path);
 
 /*** plugin interface functions ***/
 
@@ -85,9 +130,23 @@ Return Value: 0 if everything is ok
 ******************************************************************************/
 int input_init(input_parameter *param, int plugin_no)
 {
+    char resolution[32];
+    context *pctx;
     int i;
 
-    pics = &picture_lookup[1];
+    if((pctx = calloc(1, sizeof(context))) == NULL) {
+        IPRINT("could not allocate memory\n");
+        return 1;
+    }
+    pctx->id = plugin_no;
+    pctx->delay = 1000;
+    pctx->burst = 1;
+    pctx->width = 640;
+    pctx->height = 480;
+    pctx->quality = 80;
+    pctx->pool_size = 30;
+    pctx->noise = 8;
+    pctx->pics = &picture_lookup[1];
 
     if(pthread_mutex_init(&controls_mutex, NULL) != 0) {
         IPRINT("could not initialize mutex variable\n");
@@ -112,6 +171,18 @@ int input_init(input_parameter *param, int plugin_no)
             {"delay", required_argument, 0, 0},
             {"r", required_argument, 0, 0},
             {"resolution", required_argument, 0, 0},
+            {"l", no_argument, 0, 0},
+            {"latency", no_argument, 0, 0},
+            {"b", required_argument, 0, 0},
+            {"burst", required_argument, 0, 0},
+            {"q", required_argument, 0, 0},
+            {"quality", required_argument, 0, 0},
+            {"n", required_argument, 0, 0},
+            {"frames", required_argument, 0, 0},
+            {"noise", required_argument, 0, 0},
+            {"fps", required_argument, 0, 0},
+            {"f", required_argument, 0, 0},
+            {"file", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -139,19 +210,74 @@ int input_init(input_parameter *param, int plugin_no)
         case 2:
         case 3:
             DBG("case 2,3\n");
-            delay = atoi(optarg);
+            pctx->delay = atoi(optarg);
             break;
 
             /* r, resolution */
         case 4:
         case 5:
             DBG("case 4,5\n");
+            parse_resolution_opt(optarg, &pctx->width, &pctx->height);
+            snprintf(resolution, sizeof(resolution), "%dx%d", pctx->width, pctx->height);
             for(i = 0; i < LENGTH_OF(picture_lookup); i++) {
-                if(strcmp(picture_lookup[i].resolution, optarg) == 0) {
-                    pics = &picture_lookup[i];
+                if(strcmp(picture_lookup[i].resolution, resolution) == 0) {
+                    pctx->pics = &picture_lookup[i];
                     break;
                 }
             }
+            /* other resolutions are synthesized */
+            if(i == LENGTH_OF(picture_lookup))
+                pctx->generate = 1;
+            break;
+
+            /* l, latency */
+        case 6:
+        case 7:
+            DBG("case 6,7\n");
+            pctx->latency_probe = 1;
+            break;
+
+            /* b, burst */
+        case 8:
+        case 9:
+            DBG("case 8,9\n");
+            pctx->burst = MAX(atoi(optarg), 1);
+            break;
+
+            /* q, quality */
+        case 10:
+        case 11:
+            DBG("case 10,11\n");
+            pctx->quality = MIN(MAX(atoi(optarg), 1), 100);
+            pctx->generate = 1;
+            break;
+
+            /* n, frames */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            pctx->pool_size = MAX(atoi(optarg), 1);
+            pctx->generate = 1;
+            break;
+
+            /* noise */
+        case 14:
+            DBG("case 14\n");
+            pctx->noise = MIN(MAX(atoi(optarg), 0), 127);
+            pctx->generate = 1;
+            break;
+
+            /* fps */
+        case 15:
+            DBG("case 15\n");
+            pctx->fps = atof(optarg);
+            break;
+
+            /* f, file */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            pctx->replay_file = optarg;
             break;
 
         default:
@@ -162,9 +288,35 @@ int input_init(input_parameter *param, int plugin_no)
     }
 
     pglobal = param->global;
+    pglobal->in[plugin_no].context = pctx;
 
-    IPRINT("delay.............: %i\n", delay);
-    IPRINT("resolution........: %s\n", pics->resolution);
+    if(pctx->replay_file != NULL) {
+        if(load_recording(pctx, pctx->replay_file) < 0)
+            return 1;
+        IPRINT("replaying.........: %s, %d pictures\n", pctx->replay_file, pctx->frame_count);
+    } else if(pctx->generate) {
+        if(generate_pictures(pctx) < 0)
+            return 1;
+        IPRINT("resolution........: %ix%i, synthesized\n", pctx->width, pctx->height);
+        IPRINT("quality...........: %i\n", pctx->quality);
+        IPRINT("pictures..........: %i, noise %i\n", pctx->frame_count, pctx->noise);
+    } else {
+        pctx->frames = pctx->pics->sequence;
+        pctx->frame_count = LENGTH_OF(pctx->pics->sequence);
+        IPRINT("resolution........: %s\n", pctx->pics->resolution);
+    }
+
+    for(i = 0; i < pctx->frame_count; i++)
+        pctx->max_size = MAX(pctx->max_size, pctx->frames[i].size);
+
+    if(pctx->fps > 0) {
+        IPRINT("frames per second.: %.2f\n", pctx->fps);
+    } else {
+        IPRINT("delay.............: %i\n", pctx->delay);
+    }
+    IPRINT("burst.............: %i\n", pctx->burst);
+    IPRINT("largest picture...: %i bytes\n", pctx->max_size);
+    IPRINT("latency probe.....: %s\n", pctx->latency_probe ? "enabled" : "disabled");
 
     return 0;
 }
@@ -176,9 +328,16 @@ Return Value: 0
 ******************************************************************************/
 int input_stop(int id)
 {
+    context *pctx = pglobal->in[id].context;
+
+    /* the worker is not detached, it may have left already when stop was set */
     DBG("will cancel input thread\n");
-    pthread_cancel(worker);
+    pthread_cancel(pctx->worker);
+    pthread_join(pctx->worker, NULL);
 
+    /* input_init() makes a new context when the input is started again */
+    free(pctx);
+    pglobal->in[id].context = NULL;
     return 0;
 }
 
@@ -189,18 +348,20 @@ Return Value: 0
 ******************************************************************************/
 int input_run(int id)
 {
-    pglobal->in[id].buf = malloc(256 * 1024);
+    context *pctx = pglobal->in[id].context;
+
+    /* leave room for the comment of the latency probe */
+    pglobal->in[id].buf = malloc(pctx->max_size + 256);
     if(pglobal->in[id].buf == NULL) {
         fprintf(stderr, "could not allocate memory\n");
         exit(EXIT_FAILURE);
     }
 
-    if(pthread_create(&worker, 0, worker_thread, NULL) != 0) {
+    if(pthread_create(&pctx->worker, 0, worker_thread, pctx) != 0) {
         free(pglobal->in[id].buf);
         fprintf(stderr, "could not start worker thread\n");
         exit(EXIT_FAILURE);
     }
-    pthread_detach(worker);
 
     return 0;
 }
@@ -216,39 +377,411 @@ void help(void)
     " Help for input plugin..: "INPUT_PLUGIN_NAME"\n" \
     " ---------------------------------------------------------------\n" \
     " The following parameters can be passed to this plugin:\n\n" \
-    " [-d | --delay ]........: delay to pause between frames\n" \
-    " [-r | --resolution]....: can be 960x720, 640x480, 320x240, 160x120\n"
+    " [-d | --delay ]........: delay to pause between frames in ms\n" \
+    " [-fps ]................: frames per second, replaces the delay\n" \
+    " [-r | --resolution]....: 960x720, 640x480, 320x240 and 160x120 are built in,\n" \
+    "                          pictures of other sizes are synthesized\n" \
+    " [-q | --quality ]......: synthesize pictures with this JPEG quality (80)\n" \
+    " [-n | --frames ].......: number of synthesized pictures (30), the pattern\n" \
+    "                          moves across the picture once per cycle\n" \
+    " [-noise ]..............: amplitude of the noise of synthesized pictures,\n" \
+    "                          0-127 (8), more noise makes larger pictures\n" \
+    " [-f | --file ].........: replay a recorded stream (multipart, as saved from\n" \
+    "                          ?action=stream) with its timing, or a file of\n" \
+    "                          concatenated JPEGs with the delay\n" \
+    " [-l | --latency ]......: write the sequence number and the time the frame\n" \
+    "                          was emitted into a JPEG comment of each frame\n"
+    " [-b | --burst ]........: emit this many frames at once, then pause as long\n" \
+    "                          as for all of them, the average rate stays the same\n"
     " ---------------------------------------------------------------\n");
 }
 
 /******************************************************************************
-Description.: copy a picture from testpictures.h and signal this to all output
-              plugins, afterwards switch to the next frame of the animation.
-Input Value.: arg is not used
-Return Value: NULL
+Description.: copies a picture and inserts a comment (COM) segment right after
+              the SOI marker, it carries the sequence number and the wall clock
+              time the frame was emitted. Decoders ignore it, a client can
+              compare it with the time it received the frame.
+Input Value.: buf is the destination, pic the picture and in the input which
+              holds the stamps of the frame
+Return Value: size of the copied picture
 ******************************************************************************/
-void *worker_thread(void *arg)
+static int probe_picture(unsigned char *buf, const struct pic *pic, input *in)
 {
-    int i = 0;
+    char comment[128];
+    int len;
+
+    len = snprintf(comment, sizeof(comment), PROBE_COMMENT,
+                   in->sequence, (long)in->timestamp.tv_sec, (long)in->timestamp.tv_usec);
+
+    /* SOI, then the COM marker, its length includes the two length bytes */
+    buf[0] = 0xFF;
+    buf[1] = 0xD8;
+    buf[2] = 0xFF;
+    buf[3] = 0xFE;
+    buf[4] = (len + 2) >> 8;
+    buf[5] = (len + 2) & 0xFF;
+    memcpy(buf + 6, comment, len);
+    memcpy(buf + 6 + len, pic->data + 2, pic->size - 2);
+
+    return pic->size + 4 + len;
+}
 
-    /* set cleanup handler to cleanup allocated resources */
-    pthread_cleanup_push(worker_cleanup, NULL);
+/******************************************************************************
+Description.: adds a picture to the pool of synthesized or replayed pictures
+Input Value.: pctx is the input, data and size of the JPEG, interval to the
+              next picture
+Return Value: 0 if ok, -1 if there is no memory
+******************************************************************************/
+static int add_picture(context *pctx, const unsigned char *data, int size, double interval)
+{
+    if(pctx->pool_count == pctx->pool_capacity) {
+        int capacity = pctx->pool_capacity ? 2 * pctx->pool_capacity : 64;
+        struct pic *tmp = realloc(pctx->pool, capacity * sizeof(struct pic));
+
+        if(tmp == NULL)
+            return -1;
+        pctx->pool = tmp;
+        pctx->pool_capacity = capacity;
+    }
+
+    pctx->pool[pctx->pool_count].data = data;
+    pctx->pool[pctx->pool_count].size = size;
+    pctx->pool[pctx->pool_count].interval = interval;
+    pctx->pool_count++;
+    return 0;
+}
+
+#ifndef NO_LIBJPEG
+/* 75% color bars: white, yellow, cyan, green, magenta, red, blue */
+static const unsigned char bars[7][3] = {
+    { 191, 191, 191 }, { 191, 191, 0 }, { 0, 191, 191 }, { 0, 191, 0 },
+    { 191, 0, 191 }, { 191, 0, 0 }, { 0, 0, 191 }
+};
+
+/******************************************************************************
+Description.: renders a line of the test pattern: color bars, a gray ramp and
+              a checkerboard, a white square moving across them and noise
+Input Value.: pctx holds the size and noise, row receives width RGB pixels,
+              y is the line, shift how far the pattern moved, seed the state
+              of the noise generator
+Return Value: -
+******************************************************************************/
+static void pattern_row(context *pctx, unsigned char *row, int y, int shift, unsigned int *seed)
+{
+    int width = pctx->width, height = pctx->height, noise = pctx->noise;
+    int box = height / 4, top = (height - box) / 2;
+    int x, c, value;
+
+    for(x = 0; x < width; x++) {
+        unsigned char *pixel = row + 3 * x;
+        int offset = 0;
+
+        if((x - shift + width) % width < box && y >= top && y < top + box) {
+            pixel[0] = pixel[1] = pixel[2] = 255;
+        } else if(y < height * 2 / 3) {
+            memcpy(pixel, bars[x * 7 / width], 3);
+        } else if(y < height * 5 / 6) {
+            pixel[0] = pixel[1] = pixel[2] = (x + shift) % width * 255 / width;
+        } else {
+            pixel[0] = pixel[1] = pixel[2] = (((x + shift) / 16 + y / 16) & 1) ? 235 : 16;
+        }
+
+        /* xorshift, the same noise in each cycle */
+        if(noise > 0) {
+            *seed ^= *seed << 13;
+            *seed ^= *seed >> 17;
+            *seed ^= *seed << 5;
+            offset = (int)(*seed % (2 * noise + 1)) - noise;
+        }
+        for(c = 0; c < 3; c++) {
+            value = pixel[c] + offset;
+            pixel[c] = MIN(MAX(value, 0), 255);
+        }
+    }
+}
+
+/******************************************************************************
+Description.: encodes the pictures of one cycle of the moving test pattern,
+              this is done once, the worker just copies them
+Input Value.: pctx is the input
+Return Value: 0 if ok, -1 on errors
+******************************************************************************/
+static int generate_pictures(context *pctx)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *row;
+    unsigned int seed;
+    int i;
+
+    if(pctx->width <= 0 || pctx->height <= 0) {
+        IPRINT("invalid resolution %ix%i\n", pctx->width, pctx->height);
+        return -1;
+    }
+
+    if((row = malloc(pctx->width * 3)) == NULL) {
+        IPRINT("could not allocate memory\n");
+        return -1;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    for(i = 0; i < pctx->pool_size; i++) {
+        unsigned char *data = NULL;
+        unsigned long size = 0;
+
+        jpeg_mem_dest(&cinfo, &data, &size);
+        cinfo.image_width = pctx->width;
+        cinfo.image_height = pctx->height;
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, pctx->quality, TRUE);
+        jpeg_start_compress(&cinfo, TRUE);
+
+        seed = 2463534242u + i;
+        while(cinfo.next_scanline < cinfo.image_height) {
+            pattern_row(pctx, row, cinfo.next_scanline, (int)((long long)i * pctx->width / pctx->pool_size), &seed);
+            jpeg_write_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_compress(&cinfo);
+
+        if(add_picture(pctx, data, size, 0) < 0) {
+            free(data);
+            break;
+        }
+    }
+
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+
+    if(pctx->pool_count < pctx->pool_size) {
+        IPRINT("could not allocate memory for the pictures\n");
+        return -1;
+    }
+
+    pctx->frames = pctx->pool;
+    pctx->frame_count = pctx->pool_count;
+    return 0;
+}
+#else
+static int generate_pictures(context *pctx)
+{
+    IPRINT("synthesizing pictures requires libjpeg, use one of the built in resolutions\n");
+    return -1;
+}
+#endif
+
+/******************************************************************************
+Description.: finds the end of a JPEG by walking its segments, the entropy
+              coded data is scanned for the next marker
+Input Value.: data points to the SOI marker, size is the data available
+Return Value: the length of the JPEG including the EOI marker, -1 if the JPEG
+              is truncated or broken
+******************************************************************************/
+static long jpeg_length(const unsigned char *data, long size)
+{
+    long i = 2;
+
+    if(size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return -1;
+
+    while(i + 2 <= size) {
+        int marker;
+
+        if(data[i] != 0xFF)
+            return -1;
+        marker = data[i + 1];
+        if(marker == 0xFF) {
+            /* fill byte */
+            i++;
+            continue;
+        }
+        if(marker == 0xD9)
+            return i + 2;
+        if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            /* TEM and RSTn have no length */
+            i += 2;
+            continue;
+        }
+        if(i + 4 > size)
+            return -1;
+        i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+
+        if(marker == 0xDA) {
+            /* stuffed zero bytes and restart markers belong to the scan */
+            while(i + 1 < size && !(data[i] == 0xFF && data[i + 1] != 0x00 &&
+                                    !(data[i + 1] >= 0xD0 && data[i + 1] <= 0xD7)))
+                i++;
+        }
+    }
+    return -1;
+}
+
+/******************************************************************************
+Description.: maps a recording and indexes its pictures. A multipart stream as
+              sent by ?action=stream is split by the Content-Length of its
+              parts, the X-Timestamp headers give the original timing. Other
+              files are read as concatenated JPEGs.
+Input Value.: pctx is the input, path of the file
+Return Value: 0 if ok, -1 if the file can not be read or has no pictures
+******************************************************************************/
+static int load_recording(context *pctx, const char *path)
+{
+    const unsigned char *p, *end, *hdr, *body, *stamp;
+    struct stat st;
+    double timestamp, last = 0;
+    long length;
+    int fd, i;
+
+    if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        IPRINT("could not open %s: %s\n", path, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    pctx->recording_size = st.st_size;
+    pctx->recording = (pctx->recording_size > 0) ? mmap(NULL, pctx->recording_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(pctx->recording == MAP_FAILED) {
+        IPRINT("could not map %s\n", path);
+        pctx->recording = NULL;
+        return -1;
+    }
+
+    p = pctx->recording;
+    end = p + pctx->recording_size;
+
+    if(memmem(p, MIN(pctx->recording_size, 4096), "Content-Length:", 15) != NULL) {
+        while((hdr = memmem(p, end - p, "Content-Length:", 15)) != NULL) {
+            if((body = memmem(hdr, end - hdr, "\r\n\r\n", 4)) == NULL)
+                break;
+            body += 4;
+            length = strtol((const char *)hdr + 15, NULL, 10);
+            if(length <= 0 || length > end - body)
+                break;
+
+            /* the interval of the previous picture is known now */
+            stamp = memmem(p, body - p, "X-Timestamp:", 12);
+            timestamp = (stamp != NULL) ? strtod((const char *)stamp + 12, NULL) : 0;
+            if(pctx->pool_count > 0 && last > 0 && timestamp > last)
+                pctx->pool[pctx->pool_count - 1].interval = timestamp - last;
+            last = timestamp;
+
+            if(add_picture(pctx, body, length, 0) < 0)
+                break;
+            p = body + length;
+        }
+    } else {
+        while((p = memmem(p, end - p, "\xFF\xD8\xFF", 3)) != NULL) {
+            if((length = jpeg_length(p, end - p)) < 0)
+                break;
+            if(add_picture(pctx, p, length, 0) < 0)
+                break;
+            p += length;
+        }
+    }
+
+    if(pctx->pool_count == 0) {
+        IPRINT("no pictures found in %s\n", path);
+        return -1;
+    }
+
+    /* the last picture has no successor, it waits as long as the one before */
+    if(pctx->pool_count > 1)
+        pctx->pool[pctx->pool_count - 1].interval = pctx->pool[pctx->pool_count - 2].interval;
+
+    for(i = 0; i < pctx->pool_count && pctx->pool[i].interval == 0; i++);
+    if(i < pctx->pool_count)
+        IPRINT("timing............: as recorded\n");
+
+    pctx->frames = pctx->pool;
+    pctx->frame_count = pctx->pool_count;
+    return 0;
+}
+
+/******************************************************************************
+Description.: copy a picture and signal this to all output plugins, afterwards
+              switch to the next frame of the animation. The frames are paced
+              against absolute deadlines, so the rate does not drift with the
+              time it takes to copy them.
+Input Value.: pctx is the context of the input
+Return Value: -
+******************************************************************************/
+static void play_frames(context *pctx)
+{
+    input *in = &pglobal->in[pctx->id];
+    const struct pic *frames = pctx->frames;
+    struct timespec next, now;
+    double period = (pctx->fps > 0) ? 1.0 / pctx->fps : pctx->delay / 1000.0, pending = 0;
+    long long ns;
+    int i = -1, burst_count = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
 
     while(!pglobal->stop) {
 
         /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
-
-        i = (i + 1) % LENGTH_OF(pics->sequence);
-        pglobal->in[plugin_number].size = pics->sequence[i].size;
-        memcpy(pglobal->in[plugin_number].buf, pics->sequence[i].data, pglobal->in[plugin_number].size);
+        pthread_mutex_lock(&in->db);
+
+        i = (i + 1) % pctx->frame_count;
+        stamp_frame(in, NULL);
+        if(pctx->latency_probe) {
+            in->size = probe_picture(in->buf, &frames[i], in);
+        } else {
+            in->size = frames[i].size;
+            memcpy(in->buf, frames[i].data, in->size);
+        }
 
         /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-        pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+        pthread_cond_broadcast(&in->db_update);
+        pthread_mutex_unlock(&in->db);
+
+        /* a recording keeps its own timing */
+        pending += (frames[i].interval > 0) ? frames[i].interval : period;
+
+        /* frames of a burst follow each other immediately */
+        if(++burst_count < pctx->burst)
+            continue;
+        burst_count = 0;
+
+        ns = next.tv_nsec + (long long)(pending * 1000000000.0);
+        next.tv_sec += ns / 1000000000;
+        next.tv_nsec = ns % 1000000000;
+        pending = 0;
+
+        /* start over if we fell behind, catching up would send a burst */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(now.tv_sec - next.tv_sec > 1 ||
+           (now.tv_sec - next.tv_sec) * 1000000000LL + now.tv_nsec - next.tv_nsec > period * 1000000000.0) {
+            DBG("frame is late, restarting the schedule\n");
+            next = now;
+            continue;
+        }
 
-        usleep(1000 * delay);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
     }
+}
+
+/******************************************************************************
+Description.: the thread of the input, it plays the pictures until the
+              program stops. The pacing runs in play_frames(), so the locals it
+              carries from one frame to the next do not share a stack frame
+              with the cleanup handler.
+Input Value.: arg is the context of the input
+Return Value: NULL
+******************************************************************************/
+void *worker_thread(void *arg)
+{
+    context *pctx = arg;
+
+    pglobal->thread_start(Dest_Input, pctx->id, "capture");
+
+    /* set cleanup handler to cleanup allocated resources */
+    pthread_cleanup_push(worker_cleanup, pctx);
+
+    play_frames(pctx);
 
     IPRINT("leaving input thread, calling cleanup function now\n");
     pthread_cleanup_pop(1);
@@ -258,22 +791,32 @@ void *worker_thread(void *arg)
 
 /******************************************************************************
 Description.: this functions cleans up allocated resources
-Input Value.: arg is unused
+Input Value.: arg is the context of the input
 Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
+    context *pctx = arg;
+    int i;
 
-    if(!first_run) {
+    if(pctx->cleaned_up) {
         DBG("already cleaned up resources\n");
         return;
     }
 
-    first_run = 0;
+    pctx->cleaned_up = 1;
     DBG("cleaning up resources allocated by input thread\n");
 
-    if(pglobal->in[plugin_number].buf != NULL) free(pglobal->in[plugin_number].buf);
+    if(pglobal->in[pctx->id].buf != NULL) free(pglobal->in[pctx->id].buf);
+
+    if(pctx->recording != NULL) {
+        munmap(pctx->recording, pctx->recording_size);
+    } else {
+        /* synthesized pictures were allocated by libjpeg */
+        for(i = 0; i < pctx->pool_count; i++)
+            free((void *)pctx->pool[i].data);
+    }
+    free(pctx->pool);
 }
 
 
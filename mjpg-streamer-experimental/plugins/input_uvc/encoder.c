@@ -0,0 +1,89 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "v4l2uvc.h"
+
+/******************************************************************************
+Description.: chooses the encoder of a camera, the software encoder unless
+              the spec asks for another one
+Input Value.: enc is the encoder, spec "software", "m2m" or "m2m:<device>"
+Return Value: 0 if ok, -1 if there is no such encoder
+******************************************************************************/
+int encoder_select(encoder *enc, const char *spec)
+{
+    memset(enc, 0, sizeof(encoder));
+
+    if(spec == NULL || strcmp(spec, "software") == 0) {
+        enc->backend = &software_encoder;
+    } else if(strcmp(spec, "m2m") == 0) {
+        enc->backend = &m2m_encoder;
+    } else if(strncmp(spec, "m2m:", 4) == 0) {
+        enc->backend = &m2m_encoder;
+        enc->device = strdup(spec + 4);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: encodes a frame, the encoder is opened on the first frame and
+              opened again whenever the camera got new buffers. If it can not
+              be opened the software encoder takes over.
+Input Value.: enc is the encoder, vd the camera, frame to encode, buffer and
+              its size for the JPEG, quality of the JPEG
+Return Value: size of the JPEG or -1 on error
+******************************************************************************/
+int encoder_encode(encoder *enc, struct vdIn *vd, const raw_frame *frame, unsigned char *buffer, int size, int quality)
+{
+    if(enc->opened && enc->generation != vd->generation)
+        encoder_close(enc);
+
+    if(!enc->opened && enc->backend->open != NULL) {
+        if(enc->backend->open(enc, vd) < 0) {
+            IPRINT("the %s encoder can not be used, falling back to the software encoder\n", enc->backend->name);
+            enc->backend = &software_encoder;
+            vd->keep_buffer = 0;
+        } else {
+            enc->generation = vd->generation;
+            enc->opened = 1;
+        }
+    }
+
+    return enc->backend->encode(enc, frame, buffer, size, quality);
+}
+
+/******************************************************************************
+Description.: closes the encoder, the next frame opens it again
+Input Value.: enc is the encoder
+Return Value: -
+******************************************************************************/
+void encoder_close(encoder *enc)
+{
+    if(enc->opened && enc->backend->close != NULL)
+        enc->backend->close(enc);
+    enc->opened = 0;
+}
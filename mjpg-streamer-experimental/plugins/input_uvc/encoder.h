@@ -0,0 +1,69 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+struct vdIn;
+
+/* an uncompressed frame to encode */
+typedef struct {
+    const unsigned char *data;  /* the pixels */
+    int length;                 /* bytes used */
+    int width, height;
+    unsigned int format;
+    unsigned int bytesperline;
+    int index;                  /* of the buffer of the camera, -1 for a copy */
+} raw_frame;
+
+typedef struct _encoder encoder;
+
+/* the operations of a JPEG encoder */
+typedef struct {
+    const char *name;
+    /*
+     * a lazy encoder compresses a copy of the frame only when a consumer
+     * reads it, the others compress every frame while it is still in the
+     * buffer of the camera (see keep_buffer of struct vdIn)
+     */
+    int lazy;
+    int (*open)(encoder *enc, struct vdIn *vd);
+    int (*encode)(encoder *enc, const raw_frame *frame, unsigned char *buffer, int size, int quality);
+    void (*close)(encoder *enc);
+} encoder_backend;
+
+struct _encoder {
+    const encoder_backend *backend;
+    char *device;               /* of a hardware encoder, NULL to look for one */
+    unsigned int generation;    /* of the buffers of the camera it was opened for */
+    int opened;
+    void *priv;                 /* state of the backend */
+};
+
+extern const encoder_backend software_encoder;
+extern const encoder_backend m2m_encoder;
+
+int encoder_select(encoder *enc, const char *spec);
+int encoder_encode(encoder *enc, struct vdIn *vd, const raw_frame *frame, unsigned char *buffer, int size, int quality);
+void encoder_close(encoder *enc);
+
+#endif
@@ -0,0 +1,427 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * JPEG encoder of the SoC, a V4L2 memory-to-memory device: the raw frames
+ * are queued on its OUTPUT queue and come back as JPEG on its CAPTURE queue.
+ * If the camera exports its buffers the encoder reads the frames straight
+ * from them (DMABUF), otherwise they are copied into a buffer of the encoder.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <glob.h>
+#include <poll.h>
+#include <syslog.h>
+#include <getopt.h>
+
+#include "../../utils.h"
+#include "v4l2uvc.h"
+
+/* how long a frame may take */
+#define M2M_TIMEOUT_MS 1000
+
+typedef struct {
+    int fd;
+    char *device;               /* the node, for the messages */
+    int dmabuf;                 /* the OUTPUT queue imports the buffers of the camera */
+    const int *imported;        /* DMABUF descriptors of the buffers of the camera */
+    unsigned int imported_length[NB_BUFFER];
+    void *output;               /* the buffer the frames are copied to without DMABUF */
+    unsigned int output_length;
+    unsigned int bytesperline;  /* of the OUTPUT queue */
+    void *capture;              /* receives the JPEG */
+    unsigned int capture_length;
+    int height;
+    int quality;                /* set on the device, -1 if unknown */
+} m2m_state;
+
+/******************************************************************************
+Description.: tells if a device is a multi-planar memory-to-memory device
+              which produces JPEG
+Input Value.: fd of the device
+Return Value: the pixel format of its JPEGs or 0 if it is no JPEG encoder
+******************************************************************************/
+static __u32 jpeg_format(int fd)
+{
+    struct v4l2_capability cap;
+    struct v4l2_fmtdesc fmtdesc;
+    __u32 caps;
+
+    memset(&cap, 0, sizeof(cap));
+    if(xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0)
+        return 0;
+    caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if(!(caps & V4L2_CAP_VIDEO_M2M_MPLANE) || !(caps & V4L2_CAP_STREAMING))
+        return 0;
+
+    memset(&fmtdesc, 0, sizeof(fmtdesc));
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    for(fmtdesc.index = 0; xioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == 0; fmtdesc.index++) {
+        if(fmtdesc.pixelformat == V4L2_PIX_FMT_JPEG || fmtdesc.pixelformat == V4L2_PIX_FMT_MJPEG)
+            return fmtdesc.pixelformat;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: opens the given encoder or the first JPEG encoder found
+Input Value.: enc is the encoder, st receives the descriptor and the name
+Return Value: the pixel format of its JPEGs or 0 if there is none
+******************************************************************************/
+static __u32 open_device(encoder *enc, m2m_state *st)
+{
+    glob_t nodes;
+    __u32 format = 0;
+    size_t i;
+
+    if(enc->device != NULL) {
+        if((st->fd = OPEN_VIDEO(enc->device, O_RDWR | O_NONBLOCK)) < 0) {
+            IPRINT("could not open %s: %s\n", enc->device, strerror(errno));
+            return 0;
+        }
+        st->device = strdup(enc->device);
+        if((format = jpeg_format(st->fd)) == 0)
+            IPRINT("%s is no multi-planar JPEG encoder\n", enc->device);
+        return format;
+    }
+
+    if(glob("/dev/video*", 0, NULL, &nodes) != 0)
+        return 0;
+    for(i = 0; i < nodes.gl_pathc && format == 0; i++) {
+        if((st->fd = OPEN_VIDEO(nodes.gl_pathv[i], O_RDWR | O_NONBLOCK)) < 0)
+            continue;
+        if((format = jpeg_format(st->fd)) != 0) {
+            st->device = strdup(nodes.gl_pathv[i]);
+        } else {
+            CLOSE_VIDEO(st->fd);
+            st->fd = -1;
+        }
+    }
+    globfree(&nodes);
+    if(format == 0)
+        IPRINT("found no multi-planar JPEG encoder\n");
+    return format;
+}
+
+/******************************************************************************
+Description.: requests and maps a single buffer of a queue
+Input Value.: st is the state, type of the queue, mem and length receive the
+              mapping
+Return Value: 0 if ok, -1 on error
+******************************************************************************/
+static int map_buffer(m2m_state *st, __u32 type, void **mem, unsigned int *length)
+{
+    struct v4l2_requestbuffers rb;
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    memset(&rb, 0, sizeof(rb));
+    rb.count = 1;
+    rb.type = type;
+    rb.memory = V4L2_MEMORY_MMAP;
+    if(xioctl(st->fd, VIDIOC_REQBUFS, &rb) < 0 || rb.count < 1)
+        return -1;
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = type;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.m.planes = planes;
+    buf.length = 1;
+    if(xioctl(st->fd, VIDIOC_QUERYBUF, &buf) < 0)
+        return -1;
+
+    *length = planes[0].length;
+    *mem = mmap(NULL, planes[0].length, PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, planes[0].m.mem_offset);
+    if(*mem == MAP_FAILED) {
+        *mem = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void m2m_close(encoder *enc);
+
+/******************************************************************************
+Description.: sets up the encoder for the frames of the camera: the OUTPUT
+              queue takes the format of the camera, the CAPTURE queue JPEG
+Input Value.: enc is the encoder, vd the camera
+Return Value: 0 if ok, -1 if the encoder can not be used
+******************************************************************************/
+static int m2m_open(encoder *enc, struct vdIn *vd)
+{
+    struct v4l2_requestbuffers rb;
+    struct v4l2_format fmt;
+    m2m_state *st;
+    __u32 jpeg;
+    int type, i;
+
+    st = calloc(1, sizeof(m2m_state));
+    if(st == NULL)
+        return -1;
+    st->fd = -1;
+    st->quality = -1;
+    st->height = vd->height;
+    enc->priv = st;
+
+    if((jpeg = open_device(enc, st)) == 0)
+        goto error;
+
+    /* the raw frames, with the line length of the camera to read its buffers */
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.width = vd->width;
+    fmt.fmt.pix_mp.height = vd->height;
+    fmt.fmt.pix_mp.pixelformat = vd->formatIn;
+    fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].bytesperline = vd->bytesperline;
+    if(xioctl(st->fd, VIDIOC_S_FMT, &fmt) < 0 || fmt.fmt.pix_mp.pixelformat != (__u32)vd->formatIn ||
+       fmt.fmt.pix_mp.width != (__u32)vd->width || fmt.fmt.pix_mp.height != (__u32)vd->height ||
+       fmt.fmt.pix_mp.num_planes != 1) {
+        char fourcc[8];
+        fcc2s(fourcc, sizeof(fourcc), vd->formatIn);
+        IPRINT("%s does not take %dx%d %s frames\n", st->device, vd->width, vd->height, fourcc);
+        goto error;
+    }
+    st->bytesperline = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    fmt.fmt.pix_mp.width = vd->width;
+    fmt.fmt.pix_mp.height = vd->height;
+    fmt.fmt.pix_mp.pixelformat = jpeg;
+    fmt.fmt.pix_mp.num_planes = 1;
+    if(xioctl(st->fd, VIDIOC_S_FMT, &fmt) < 0) {
+        IPRINT("%s can not produce %dx%d JPEGs\n", st->device, vd->width, vd->height);
+        goto error;
+    }
+
+    /* the buffers of the camera are imported if the line lengths match */
+    st->dmabuf = (vd->dmabuf[0] >= 0 && st->bytesperline == vd->bytesperline);
+    if(st->dmabuf) {
+        memset(&rb, 0, sizeof(rb));
+        rb.count = NB_BUFFER;
+        rb.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        rb.memory = V4L2_MEMORY_DMABUF;
+        if(xioctl(st->fd, VIDIOC_REQBUFS, &rb) < 0 || rb.count < NB_BUFFER) {
+            DBG("%s does not import DMABUF: %s\n", st->device, strerror(errno));
+            st->dmabuf = 0;
+        }
+    }
+    if(st->dmabuf) {
+        st->imported = vd->dmabuf;
+        for(i = 0; i < NB_BUFFER; i++)
+            st->imported_length[i] = vd->memlength[i];
+    } else if(map_buffer(st, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &st->output, &st->output_length) < 0) {
+        IPRINT("could not map the OUTPUT buffer of %s: %s\n", st->device, strerror(errno));
+        goto error;
+    }
+
+    if(map_buffer(st, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, &st->capture, &st->capture_length) < 0) {
+        IPRINT("could not map the CAPTURE buffer of %s: %s\n", st->device, strerror(errno));
+        goto error;
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if(xioctl(st->fd, VIDIOC_STREAMON, &type) < 0)
+        goto error;
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if(xioctl(st->fd, VIDIOC_STREAMON, &type) < 0)
+        goto error;
+
+    IPRINT("Encoder device....: %s, %s\n", st->device,
+           st->dmabuf ? "reads the buffers of the camera" : "copies the frames");
+    return 0;
+
+error:
+    m2m_close(enc);
+    return -1;
+}
+
+/******************************************************************************
+Description.: queues a buffer on one of the queues of the encoder
+Input Value.: st is the state, type of the queue, memory, index of the
+              buffer, fd to import or -1, length and bytes used of the plane
+Return Value: result of the ioctl
+******************************************************************************/
+static int queue_buffer(m2m_state *st, __u32 type, __u32 memory, int index, int fd, unsigned int length, unsigned int bytesused)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = type;
+    buf.memory = memory;
+    buf.index = index;
+    buf.m.planes = planes;
+    buf.length = 1;
+    planes[0].length = length;
+    planes[0].bytesused = bytesused;
+    if(memory == V4L2_MEMORY_DMABUF)
+        planes[0].m.fd = fd;
+    return xioctl(st->fd, VIDIOC_QBUF, &buf);
+}
+
+/******************************************************************************
+Description.: takes the next finished buffer of a queue
+Input Value.: st is the state, type and memory of the queue
+              offset receives where the data starts in the plane, may be NULL
+Return Value: the bytes used or -1 on error
+******************************************************************************/
+static int dequeue_buffer(m2m_state *st, __u32 type, __u32 memory, unsigned int *offset)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = type;
+    buf.memory = memory;
+    buf.m.planes = planes;
+    buf.length = 1;
+    if(xioctl(st->fd, VIDIOC_DQBUF, &buf) < 0)
+        return -1;
+    if(buf.flags & V4L2_BUF_FLAG_ERROR)
+        return -1;
+    if(offset != NULL)
+        *offset = planes[0].data_offset;
+    return planes[0].bytesused - planes[0].data_offset;
+}
+
+/******************************************************************************
+Description.: encodes a frame, synchronously: the camera keeps the buffer of
+              the frame until the JPEG is there
+Input Value.: enc is the encoder, frame to encode, buffer and its size for
+              the JPEG, quality of the JPEG
+Return Value: size of the JPEG or -1 on error
+******************************************************************************/
+static int m2m_encode(encoder *enc, const raw_frame *frame, unsigned char *buffer, int size, int quality)
+{
+    m2m_state *st = enc->priv;
+    __u32 output_memory;
+    unsigned int offset = 0;
+    struct pollfd pfd;
+    int ret, y, n;
+
+    if(quality != st->quality) {
+        struct v4l2_control control;
+
+        control.id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+        control.value = quality;
+        if(xioctl(st->fd, VIDIOC_S_CTRL, &control) < 0) {
+            DBG("%s does not take the JPEG quality %d\n", st->device, quality);
+        }
+        st->quality = quality;
+    }
+
+    if(st->dmabuf && frame->index >= 0) {
+        output_memory = V4L2_MEMORY_DMABUF;
+        ret = queue_buffer(st, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, output_memory, frame->index,
+                           st->imported[frame->index], st->imported_length[frame->index], frame->length);
+    } else if(st->output != NULL) {
+        /* the encoder may want another line length than the camera delivers */
+        output_memory = V4L2_MEMORY_MMAP;
+        if(st->bytesperline == frame->bytesperline) {
+            n = MIN(frame->length, (int)st->output_length);
+            memcpy(st->output, frame->data, n);
+        } else {
+            n = MIN(st->bytesperline, frame->bytesperline);
+            for(y = 0; y < frame->height && (y + 1) * st->bytesperline <= st->output_length; y++)
+                memcpy((unsigned char *)st->output + y * st->bytesperline, frame->data + y * frame->bytesperline, n);
+            n = y * st->bytesperline;
+        }
+        ret = queue_buffer(st, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, output_memory, 0, -1, st->output_length, n);
+    } else {
+        DBG("the frame is not in a buffer of the camera\n");
+        return -1;
+    }
+    if(ret < 0) {
+        DBG("could not queue the frame: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(queue_buffer(st, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, 0, -1, st->capture_length, 0) < 0) {
+        DBG("could not queue the JPEG buffer: %s\n", strerror(errno));
+        dequeue_buffer(st, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, output_memory, NULL);
+        return -1;
+    }
+
+    pfd.fd = st->fd;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, M2M_TIMEOUT_MS) <= 0) {
+        IPRINT("%s did not encode the frame in time\n", st->device);
+        /* the queues must be empty for the next frame, STREAMOFF empties them */
+        encoder_close(enc);
+        return -1;
+    }
+
+    ret = dequeue_buffer(st, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &offset);
+    dequeue_buffer(st, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, output_memory, NULL);
+    if(ret < 0 || offset > st->capture_length || (unsigned int)ret > st->capture_length - offset) {
+        DBG("the encoder returned a broken JPEG buffer\n");
+        return -1;
+    }
+    if(ret > size) {
+        DBG("the JPEG of %d bytes does not fit into %d bytes\n", ret, size);
+        return -1;
+    }
+    /* the JPEG starts after data_offset in the plane */
+    memcpy(buffer, (unsigned char *)st->capture + offset, ret);
+    return ret;
+}
+
+/******************************************************************************
+Description.: stops the encoder and releases its buffers
+Input Value.: enc is the encoder
+Return Value: -
+******************************************************************************/
+static void m2m_close(encoder *enc)
+{
+    m2m_state *st = enc->priv;
+    int type;
+
+    if(st == NULL)
+        return;
+    if(st->fd >= 0) {
+        type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        xioctl(st->fd, VIDIOC_STREAMOFF, &type);
+        type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        xioctl(st->fd, VIDIOC_STREAMOFF, &type);
+    }
+    if(st->output != NULL)
+        munmap(st->output, st->output_length);
+    if(st->capture != NULL)
+        munmap(st->capture, st->capture_length);
+    if(st->fd >= 0)
+        CLOSE_VIDEO(st->fd);
+    free(st->device);
+    free(st);
+    enc->priv = NULL;
+}
+
+const encoder_backend m2m_encoder = {
+    "m2m", 0, m2m_open, m2m_encode, m2m_close
+};
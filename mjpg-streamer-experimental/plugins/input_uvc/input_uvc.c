@@ -38,6 +38,9 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <syslog.h>
+#include <limits.h>
+#include <glob.h>
+#include <sys/sysmacros.h>
 
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
@@ -56,6 +59,13 @@
 
 #define INPUT_PLUGIN_NAME "UVC webcam grabber"
 
+/* the delays between the attempts to open a lost camera */
+#define RECONNECT_MIN_MS 250
+#define RECONNECT_MAX_MS 2000
+
+/* the highest -target_rate in kB/s, the rate control counts bytes in an int */
+#define TARGET_RATE_MAX 1000000
+
 static const struct {
     const char *string;
     const v4l2_std_id vstd;
@@ -68,14 +78,6 @@ static const struct {
 
 /* private functions and variables to this plugin */
 static globals *pglobal;
-static unsigned int minimum_size = 0;
-static int dynctrls = 1;
-static unsigned int every = 1;
-static int wantTimestamp = 0;
-static struct timeval timestamp;
-static int softfps = -1;
-static unsigned int timeout = 5;
-static unsigned int dv_timings = 0;
 
 static const struct {
   const char * k;
@@ -100,6 +102,11 @@ void *cam_thread(void *);
 void cam_cleanup(void *);
 void help(void);
 int input_cmd(int plugin, unsigned int control, unsigned int group, int value, char *value_string);
+static void rate_control_init(context *pcontext, context_settings *settings, input *in);
+static void describe_camera(context *pcontext);
+static void load_controls(context *pctx);
+static void remember_settings(context *pctx, context_settings *settings);
+static void camera_identity(const char *dev, char **sysfs_device, char **serial, int *index);
 
 const char *get_name_by_tvnorm(v4l2_std_id vstd) {
 	int i;
@@ -121,6 +128,9 @@ static context_settings * init_settings() {
     }
     
     settings->quality = 80;
+    settings->qmin = 20;
+    settings->qmax = 95;
+    settings->rate_smoothing = 2.0;
     return settings;
 }
 
@@ -137,9 +147,11 @@ Return Value: 0 if everything is fine
 ******************************************************************************/
 int input_init(input_parameter *param, int id)
 {
-    char *dev = "/dev/video0", *s;
+    char *dev = "/dev/video0", *resolved = NULL, *s;
     int width = 640, height = 480, fps = -1, format = V4L2_PIX_FMT_MJPEG, i;
     v4l2_std_id tvnorm = V4L2_STD_UNKNOWN;
+    unsigned int dv_timings = 0;
+    int dynctrls = 1;
     context *pctx;
     context_settings *settings;
     
@@ -148,6 +160,10 @@ int input_init(input_parameter *param, int id)
         IPRINT("error allocating context");
         exit(EXIT_FAILURE);
     }
+    pctx->every = 1;
+    pctx->timeout = 5;
+    pctx->softfps = -1;
+    encoder_select(&pctx->encoder, NULL);
     
     settings = pctx->init_settings = init_settings();
     pglobal = param->global;
@@ -215,6 +231,13 @@ int input_init(input_parameter *param, int id)
             {"softfps", required_argument, 0, 0},
             {"timeout", required_argument, 0, 0},
             {"dv_timings", no_argument, 0, 0},
+            {"ondemand", no_argument, 0, 0},
+            {"target_rate", required_argument, 0, 0},
+            {"qmin", required_argument, 0, 0},
+            {"qmax", required_argument, 0, 0},
+            {"rate_smoothing", required_argument, 0, 0},
+            {"controls_file", required_argument, 0, 0},
+            {"encoder", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -244,7 +267,10 @@ int input_init(input_parameter *param, int id)
         case 2:
         case 3:
             DBG("case 2,3\n");
-            dev = realpath(optarg, NULL);
+            free(resolved);
+            resolved = realpath(optarg, NULL);
+            /* a camera which is not plugged in yet keeps the given path */
+            dev = (resolved != NULL) ? resolved : optarg;
             break;
 
         /* r, resolution */
@@ -288,7 +314,7 @@ int input_init(input_parameter *param, int id)
         case 14:
         case 15:
             DBG("case 14,15\n");
-            minimum_size = MAX(atoi(optarg), 0);
+            pctx->minimum_size = MAX(atoi(optarg), 0);
             break;
 
         /* n, no_dynctrl */
@@ -341,7 +367,7 @@ int input_init(input_parameter *param, int id)
         /* e, every */
         case 24:
             DBG("case 24\n");
-            every = MAX(atoi(optarg), 1);
+            pctx->every = MAX(atoi(optarg), 1);
             break;
 
         /* options */
@@ -374,19 +400,47 @@ int input_init(input_parameter *param, int id)
         OPTION_INT_AUTO(38, cb)
             break;
         case 39:
-            wantTimestamp = 1;
+            pctx->wantTimestamp = 1;
             break;
        case 40:
-           softfps = atoi(optarg);
+           pctx->softfps = atoi(optarg);
            break;
         case 41:
             DBG("case 41\n");
-            timeout = MAX(atoi(optarg), 1);
+            pctx->timeout = MAX(atoi(optarg), 1);
             break;
         case 42:
             DBG("case 42\n");
             dv_timings = 1;
             break;
+        case 43:
+            DBG("case 43\n");
+            pctx->ondemand = 1;
+            break;
+        OPTION_INT(44, target_rate)
+            settings->target_rate = MIN(MAX(settings->target_rate, 0), TARGET_RATE_MAX);
+            break;
+        OPTION_INT(45, qmin)
+            settings->qmin = MIN(MAX(settings->qmin, 1), 100);
+            break;
+        OPTION_INT(46, qmax)
+            settings->qmax = MIN(MAX(settings->qmax, 1), 100);
+            break;
+        case 47:
+            DBG("case 47\n");
+            settings->rate_smoothing = MAX(atof(optarg), 0.1);
+            break;
+        case 48:
+            DBG("case 48\n");
+            pctx->controls_file = strdup(optarg);
+            break;
+        case 49:
+            DBG("case 49\n");
+            if(encoder_select(&pctx->encoder, optarg) < 0) {
+                help();
+                return 1;
+            }
+            break;
        default:
            DBG("default case\n");
            help();
@@ -403,6 +457,8 @@ int input_init(input_parameter *param, int id)
         IPRINT("not enough memory for videoIn\n");
         exit(EXIT_FAILURE);
     }
+    /* a hardware encoder reads the buffers of the camera without a copy */
+    pctx->videoIn->export_buffers = (pctx->encoder.backend == &m2m_encoder);
     
     /* display the parsed values */
     IPRINT("Using V4L2 device.: %s\n", dev);
@@ -435,8 +491,10 @@ int input_init(input_parameter *param, int id)
 
     IPRINT("Format............: %s\n", fmtString);
     #ifndef NO_LIBJPEG
-        if(format != V4L2_PIX_FMT_MJPEG && format != V4L2_PIX_FMT_JPEG)
+        if(format != V4L2_PIX_FMT_MJPEG && format != V4L2_PIX_FMT_JPEG) {
             IPRINT("JPEG Quality......: %d\n", settings->quality);
+            IPRINT("JPEG encoder......: %s\n", pctx->encoder.backend->name);
+        }
     #endif
 
     if (tvnorm != V4L2_STD_UNKNOWN) {
@@ -445,29 +503,33 @@ int input_init(input_parameter *param, int id)
         IPRINT("TV-Norm...........: DEFAULT\n");
     }
 
-    DBG("vdIn pn: %d\n", id);
-    /* open video device and prepare data structure */
-    pctx->videoIn->dv_timings = dv_timings;
-    if(init_videoIn(pctx->videoIn, dev, width, height, fps, format, 1, pctx->pglobal, id, tvnorm) < 0) {
-        IPRINT("init_VideoIn failed\n");
-        closelog();
-        exit(EXIT_FAILURE);
+    if (pctx->softfps > 0) {
+        IPRINT("Framedrop FPS.....: %d\n", pctx->softfps);
     }
 
-    if (softfps > 0) {
-        IPRINT("Framedrop FPS.....: %d\n", softfps);
+    /* the values of the command line take precedence over the saved ones */
+    if (pctx->controls_file != NULL) {
+        IPRINT("Controls file.....: %s\n", pctx->controls_file);
+        load_controls(pctx);
     }
+    remember_settings(pctx, settings);
 
     /*
-     * recent linux-uvc driver (revision > ~#125) requires to use dynctrls
-     * for pan/tilt/focus/...
-     * dynctrls must get initialized
+     * the device is opened by the camera thread, opening a camera takes up
+     * to a second and this way all cameras are opened at the same time
      */
-    if(dynctrls)
-        initDynCtrls(pctx->videoIn->fd);
-    
-    enumerateControls(pctx->videoIn, pctx->pglobal, id); // enumerate V4L2 controls after UVC extended mapping
-    
+    DBG("vdIn pn: %d\n", id);
+    pctx->videoIn->fd = -1;
+    pctx->videoIn->dv_timings = dv_timings;
+    pctx->device = (dev != NULL) ? strdup(dev) : NULL;
+    free(resolved);
+    pctx->width = width;
+    pctx->height = height;
+    pctx->fps = fps;
+    pctx->format = format;
+    pctx->tvnorm = tvnorm;
+    pctx->dynctrls = dynctrls;
+
     return 0;
 }
 
@@ -483,6 +545,14 @@ int input_stop(int id)
     
     DBG("will cancel camera thread #%02d\n", id);
     pthread_cancel(pctx->threadID);
+    /* the device is closed when the thread left, it may be opened again right away */
+    pthread_join(pctx->threadID, NULL);
+
+    /* input_init() makes a new context when the input is started again */
+    free(pctx->init_settings);
+    pthread_mutex_destroy(&pctx->controls_mutex);
+    free(pctx);
+    in->context = NULL;
     return 0;
 }
 
@@ -495,17 +565,10 @@ int input_run(int id)
 {
     input * in = &pglobal->in[id];
     context *pctx = (context*)in->context;
-    
-    in->buf = malloc(pctx->videoIn->framesizeIn);
-    if(in->buf == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        exit(EXIT_FAILURE);
-    }
 
     DBG("launching camera thread #%02d\n", id);
     /* create thread and pass context to thread function */
     pthread_create(&(pctx->threadID), NULL, cam_thread, in);
-    pthread_detach(pctx->threadID);
     return 0;
 }
 
@@ -546,11 +609,20 @@ void help(void)
     " [-y | --yuv  ] ........: Use YUV format, default: MJPEG (uses more cpu power)\n" \
     " [-fourcc ] ............: Use FOURCC codec 'argopt', \n" \
     "                          currently supported codecs are: RGB24, RGBP \n" \
-    " [-timestamp ]..........: Populate frame timestamp with system time\n" \
+    " [-timestamp ]..........: Stamp frames at dequeue, not with the driver timestamp\n" \
     " [-softfps] ............: Drop frames to try and achieve this fps\n" \
     "                          set your camera to its maximum fps to avoid stuttering\n" \
     " [-timeout] ............: Timeout for device querying (seconds)\n" \
     " [-dv_timings] .........: Enable DV timings queriyng and events processing\n" \
+    " [-ondemand] ...........: Stop the capture while no output plugin needs frames\n" \
+    " [-target_rate] ........: Adapt the JPEG quality to produce this many kB/s\n" \
+    " [-qmin] ...............: Lowest JPEG quality the rate control may use (20)\n" \
+    " [-qmax] ...............: Highest JPEG quality the rate control may use (95)\n" \
+    " [-rate_smoothing] .....: Time constant of the rate measurement in seconds (2)\n" \
+    " [-controls_file] ......: Save the controls set at runtime to this file and\n" \
+    "                          restore them when the camera is opened\n" \
+    " [-encoder] ............: JPEG encoder of the uncompressed formats: software,\n" \
+    "                          m2m or m2m:<device> for a V4L2 memory-to-memory encoder\n" \
     " ---------------------------------------------------------------\n");
 
     fprintf(stderr, "\n"\
@@ -573,104 +645,1006 @@ void help(void)
     );
 }
 
+/*
+ * the controller changes the quality by up to RATE_GAIN points per time
+ * constant of the smoothing, errors below RATE_DEADBAND are ignored so the
+ * quality does not wander with the noise of the frame sizes
+ */
+#define RATE_GAIN 40.0
+#define RATE_DEADBAND 0.05
+/* the camera and the values of the controls are updated at most this often */
+#define RATE_UPDATE_INTERVAL 0.5
+
+static double seconds_between(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1000000000.0;
+}
+
 /******************************************************************************
-Description.: this thread worker grabs a frame and copies it to the global buffer
-Input Value.: unused
-Return Value: unused, always NULL
+Description.: looks up a control of the input
+Input Value.: in is the input, group and id identify the control
+Return Value: the control or NULL if the input does not have it
 ******************************************************************************/
-void *cam_thread(void *arg)
+static control *find_control(input *in, int group, unsigned int id)
 {
-    input * in = (input*)arg;
-    context *pcontext = (context*)in->context;
-    context_settings *settings = pcontext->init_settings;
-    
-    unsigned int every_count = 0;
-    int quality = settings->quality;
-    
-    /* set cleanup handler to cleanup allocated resources */
-    pthread_cleanup_push(cam_cleanup, in);
-    
-    #define V4L_OPT_SET(vid, var, desc) \
-      if (input_cmd(pcontext->id, vid, IN_CMD_V4L2, settings->var, NULL) != 0) {\
-          fprintf(stderr, "Failed to set " desc "\n"); \
-      } else { \
-          printf(" i: %-18s: %d\n", desc, settings->var); \
+    int i;
+
+    for(i = 0; i < in->parametercount; i++) {
+        if(in->in_parameters[i].group == group && in->in_parameters[i].ctrl.id == id)
+            return &in->in_parameters[i];
+    }
+    return NULL;
+}
+
+/******************************************************************************
+Description.: reports the state of the rate controller as control value
+Input Value.: rc is the controller, id one of the RATE_CTRL_* ids
+Return Value: the value of the control
+******************************************************************************/
+static int rate_control_value(rate_control *rc, unsigned int id)
+{
+    switch(id) {
+    case RATE_CTRL_TARGET:
+        return rc->target / 1000;
+    case RATE_CTRL_MIN_QUALITY:
+        return rc->min_quality;
+    case RATE_CTRL_MAX_QUALITY:
+        return rc->max_quality;
+    case RATE_CTRL_QUALITY:
+        return rc->applied;
+    case RATE_CTRL_RATE:
+        return (int)(rc->rate / 1000);
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: sets up the rate controller, it changes the quality of our own
+              encoder for uncompressed formats and the quality of the camera
+              for MJPEG if the driver allows to. Its controls are added to
+              the controls of the input.
+Input Value.: pcontext of the camera, settings parsed from the command line,
+              in holds the controls of the camera, they are not published yet
+Return Value: -
+******************************************************************************/
+static void rate_control_init(context *pcontext, context_settings *settings, input *in)
+{
+    static const struct {
+        unsigned int id;
+        const char *name;
+        int minimum, maximum;
+        unsigned int flags;
+    } controls[] = {
+        { RATE_CTRL_TARGET, "Target rate (kB/s)", 0, TARGET_RATE_MAX, 0 },
+        { RATE_CTRL_MIN_QUALITY, "Minimum JPEG quality", 1, 100, 0 },
+        { RATE_CTRL_MAX_QUALITY, "Maximum JPEG quality", 1, 100, 0 },
+        { RATE_CTRL_QUALITY, "Current JPEG quality", 0, 100, V4L2_CTRL_FLAG_READ_ONLY },
+        { RATE_CTRL_RATE, "Current rate (kB/s)", 0, INT_MAX, V4L2_CTRL_FLAG_READ_ONLY }
+    };
+    rate_control *rc = &pcontext->rc;
+    control *c;
+    int i;
+
+    rc->target = settings->target_rate * 1000;
+    rc->min_quality = MIN(settings->qmin, settings->qmax);
+    rc->max_quality = MAX(settings->qmin, settings->qmax);
+    rc->smoothing = settings->rate_smoothing;
+
+    switch(pcontext->videoIn->formatIn) {
+    #ifndef NO_LIBJPEG
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_RGB24:
+    case V4L2_PIX_FMT_RGB565:
+        rc->method = RATE_CONTROL_SOFTWARE;
+        rc->applied = settings->quality;
+        break;
+    #endif
+    default:
+        #ifdef V4L2_CID_JPEG_COMPRESSION_QUALITY
+        if((c = find_control(in, IN_CMD_V4L2, V4L2_CID_JPEG_COMPRESSION_QUALITY)) != NULL) {
+            rc->method = RATE_CONTROL_V4L2;
+            rc->applied = c->value;
+            break;
+        }
+        #endif
+        if(in->jpegcomp.quality != -1) {
+            rc->method = RATE_CONTROL_JPEGCOMP;
+            rc->applied = in->jpegcomp.quality;
+        } else {
+            rc->method = RATE_CONTROL_NONE;
+        }
+    }
+
+    if(rc->method == RATE_CONTROL_NONE) {
+        if(rc->target > 0)
+            IPRINT("the camera does not allow to change the JPEG quality, -target_rate is ignored\n");
+        rc->target = 0;
+        return;
+    }
+    rc->quality = rc->applied;
+
+    if(rc->target > 0) {
+        IPRINT("Target rate.......: %d kB/s, JPEG quality %d .. %d\n",
+               settings->target_rate, rc->min_quality, rc->max_quality);
+    }
+
+    c = realloc(in->in_parameters, (in->parametercount + LENGTH_OF(controls)) * sizeof(control));
+    if(c == NULL) {
+        IPRINT("not enough memory for the rate controls\n");
+        return;
+    }
+    in->in_parameters = c;
+
+    for(i = 0; i < LENGTH_OF(controls); i++) {
+        c = &in->in_parameters[in->parametercount++];
+        memset(c, 0, sizeof(control));
+        c->ctrl.id = controls[i].id;
+        snprintf((char *)c->ctrl.name, sizeof(c->ctrl.name), "%s", controls[i].name);
+        c->ctrl.type = V4L2_CTRL_TYPE_INTEGER;
+        c->ctrl.minimum = controls[i].minimum;
+        c->ctrl.maximum = controls[i].maximum;
+        c->ctrl.step = 1;
+        c->ctrl.flags = controls[i].flags;
+        c->ctrl.default_value = c->value = rate_control_value(rc, controls[i].id);
+        c->group = IN_CMD_GENERIC;
+    }
+}
+
+/******************************************************************************
+Description.: changes a setting of the rate controller
+Input Value.: pcontext of the camera, the caller holds the db mutex
+              id is one of the RATE_CTRL_* ids, value the new value
+Return Value: 0 if ok, -1 if the value is not allowed
+******************************************************************************/
+static int rate_control_set(context *pcontext, unsigned int id, int value)
+{
+    rate_control *rc = &pcontext->rc;
+
+    switch(id) {
+    case RATE_CTRL_TARGET:
+        if(value < 0 || value > TARGET_RATE_MAX)
+            return -1;
+        rc->target = value * 1000;
+        break;
+    case RATE_CTRL_MIN_QUALITY:
+        if(value > rc->max_quality)
+            return -1;
+        rc->min_quality = value;
+        break;
+    case RATE_CTRL_MAX_QUALITY:
+        if(value < rc->min_quality)
+            return -1;
+        rc->max_quality = value;
+        break;
+    default:
+        return -1;
+    }
+
+    if(rc->target > 0)
+        rc->quality = MIN(MAX(rc->quality, rc->min_quality), rc->max_quality);
+    return 0;
+}
+
+/******************************************************************************
+Description.: measures the rate and adjusts the quality to a produced frame,
+              for our own encoder the new quality is used for the next frame
+Input Value.: pcontext of the camera, the caller holds the db mutex
+              size of the JPG, capture is the CLOCK_MONOTONIC time of the frame
+Return Value: -
+******************************************************************************/
+static void rate_control_sample(context *pcontext, int size, const struct timespec *capture)
+{
+    rate_control *rc = &pcontext->rc;
+    double dt, weight, error;
+
+    if(rc->method == RATE_CONTROL_NONE)
+        return;
+
+    if(rc->last_frame.tv_sec == 0 && rc->last_frame.tv_nsec == 0) {
+        rc->last_frame = *capture;
+        return;
+    }
+
+    dt = seconds_between(&rc->last_frame, capture);
+    if(dt <= 0)
+        return;
+    rc->last_frame = *capture;
+
+    /*
+     * frames which nobody read were not compressed, they do not count and the
+     * time between the compressed frames gets longer
+     */
+    weight = MIN(dt / rc->smoothing, 1.0);
+    if(rc->rate == 0)
+        rc->rate = size / dt;
+    else
+        rc->rate += weight * (size / dt - rc->rate);
+
+    if(rc->target <= 0)
+        return;
+
+    error = (rc->target - rc->rate) / MAX(rc->target, rc->rate);
+    if(error > -RATE_DEADBAND && error < RATE_DEADBAND)
+        return;
+
+    rc->quality += RATE_GAIN * weight * error;
+    rc->quality = MIN(MAX(rc->quality, rc->min_quality), rc->max_quality);
+
+    if(rc->method == RATE_CONTROL_SOFTWARE) {
+        pcontext->quality = (int)(rc->quality + 0.5);
+        rc->applied = pcontext->quality;
+    }
+}
+
+/******************************************************************************
+Description.: refreshes the values of the rate controls and decides if the
+              quality of the camera has to change, at most twice a second
+Input Value.: pcontext of the camera, the caller holds the db mutex
+              now is the CLOCK_MONOTONIC time of the last frame
+Return Value: the quality to set with set_camera_quality() or -1
+******************************************************************************/
+static int rate_control_update(context *pcontext, const struct timespec *now)
+{
+    input *in = &pglobal->in[pcontext->id];
+    rate_control *rc = &pcontext->rc;
+    int quality, changed = 0;
+    unsigned int id;
+    control *c;
+
+    if(rc->method == RATE_CONTROL_NONE || seconds_between(&rc->last_update, now) < RATE_UPDATE_INTERVAL)
+        return -1;
+    rc->last_update = *now;
+
+    for(id = RATE_CTRL_QUALITY; id <= RATE_CTRL_RATE; id++) {
+        if((c = find_control(in, IN_CMD_GENERIC, id)) != NULL && c->value != rate_control_value(rc, id)) {
+            c->value = rate_control_value(rc, id);
+            changed = 1;
+        }
+    }
+    if(changed)
+        CONTROLS_CHANGED(in);
+
+    quality = (int)(rc->quality + 0.5);
+    if(rc->method == RATE_CONTROL_SOFTWARE || rc->target <= 0 || quality == rc->applied)
+        return -1;
+    return quality;
+}
+
+/******************************************************************************
+Description.: sets the JPEG quality of the camera for the rate controller
+Input Value.: pcontext of the camera, quality to set
+Return Value: -
+******************************************************************************/
+static void set_camera_quality(context *pcontext, int quality)
+{
+    input *in = &pglobal->in[pcontext->id];
+    rate_control *rc = &pcontext->rc;
+    control *c = NULL;
+    int ret = -1;
+
+    switch(rc->method) {
+    #ifdef V4L2_CID_JPEG_COMPRESSION_QUALITY
+    case RATE_CONTROL_V4L2:
+        if((c = find_control(in, IN_CMD_V4L2, V4L2_CID_JPEG_COMPRESSION_QUALITY)) != NULL) {
+            quality = MIN(MAX(quality, c->ctrl.minimum), c->ctrl.maximum);
+            ret = v4l2SetControl(pcontext->videoIn, V4L2_CID_JPEG_COMPRESSION_QUALITY, quality, pcontext->id, pglobal);
+        }
+        break;
+    #endif
+    case RATE_CONTROL_JPEGCOMP:
+        c = find_control(in, IN_CMD_JPEG_QUALITY, 1);
+        in->jpegcomp.quality = quality;
+        ret = IOCTL_VIDEO(pcontext->videoIn->fd, VIDIOC_S_JPEGCOMP, &in->jpegcomp);
+        break;
+    default:
+        break;
+    }
+
+    if(ret < 0) {
+        IPRINT("could not set the JPEG quality of the camera, stopping the rate control\n");
+        rc->method = RATE_CONTROL_NONE;
+        return;
+    }
+
+    DBG("JPEG quality set to %d, rate %d B/s\n", quality, (int)rc->rate);
+    rc->applied = quality;
+    if(c != NULL) {
+        c->value = quality;
+        CONTROLS_CHANGED(in);
+    }
+}
+
+#ifndef NO_LIBJPEG
+/******************************************************************************
+Description.: compresses the raw frame published last, input_frame() calls it
+              for the first consumer which reads the frame
+Input Value.: in is the input, the caller holds its db mutex
+Return Value: size of the JPG in the buffer of the input
+******************************************************************************/
+static int compress_raw_frame(input *in)
+{
+    context *pcontext = in->context;
+    raw_frame frame = {pcontext->raw, pcontext->raw_capacity, pcontext->raw_width, pcontext->raw_height,
+                       pcontext->raw_format, pcontext->raw_bytesperline, -1};
+    int size;
+
+    DBG("compressing frame from input: %d\n", (int)pcontext->id);
+    size = encoder_encode(&pcontext->encoder, pcontext->videoIn, &frame, in->buf, pcontext->buf_size, pcontext->quality);
+    rate_control_sample(pcontext, size, &in->capture_time);
+    return size;
+}
+
+/******************************************************************************
+Description.: publishes the uncompressed frame, it is compressed only if a
+              consumer reads it before the next one arrives
+Input Value.: pcontext of the camera, the caller holds the db mutex
+Return Value: 0 if ok, -1 if there was no memory for the copy
+******************************************************************************/
+static int publish_raw_frame(context *pcontext)
+{
+    input *in = &pglobal->in[pcontext->id];
+    struct vdIn *vd = pcontext->videoIn;
+
+    if(pcontext->raw_capacity < vd->framesizeIn) {
+        unsigned char *tmp = realloc(pcontext->raw, vd->framesizeIn);
+
+        if(tmp == NULL)
+            return -1;
+        pcontext->raw = tmp;
+        pcontext->raw_capacity = vd->framesizeIn;
+    }
+
+    memcpy(pcontext->raw, vd->framebuffer, vd->framesizeIn);
+    pcontext->raw_width = vd->width;
+    pcontext->raw_height = vd->height;
+    pcontext->raw_format = vd->formatIn;
+    /* uvcGrab() left out the padding of the lines */
+    pcontext->raw_bytesperline = vd->framesizeIn / vd->height;
+    in->compress = compress_raw_frame;
+    in->raw = 1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: compresses the frame the camera still holds in its buffer, for
+              the encoders which are not lazy (a hardware encoder reads the
+              buffer itself)
+Input Value.: pcontext of the camera, the caller holds the db mutex
+Return Value: size of the JPG in the buffer of the input or -1 on error
+******************************************************************************/
+static int encode_held_frame(context *pcontext)
+{
+    input *in = &pglobal->in[pcontext->id];
+    struct vdIn *vd = pcontext->videoIn;
+    raw_frame frame = {vd->mem[vd->held], MIN(vd->tmpbytesused, vd->memlength[vd->held]), vd->width, vd->height,
+                       vd->formatIn, vd->bytesperline, vd->held};
+
+    DBG("encoding frame from input: %d\n", (int)pcontext->id);
+    return encoder_encode(&pcontext->encoder, vd, &frame, in->buf, pcontext->buf_size, pcontext->quality);
+}
+#endif
+
+static void unlock_db(void *arg)
+{
+    pthread_mutex_unlock(&((input *)arg)->db);
+}
+
+/******************************************************************************
+Description.: stops the capture while no output plugin needs frames, so
+              neither the USB bus nor the CPU are busy for nothing. The
+              capture is resumed as soon as a consumer shows up.
+Input Value.: pcontext of the camera
+Return Value: 0 if the camera captures, -1 if it could not be resumed
+******************************************************************************/
+static int wait_for_consumers(context *pcontext)
+{
+    input *in = &pglobal->in[pcontext->id];
+    struct timespec deadline;
+    int idle;
+
+    pthread_mutex_lock(&in->db);
+    idle = (in->consumers <= 0);
+    pthread_mutex_unlock(&in->db);
+    if(!idle)
+        return 0;
+
+    /* nobody waits for a frame, the camera may be described now */
+    describe_camera(pcontext);
+
+    IPRINT("no consumers, stopping the capture\n");
+    if(video_pause(pcontext->videoIn) < 0)
+        return -1;
+
+    pthread_mutex_lock(&in->db);
+    pthread_cleanup_push(unlock_db, in);
+    while(in->consumers <= 0 && !pglobal->stop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&in->demand_update, &in->db, &deadline);
+    }
+    /* the pause does not count for the rate control */
+    pcontext->rc.last_frame.tv_sec = pcontext->rc.last_frame.tv_nsec = 0;
+    pthread_cleanup_pop(1);
+
+    DBG("resuming the capture\n");
+    clock_gettime(CLOCK_MONOTONIC, &pcontext->resumed);
+    pcontext->warming_up = 1;
+    return video_resume(pcontext->videoIn);
+}
+
+/* the modes are restored before the values which depend on them */
+static const __u32 mode_controls[] = {
+    V4L2_CID_EXPOSURE_AUTO,
+    V4L2_CID_AUTO_WHITE_BALANCE,
+    V4L2_CID_AUTOGAIN,
+    V4L2_CID_AUTOBRIGHTNESS,
+    V4L2_CID_HUE_AUTO,
+    V4L2_CID_CHROMA_AGC,
+    V4L2_CID_FOCUS_AUTO
+};
+
+/******************************************************************************
+Description.: stores the value of a control in the snapshot of the camera,
+              the caller holds the controls_mutex or is the only user
+Input Value.: pctx is the camera, id and value of the control
+Return Value: -
+******************************************************************************/
+static void remember_control(context *pctx, __u32 id, __s32 value)
+{
+    control_value *saved;
+    int i;
+
+    for(i = 0; i < pctx->saved_count; i++) {
+        if(pctx->saved[i].id == id) {
+            pctx->saved[i].value = value;
+            return;
+        }
+    }
+
+    saved = realloc(pctx->saved, (pctx->saved_count + 1) * sizeof(control_value));
+    if(saved == NULL) {
+        LOG("could not allocate memory\n");
+        return;
+    }
+    pctx->saved = saved;
+    pctx->saved[pctx->saved_count].id = id;
+    pctx->saved[pctx->saved_count].value = value;
+    pctx->saved_count++;
+}
+
+/******************************************************************************
+Description.: takes the V4L2 controls of the command line into the snapshot,
+              so they are set together with the others when the camera opens
+Input Value.: pctx is the camera, settings parsed from the command line
+Return Value: -
+******************************************************************************/
+static void remember_settings(context *pctx, context_settings *settings)
+{
+    #define REMEMBER_INT(cid, var) \
+      if (settings->var##_set) { \
+          remember_control(pctx, cid, settings->var); \
       }
-    
-    #define V4L_INT_OPT(vid, var, desc) \
+
+    #define REMEMBER_AUTO(cid_auto, cid, var) \
       if (settings->var##_set) { \
-          V4L_OPT_SET(vid, var, desc) \
+          remember_control(pctx, cid_auto, settings->var##_auto); \
+          if (settings->var##_auto == 0) \
+              remember_control(pctx, cid, settings->var); \
       }
-    
-    /* V4L options */
-    V4L_INT_OPT(V4L2_CID_SHARPNESS, sh, "sharpness")
-    V4L_INT_OPT(V4L2_CID_CONTRAST, co, "contrast")
-    V4L_INT_OPT(V4L2_CID_SATURATION, sa, "saturation")
-    V4L_INT_OPT(V4L2_CID_BACKLIGHT_COMPENSATION, bk, "backlight compensation")
-    V4L_INT_OPT(V4L2_CID_ROTATE, rot, "rotation")
-    V4L_INT_OPT(V4L2_CID_HFLIP, hf, "hflip")
-    V4L_INT_OPT(V4L2_CID_VFLIP, vf, "vflip")
-    V4L_INT_OPT(V4L2_CID_VFLIP, pl, "power line filter")
-    
-    if (settings->br_set) {
-        V4L_OPT_SET(V4L2_CID_AUTOBRIGHTNESS, br_auto, "auto brightness mode")
-        
-        if (settings->br_auto == 0) {
-            V4L_OPT_SET(V4L2_CID_BRIGHTNESS, br, "brightness")
+
+    REMEMBER_INT(V4L2_CID_SHARPNESS, sh)
+    REMEMBER_INT(V4L2_CID_CONTRAST, co)
+    REMEMBER_INT(V4L2_CID_SATURATION, sa)
+    REMEMBER_INT(V4L2_CID_BACKLIGHT_COMPENSATION, bk)
+    REMEMBER_INT(V4L2_CID_ROTATE, rot)
+    REMEMBER_INT(V4L2_CID_HFLIP, hf)
+    REMEMBER_INT(V4L2_CID_VFLIP, vf)
+    REMEMBER_INT(V4L2_CID_POWER_LINE_FREQUENCY, pl)
+    REMEMBER_AUTO(V4L2_CID_AUTOBRIGHTNESS, V4L2_CID_BRIGHTNESS, br)
+    REMEMBER_AUTO(V4L2_CID_AUTO_WHITE_BALANCE, V4L2_CID_WHITE_BALANCE_TEMPERATURE, wb)
+    REMEMBER_AUTO(V4L2_CID_AUTOGAIN, V4L2_CID_GAIN, gain)
+    REMEMBER_AUTO(V4L2_CID_CHROMA_AGC, V4L2_CID_CHROMA_GAIN, cagc)
+    REMEMBER_AUTO(V4L2_CID_HUE_AUTO, V4L2_CID_HUE, cb)
+
+    if (settings->ex_set) {
+        remember_control(pctx, V4L2_CID_EXPOSURE_AUTO, settings->ex_auto);
+        if (settings->ex_auto == V4L2_EXPOSURE_MANUAL)
+            remember_control(pctx, V4L2_CID_EXPOSURE_ABSOLUTE, settings->ex);
+    }
+}
+
+/******************************************************************************
+Description.: reads the snapshot of the controls from the controls file, a
+              missing file is an empty snapshot. Each line holds the id and
+              the value of a control, '#' starts a comment.
+Input Value.: pctx is the camera
+Return Value: -
+******************************************************************************/
+static void load_controls(context *pctx)
+{
+    char line[256], *p, *end;
+    unsigned long id;
+    long value;
+    FILE *f;
+
+    if((f = fopen(pctx->controls_file, "r")) == NULL) {
+        if(errno != ENOENT)
+            IPRINT("could not read %s: %s\n", pctx->controls_file, strerror(errno));
+        return;
+    }
+
+    while(fgets(line, sizeof(line), f) != NULL) {
+        if((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+        id = strtoul(line, &p, 0);
+        if(p == line)
+            continue;
+        value = strtol(p, &end, 0);
+        if(end == p) {
+            IPRINT("ignoring control 0x%08lx of %s without value\n", id, pctx->controls_file);
+            continue;
         }
+        remember_control(pctx, id, value);
     }
-    
-    if (settings->wb_set) {
-        V4L_OPT_SET(V4L2_CID_AUTO_WHITE_BALANCE, wb_auto, "auto white balance mode")
-        
-        if (settings->wb_auto == 0) {
-            V4L_OPT_SET(V4L2_CID_WHITE_BALANCE_TEMPERATURE, wb, "white balance temperature")
+    fclose(f);
+    DBG("loaded %d controls from %s\n", pctx->saved_count, pctx->controls_file);
+}
+
+/******************************************************************************
+Description.: writes the snapshot to the controls file. The file is replaced
+              as a whole, a crash while writing leaves the old one intact.
+              The caller holds the controls_mutex.
+Input Value.: pctx is the camera, in the input with the names of the controls
+Return Value: -
+******************************************************************************/
+static void save_controls(context *pctx, input *in)
+{
+    char tmp[PATH_MAX + sizeof(".tmp")];
+    control *c;
+    FILE *f;
+    int i;
+
+    if(pctx->controls_file == NULL)
+        return;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", pctx->controls_file);
+    if((f = fopen(tmp, "w")) == NULL) {
+        LOG("could not write %s.tmp: %s\n", pctx->controls_file, strerror(errno));
+        return;
+    }
+    fprintf(f, "# V4L2 controls of %s, restored when the camera is opened\n", pctx->device);
+    for(i = 0; i < pctx->saved_count; i++) {
+        c = find_control(in, IN_CMD_V4L2, pctx->saved[i].id);
+        fprintf(f, "0x%08x %d\t# %s\n", pctx->saved[i].id, pctx->saved[i].value,
+                c != NULL ? (char *)c->ctrl.name : "");
+    }
+    if(fclose(f) != 0 || rename(tmp, pctx->controls_file) != 0) {
+        LOG("could not write %s: %s\n", pctx->controls_file, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+/******************************************************************************
+Description.: sets the controls of the snapshot with one ioctl after the
+              camera was opened, the modes first. The new values are stored
+              in the controls before they are published.
+Input Value.: pcontext is the camera, in holds its enumerated controls
+Return Value: -
+******************************************************************************/
+static void restore_controls(context *pcontext, input *in)
+{
+    struct v4l2_ext_control *ctrls;
+    struct timespec begin, end;
+    control **targets;
+    control_value *v;
+    char *applied;
+    control *c;
+    int i, j, mode, count = 0, set;
+
+    pthread_mutex_lock(&pcontext->controls_mutex);
+    if(pcontext->saved_count == 0) {
+        pthread_mutex_unlock(&pcontext->controls_mutex);
+        return;
+    }
+    ctrls = calloc(pcontext->saved_count, sizeof(struct v4l2_ext_control));
+    targets = calloc(pcontext->saved_count, sizeof(control *));
+    applied = calloc(pcontext->saved_count, sizeof(char));
+    if(ctrls == NULL || targets == NULL || applied == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(mode = 1; mode >= 0; mode--) {
+        for(i = 0; i < pcontext->saved_count; i++) {
+            v = &pcontext->saved[i];
+            for(j = 0; j < LENGTH_OF(mode_controls) && mode_controls[j] != v->id; j++);
+            if((j < LENGTH_OF(mode_controls)) != mode)
+                continue;
+
+            if((c = find_control(in, IN_CMD_V4L2, v->id)) == NULL) {
+                DBG("the camera has no control 0x%08x\n", v->id);
+                continue;
+            }
+            if((c->ctrl.flags & (V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_WRITE_ONLY)) ||
+               (v->value < c->ctrl.minimum) || (v->value > c->ctrl.maximum)) {
+                LOG("the %s can not be restored to %d\n", c->ctrl.name, v->value);
+                continue;
+            }
+
+            ctrls[count].id = v->id;
+            if(c->ctrl.type == V4L2_CTRL_TYPE_INTEGER64)
+                ctrls[count].value64 = v->value;
+            else
+                ctrls[count].value = v->value;
+            targets[count++] = c;
         }
     }
-    
-    if (settings->ex_set) {
-        V4L_OPT_SET(V4L2_CID_EXPOSURE_AUTO, ex_auto, "exposure mode")
-        if (settings->ex_auto == V4L2_EXPOSURE_MANUAL) {
-            V4L_OPT_SET(V4L2_CID_EXPOSURE_ABSOLUTE, ex, "absolute exposure")
+    pthread_mutex_unlock(&pcontext->controls_mutex);
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    set = v4l2SetControls(pcontext->videoIn, ctrls, count, applied);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for(i = 0; i < count; i++) {
+        if(applied[i]) {
+            targets[i]->value = targets[i]->ctrl.type == V4L2_CTRL_TYPE_INTEGER64 ?
+                                ctrls[i].value64 : ctrls[i].value;
+        } else {
+            LOG("could not restore the %s\n", targets[i]->ctrl.name);
         }
     }
-    
-    if (settings->gain_set) {
-        V4L_OPT_SET(V4L2_CID_AUTOGAIN, gain_auto, "auto gain mode")
-        
-        if (settings->gain_auto == 0) {
-            V4L_OPT_SET(V4L2_CID_GAIN, gain, "gain")
+    IPRINT("restored %d of %d controls in %ld ms\n", set, count,
+           (end.tv_sec - begin.tv_sec) * 1000 + (end.tv_nsec - begin.tv_nsec) / 1000000);
+
+    free(ctrls);
+    free(targets);
+    free(applied);
+}
+
+/******************************************************************************
+Description.: opens the device with the options of input_init(), enumerates
+              the controls and publishes them together with the frame buffer.
+              The formats and the names of the menu items are left for
+              describe_camera(), nobody needs them before the first frame.
+              When the camera comes back after it was lost its controls are
+              known already, only the saved values are set again.
+Input Value.: pcontext of the camera
+Return Value: 0 if ok, -1 if the device could not be opened
+******************************************************************************/
+static int open_camera(context *pcontext)
+{
+    input *in = &pglobal->in[pcontext->id];
+    struct timespec begin, end;
+    input controls;
+    unsigned char *buf, *old;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if(init_videoIn(pcontext->videoIn, pcontext->device, pcontext->width, pcontext->height,
+                    pcontext->fps, pcontext->format, 1, pglobal, pcontext->id, pcontext->tvnorm) < 0)
+        return -1;
+
+    /*
+     * recent linux-uvc driver (revision > ~#125) requires to use dynctrls
+     * for pan/tilt/focus/...
+     * dynctrls must get initialized
+     */
+    if(pcontext->dynctrls)
+        initDynCtrls(pcontext->videoIn->fd);
+
+    if(pcontext->opened) {
+        restore_controls(pcontext, in);
+        CONTROLS_CHANGED(in);
+        /* the pause does not count for the rate control, the camera forgot its quality */
+        pcontext->rc.last_frame.tv_sec = pcontext->rc.last_frame.tv_nsec = 0;
+        if(pcontext->rc.target > 0 && pcontext->rc.method != RATE_CONTROL_SOFTWARE)
+            set_camera_quality(pcontext, pcontext->rc.applied);
+    } else {
+        /* the controls are collected aside and published when they are complete */
+        memset(&controls, 0, sizeof(controls));
+        enumerateControls(pcontext->videoIn, &controls); // enumerate V4L2 controls after UVC extended mapping
+        restore_controls(pcontext, &controls);
+        rate_control_init(pcontext, pcontext->init_settings, &controls);
+
+        in->jpegcomp = controls.jpegcomp;
+        in->in_parameters = controls.in_parameters;
+        __sync_synchronize();
+        in->parametercount = controls.parametercount;
+        CONTROLS_CHANGED(in);
+
+        camera_identity(pcontext->device, &pcontext->sysfs_device, &pcontext->serial, &pcontext->index);
+        DBG("%s is %s, serial %s, node %d\n", pcontext->device, pcontext->sysfs_device,
+            pcontext->serial, pcontext->index);
+        pcontext->opened = 1;
+    }
+
+    /* the frame published last (a placeholder after a reconnect) stays valid */
+    pthread_mutex_lock(&in->db);
+    old = in->buf;
+    if(old == NULL || pcontext->buf_size != pcontext->videoIn->framesizeIn) {
+        buf = malloc(pcontext->videoIn->framesizeIn);
+        if(buf == NULL) {
+            fprintf(stderr, "could not allocate memory\n");
+            exit(EXIT_FAILURE);
         }
+        if(in->size > pcontext->videoIn->framesizeIn)
+            in->size = 0;
+        if(old != NULL)
+            memcpy(buf, old, in->size);
+        in->buf = buf;
+        pcontext->buf_size = pcontext->videoIn->framesizeIn;
+        free(old);
     }
-    
-    if (settings->cagc_set) {
-        V4L_OPT_SET(V4L2_CID_AUTO_WHITE_BALANCE, cagc_auto, "chroma gain mode")
-        
-        if (settings->cagc_auto == 0) {
-            V4L_OPT_SET(V4L2_CID_WHITE_BALANCE_TEMPERATURE, cagc, "chroma gain")
+    pthread_mutex_unlock(&in->db);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    IPRINT("%s opened in %ld ms\n", pcontext->device,
+           (end.tv_sec - begin.tv_sec) * 1000 + (end.tv_nsec - begin.tv_nsec) / 1000000);
+    return 0;
+}
+
+/******************************************************************************
+Description.: enumerates the formats, frame sizes and menu items of the camera
+              once, for the clients which show the settings. The many
+              queries are done after the first frame or before the capture
+              pauses, so they do not delay the stream.
+Input Value.: pcontext of the camera
+Return Value: -
+******************************************************************************/
+static void describe_camera(context *pcontext)
+{
+    input *in = &pglobal->in[pcontext->id];
+    input formats;
+
+    if(pcontext->described)
+        return;
+    pcontext->described = 1;
+
+    memset(&formats, 0, sizeof(formats));
+    enumerateFormats(pcontext->videoIn, &formats);
+    in->in_formats = formats.in_formats;
+    in->currentFormat = formats.currentFormat;
+    __sync_synchronize();
+    in->formatCount = formats.formatCount;
+
+    enumerateMenus(pcontext->videoIn, in);
+    CONTROLS_CHANGED(in);
+    DBG("described camera #%02d: %d formats\n", pcontext->id, in->formatCount);
+}
+
+/******************************************************************************
+Description.: reads the first line of a file in sysfs
+Input Value.: path of the file, buffer and its size
+Return Value: 0 if ok, -1 if the file could not be read
+******************************************************************************/
+static int read_sysfs(const char *path, char *buffer, size_t size)
+{
+    FILE *f;
+    char *p;
+
+    if((f = fopen(path, "r")) == NULL)
+        return -1;
+    p = fgets(buffer, size, f);
+    fclose(f);
+    if(p == NULL)
+        return -1;
+    buffer[strcspn(buffer, "\n")] = '\0';
+    return 0;
+}
+
+/******************************************************************************
+Description.: looks up the device behind a video node in sysfs. The path of
+              the device contains the port it is plugged into, USB cameras
+              usually have a serial number as well.
+Input Value.: dev is the video node, sysfs_device, serial and index receive
+              the identity, the strings are allocated and NULL if unknown
+Return Value: -
+******************************************************************************/
+static void camera_identity(const char *dev, char **sysfs_device, char **serial, int *index)
+{
+    char path[PATH_MAX], value[128];
+    struct stat st;
+
+    *sysfs_device = *serial = NULL;
+    *index = -1;
+    if(stat(dev, &st) < 0 || !S_ISCHR(st.st_mode))
+        return;
+
+    snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device", major(st.st_rdev), minor(st.st_rdev));
+    if((*sysfs_device = realpath(path, NULL)) == NULL)
+        return;
+
+    snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/index", major(st.st_rdev), minor(st.st_rdev));
+    if(read_sysfs(path, value, sizeof(value)) == 0)
+        *index = atoi(value);
+
+    /* the device is an interface of the USB device, which has the serial */
+    snprintf(path, sizeof(path), "%s/../serial", *sysfs_device);
+    if(read_sysfs(path, value, sizeof(value)) == 0 && value[0] != '\0')
+        *serial = strdup(value);
+}
+
+/******************************************************************************
+Description.: finds the video node of the camera after it was plugged in
+              again, it may have got another node. A camera with a serial
+              number may be plugged into any port, otherwise it must be the
+              same port. Devices unknown to sysfs keep their node.
+Input Value.: pcontext of the camera
+Return Value: the allocated path of the node or NULL if it is not there
+******************************************************************************/
+static char *find_camera(context *pcontext)
+{
+    char *sysfs_device, *serial, *found = NULL;
+    int index, match;
+    glob_t nodes;
+    size_t i;
+
+    if(pcontext->sysfs_device == NULL)
+        return access(pcontext->device, F_OK) == 0 ? strdup(pcontext->device) : NULL;
+
+    if(glob("/dev/video*", 0, NULL, &nodes) != 0)
+        return NULL;
+
+    for(i = 0; i < nodes.gl_pathc && found == NULL; i++) {
+        camera_identity(nodes.gl_pathv[i], &sysfs_device, &serial, &index);
+        if(pcontext->serial != NULL)
+            match = (serial != NULL && strcmp(serial, pcontext->serial) == 0);
+        else
+            match = (sysfs_device != NULL && strcmp(sysfs_device, pcontext->sysfs_device) == 0);
+        if(match && index == pcontext->index)
+            found = strdup(nodes.gl_pathv[i]);
+        free(sysfs_device);
+        free(serial);
+    }
+    globfree(&nodes);
+    return found;
+}
+
+/******************************************************************************
+Description.: publishes a placeholder while the camera is gone, so the
+              clients keep their connection. It is a gray picture in the
+              size of the camera, without libjpeg the last frame is repeated.
+Input Value.: pcontext of the camera
+Return Value: -
+******************************************************************************/
+static void publish_placeholder(context *pcontext)
+{
+    input *in = &pglobal->in[pcontext->id];
+
+    pthread_mutex_lock(&in->db);
+    if(in->buf == NULL) {
+        /* the camera was not opened yet, the clients wait for the first frame */
+        pthread_mutex_unlock(&in->db);
+        return;
+    }
+    #ifndef NO_LIBJPEG
+    struct vdIn *vd = pcontext->videoIn;
+    int i, size = vd->width * vd->height * 2;
+    unsigned char *gray = malloc(size);
+
+    if(gray != NULL) {
+        for(i = 0; i < size; i += 2) {
+            gray[i] = 0x40;     // Y
+            gray[i + 1] = 0x80; // U, V
         }
+        in->size = compress_frame_to_jpeg(gray, vd->width, vd->height, V4L2_PIX_FMT_YUYV,
+                                          in->buf, pcontext->buf_size, 50);
+        free(gray);
     }
-    
-    if (settings->cb_set) {
-        V4L_OPT_SET(V4L2_CID_HUE_AUTO, cb_auto, "color balance mode")
-        
-        if (settings->cb_auto == 0) {
-            V4L_OPT_SET(V4L2_CID_HUE, cagc, "color balance")
+    #endif
+    in->raw = 0;
+    stamp_frame(in, NULL);
+    pthread_cond_broadcast(&in->db_update);
+    pthread_mutex_unlock(&in->db);
+}
+
+/******************************************************************************
+Description.: closes the lost camera and opens it again as soon as it is
+              back, waiting longer after each attempt. The clients get a
+              placeholder each time meanwhile. A camera which could not be
+              opened at the start is waited for the same way.
+Input Value.: pcontext of the camera
+Return Value: 0 if the camera captures again, -1 if the plugin stops
+******************************************************************************/
+static int reconnect_camera(context *pcontext)
+{
+    input *in = &pglobal->in[pcontext->id];
+    struct timespec lost, back;
+    int delay = RECONNECT_MIN_MS, attempts = 0;
+    char *device;
+
+    clock_gettime(CLOCK_MONOTONIC, &lost);
+    IPRINT("lost %s, waiting for it to come back\n", pcontext->device);
+
+    /* the raw frame can not be compressed without the device any more */
+    pthread_mutex_lock(&in->db);
+    in->raw = 0;
+    pthread_mutex_unlock(&in->db);
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    close_v4l2(pcontext->videoIn);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+    while(!pglobal->stop) {
+        publish_placeholder(pcontext);
+        usleep(delay * 1000);
+        delay = MIN(delay * 2, RECONNECT_MAX_MS);
+        attempts++;
+
+        if((device = find_camera(pcontext)) == NULL)
+            continue;
+
+        /* input_stop() waits until the device is opened completely */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if(strcmp(device, pcontext->device) != 0) {
+            IPRINT("%s is %s now\n", pcontext->device, device);
+            pthread_mutex_lock(&pcontext->controls_mutex);
+            free(pcontext->device);
+            pcontext->device = device;
+            pthread_mutex_unlock(&pcontext->controls_mutex);
+        } else {
+            free(device);
         }
+
+        if(open_camera(pcontext) == 0 && video_enable(pcontext->videoIn) == 0) {
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            clock_gettime(CLOCK_MONOTONIC, &back);
+            IPRINT("%s is back after %ld ms and %d attempts\n", pcontext->device,
+                   (back.tv_sec - lost.tv_sec) * 1000 + (back.tv_nsec - lost.tv_nsec) / 1000000,
+                   attempts);
+            return 0;
+        }
+        close_v4l2(pcontext->videoIn);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    }
+    return -1;
+}
+
+/******************************************************************************
+Description.: this thread worker grabs a frame and copies it to the global buffer
+Input Value.: unused
+Return Value: unused, always NULL
+******************************************************************************/
+void *cam_thread(void *arg)
+{
+    input * in = (input*)arg;
+    context *pcontext = (context*)in->context;
+    context_settings *settings = pcontext->init_settings;
+    
+    unsigned int every_count = 0;
+    struct timespec capture;
+    int quality;
+    
+    /* set cleanup handler to cleanup allocated resources */
+    pthread_cleanup_push(cam_cleanup, in);
+
+    pglobal->thread_start(Dest_Input, pcontext->id, "capture");
+
+    /* input_stop() waits until the device is opened completely */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if(open_camera(pcontext) < 0) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        /* only this input waits for its camera, the others keep running */
+        IPRINT("init_VideoIn failed\n");
+        if(reconnect_camera(pcontext) < 0)
+            goto endloop;
     }
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     
+    pcontext->quality = settings->quality;
     free(settings);
     settings = NULL;
     pcontext->init_settings = NULL;
 
-    if (softfps > 0) {
+    if (pcontext->softfps > 0) {
         pcontext->videoIn->soft_framedrop = 1;
-        pcontext->videoIn->frame_period_time = 1000/softfps;
+        pcontext->videoIn->frame_period_time = 1000/pcontext->softfps;
     }
 
-    if (video_enable(pcontext->videoIn)) {
+    if (pcontext->videoIn->streamingState != STREAMING_ON && video_enable(pcontext->videoIn)) {
         IPRINT("Can\'t enable video in first time\n");
-        goto endloop;
+        if (reconnect_camera(pcontext) < 0)
+            goto endloop;
     }
 
     while(!pglobal->stop) {
@@ -678,6 +1652,11 @@ void *cam_thread(void *arg)
             usleep(1); // maybe not the best way so FIXME
         }
 
+        if(pcontext->ondemand && wait_for_consumers(pcontext) < 0) {
+            IPRINT("Can\'t resume the capture\n");
+            goto lost;
+        }
+
         fd_set rd_fds; // for capture
         fd_set ex_fds; // for capture
         fd_set wr_fds; // for output
@@ -692,7 +1671,7 @@ void *cam_thread(void *arg)
         FD_SET(pcontext->videoIn->fd, &wr_fds);
 
         struct timeval tv;
-        tv.tv_sec = timeout;
+        tv.tv_sec = pcontext->timeout;
         tv.tv_usec = 0;
 
         int sel = select(pcontext->videoIn->fd + 1, &rd_fds, &wr_fds, &ex_fds, &tv);
@@ -703,29 +1682,30 @@ void *cam_thread(void *arg)
                 continue;
             }
             perror("select() error");
-            goto endloop;
+            goto lost;
         } else if (sel == 0) {
             IPRINT("select() timeout\n");
-            if (dv_timings) {
+            if (pcontext->videoIn->dv_timings) {
                 if (setResolution(pcontext->videoIn, pcontext->videoIn->width, pcontext->videoIn->height) < 0) {
-                    goto endloop;
+                    goto lost;
                 }
                 continue;
             } else {
-                goto endloop;
+                goto lost;
             }
         }
 
         if (FD_ISSET(pcontext->videoIn->fd, &rd_fds)) {
             DBG("Grabbing a frame...\n");
-            /* grab a frame */
+            /* grab a frame, an encoder which is not lazy reads it from the buffer of the camera */
+            pcontext->videoIn->keep_buffer = !pcontext->encoder.backend->lazy;
             if(uvcGrab(pcontext->videoIn) < 0) {
                 IPRINT("Error grabbing frames\n");
-                goto endloop;
+                goto lost;
             }
 
-            if ( every_count < every - 1 ) {
-                DBG("dropping %d frame for every=%d\n", every_count + 1, every);
+            if ( every_count < pcontext->every - 1 ) {
+                DBG("dropping %d frame for every=%d\n", every_count + 1, pcontext->every);
                 ++every_count;
                 goto other_select_handlers;
             } else {
@@ -741,25 +1721,32 @@ void *cam_thread(void *arg)
              * For example a VGA (640x480) webcam picture is normally >= 8kByte large,
              * corrupted frames are smaller.
              */
-            if(pcontext->videoIn->tmpbytesused < minimum_size) {
+            if(pcontext->videoIn->tmpbytesused < pcontext->minimum_size) {
                 DBG("dropping too small frame, assuming it as broken\n");
                 goto other_select_handlers;
             }
 
-            // Overwrite timestamp (e.g. where camera is providing 0 values)
-            // Do it here so that this timestamp can be used in frameskipping
-            if(wantTimestamp)
-            {
-                gettimeofday(&timestamp, NULL);
-                pcontext->videoIn->tmptimestamp = timestamp;
+            /*
+             * Most drivers stamp the buffers with CLOCK_MONOTONIC when the frame
+             * was captured, use that unless the camera is known to provide bogus
+             * values (e.g. 0), then the time of the dequeue is the best we have.
+             */
+            clock_gettime(CLOCK_MONOTONIC, &capture);
+            #ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+            if(!pcontext->wantTimestamp &&
+               (pcontext->videoIn->tmpflags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+               (pcontext->videoIn->tmptimestamp.tv_sec != 0 || pcontext->videoIn->tmptimestamp.tv_usec != 0)) {
+                capture.tv_sec = pcontext->videoIn->tmptimestamp.tv_sec;
+                capture.tv_nsec = pcontext->videoIn->tmptimestamp.tv_usec * 1000;
             }
+            #endif
 
             // use software frame dropping on low fps
             if (pcontext->videoIn->soft_framedrop == 1) {
-                unsigned long last = pglobal->in[pcontext->id].timestamp.tv_sec * 1000 +
-                                    (pglobal->in[pcontext->id].timestamp.tv_usec/1000); // convert to ms
-                unsigned long current = pcontext->videoIn->tmptimestamp.tv_sec * 1000 +
-                                        pcontext->videoIn->tmptimestamp.tv_usec/1000; // convert to ms
+                unsigned long last = pglobal->in[pcontext->id].capture_time.tv_sec * 1000 +
+                                    (pglobal->in[pcontext->id].capture_time.tv_nsec/1000000); // convert to ms
+                unsigned long current = capture.tv_sec * 1000 +
+                                        capture.tv_nsec/1000000; // convert to ms
 
                 // if the requested time did not esplashed skip the frame
                 if ((current - last) < pcontext->videoIn->frame_period_time) {
@@ -783,16 +1770,28 @@ void *cam_thread(void *arg)
             (pcontext->videoIn->formatIn == V4L2_PIX_FMT_UYVY) ||
             (pcontext->videoIn->formatIn == V4L2_PIX_FMT_RGB24) ||
             (pcontext->videoIn->formatIn == V4L2_PIX_FMT_RGB565) ) {
-                DBG("compressing frame from input: %d\n", (int)pcontext->id);
-                pglobal->in[pcontext->id].size = compress_image_to_jpeg(pcontext->videoIn, pglobal->in[pcontext->id].buf, pcontext->videoIn->framesizeIn, quality);
-                /* copy this frame's timestamp to user space */
-                pglobal->in[pcontext->id].timestamp = pcontext->videoIn->tmptimestamp;
+                if(pcontext->videoIn->held >= 0) {
+                    int size = encode_held_frame(pcontext);
+
+                    if(size < 0) {
+                        pthread_mutex_unlock(&pglobal->in[pcontext->id].db);
+                        goto other_select_handlers;
+                    }
+                    pglobal->in[pcontext->id].size = size;
+                    pglobal->in[pcontext->id].raw = 0;
+                    rate_control_sample(pcontext, size, &capture);
+                } else if(publish_raw_frame(pcontext) < 0) {
+                    DBG("compressing frame from input: %d\n", (int)pcontext->id);
+                    pglobal->in[pcontext->id].size = compress_image_to_jpeg(pcontext->videoIn, pglobal->in[pcontext->id].buf, pcontext->videoIn->framesizeIn, pcontext->quality);
+                    pglobal->in[pcontext->id].raw = 0;
+                    rate_control_sample(pcontext, pglobal->in[pcontext->id].size, &capture);
+                }
             } else {
             #endif
                 DBG("copying frame from input: %d\n", (int)pcontext->id);
                 pglobal->in[pcontext->id].size = memcpy_picture(pglobal->in[pcontext->id].buf, pcontext->videoIn->tmpbuffer, pcontext->videoIn->tmpbytesused);
-                /* copy this frame's timestamp to user space */
-                pglobal->in[pcontext->id].timestamp = pcontext->videoIn->tmptimestamp;
+                pglobal->in[pcontext->id].raw = 0;
+                rate_control_sample(pcontext, pglobal->in[pcontext->id].size, &capture);
             #ifndef NO_LIBJPEG
             }
             #endif
@@ -805,14 +1804,34 @@ void *cam_thread(void *arg)
             prev_size = global->size;
 #endif
 
+            stamp_frame(&pglobal->in[pcontext->id], &capture);
+
+            if(pcontext->warming_up) {
+                pcontext->warming_up = 0;
+                IPRINT("first frame %ld ms after resuming the capture\n",
+                       (capture.tv_sec - pcontext->resumed.tv_sec) * 1000 +
+                       (capture.tv_nsec - pcontext->resumed.tv_nsec) / 1000000);
+            }
+
+            quality = rate_control_update(pcontext, &capture);
+
             /* signal fresh_frame */
             pthread_cond_broadcast(&pglobal->in[pcontext->id].db_update);
             pthread_mutex_unlock(&pglobal->in[pcontext->id].db);
+
+            if(quality >= 0)
+                set_camera_quality(pcontext, quality);
+
+            describe_camera(pcontext);
         }
 
 other_select_handlers:
 
-        if (dv_timings) {
+        if (uvcRelease(pcontext->videoIn) < 0) {
+            goto lost;
+        }
+
+        if (pcontext->videoIn->dv_timings) {
             if (FD_ISSET(pcontext->videoIn->fd, &wr_fds)) {
                 IPRINT("Writing?!\n");
             }
@@ -820,10 +1839,17 @@ other_select_handlers:
             if (FD_ISSET(pcontext->videoIn->fd, &ex_fds)) {
                 IPRINT("FD exception\n");
                 if (video_handle_event(pcontext->videoIn) < 0) {
-                    goto endloop;
+                    goto lost;
                 }
             }
         }
+        continue;
+
+lost:
+        /* the camera was unplugged or hangs, the clients keep waiting meanwhile */
+        if (reconnect_camera(pcontext) < 0)
+            break;
+        every_count = 0;
     }
 
 endloop:
@@ -846,12 +1872,37 @@ void cam_cleanup(void *arg)
     
     IPRINT("cleaning up resources allocated by input thread\n");
 
+    /* the raw frame can not be compressed without the device any more */
+    in->raw = 0;
+    free(pctx->raw);
+    pctx->raw = NULL;
+    pctx->raw_capacity = 0;
+    encoder_close(&pctx->encoder);
+    /* encoder_select() copied the device of "-encoder m2m:<device>" */
+    free(pctx->encoder.device);
+    pctx->encoder.device = NULL;
+
     if (pctx->videoIn != NULL) {
         close_v4l2(pctx->videoIn);
         free(pctx->videoIn->tmpbuffer);
         free(pctx->videoIn);
         pctx->videoIn = NULL;
     }
+
+    pthread_mutex_lock(&pctx->controls_mutex);
+    free(pctx->saved);
+    pctx->saved = NULL;
+    pctx->saved_count = 0;
+    free(pctx->controls_file);
+    pctx->controls_file = NULL;
+    /* reconnect_camera() may have replaced the path of the node */
+    free(pctx->device);
+    pctx->device = NULL;
+    free(pctx->sysfs_device);
+    pctx->sysfs_device = NULL;
+    free(pctx->serial);
+    pctx->serial = NULL;
+    pthread_mutex_unlock(&pctx->controls_mutex);
     
     free(in->buf);
     in->buf = NULL;
@@ -872,26 +1923,46 @@ int input_cmd(int plugin_number, unsigned int control_id, unsigned int group, in
     context *pctx = (context*)in->context;
     
     int ret = -1;
-    int i = 0;
+
+    /* a stopped input has no camera */
+    if(pctx == NULL || pctx->videoIn == NULL)
+        return -1;
+
     DBG("Requested cmd (id: %d) for the %d plugin. Group: %d value: %d\n", control_id, plugin_number, group, value);
     switch(group) {
     case IN_CMD_GENERIC: {
-            int i;
-            for (i = 0; i<in->parametercount; i++) {
-                if ((in->in_parameters[i].ctrl.id == control_id) &&
-                    (in->in_parameters[i].group == IN_CMD_GENERIC)){
-                    DBG("Generic control found (id: %d): %s\n", control_id, in->in_parameters[i].ctrl.name);
-                    DBG("New %s value: %d\n", in->in_parameters[i].ctrl.name, value);
-                    return 0;
-                }
+            control *c = find_control(in, IN_CMD_GENERIC, control_id);
+            if (c == NULL) {
+                DBG("Requested generic control (%d) did not found\n", control_id);
+                return -1;
             }
-            DBG("Requested generic control (%d) did not found\n", control_id);
-            return -1;
+            DBG("Generic control found (id: %d): %s\n", control_id, c->ctrl.name);
+            if ((c->ctrl.flags & V4L2_CTRL_FLAG_READ_ONLY) ||
+                (value < c->ctrl.minimum) || (value > c->ctrl.maximum)) {
+                DBG("The %s can not be set to %d\n", c->ctrl.name, value);
+                return -1;
+            }
+            pthread_mutex_lock(&in->db);
+            ret = rate_control_set(pctx, control_id, value);
+            pthread_mutex_unlock(&in->db);
+            if (ret == 0) {
+                DBG("New %s value: %d\n", c->ctrl.name, value);
+                c->value = value;
+            }
+            return ret;
         } break;
     case IN_CMD_V4L2: {
+            control *c = find_control(in, IN_CMD_V4L2, control_id);
             ret = v4l2SetControl(pctx->videoIn, control_id, value, plugin_number, pglobal);
             if(ret == 0) {
-                in->in_parameters[i].value = value;
+                /* the buttons and the relative controls trigger actions, they have no state to restore */
+                if(c != NULL && c->ctrl.type != V4L2_CTRL_TYPE_BUTTON &&
+                   !(c->ctrl.flags & V4L2_CTRL_FLAG_WRITE_ONLY)) {
+                    pthread_mutex_lock(&pctx->controls_mutex);
+                    remember_control(pctx, control_id, value);
+                    save_controls(pctx, in);
+                    pthread_mutex_unlock(&pctx->controls_mutex);
+                }
             } else {
                 DBG("v4l2SetControl failed: %d\n", ret);
             }
@@ -899,6 +1970,10 @@ int input_cmd(int plugin_number, unsigned int control_id, unsigned int group, in
         } break;
     case IN_CMD_RESOLUTION: {
         // the value points to the current formats nth resolution
+        if(in->in_formats == NULL || in->formatCount == 0) {
+            DBG("The formats are not enumerated yet");
+            return -1;
+        }
         if(value > (in->in_formats[in->currentFormat].resolutionCount - 1)) {
             DBG("The value is out of range");
             return -1;
@@ -916,6 +1991,7 @@ int input_cmd(int plugin_number, unsigned int control_id, unsigned int group, in
             in->jpegcomp.quality = value;
             if(IOCTL_VIDEO(pctx->videoIn->fd, VIDIOC_S_JPEGCOMP, &in->jpegcomp) != EINVAL) {
                 DBG("JPEG quality is set to %d\n", value);
+                pctx->rc.quality = pctx->rc.applied = value;
                 ret = 0;
             } else {
                 DBG("Setting the JPEG quality is not supported\n");
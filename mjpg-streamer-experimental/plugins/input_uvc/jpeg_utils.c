@@ -134,29 +134,31 @@ Description.: yuv2jpeg function is based on compress_yuyv_to_jpeg written by
               YUYV data to JPEG. Most other implementations use the
               "jpeg_stdio_dest" from libjpeg, which can not store compressed
               pictures to memory instead of a file.
-Input Value.: video structure from v4l2uvc.c/h, destination buffer and buffersize
+Input Value.: the uncompressed frame, its size and pixel format, destination
+              buffer and buffersize
               the buffer must be large enough, no error/size checking is done!
 Return Value: the buffer will contain the compressed data
 ******************************************************************************/
-int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int quality)
+int compress_frame_to_jpeg(const unsigned char *frame, int width, int height, unsigned int format, unsigned char *buffer, int size, int quality)
 {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
     JSAMPROW row_pointer[1];
-    unsigned char *line_buffer, *yuyv;
+    unsigned char *line_buffer;
+    const unsigned char *yuyv;
     int z;
-    static int written;
+    int written;
 
-    line_buffer = calloc(vd->width * 3, 1);
-    yuyv = vd->framebuffer;
+    line_buffer = calloc(width * 3, 1);
+    yuyv = frame;
 
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_compress(&cinfo);
     /* jpeg_stdio_dest (&cinfo, file); */
     dest_buffer(&cinfo, buffer, size, &written);
 
-    cinfo.image_width = vd->width;
-    cinfo.image_height = vd->height;
+    cinfo.image_width = width;
+    cinfo.image_height = height;
     cinfo.input_components = 3;
     cinfo.in_color_space = JCS_RGB;
 
@@ -166,13 +168,13 @@ int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int
     jpeg_start_compress(&cinfo, TRUE);
 
     z = 0;
-    if (vd->formatIn == V4L2_PIX_FMT_YUYV) {
-        while(cinfo.next_scanline < vd->height) {
+    if (format == V4L2_PIX_FMT_YUYV) {
+        while(cinfo.next_scanline < height) {
             int x;
             unsigned char *ptr = line_buffer;
 
 
-            for(x = 0; x < vd->width; x++) {
+            for(x = 0; x < width; x++) {
                 int r, g, b;
                 int y, u, v;
 
@@ -200,12 +202,12 @@ int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int
             row_pointer[0] = line_buffer;
             jpeg_write_scanlines(&cinfo, row_pointer, 1);
         }
-    } else if (vd->formatIn == V4L2_PIX_FMT_RGB24) {
-        while(cinfo.next_scanline < vd->height) {
+    } else if (format == V4L2_PIX_FMT_RGB24) {
+        while(cinfo.next_scanline < height) {
             int x;
             unsigned char *ptr = line_buffer;
 
-            for(x = 0; x < vd->width; x++) {
+            for(x = 0; x < width; x++) {
                 *(ptr++) = yuyv[0];
                 *(ptr++) = yuyv[1];
                 *(ptr++) = yuyv[2];
@@ -215,12 +217,12 @@ int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int
             row_pointer[0] = line_buffer;
             jpeg_write_scanlines(&cinfo, row_pointer, 1);
         }
-    } else if (vd->formatIn == V4L2_PIX_FMT_RGB565) {
-        while(cinfo.next_scanline < vd->height) {
+    } else if (format == V4L2_PIX_FMT_RGB565) {
+        while(cinfo.next_scanline < height) {
             int x;
             unsigned char *ptr = line_buffer;
 
-            for(x = 0; x < vd->width; x++) {
+            for(x = 0; x < width; x++) {
                 /*
                 unsigned int tb = ((unsigned char)raw[i+1] << 8) + (unsigned char)raw[i];
                 r =  ((unsigned char)(raw[i+1]) & 248);
@@ -237,13 +239,13 @@ int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int
             row_pointer[0] = line_buffer;
             jpeg_write_scanlines(&cinfo, row_pointer, 1);
         }
-    }  else if (vd->formatIn == V4L2_PIX_FMT_UYVY) {
-        while(cinfo.next_scanline < vd->height) {
+    }  else if (format == V4L2_PIX_FMT_UYVY) {
+        while(cinfo.next_scanline < height) {
             int x;
             unsigned char *ptr = line_buffer;
 
 
-            for(x = 0; x < vd->width; x++) {
+            for(x = 0; x < width; x++) {
                 int r, g, b;
                 int y, u, v;
 
@@ -279,3 +281,33 @@ int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int
 
     return (written);
 }
+
+/******************************************************************************
+Description.: compresses the frame the camera delivered last
+Input Value.: video structure from v4l2uvc.c/h, destination buffer and buffersize
+Return Value: the buffer will contain the compressed data
+******************************************************************************/
+int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int quality)
+{
+    return compress_frame_to_jpeg(vd->framebuffer, vd->width, vd->height, vd->formatIn, buffer, size, quality);
+}
+
+/*
+ * the frames are compressed by libjpeg, only the ones a consumer reads,
+ * their lines must not be padded
+ */
+static int software_encode(encoder *enc, const raw_frame *frame, unsigned char *buffer, int size, int quality)
+{
+    int bpp = (frame->format == V4L2_PIX_FMT_RGB24) ? 3 : 2;
+
+    (void)enc;
+    if(frame->bytesperline != 0 && frame->bytesperline != (unsigned int)(frame->width * bpp)) {
+        DBG("the lines of the frame are padded to %u bytes\n", frame->bytesperline);
+        return -1;
+    }
+    return compress_frame_to_jpeg(frame->data, frame->width, frame->height, frame->format, buffer, size, quality);
+}
+
+const encoder_backend software_encoder = {
+    "software", 1, NULL, software_encode, NULL
+};
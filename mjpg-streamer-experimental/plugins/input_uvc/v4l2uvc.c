@@ -90,6 +90,56 @@ static int init_v4l2(struct vdIn *vd);
 static int init_framebuffer(struct vdIn *vd);
 static void free_framebuffer(struct vdIn *vd);
 
+/******************************************************************************
+Description.: prepares vd->buf for an ioctl on a buffer, devices with the
+              multi-planar API get the plane array along
+Input Value.: vd is the device, index of the buffer
+Return Value: -
+******************************************************************************/
+static void init_buffer(struct vdIn *vd, int index)
+{
+    memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
+    vd->buf.index = index;
+    vd->buf.type = vd->buftype;
+    vd->buf.memory = V4L2_MEMORY_MMAP;
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(vd->planes, 0, sizeof(vd->planes));
+        vd->buf.m.planes = vd->planes;
+        vd->buf.length = 1;
+    }
+}
+
+/* the bytes of the frame in the buffer of the last ioctl */
+static unsigned int buffer_bytesused(struct vdIn *vd)
+{
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+        return vd->planes[0].bytesused;
+    return vd->buf.bytesused;
+}
+
+/******************************************************************************
+Description.: unmaps the buffers and closes their DMABUF descriptors
+Input Value.: vd is the device
+Return Value: -
+******************************************************************************/
+static void free_buffers(struct vdIn *vd)
+{
+    int i;
+
+    for(i = 0; i < NB_BUFFER; i++) {
+        if(vd->mem[i] == NULL)
+            continue;
+        /* only mapped buffers are exported */
+        if(vd->mem[i] != MAP_FAILED)
+            munmap(vd->mem[i], vd->memlength[i]);
+        if(vd->dmabuf[i] >= 0)
+            close(vd->dmabuf[i]);
+        vd->mem[i] = NULL;
+        vd->dmabuf[i] = -1;
+    }
+    vd->held = -1;
+}
+
 int init_videoIn(struct vdIn *vd, char *device, int width,
                  int height, int fps, int format, int grabmethod, globals *pglobal, int id, v4l2_std_id vstd)
 {
@@ -134,84 +184,6 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
         DBG("VIDIOC_ENUMINPUT failed\n");
     }
 
-    // enumerating formats
-
-    struct v4l2_format currentFormat;
-    memset(&currentFormat, 0, sizeof(struct v4l2_format));
-    currentFormat.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (xioctl(vd->fd, VIDIOC_G_FMT, &currentFormat) == 0) {
-        DBG("Current size: %dx%d\n",
-             currentFormat.fmt.pix.width,
-             currentFormat.fmt.pix.height);
-    }
-
-    pglobal->in[id].in_formats = NULL;
-    for(pglobal->in[id].formatCount = 0; 1; pglobal->in[id].formatCount++) {
-        struct v4l2_fmtdesc fmtdesc;
-        memset(&fmtdesc, 0, sizeof(struct v4l2_fmtdesc));
-        fmtdesc.index = pglobal->in[id].formatCount;
-        fmtdesc.type  = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        if(xioctl(vd->fd, VIDIOC_ENUM_FMT, &fmtdesc) < 0) {
-            break;
-        }
-
-        if (pglobal->in[id].in_formats == NULL) {
-            pglobal->in[id].in_formats = (input_format*)calloc(1, sizeof(input_format));
-        } else {
-            pglobal->in[id].in_formats = (input_format*)realloc(pglobal->in[id].in_formats, (pglobal->in[id].formatCount + 1) * sizeof(input_format));
-        }
-
-        if (pglobal->in[id].in_formats == NULL) {
-            LOG("Calloc/realloc failed: %s\n", strerror(errno));
-            return -1;
-        }
-
-        memcpy(&pglobal->in[id].in_formats[pglobal->in[id].formatCount], &fmtdesc, sizeof(struct v4l2_fmtdesc));
-
-        if(fmtdesc.pixelformat == format)
-            pglobal->in[id].currentFormat = pglobal->in[id].formatCount;
-
-        DBG("Supported format: %s\n", fmtdesc.description);
-        struct v4l2_frmsizeenum fsenum;
-        memset(&fsenum, 0, sizeof(struct v4l2_frmsizeenum));
-        fsenum.pixel_format = fmtdesc.pixelformat;
-        int j = 0;
-        pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions = NULL;
-        pglobal->in[id].in_formats[pglobal->in[id].formatCount].resolutionCount = 0;
-        pglobal->in[id].in_formats[pglobal->in[id].formatCount].currentResolution = -1;
-        while(1) {
-            fsenum.index = j;
-            j++;
-            if(xioctl(vd->fd, VIDIOC_ENUM_FRAMESIZES, &fsenum) == 0) {
-                pglobal->in[id].in_formats[pglobal->in[id].formatCount].resolutionCount++;
-
-                if (pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions == NULL) {
-                    pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions = (input_resolution*)
-                            calloc(1, sizeof(input_resolution));
-                } else {
-                    pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions = (input_resolution*)
-                            realloc(pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions, j * sizeof(input_resolution));
-                }
-
-                if (pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions == NULL) {
-                    LOG("Calloc/realloc failed\n");
-                    return -1;
-                }
-
-                pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions[j-1].width = fsenum.discrete.width;
-                pglobal->in[id].in_formats[pglobal->in[id].formatCount].supportedResolutions[j-1].height = fsenum.discrete.height;
-                if(format == fmtdesc.pixelformat) {
-                    pglobal->in[id].in_formats[pglobal->in[id].formatCount].currentResolution = (j - 1);
-                    DBG("\tSupported size with the current format: %dx%d\n", fsenum.discrete.width, fsenum.discrete.height);
-                } else {
-                    DBG("\tSupported size: %dx%d\n", fsenum.discrete.width, fsenum.discrete.height);
-                }
-            } else {
-                break;
-            }
-        }
-    }
-
     if (init_framebuffer(vd) < 0) {
         goto error;
     }
@@ -219,11 +191,15 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
     return 0;
 error:
     free_framebuffer(vd);
-    free(pglobal->in[id].in_parameters);
     free(vd->videodevice);
     free(vd->status);
     free(vd->pictName);
-    CLOSE_VIDEO(vd->fd);
+    vd->videodevice = NULL;
+    vd->status = NULL;
+    vd->pictName = NULL;
+    if(vd->fd >= 0)
+        CLOSE_VIDEO(vd->fd);
+    vd->fd = -1;
     return -1;
 }
 
@@ -271,6 +247,7 @@ static int init_v4l2(struct vdIn *vd)
 {
     int i;
     int ret = 0;
+    __u32 caps, width, height, pixelformat;
     if((vd->fd = OPEN_VIDEO(vd->videodevice, O_RDWR)) == -1) {
         perror("ERROR opening V4L interface");
         DBG("errno: %d", errno);
@@ -284,7 +261,17 @@ static int init_v4l2(struct vdIn *vd)
         goto fatal;
     }
 
-    if((vd->cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) == 0) {
+    caps = vd->cap.capabilities;
+    #ifdef V4L2_CAP_DEVICE_CAPS
+    if(caps & V4L2_CAP_DEVICE_CAPS)
+        caps = vd->cap.device_caps;
+    #endif
+    if(caps & V4L2_CAP_VIDEO_CAPTURE) {
+        vd->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if(caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        DBG("%s uses the multi-planar API\n", vd->videodevice);
+        vd->buftype = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else {
         fprintf(stderr, "Error opening device %s: video capture not supported.\n",
                 vd->videodevice);
         goto fatal;;
@@ -326,59 +313,83 @@ static int init_v4l2(struct vdIn *vd)
      * set format in
      */
     memset(&vd->fmt, 0, sizeof(struct v4l2_format));
-    vd->fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vd->fmt.fmt.pix.width = vd->width;
-    vd->fmt.fmt.pix.height = vd->height;
-    vd->fmt.fmt.pix.pixelformat = vd->formatIn;
-    vd->fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    vd->fmt.type = vd->buftype;
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        vd->fmt.fmt.pix_mp.width = vd->width;
+        vd->fmt.fmt.pix_mp.height = vd->height;
+        vd->fmt.fmt.pix_mp.pixelformat = vd->formatIn;
+        vd->fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+        vd->fmt.fmt.pix_mp.num_planes = 1;
+    } else {
+        vd->fmt.fmt.pix.width = vd->width;
+        vd->fmt.fmt.pix.height = vd->height;
+        vd->fmt.fmt.pix.pixelformat = vd->formatIn;
+        vd->fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    }
     ret = xioctl(vd->fd, VIDIOC_S_FMT, &vd->fmt);
     if(ret < 0) {
         fprintf(stderr, "Unable to set format: %d res: %dx%d\n", vd->formatIn, vd->width, vd->height);
         goto fatal;
     }
 
+    if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        if(vd->fmt.fmt.pix_mp.num_planes != 1) {
+            fprintf(stderr, "Formats with %d planes are not supported\n", vd->fmt.fmt.pix_mp.num_planes);
+            goto fatal;
+        }
+        width = vd->fmt.fmt.pix_mp.width;
+        height = vd->fmt.fmt.pix_mp.height;
+        pixelformat = vd->fmt.fmt.pix_mp.pixelformat;
+        vd->bytesperline = vd->fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+    } else {
+        width = vd->fmt.fmt.pix.width;
+        height = vd->fmt.fmt.pix.height;
+        pixelformat = vd->fmt.fmt.pix.pixelformat;
+        vd->bytesperline = vd->fmt.fmt.pix.bytesperline;
+    }
+
     /* 
      * Check reoslution 
      */
-    if((vd->fmt.fmt.pix.width != vd->width) ||
-            (vd->fmt.fmt.pix.height != vd->height)) {
-       fprintf(stderr, " i: The specified resolution is unavailable, using: width %d height %d instead \n", vd->fmt.fmt.pix.width, vd->fmt.fmt.pix.height);
-        vd->width = vd->fmt.fmt.pix.width;
-        vd->height = vd->fmt.fmt.pix.height;
+    if((width != vd->width) ||
+            (height != vd->height)) {
+       fprintf(stderr, " i: The specified resolution is unavailable, using: width %d height %d instead \n", width, height);
+        vd->width = width;
+        vd->height = height;
     }
     /*
      * Check format
      */
-    if(vd->formatIn != vd->fmt.fmt.pix.pixelformat) {
+    if(vd->formatIn != pixelformat) {
       char fmtStringRequested[8];
       char fmtStringObtained[8];
-      fcc2s(fmtStringObtained,8,vd->fmt.fmt.pix.pixelformat);
+      fcc2s(fmtStringObtained,8,pixelformat);
       fcc2s(fmtStringRequested,8,vd->formatIn);
       fprintf(stderr, " i: Could not obtain the requested pixelformat: %s , driver gave us: %s\n",fmtStringRequested,fmtStringObtained);
       fprintf(stderr, "    ... will try to handle this by checking against supported formats. \n");
 
-      switch(vd->fmt.fmt.pix.pixelformat){
+      switch(pixelformat){
       case V4L2_PIX_FMT_JPEG:
 	// Fall-through intentional
       case V4L2_PIX_FMT_MJPEG:
 	fprintf(stderr, "    ... Falling back to the faster MJPG mode (consider changing cmd line options).\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
 	break;
       case V4L2_PIX_FMT_YUYV:
 	fprintf(stderr, "    ... Falling back to YUV mode (consider using -yuv option). Note that this requires much more CPU power\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
         break;
       case V4L2_PIX_FMT_UYVY:
 	fprintf(stderr, "    ... Falling back to UYVY mode (consider using -uyvy option). Note that this requires much more CPU power\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
         break;
       case V4L2_PIX_FMT_RGB24:
 	fprintf(stderr, "    ... Falling back to RGB24 mode (consider using -fourcc RGB24 option). Note that this requires much more CPU power\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
 	break;
       case V4L2_PIX_FMT_RGB565:
 	fprintf(stderr, "    ... Falling back to RGB565 mode (consider using -fourcc RGBP option). Note that this requires much more CPU power\n");
-	vd->formatIn = vd->fmt.fmt.pix.pixelformat;
+	vd->formatIn = pixelformat;
 	break;
       default:
 	goto fatal;
@@ -394,7 +405,7 @@ static int init_v4l2(struct vdIn *vd)
         struct v4l2_streamparm *setfps;
         setfps = (struct v4l2_streamparm *) calloc(1, sizeof(struct v4l2_streamparm));
         memset(setfps, 0, sizeof(struct v4l2_streamparm));
-        setfps->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        setfps->type = vd->buftype;
 
         /*
         * first query streaming parameters to determine that the FPS selection is supported
@@ -403,7 +414,7 @@ static int init_v4l2(struct vdIn *vd)
         if (ret == 0) {
             if (setfps->parm.capture.capability & V4L2_CAP_TIMEPERFRAME) {
                 memset(setfps, 0, sizeof(struct v4l2_streamparm));
-                setfps->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+                setfps->type = vd->buftype;
                 setfps->parm.capture.timeperframe.numerator = 1;
                 setfps->parm.capture.timeperframe.denominator = vd->fps==-1?255:vd->fps; // if no default fps set set it to maximum
 
@@ -431,7 +442,7 @@ static int init_v4l2(struct vdIn *vd)
      */
     memset(&vd->rb, 0, sizeof(struct v4l2_requestbuffers));
     vd->rb.count = NB_BUFFER;
-    vd->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    vd->rb.type = vd->buftype;
     vd->rb.memory = V4L2_MEMORY_MMAP;
 
     ret = xioctl(vd->fd, VIDIOC_REQBUFS, &vd->rb);
@@ -443,39 +454,61 @@ static int init_v4l2(struct vdIn *vd)
     /*
      * map the buffers
      */
+    for(i = 0; i < NB_BUFFER; i++)
+        vd->dmabuf[i] = -1;
     for(i = 0; i < NB_BUFFER; i++) {
-        memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-        vd->buf.index = i;
-        vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vd->buf.memory = V4L2_MEMORY_MMAP;
+        __u32 offset;
+
+        init_buffer(vd, i);
         ret = xioctl(vd->fd, VIDIOC_QUERYBUF, &vd->buf);
         if(ret < 0) {
             perror("Unable to query buffer");
             goto fatal;
         }
 
+        if(vd->buftype == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+            vd->memlength[i] = vd->planes[0].length;
+            offset = vd->planes[0].m.mem_offset;
+        } else {
+            vd->memlength[i] = vd->buf.length;
+            offset = vd->buf.m.offset;
+        }
         if(debug)
-            fprintf(stderr, "length: %u offset: %u\n", vd->buf.length, vd->buf.m.offset);
+            fprintf(stderr, "length: %u offset: %u\n", vd->memlength[i], offset);
 
         vd->mem[i] = mmap(0 /* start anywhere */ ,
-                          vd->buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, vd->fd,
-                          vd->buf.m.offset);
+                          vd->memlength[i], PROT_READ | PROT_WRITE, MAP_SHARED, vd->fd,
+                          offset);
         if(vd->mem[i] == MAP_FAILED) {
             perror("Unable to map buffer");
             goto fatal;
         }
         if(debug)
             fprintf(stderr, "Buffer mapped at address %p.\n", vd->mem[i]);
+
+        /* an encoder may read the frames straight from the buffers of the camera */
+        if(vd->export_buffers) {
+            struct v4l2_exportbuffer expbuf;
+
+            memset(&expbuf, 0, sizeof(expbuf));
+            expbuf.type = vd->buftype;
+            expbuf.index = i;
+            expbuf.flags = O_CLOEXEC | O_RDONLY;
+            if(xioctl(vd->fd, VIDIOC_EXPBUF, &expbuf) == 0) {
+                vd->dmabuf[i] = expbuf.fd;
+            } else {
+                DBG("VIDIOC_EXPBUF of buffer %d failed: %s\n", i, strerror(errno));
+            }
+        }
     }
+    vd->held = -1;
+    vd->generation++;
 
     /*
      * Queue the buffers.
      */
     for(i = 0; i < NB_BUFFER; ++i) {
-        memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-        vd->buf.index = i;
-        vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vd->buf.memory = V4L2_MEMORY_MMAP;
+        init_buffer(vd, i);
         ret = xioctl(vd->fd, VIDIOC_QBUF, &vd->buf);
         if(ret < 0) {
             perror("Unable to queue buffer");
@@ -491,7 +524,7 @@ fatal:
 
 int video_enable(struct vdIn *vd)
 {
-    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int type = vd->buftype;
     int ret;
 
     ret = xioctl(vd->fd, VIDIOC_STREAMON, &type);
@@ -505,7 +538,7 @@ int video_enable(struct vdIn *vd)
 
 static int video_disable(struct vdIn *vd, streaming_state disabledState)
 {
-    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int type = vd->buftype;
     int ret;
     DBG("STopping capture\n");
     ret = xioctl(vd->fd, VIDIOC_STREAMOFF, &type);
@@ -515,9 +548,43 @@ static int video_disable(struct vdIn *vd, streaming_state disabledState)
     }
     DBG("STopping capture done\n");
     vd->streamingState = disabledState;
+    vd->held = -1; // STREAMOFF returned all buffers
     return 0;
 }
 
+/******************************************************************************
+Description.: stops the capture but keeps the format and the buffers, so
+              video_resume() can start it again quickly
+Input Value.: vd is the device
+Return Value: 0 if ok, the result of the ioctl otherwise
+******************************************************************************/
+int video_pause(struct vdIn *vd)
+{
+    return video_disable(vd, STREAMING_OFF);
+}
+
+/******************************************************************************
+Description.: starts the capture again after video_pause(), STREAMOFF took
+              all buffers out of the queue, so they are queued again first
+Input Value.: vd is the device
+Return Value: 0 if ok, the result of the ioctl otherwise
+******************************************************************************/
+int video_resume(struct vdIn *vd)
+{
+    int i, ret;
+
+    for(i = 0; i < NB_BUFFER; ++i) {
+        init_buffer(vd, i);
+        ret = xioctl(vd->fd, VIDIOC_QBUF, &vd->buf);
+        if(ret < 0) {
+            perror("Unable to queue buffer");
+            return ret;
+        }
+    }
+
+    return video_enable(vd);
+}
+
 int video_set_dv_timings(struct vdIn *vd)
 {
     struct v4l2_dv_timings timings;
@@ -617,27 +684,26 @@ int memcpy_picture(unsigned char *out, unsigned char *buf, int size)
 int uvcGrab(struct vdIn *vd)
 {
 #define HEADERFRAME1 0xaf
+    unsigned int bytesused, line, y;
     int ret;
 
     if(vd->streamingState == STREAMING_OFF) {
         if(video_enable(vd))
             goto err;
     }
-    memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-    vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vd->buf.memory = V4L2_MEMORY_MMAP;
-
+    init_buffer(vd, 0);
     ret = xioctl(vd->fd, VIDIOC_DQBUF, &vd->buf);
     if(ret < 0) {
         perror("Unable to dequeue buffer");
         goto err;
     }
+    bytesused = buffer_bytesused(vd);
 
     switch(vd->formatIn) {
     case V4L2_PIX_FMT_JPEG:
         // Fall-through intentional
     case V4L2_PIX_FMT_MJPEG:
-        if(vd->buf.bytesused <= HEADERFRAME1) {
+        if(bytesused <= HEADERFRAME1) {
             /* Prevent crash
              * on empty image */
             fprintf(stderr, "Ignoring empty buffer ...\n");
@@ -651,25 +717,37 @@ int uvcGrab(struct vdIn *vd)
         memcpy (vd->tmpbuffer + HEADERFRAME1 + sizeof(dht_data), vd->mem[vd->buf.index] + HEADERFRAME1, (vd->buf.bytesused - HEADERFRAME1));
         */
 
-        memcpy(vd->tmpbuffer, vd->mem[vd->buf.index], vd->buf.bytesused);
-        vd->tmpbytesused = vd->buf.bytesused;
+        memcpy(vd->tmpbuffer, vd->mem[vd->buf.index], bytesused);
+        vd->tmpbytesused = bytesused;
         vd->tmptimestamp = vd->buf.timestamp;
+        vd->tmpflags = vd->buf.flags;
 
         if(debug) {
-            fprintf(stderr, "bytes in used %d \n", vd->buf.bytesused);
+            fprintf(stderr, "bytes in used %d \n", bytesused);
         }
         break;
     case V4L2_PIX_FMT_RGB24:
     case V4L2_PIX_FMT_RGB565:
     case V4L2_PIX_FMT_YUYV:
     case V4L2_PIX_FMT_UYVY:
-        if(vd->buf.bytesused > vd->framesizeIn) {
+        vd->tmpbytesused = bytesused;
+        vd->tmptimestamp = vd->buf.timestamp;
+        vd->tmpflags = vd->buf.flags;
+        if(vd->keep_buffer) {
+            /* the encoder reads the buffer itself, uvcRelease() queues it again */
+            vd->held = vd->buf.index;
+            return 0;
+        }
+        line = vd->framesizeIn / vd->height;
+        if(vd->bytesperline > line) {
+            /* the lines are padded, the framebuffer holds them without the padding */
+            for(y = 0; y < (unsigned int)vd->height && (y + 1) * vd->bytesperline <= bytesused; y++)
+                memcpy(vd->framebuffer + y * line, (unsigned char *)vd->mem[vd->buf.index] + y * vd->bytesperline, line);
+        } else if(bytesused > (unsigned int)vd->framesizeIn) {
             memcpy(vd->framebuffer, vd->mem[vd->buf.index], (size_t) vd->framesizeIn);
         } else {
-            memcpy(vd->framebuffer, vd->mem[vd->buf.index], (size_t) vd->buf.bytesused);
+            memcpy(vd->framebuffer, vd->mem[vd->buf.index], (size_t) bytesused);
         }
-        vd->tmpbytesused = vd->buf.bytesused;
-        vd->tmptimestamp = vd->buf.timestamp;
         break;
     default:
         goto err;
@@ -689,11 +767,39 @@ err:
     return -1;
 }
 
+/******************************************************************************
+Description.: queues the buffer uvcGrab() left dequeued with keep_buffer set
+Input Value.: vd is the device
+Return Value: 0 if ok or there was no such buffer, -1 on error
+******************************************************************************/
+int uvcRelease(struct vdIn *vd)
+{
+    int index = vd->held;
+
+    if(index < 0)
+        return 0;
+    vd->held = -1;
+    init_buffer(vd, index);
+    if(xioctl(vd->fd, VIDIOC_QBUF, &vd->buf) < 0) {
+        perror("Unable to requeue buffer");
+        return -1;
+    }
+    return 0;
+}
+
 int close_v4l2(struct vdIn *vd)
 {
     if(vd->streamingState == STREAMING_ON)
         video_disable(vd, STREAMING_OFF);
     free_framebuffer(vd);
+
+    /* the device may not have been opened yet */
+    free_buffers(vd);
+    if(vd->fd >= 0)
+        CLOSE_VIDEO(vd->fd);
+    vd->fd = -1;
+    vd->streamingState = STREAMING_OFF; // STREAMOFF fails if the camera is gone
+
     free(vd->videodevice);
     free(vd->status);
     free(vd->pictName);
@@ -782,9 +888,11 @@ int v4l2SetControl(struct vdIn *vd, int control_id, int value, int plugin_number
                 } else {
                     DBG("V4L2 ctrl 0x%08x new value: %d\n", control_id, value);
                     pglobal->in[plugin_number].in_parameters[i].value = value;
+                    CONTROLS_CHANGED(&pglobal->in[plugin_number]);
                 }
             } else {
                 LOG("Value (%d) out of range (%d .. %d)\n", value, min, max);
+                return -1;
             }
             return 0;
         } else { // not user class controls
@@ -819,6 +927,8 @@ int v4l2SetControl(struct vdIn *vd, int control_id, int value, int plugin_number
                 return -1;
             } else {
                 DBG("control id: 0x%08x new value: %d\n", ext_ctrl.id, ext_ctrl.value);
+                pglobal->in[plugin_number].in_parameters[i].value = value;
+                CONTROLS_CHANGED(&pglobal->in[plugin_number]);
             }
             return 0;
         }
@@ -828,6 +938,51 @@ int v4l2SetControl(struct vdIn *vd, int control_id, int value, int plugin_number
     }
 }
 
+/******************************************************************************
+Description.: sets several controls with one VIDIOC_S_EXT_CTRLS call. The
+              call either sets all controls or none, if it fails the
+              controls are set one by one, so one broken value does not
+              discard the others.
+Input Value.: vd is the device, ctrls the controls and their values in the
+              order they shall be applied, applied receives a flag for
+              each control
+Return Value: the number of controls set
+******************************************************************************/
+int v4l2SetControls(struct vdIn *vd, struct v4l2_ext_control *ctrls, int count, char *applied)
+{
+    struct v4l2_ext_controls ext_ctrls;
+    struct v4l2_control control_s;
+    int i, set = 0;
+
+    if(count == 0)
+        return 0;
+
+    memset(&ext_ctrls, 0, sizeof(ext_ctrls)); // class 0, the controls may be of any class
+    ext_ctrls.count = count;
+    ext_ctrls.controls = ctrls;
+    if(xioctl(vd->fd, VIDIOC_S_EXT_CTRLS, &ext_ctrls) == 0) {
+        memset(applied, 1, count);
+        return count;
+    }
+    DBG("VIDIOC_S_EXT_CTRLS of %d controls failed at %u, setting them one by one\n", count, ext_ctrls.error_idx);
+
+    for(i = 0; i < count; i++) {
+        memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+        ext_ctrls.ctrl_class = V4L2_CTRL_ID2CLASS(ctrls[i].id);
+        ext_ctrls.count = 1;
+        ext_ctrls.controls = &ctrls[i];
+        applied[i] = (xioctl(vd->fd, VIDIOC_S_EXT_CTRLS, &ext_ctrls) == 0);
+        if(!applied[i] && ext_ctrls.ctrl_class == V4L2_CTRL_CLASS_USER) {
+            /* drivers without extended controls */
+            control_s.id = ctrls[i].id;
+            control_s.value = ctrls[i].value;
+            applied[i] = (xioctl(vd->fd, VIDIOC_S_CTRL, &control_s) == 0);
+        }
+        set += applied[i];
+    }
+    return set;
+}
+
 int v4l2ResetControl(struct vdIn *vd, int control)
 {
     struct v4l2_control control_s;
@@ -849,59 +1004,42 @@ int v4l2ResetControl(struct vdIn *vd, int control)
     return 0;
 }
 
-void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglobal, int id)
+void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, input *in)
 {
     struct v4l2_control c;
     memset(&c, 0, sizeof(struct v4l2_control));
     c.id = ctrl->id;
 
-    if (pglobal->in[id].in_parameters == NULL) {
-        pglobal->in[id].in_parameters = (control*)calloc(1, sizeof(control));
+    if (in->in_parameters == NULL) {
+        in->in_parameters = (control*)calloc(1, sizeof(control));
     } else {
-        pglobal->in[id].in_parameters =
-        (control*)realloc(pglobal->in[id].in_parameters,(pglobal->in[id].parametercount + 1) * sizeof(control));
+        in->in_parameters =
+        (control*)realloc(in->in_parameters,(in->parametercount + 1) * sizeof(control));
     }
 
-    if (pglobal->in[id].in_parameters == NULL) {
+    if (in->in_parameters == NULL) {
         DBG("Calloc failed\n");
         return;
     }
 
-    memcpy(&pglobal->in[id].in_parameters[pglobal->in[id].parametercount].ctrl, ctrl, sizeof(struct v4l2_queryctrl));
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].group = IN_CMD_V4L2;
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = c.value;
-    if(ctrl->type == V4L2_CTRL_TYPE_MENU) {
-        pglobal->in[id].in_parameters[pglobal->in[id].parametercount].menuitems =
-            (struct v4l2_querymenu*)malloc((ctrl->maximum + 1) * sizeof(struct v4l2_querymenu));
-        int i;
-        for(i = ctrl->minimum; i <= ctrl->maximum; i++) {
-            struct v4l2_querymenu qm;
-            memset(&qm, 0 , sizeof(struct v4l2_querymenu));
-            qm.id = ctrl->id;
-            qm.index = i;
-            if(xioctl(vd->fd, VIDIOC_QUERYMENU, &qm) == 0) {
-                memcpy(&pglobal->in[id].in_parameters[pglobal->in[id].parametercount].menuitems[i], &qm, sizeof(struct v4l2_querymenu));
-                DBG("Menu item %d: %s\n", qm.index, qm.name);
-            } else {
-                DBG("Unable to get menu item for %s, index=%d\n", ctrl->name, qm.index);
-            }
-        }
-    } else {
-        pglobal->in[id].in_parameters[pglobal->in[id].parametercount].menuitems = NULL;
-    }
+    memcpy(&in->in_parameters[in->parametercount].ctrl, ctrl, sizeof(struct v4l2_queryctrl));
+    in->in_parameters[in->parametercount].group = IN_CMD_V4L2;
+    in->in_parameters[in->parametercount].value = c.value;
+    /* the names of the menu items are only needed by clients, see enumerateMenus() */
+    in->in_parameters[in->parametercount].menuitems = NULL;
 
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = 0;
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].class_id = (ctrl->id & 0xFFFF0000);
+    in->in_parameters[in->parametercount].value = 0;
+    in->in_parameters[in->parametercount].class_id = (ctrl->id & 0xFFFF0000);
 #ifndef V4L2_CTRL_FLAG_NEXT_CTRL
-    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].class_id = V4L2_CTRL_CLASS_USER;
+    in->in_parameters[in->parametercount].class_id = V4L2_CTRL_CLASS_USER;
 #endif
 
     int ret = -1;
-    if (pglobal->in[id].in_parameters[pglobal->in[id].parametercount].class_id == V4L2_CTRL_CLASS_USER) {
+    if (in->in_parameters[in->parametercount].class_id == V4L2_CTRL_CLASS_USER) {
         DBG("V4L2 parameter found: %s value %d Class: USER \n", ctrl->name, c.value);
         ret = xioctl(vd->fd, VIDIOC_G_CTRL, &c);
         if(ret == 0) {
-            pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = c.value;
+            in->in_parameters[in->parametercount].value = c.value;
         } else {
             DBG("Unable to get the value of %s retcode: %d  %s\n", ctrl->name, ret, strerror(errno));
         }
@@ -923,15 +1061,15 @@ void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglob
         if(ret) {
             switch (ext_ctrl.id) {
                 case V4L2_CID_PAN_RESET:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = 1;
+                    in->in_parameters[in->parametercount].value = 1;
                     DBG("Setting PAN reset value to 1\n");
                     break;
                 case V4L2_CID_TILT_RESET:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = 1;
+                    in->in_parameters[in->parametercount].value = 1;
                     DBG("Setting the Tilt reset value to 2\n");
                     break;
                 case V4L2_CID_PANTILT_RESET_LOGITECH:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = 3;
+                    in->in_parameters[in->parametercount].value = 3;
                     DBG("Setting the PAN/TILT reset value to 3\n");
                     break;
                 default:
@@ -944,20 +1082,104 @@ void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglob
                 case V4L2_CTRL_TYPE_STRING:
                     //string gets set on VIDIOC_G_EXT_CTRLS
                     //add the maximum size to value
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = ext_ctrl.size;
+                    in->in_parameters[in->parametercount].value = ext_ctrl.size;
                     break;
 #endif
                 case V4L2_CTRL_TYPE_INTEGER64:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = ext_ctrl.value64;
+                    in->in_parameters[in->parametercount].value = ext_ctrl.value64;
                     break;
                 default:
-                    pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = ext_ctrl.value;
+                    in->in_parameters[in->parametercount].value = ext_ctrl.value;
                     break;
             }
         }
     }
 
-    pglobal->in[id].parametercount++;
+    in->parametercount++;
+}
+
+/*
+ * Enumerates the formats and frame sizes of the device into in, which may
+ * be a copy of the input that is published when it is complete
+ */
+void enumerateFormats(struct vdIn *vd, input *in)
+{
+
+    struct v4l2_format currentFormat;
+    memset(&currentFormat, 0, sizeof(struct v4l2_format));
+    currentFormat.type = vd->buftype;
+    if (xioctl(vd->fd, VIDIOC_G_FMT, &currentFormat) == 0) {
+        DBG("Current size: %dx%d\n",
+             currentFormat.fmt.pix.width,
+             currentFormat.fmt.pix.height);
+    }
+
+    in->in_formats = NULL;
+    for(in->formatCount = 0; 1; in->formatCount++) {
+        struct v4l2_fmtdesc fmtdesc;
+        memset(&fmtdesc, 0, sizeof(struct v4l2_fmtdesc));
+        fmtdesc.index = in->formatCount;
+        fmtdesc.type  = vd->buftype;
+        if(xioctl(vd->fd, VIDIOC_ENUM_FMT, &fmtdesc) < 0) {
+            break;
+        }
+
+        if (in->in_formats == NULL) {
+            in->in_formats = (input_format*)calloc(1, sizeof(input_format));
+        } else {
+            in->in_formats = (input_format*)realloc(in->in_formats, (in->formatCount + 1) * sizeof(input_format));
+        }
+
+        if (in->in_formats == NULL) {
+            LOG("Calloc/realloc failed: %s\n", strerror(errno));
+            return;
+        }
+
+        memcpy(&in->in_formats[in->formatCount], &fmtdesc, sizeof(struct v4l2_fmtdesc));
+
+        if(fmtdesc.pixelformat == vd->formatIn)
+            in->currentFormat = in->formatCount;
+
+        DBG("Supported format: %s\n", fmtdesc.description);
+        struct v4l2_frmsizeenum fsenum;
+        memset(&fsenum, 0, sizeof(struct v4l2_frmsizeenum));
+        fsenum.pixel_format = fmtdesc.pixelformat;
+        int j = 0;
+        in->in_formats[in->formatCount].supportedResolutions = NULL;
+        in->in_formats[in->formatCount].resolutionCount = 0;
+        in->in_formats[in->formatCount].currentResolution = -1;
+        while(1) {
+            fsenum.index = j;
+            j++;
+            if(xioctl(vd->fd, VIDIOC_ENUM_FRAMESIZES, &fsenum) == 0) {
+                in->in_formats[in->formatCount].resolutionCount++;
+
+                if (in->in_formats[in->formatCount].supportedResolutions == NULL) {
+                    in->in_formats[in->formatCount].supportedResolutions = (input_resolution*)
+                            calloc(1, sizeof(input_resolution));
+                } else {
+                    in->in_formats[in->formatCount].supportedResolutions = (input_resolution*)
+                            realloc(in->in_formats[in->formatCount].supportedResolutions, j * sizeof(input_resolution));
+                }
+
+                if (in->in_formats[in->formatCount].supportedResolutions == NULL) {
+                    LOG("Calloc/realloc failed\n");
+                    return;
+                }
+
+                in->in_formats[in->formatCount].supportedResolutions[j-1].width = fsenum.discrete.width;
+                in->in_formats[in->formatCount].supportedResolutions[j-1].height = fsenum.discrete.height;
+                if(vd->formatIn == fmtdesc.pixelformat) {
+                    in->in_formats[in->formatCount].currentResolution = (j - 1);
+                    DBG("\tSupported size with the current format: %dx%d\n", fsenum.discrete.width, fsenum.discrete.height);
+                } else {
+                    DBG("\tSupported size: %dx%d\n", fsenum.discrete.width, fsenum.discrete.height);
+                }
+            } else {
+                break;
+            }
+        }
+    }
 }
 
 /*  It should set the capture resolution
@@ -976,10 +1198,7 @@ int setResolution(struct vdIn *vd, int width, int height)
     }
 
     DBG("Unmap buffers\n");
-    int i;
-    for (i = 0; i < NB_BUFFER; i++) {
-        munmap(vd->mem[i], vd->buf.length);
-    }
+    free_buffers(vd);
 
     if (CLOSE_VIDEO(vd->fd) == 0) {
         DBG("Device closed successfully\n");
@@ -1013,13 +1232,13 @@ int setResolution(struct vdIn *vd, int width, int height)
  *
  */
 
-void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
+void enumerateControls(struct vdIn *vd, input *in)
 {
     // enumerating v4l2 controls
     struct v4l2_queryctrl ctrl;
     memset(&ctrl, 0, sizeof(struct v4l2_queryctrl));
-    pglobal->in[id].parametercount = 0;
-    pglobal->in[id].in_parameters = malloc(0 * sizeof(control));
+    in->parametercount = 0;
+    in->in_parameters = malloc(0 * sizeof(control));
     /* Enumerate the v4l2 controls
      Try the extended control API first */
 #ifdef V4L2_CTRL_FLAG_NEXT_CTRL
@@ -1027,7 +1246,7 @@ void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
     ctrl.id = V4L2_CTRL_FLAG_NEXT_CTRL;
     if(0 == IOCTL_VIDEO(vd->fd, VIDIOC_QUERYCTRL, &ctrl)) {
         do {
-            control_readed(vd, &ctrl, pglobal, id);
+            control_readed(vd, &ctrl, in);
             ctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
         } while(0 == IOCTL_VIDEO(vd->fd, VIDIOC_QUERYCTRL, &ctrl));
         // note: use simple ioctl or v4l2_ioctl instead of the xioctl
@@ -1041,7 +1260,7 @@ void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
         for(i = V4L2_CID_BASE; i < V4L2_CID_LASTP1; i++) {
             ctrl.id = i;
             if(IOCTL_VIDEO(vd->fd, VIDIOC_QUERYCTRL, &ctrl) == 0) {
-                control_readed(vd, &ctrl, pglobal, id);
+                control_readed(vd, &ctrl, in);
             }
         }
 
@@ -1049,22 +1268,22 @@ void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
         for(i = V4L2_CID_PRIVATE_BASE; ; i++) {
             ctrl.id = i;
             if(IOCTL_VIDEO(vd->fd, VIDIOC_QUERYCTRL, &ctrl) == 0) {
-                control_readed(vd, &ctrl, pglobal, id);
+                control_readed(vd, &ctrl, in);
             } else {
                 break;
             }
         }
     }
 
-    memset(&pglobal->in[id].jpegcomp, 0, sizeof(struct v4l2_jpegcompression));
-    if(xioctl(vd->fd, VIDIOC_G_JPEGCOMP, &pglobal->in[id].jpegcomp) != EINVAL) {
+    memset(&in->jpegcomp, 0, sizeof(struct v4l2_jpegcompression));
+    if(xioctl(vd->fd, VIDIOC_G_JPEGCOMP, &in->jpegcomp) != EINVAL) {
         DBG("JPEG compression details:\n");
-        DBG("Quality: %d\n", pglobal->in[id].jpegcomp.quality);
-        DBG("APPn: %d\n", pglobal->in[id].jpegcomp.APPn);
-        DBG("APP length: %d\n", pglobal->in[id].jpegcomp.APP_len);
-        DBG("APP data: %s\n", pglobal->in[id].jpegcomp.APP_data);
-        DBG("COM length: %d\n", pglobal->in[id].jpegcomp.COM_len);
-        DBG("COM data: %s\n", pglobal->in[id].jpegcomp.COM_data);
+        DBG("Quality: %d\n", in->jpegcomp.quality);
+        DBG("APPn: %d\n", in->jpegcomp.APPn);
+        DBG("APP length: %d\n", in->jpegcomp.APP_len);
+        DBG("APP data: %s\n", in->jpegcomp.APP_data);
+        DBG("COM length: %d\n", in->jpegcomp.COM_len);
+        DBG("COM data: %s\n", in->jpegcomp.COM_data);
         struct v4l2_queryctrl ctrl_jpeg;
         ctrl_jpeg.id = 1;
         sprintf((char*)&ctrl_jpeg.name, "JPEG quality");
@@ -1074,23 +1293,57 @@ void enumerateControls(struct vdIn *vd, globals *pglobal, int id)
         ctrl_jpeg.default_value = 50;
         ctrl_jpeg.flags = 0;
         ctrl_jpeg.type = V4L2_CTRL_TYPE_INTEGER;
-        if (pglobal->in[id].in_parameters == NULL) {
-            pglobal->in[id].in_parameters = (control*)calloc(1, sizeof(control));
+        if (in->in_parameters == NULL) {
+            in->in_parameters = (control*)calloc(1, sizeof(control));
         } else {
-            pglobal->in[id].in_parameters = (control*)realloc(pglobal->in[id].in_parameters,(pglobal->in[id].parametercount + 1) * sizeof(control));
+            in->in_parameters = (control*)realloc(in->in_parameters,(in->parametercount + 1) * sizeof(control));
         }
 
-        if (pglobal->in[id].in_parameters == NULL) {
+        if (in->in_parameters == NULL) {
             DBG("Calloc/realloc failed\n");
             return;
         }
 
-        memcpy(&pglobal->in[id].in_parameters[pglobal->in[id].parametercount].ctrl, &ctrl_jpeg, sizeof(struct v4l2_queryctrl));
-        pglobal->in[id].in_parameters[pglobal->in[id].parametercount].group = IN_CMD_JPEG_QUALITY;
-        pglobal->in[id].in_parameters[pglobal->in[id].parametercount].value = pglobal->in[id].jpegcomp.quality;
-        pglobal->in[id].parametercount++;
+        memcpy(&in->in_parameters[in->parametercount].ctrl, &ctrl_jpeg, sizeof(struct v4l2_queryctrl));
+        in->in_parameters[in->parametercount].group = IN_CMD_JPEG_QUALITY;
+        in->in_parameters[in->parametercount].value = in->jpegcomp.quality;
+        in->in_parameters[in->parametercount].menuitems = NULL;
+        in->parametercount++;
     } else {
         DBG("Modifying the setting of the JPEG compression is not supported\n");
-        pglobal->in[id].jpegcomp.quality = -1;
+        in->jpegcomp.quality = -1;
+    }
+}
+
+/*
+ * Queries the names of the items of all menu controls, the list of each
+ * control is published when it is complete
+ */
+void enumerateMenus(struct vdIn *vd, input *in)
+{
+    struct v4l2_querymenu *items;
+    struct v4l2_queryctrl *ctrl;
+    int i, j;
+
+    for(i = 0; i < in->parametercount; i++) {
+        ctrl = &in->in_parameters[i].ctrl;
+        if(in->in_parameters[i].group != IN_CMD_V4L2 || ctrl->type != V4L2_CTRL_TYPE_MENU ||
+           in->in_parameters[i].menuitems != NULL || ctrl->maximum < 0)
+            continue;
+
+        items = calloc(ctrl->maximum + 1, sizeof(struct v4l2_querymenu));
+        if(items == NULL)
+            return;
+        for(j = (ctrl->minimum > 0) ? ctrl->minimum : 0; j <= ctrl->maximum; j++) {
+            items[j].id = ctrl->id;
+            items[j].index = j;
+            if(xioctl(vd->fd, VIDIOC_QUERYMENU, &items[j]) == 0) {
+                DBG("Menu item %d: %s\n", j, items[j].name);
+            } else {
+                DBG("Unable to get menu item for %s, index=%d\n", ctrl->name, j);
+            }
+        }
+        __sync_synchronize();
+        in->in_parameters[i].menuitems = items;
     }
 }
@@ -41,6 +41,7 @@
 #include <linux/videodev2.h>
 
 #include "../../mjpg_streamer.h"
+#include "encoder.h"
 #define NB_BUFFER 4
 
 
@@ -54,6 +55,7 @@
 * returns - ioctl result
 */
 int xioctl(int fd, int IOCTL_X, void *arg);
+void fcc2s(char* fmtString, unsigned int size, unsigned int pixelformat);
 
 #ifdef USE_LIBV4L2
 #include <libv4l2.h>
@@ -111,10 +113,20 @@ struct vdIn {
     int recordtime;
     uint32_t tmpbytesused;
     struct timeval tmptimestamp;
+    __u32 tmpflags;             /* flags of the dequeued buffer, tells the clock of tmptimestamp */
     v4l2_std_id vstd;
     unsigned long frame_period_time; // in ms
     unsigned char soft_framedrop;
     unsigned int dv_timings;
+    __u32 buftype;              /* V4L2_BUF_TYPE_VIDEO_CAPTURE or _MPLANE */
+    struct v4l2_plane planes[VIDEO_MAX_PLANES]; /* of buf with the multi-planar API */
+    unsigned int memlength[NB_BUFFER]; /* of the mapped buffers */
+    unsigned int bytesperline;  /* of the uncompressed formats */
+    int export_buffers;         /* export the buffers for an encoder */
+    int dmabuf[NB_BUFFER];      /* the exported buffers, -1 if not exported */
+    int keep_buffer;            /* uvcGrab() leaves uncompressed frames in the buffer */
+    int held;                   /* the buffer left dequeued by uvcGrab() or -1 */
+    unsigned int generation;    /* counts the allocations of the buffers */
 };
 
 /* optional initial settings */
@@ -133,9 +145,50 @@ typedef struct {
         pl_set, pl,
         gain_set, gain_auto, gain,
         cagc_set, cagc_auto, cagc,
-        cb_set, cb_auto, cb;
+        cb_set, cb_auto, cb,
+        target_rate_set, target_rate,
+        qmin_set, qmin,
+        qmax_set, qmax;
+    double rate_smoothing;
 } context_settings;
 
+/* how the rate controller changes the JPEG quality */
+typedef enum {
+    RATE_CONTROL_NONE,          /* the quality of the camera can not be changed */
+    RATE_CONTROL_SOFTWARE,      /* quality of our encoder */
+    RATE_CONTROL_V4L2,          /* V4L2_CID_JPEG_COMPRESSION_QUALITY */
+    RATE_CONTROL_JPEGCOMP       /* VIDIOC_S_JPEGCOMP */
+} rate_control_method;
+
+/* ids of the controls of the rate controller, group IN_CMD_GENERIC */
+#define RATE_CTRL_TARGET        10
+#define RATE_CTRL_MIN_QUALITY   11
+#define RATE_CTRL_MAX_QUALITY   12
+#define RATE_CTRL_QUALITY       13
+#define RATE_CTRL_RATE          14
+
+/*
+ * closed loop control of the JPEG quality, it is lowered while more than the
+ * target bytes per second are produced and raised while less are produced
+ */
+typedef struct {
+    int target;                 /* bytes per second, 0 disables the control */
+    int min_quality, max_quality;
+    double smoothing;           /* time constant of the rate estimate in seconds */
+    rate_control_method method;
+    double rate;                /* smoothed bytes per second */
+    double quality;             /* output of the controller */
+    int applied;                /* quality in effect */
+    struct timespec last_frame; /* capture time of the last measured frame */
+    struct timespec last_update; /* of the camera or of the controls */
+} rate_control;
+
+/* a control value the user has chosen, restored when the camera is opened */
+typedef struct {
+    __u32 id;
+    __s32 value;
+} control_value;
+
 /* context of each camera thread */
 typedef struct {
     int id;
@@ -144,23 +197,68 @@ typedef struct {
     pthread_mutex_t controls_mutex;
     struct vdIn *videoIn;
     context_settings *init_settings;
+    struct timespec resumed;    /* when the capture was resumed on demand */
+    int warming_up;             /* the first frame after resuming is still missing */
+    int quality;                /* of the software JPEG encoder */
+    rate_control rc;
+
+    /* options, kept per camera because all cameras share the plugin */
+    unsigned int minimum_size;  /* smaller frames are dropped as broken */
+    unsigned int every;         /* only every n-th frame is published */
+    unsigned int timeout;       /* seconds to wait for a frame */
+    int wantTimestamp;          /* ignore the timestamps of the driver */
+    int softfps;                /* drop frames down to this rate if > 0 */
+    int ondemand;               /* stop the capture while nobody needs frames */
+
+    /* the camera thread opens the device, so all cameras are opened at once */
+    char *device;
+    int width, height, fps, format;
+    v4l2_std_id tvnorm;
+    int dynctrls;               /* initialize the dynamic controls of UVC */
+    int described;              /* the formats and menus were enumerated */
+    int opened;                 /* the camera was opened before, its controls are known */
+    int buf_size;               /* of the frame buffer of the input */
+    encoder encoder;            /* compresses the uncompressed formats */
+
+    /* finds the camera again after it was unplugged */
+    char *sysfs_device;         /* the device in sysfs, its path is the bus path */
+    char *serial;               /* of USB cameras */
+    int index;                  /* of the video node among the nodes of the device */
+
+    /* the controls set by the user, guarded by controls_mutex */
+    control_value *saved;
+    int saved_count;
+    char *controls_file;        /* the saved controls are written there too */
+
+    /* the last uncompressed frame, it is compressed when a consumer reads it */
+    unsigned char *raw;
+    int raw_capacity;
+    int raw_width, raw_height;
+    unsigned int raw_format;
+    unsigned int raw_bytesperline;
 } context;
 
 int init_videoIn(struct vdIn *vd, char *device, int width, int height, int fps, int format, int grabmethod, globals *pglobal, int id, v4l2_std_id vstd);
-void enumerateControls(struct vdIn *vd, globals *pglobal, int id);
-void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglobal, int id);
+void enumerateControls(struct vdIn *vd, input *in);
+void enumerateMenus(struct vdIn *vd, input *in);
+void enumerateFormats(struct vdIn *vd, input *in);
+void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, input *in);
 int setResolution(struct vdIn *vd, int width, int height);
 
 int memcpy_picture(unsigned char *out, unsigned char *buf, int size);
 int uvcGrab(struct vdIn *vd);
+int uvcRelease(struct vdIn *vd);
 int close_v4l2(struct vdIn *vd);
 
 int video_enable(struct vdIn *vd);
+int video_pause(struct vdIn *vd);
+int video_resume(struct vdIn *vd);
 int video_set_dv_timings(struct vdIn *vd);
 int video_handle_event(struct vdIn *vd);
 
 int v4l2GetControl(struct vdIn *vd, int control);
 int v4l2SetControl(struct vdIn *vd, int control, int value, int plugin_number, globals *pglobal);
+int v4l2SetControls(struct vdIn *vd, struct v4l2_ext_control *ctrls, int count, char *applied);
 int v4l2UpControl(struct vdIn *vd, int control);
 int v4l2DownControl(struct vdIn *vd, int control);
 int v4l2ToggleControl(struct vdIn *vd, int control);
@@ -42,11 +42,15 @@ struct _output {
     char *plugin;
     char *name;
     void *handle;
+    char *spec;     // the argument of -o, param points into it
+    plugin_state state;
+    struct _thread_settings *threads;
     output_parameter param;
 
     // input plugin parameters
     struct _control *out_parameters;
     int parametercount;
+    unsigned int controls_version; // incremented when a control changed
 
     int (*init)(output_parameter *param, int id);
     int (*stop)(int);
@@ -50,6 +50,7 @@ static pthread_t worker;
 static globals *pglobal;
 static int fd, delay;
 static unsigned char *frame = NULL;
+static unsigned char first_run = 1;
 static int input_number;
 
 /******************************************************************************
@@ -67,6 +68,12 @@ void help(void)
             " ---------------------------------------------------------------\n");
 }
 
+/* cleanup handler, releases a mutex held while the thread got cancelled */
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
 /******************************************************************************
 Description.: clean up allocated resources
 Input Value.: unused argument
@@ -74,8 +81,6 @@ Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
-
     if(!first_run) {
         DBG("already cleaned up resources\n");
         return;
@@ -84,7 +89,11 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
+    /* this plugin does not take frames any more, see output_run() */
+    input_demand(&pglobal->in[input_number], -1);
+
     free(frame);
+    frame = NULL;
     close(fd);
 }
 
@@ -93,7 +102,7 @@ void worker_cleanup(void *arg)
 /******************************************************************************
 Description.: this is the main worker thread
               it loops forever, grabs a fresh frame and calculates focus
-Input Value.:
+Input Value.: arg is the number of the output plugin
 Return Value:
 ******************************************************************************/
 void *worker_thread(void *arg)
@@ -102,6 +111,8 @@ void *worker_thread(void *arg)
     double sv = -1.0, max_sv = 100.0, delta = 500;
     int focus = 255, step = 10, max_focus = 100, search_focus = 1;
 
+    pglobal->thread_start(Dest_Output, (int)(long)arg, "focus");
+
     if((frame = malloc(256 * 1024)) == NULL) {
         OPRINT("not enough memory for worker thread\n");
         exit(EXIT_FAILURE);
@@ -113,9 +124,12 @@ void *worker_thread(void *arg)
     while(!pglobal->stop) {
         DBG("waiting for fresh frame\n");
         pthread_mutex_lock(&pglobal->in[input_number].db);
+        pthread_cleanup_push(unlock_mutex, &pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        pthread_cleanup_pop(0);
 
         /* read buffer */
+        input_frame(&pglobal->in[input_number]);
         frame_size = pglobal->in[input_number].size;
         memcpy(frame, pglobal->in[input_number].buf, frame_size);
 
@@ -179,6 +193,10 @@ int output_init(output_parameter *param)
     int i;
 
     delay = 10000;
+    /* the library stays loaded after a removal, start from the defaults */
+    first_run = 1;
+    frame = NULL;
+    input_number = 0;
 
     param->argv[0] = OUTPUT_PLUGIN_NAME;
 
@@ -250,6 +268,7 @@ int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -260,8 +279,10 @@ Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
+    /* this plugin takes every frame, an input which captures on demand keeps running */
+    input_demand(&pglobal->in[input_number], 1);
+
     DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    pthread_create(&worker, 0, worker_thread, (void *)(long)id);
     return 0;
 }
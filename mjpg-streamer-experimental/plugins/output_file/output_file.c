@@ -49,6 +49,7 @@ static globals *pglobal;
 static int fd, delay, ringbuffer_size = -1, ringbuffer_exceed = 0, max_frame_size;
 static char *folder = "/tmp";
 static unsigned char *frame = NULL;
+static unsigned char first_run = 1;
 static char *command = NULL;
 static int input_number = 0;
 static char *mjpgFileName = NULL;
@@ -77,6 +78,12 @@ void help(void)
             " ---------------------------------------------------------------\n");
 }
 
+/* cleanup handler, releases a mutex held while the thread got cancelled */
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
 /******************************************************************************
 Description.: clean up allocated resources
 Input Value.: unused argument
@@ -84,8 +91,6 @@ Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
-
     if (mjpgFileName != NULL) {
         close(fd);
     }
@@ -98,8 +103,12 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
+    /* this plugin does not take frames any more, see output_run() */
+    input_demand(&pglobal->in[input_number], -1);
+
     if(frame != NULL) {
         free(frame);
+        frame = NULL;
     }
     close(fd);
 }
@@ -204,12 +213,16 @@ Return Value:
 void *worker_thread(void *arg)
 {
     int ok = 1, frame_size = 0, rc = 0;
-    char buffer1[1024] = {0}, buffer2[1024] = {0};
+    char buffer1[1024] = {0}, buffer2[1024] = {0}, stamp[32];
     unsigned long long counter = 0;
+    unsigned long sequence;
+    struct timeval timestamp;
     time_t t;
     struct tm *now;
     unsigned char *tmp_framebuffer = NULL;
 
+    pglobal->thread_start(Dest_Output, (int)(long)arg, "writer");
+
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
@@ -217,9 +230,12 @@ void *worker_thread(void *arg)
         DBG("waiting for fresh frame\n");
 
         pthread_mutex_lock(&pglobal->in[input_number].db);
+        pthread_cleanup_push(unlock_mutex, &pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        pthread_cleanup_pop(0);
 
         /* read buffer */
+        input_frame(&pglobal->in[input_number]);
         frame_size = pglobal->in[input_number].size;
 
         /* check if buffer for frame is large enough, increase it if necessary */
@@ -236,8 +252,10 @@ void *worker_thread(void *arg)
             frame = tmp_framebuffer;
         }
 
-        /* copy frame to our local buffer now */
+        /* copy frame and its stamps to our local buffer now */
         memcpy(frame, pglobal->in[input_number].buf, frame_size);
+        timestamp = pglobal->in[input_number].timestamp;
+        sequence = pglobal->in[input_number].sequence;
 
         /* allow others to access the global buffer again */
         pthread_mutex_unlock(&pglobal->in[input_number].db);
@@ -247,8 +265,8 @@ void *worker_thread(void *arg)
             memset(buffer1, 0, sizeof(buffer1));
             memset(buffer2, 0, sizeof(buffer2));
 
-            /* get current time */
-            t = time(NULL);
+            /* the name tells when the frame was captured, not when it was written */
+            t = timestamp.tv_sec;
             now = localtime(&t);
             if(now == NULL) {
                 perror("localtime");
@@ -256,14 +274,14 @@ void *worker_thread(void *arg)
             }
 
             /* prepare string, add time and date values */
-            if(strftime(buffer1, sizeof(buffer1), "%%s/%Y_%m_%d_%H_%M_%S_picture_%%09llu.jpg", now) == 0) {
+            if(strftime(buffer1, sizeof(buffer1), "%%s/%Y_%m_%d_%H_%M_%S_picture_%%09lu.jpg", now) == 0) {
                 OPRINT("strftime returned 0\n");
                 free(frame); frame = NULL;
                 return NULL;
             }
 
-            /* finish filename by adding the foldername and a counter value */
-            snprintf(buffer2, sizeof(buffer2), buffer1, folder, counter);
+            /* finish filename by adding the foldername and the sequence number of the frame */
+            snprintf(buffer2, sizeof(buffer2), buffer1, folder, sequence);
 
             counter++;
 
@@ -305,6 +323,12 @@ void *worker_thread(void *arg)
                     LOG("setenv failed (return value %d)\n", rc);
                 }
 
+                /* and the stamps of the frame */
+                snprintf(stamp, sizeof(stamp), "%ld.%06ld", (long)timestamp.tv_sec, (long)timestamp.tv_usec);
+                setenv("MJPG_TIMESTAMP", stamp, 1);
+                snprintf(stamp, sizeof(stamp), "%lu", sequence);
+                setenv("MJPG_SEQUENCE", stamp, 1);
+
                 /* execute the command now */
                 if((rc = system(buffer1)) != 0) {
                     LOG("command failed (return value %d)\n", rc);
@@ -356,6 +380,17 @@ int output_init(output_parameter *param, int id)
 {
 	int i;
     delay = 0;
+    /* the library stays loaded after a removal, a new instance starts from the defaults */
+    first_run = 1;
+    frame = NULL;
+    max_frame_size = 0;
+    ringbuffer_size = -1;
+    ringbuffer_exceed = 0;
+    folder = "/tmp";
+    command = NULL;
+    input_number = 0;
+    mjpgFileName = NULL;
+    linkFileName = NULL;
     pglobal = param->global;
     pglobal->out[id].name = malloc((1+strlen(OUTPUT_PLUGIN_NAME))*sizeof(char));
     sprintf(pglobal->out[id].name, "%s", OUTPUT_PLUGIN_NAME);
@@ -546,6 +581,7 @@ int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -556,9 +592,11 @@ Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
+    /* this plugin takes every frame, an input which captures on demand keeps running */
+    input_demand(&pglobal->in[input_number], 1);
+
     DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    pthread_create(&worker, 0, worker_thread, (void *)(long)id);
     return 0;
 }
 
@@ -582,6 +620,7 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
                                         return -1;
                                     }
                                     /* read buffer */
+                                    input_frame(&pglobal->in[input_number]);
                                     frame_size = pglobal->in[input_number].size;
 
                                     /* check if buffer for frame is large enough, increase it if necessary */
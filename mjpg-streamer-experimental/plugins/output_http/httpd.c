@@ -36,6 +36,7 @@
 #include <netdb.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdarg.h>
 
 #include <linux/version.h>
 #include <linux/types.h>          /* for videodev2.h */
@@ -45,6 +46,8 @@
 #include "../../utils.h"
 
 #include "httpd.h"
+#include "websocket.h"
+#include "jpeg_scale.h"
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,32)
 #define V4L2_CTRL_TYPE_STRING_SUPPORTED
@@ -54,146 +57,47 @@
 
 
 static globals *pglobal;
-extern context servers[MAX_OUTPUT_PLUGINS];
-int piggy_fine = 2; // FIXME make it command line parameter
+extern context *servers;
+
+/*
+ * the JSON descriptions are rendered once and served until they change,
+ * there is one per plugin, allocated by alloc_tables()
+ */
+static json_cache *input_json;
+static json_cache *output_json;
+static json_cache program_json = {PTHREAD_MUTEX_INITIALIZER};
+
+/* frame statistics of the inputs and the wakeup of the event streams */
+static input_watcher *watchers;
+static int watcher_users = 0;
+static int watcher_output;      /* the output which started the watchers, for their names */
+static int connections = 0;
+static pthread_mutex_t events_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t events_update = PTHREAD_COND_INITIALIZER;
+
+static const action_t actions[] = {
+    { "snapshot", A_SNAPSHOT },
+    { "stream", A_STREAM },
+    { "take", A_TAKE },
+    { "command", A_COMMAND },
+    { "events", A_EVENTS },
+    { "ws", A_WS },
+    { "manage", A_MANAGE }
+};
 
 /******************************************************************************
-Description.: initializes the iobuffer structure properly
-Input Value.: pointer to already allocated iobuffer
-Return Value: iobuf
+Description.: Get the plugin number from the "_N" suffix of an URL part
+Input Value.: * s......: the part of the URL, e.g. "stream_1" or "/input_1.json"
+              * len....: length of the part
+Return Value: the number or 0 if there is no suffix
 ******************************************************************************/
-void init_iobuffer(iobuffer *iobuf)
+int plugin_suffix(const char *s, int len)
 {
-    memset(iobuf->buffer, 0, sizeof(iobuf->buffer));
-    iobuf->level = 0;
-}
+    const char *sch = memchr(s, '_', len);
 
-/******************************************************************************
-Description.: initializes the request structure properly
-Input Value.: pointer to already allocated req
-Return Value: req
-******************************************************************************/
-void init_request(request *req)
-{
-    req->type        = A_UNKNOWN;
-    req->parameter   = NULL;
-    req->client      = NULL;
-    req->credentials = NULL;
-}
-
-/******************************************************************************
-Description.: If strings were assigned to the different members free them
-              This will fail if strings are static, so always use strdup().
-Input Value.: req: pointer to request structure
-Return Value: -
-******************************************************************************/
-void free_request(request *req)
-{
-    if(req->parameter != NULL) free(req->parameter);
-    if(req->client != NULL) free(req->client);
-    if(req->credentials != NULL) free(req->credentials);
-    if(req->query_string != NULL) free(req->query_string);
-}
-
-/******************************************************************************
-Description.: read with timeout, implemented without using signals
-              tries to read len bytes and returns if enough bytes were read
-              or the timeout was triggered. In case of timeout the return
-              value may differ from the requested bytes "len".
-Input Value.: * fd.....: fildescriptor to read from
-              * iobuf..: iobuffer that allows to use this functions from multiple
-                         threads because the complete context is the iobuffer.
-              * buffer.: The buffer to store values at, will be set to zero
-                         before storing values.
-              * len....: the length of buffer
-              * timeout: seconds to wait for an answer
-Return Value: * buffer.: will become filled with bytes read
-              * iobuf..: May get altered to save the context for future calls.
-              * func().: bytes copied to buffer or -1 in case of error
-******************************************************************************/
-int _read(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout)
-{
-    int copied = 0, rc, i;
-    fd_set fds;
-    struct timeval tv;
-
-    memset(buffer, 0, len);
-
-    while((copied < len)) {
-        i = MIN(iobuf->level, len - copied);
-        memcpy(buffer + copied, iobuf->buffer + IO_BUFFER - iobuf->level, i);
-
-        iobuf->level -= i;
-        copied += i;
-        if(copied >= len)
-            return copied;
-
-        /* select will return in case of timeout or new data arrived */
-        tv.tv_sec = timeout;
-        tv.tv_usec = 0;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        if((rc = select(fd + 1, &fds, NULL, NULL, &tv)) <= 0) {
-            if(rc < 0)
-                exit(EXIT_FAILURE);
-
-            /* this must be a timeout */
-            return copied;
-        }
-
-        init_iobuffer(iobuf);
-
-        /*
-         * there should be at least one byte, because select signalled it.
-         * But: It may happen (very seldomly), that the socket gets closed remotly between
-         * the select() and the following read. That is the reason for not relying
-         * on reading at least one byte.
-         */
-        if((iobuf->level = read(fd, &iobuf->buffer, IO_BUFFER)) <= 0) {
-            /* an error occured */
-            return -1;
-        }
-
-        /* align data to the end of the buffer if less than IO_BUFFER bytes were read */
-        memmove(iobuf->buffer + (IO_BUFFER - iobuf->level), iobuf->buffer, iobuf->level);
-    }
-
-    return 0;
-}
-
-/******************************************************************************
-Description.: Read a single line from the provided fildescriptor.
-              This funtion will return under two conditions:
-              * line end was reached
-              * timeout occured
-Input Value.: * fd.....: fildescriptor to read from
-              * iobuf..: iobuffer that allows to use this functions from multiple
-                         threads because the complete context is the iobuffer.
-              * buffer.: The buffer to store values at, will be set to zero
-                         before storing values.
-              * len....: the length of buffer
-              * timeout: seconds to wait for an answer
-Return Value: * buffer.: will become filled with bytes read
-              * iobuf..: May get altered to save the context for future calls.
-              * func().: bytes copied to buffer or -1 in case of error
-******************************************************************************/
-/* read just a single line or timeout */
-int _readline(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout)
-{
-    char c = '\0', *out = buffer;
-    int i;
-
-    memset(buffer, 0, len);
-
-    for(i = 0; i < len && c != '\n'; i++) {
-        if(_read(fd, iobuf, &c, 1, timeout) <= 0) {
-            /* timeout or error occured */
-            return -1;
-        }
-        *out++ = c;
-    }
-
-    return i;
+    if(sch == NULL || !isdigit(sch[1]))
+        return 0;
+    return MIN(strtol(sch + 1, NULL, 10), INT_MAX);
 }
 
 /******************************************************************************
@@ -307,129 +211,880 @@ int unescape(char *string)
 
 #ifdef MANAGMENT
 
+static client_shard client_infos[CLIENT_SHARDS];
+
 /******************************************************************************
-Description.: Adds a new client information struct to the ino list.
+Description.: FNV-1a hash of the client address
 Input Value.: Client IP address as a string
-Return Value: Returns with the newly added info or with a pointer to the existing item
+Return Value: hash value
 ******************************************************************************/
-client_info *add_client(char *address)
+static unsigned int client_hash(const char *address)
 {
-    unsigned int i = 0;
-    int name_length = strlen(address) + 1;
+    unsigned int hash = 2166136261u;
 
-    pthread_mutex_lock(&client_infos.mutex);
+    while(*address != '\0') {
+        hash ^= (unsigned char)*address++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    for (; i<client_infos.client_count; i++) {
-        if (strcmp(client_infos.infos[i]->address, address) == 0) {
-            pthread_mutex_unlock(&client_infos.mutex);
-            return client_infos.infos[i];
-        }
+/******************************************************************************
+Description.: Looks up a client in its shard, the shard must be locked
+Input Value.: * shard..: the shard the hash belongs to
+              * hash...: hash of the address
+              * address: Client IP address as a string
+Return Value: the client or NULL if it is not in the table
+******************************************************************************/
+static client_info *find_client(client_shard *shard, unsigned int hash, const char *address)
+{
+    client_info *client = shard->buckets[(hash / CLIENT_SHARDS) % CLIENT_BUCKETS];
+
+    for(; client != NULL; client = client->next) {
+        if(client->hash == hash && strcmp(client->address, address) == 0)
+            return client;
     }
+    return NULL;
+}
 
-    client_info *current_client_info = malloc(sizeof(client_info));
-    if (current_client_info == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        pthread_mutex_unlock(&client_infos.mutex);
-        return NULL;
+/******************************************************************************
+Description.: Removes the clients of a shard which were not seen for ttl
+              seconds, the shard must be locked
+Input Value.: * shard..: the shard to clean up
+              * now....: current time in seconds
+              * ttl....: time to live in seconds
+Return Value: -
+******************************************************************************/
+static void evict_clients(client_shard *shard, time_t now, int ttl)
+{
+    int i;
+    client_info **link, *client;
+
+    for(i = 0; i < CLIENT_BUCKETS; i++) {
+        link = &shard->buckets[i];
+        while((client = *link) != NULL) {
+            if(now - client->last_seen > ttl) {
+                *link = client->next;
+                free(client->address);
+                free(client);
+                shard->client_count--;
+            } else {
+                link = &client->next;
+            }
+        }
     }
+    shard->last_sweep = now;
+}
 
-    current_client_info->address = malloc(name_length * sizeof(char));
-    if (current_client_info->address == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        pthread_mutex_unlock(&client_infos.mutex);
-        return NULL;
+/******************************************************************************
+Description.: Initializes the client table, it is shared by all server instances
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void init_client_table(void)
+{
+    int i;
+
+    memset(client_infos, 0, sizeof(client_infos));
+    for(i = 0; i < CLIENT_SHARDS; i++) {
+        if(pthread_mutex_init(&client_infos[i].mutex, NULL)) {
+            perror("Mutex initialization failed");
+            exit(EXIT_FAILURE);
+        }
     }
+}
 
-    strcpy(current_client_info->address, address);
-    memset(&(current_client_info->last_take_time), 0, sizeof(struct timeval)); // set last time to zero
+void init_clients(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
 
-    client_infos.infos = realloc(client_infos.infos, (client_infos.client_count + 1) * sizeof(client_info*));
-    client_infos.infos[client_infos.client_count] = current_client_info;
-    client_infos.client_count += 1;
+    pthread_once(&once, init_client_table);
+}
 
-    pthread_mutex_unlock(&client_infos.mutex);
-    return current_client_info;
+/******************************************************************************
+Description.: Adds a new client to the table if it is not known yet and
+              refreshes its last seen time. Once per second the shard is
+              cleaned from clients which were idle for longer than ttl.
+Input Value.: * address: Client IP address as a string
+              * ttl....: seconds after which idle clients are removed
+Return Value: -
+******************************************************************************/
+void add_client(const char *address, int ttl)
+{
+    unsigned int hash = client_hash(address);
+    client_shard *shard = &client_infos[hash % CLIENT_SHARDS];
+    client_info *client;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    if(now != shard->last_sweep)
+        evict_clients(shard, now, ttl);
+
+    if((client = find_client(shard, hash, address)) == NULL) {
+        client = calloc(1, sizeof(client_info) + pglobal->inmax * sizeof(token_bucket));
+        if(client == NULL || (client->address = strdup(address)) == NULL) {
+            fprintf(stderr, "could not allocate memory\n");
+            free(client);
+            pthread_mutex_unlock(&shard->mutex);
+            return;
+        }
+        client->hash = hash;
+        client->next = shard->buckets[(hash / CLIENT_SHARDS) % CLIENT_BUCKETS];
+        shard->buckets[(hash / CLIENT_SHARDS) % CLIENT_BUCKETS] = client;
+        shard->client_count++;
+    }
+    client->last_seen = now;
+
+    pthread_mutex_unlock(&shard->mutex);
 }
 
 /******************************************************************************
-Description.: Looks in the client_infos for the current ip address.
-Input Value.: Client IP address as a string
-Return Value: If a frame was served to it within the specified interval it returns 1
+Description.: Takes a token from the bucket the client has for this input.
+              The bucket is refilled with rate tokens per second up to burst.
+              A refused request costs a token as well, so a client that keeps
+              hammering the server stays locked out.
+Input Value.: * address: Client IP address as a string
+              * input..: number of the input plugin
+              * rate...: allowed frames per second, 0 means unlimited
+              * burst..: size of the bucket
+Return Value: If the client exceeded its rate it returns 1
               If not it returns with 0
 ******************************************************************************/
-int check_client_status(client_info *client)
+int check_client_status(const char *address, int input, double rate, double burst)
 {
-    unsigned int i = 0;
-    pthread_mutex_lock(&client_infos.mutex);
-    for (; i<client_infos.client_count; i++) {
-        if (client_infos.infos[i] == client) {
-            long msec;
-            struct timeval tim;
-            gettimeofday(&tim, NULL);
-            msec  =(tim.tv_sec - client_infos.infos[i]->last_take_time.tv_sec)*1000;
-            msec +=(tim.tv_usec - client_infos.infos[i]->last_take_time.tv_usec)/1000;
-            DBG("diff: %ld\n", msec);
-            if ((msec < 1000) && (msec > 0)) { // FIXME make it parameter
-                DBG("CHEATER\n");
-                pthread_mutex_unlock(&client_infos.mutex);
-                return 1;
-            } else {
-                pthread_mutex_unlock(&client_infos.mutex);
-                return 0;
-            }
-        }
+    unsigned int hash = client_hash(address);
+    client_shard *shard = &client_infos[hash % CLIENT_SHARDS];
+    client_info *client;
+    token_bucket *bucket;
+    struct timeval tim;
+    double elapsed;
+    int throttled = 0;
+
+    if(rate <= 0)
+        return 0;
+
+    gettimeofday(&tim, NULL);
+    pthread_mutex_lock(&shard->mutex);
+
+    if((client = find_client(shard, hash, address)) == NULL) {
+        DBG("Client not found in the client list! How did it happend?? This is a BUG\n");
+        pthread_mutex_unlock(&shard->mutex);
+        return 0;
     }
-    DBG("Client not found in the client list! How did it happend?? This is a BUG\n");
-    pthread_mutex_unlock(&client_infos.mutex);
-    return 0;
+
+    bucket = &client->bucket[input];
+    if(bucket->refill.tv_sec == 0) {
+        bucket->tokens = burst;
+    } else {
+        elapsed = (tim.tv_sec - bucket->refill.tv_sec) +
+                  (tim.tv_usec - bucket->refill.tv_usec) / 1000000.0;
+        bucket->tokens = MIN(bucket->tokens + elapsed * rate, burst);
+    }
+    bucket->refill = tim;
+    client->last_seen = tim.tv_sec;
+
+    DBG("tokens: %f\n", bucket->tokens);
+    if(bucket->tokens < 1) {
+        DBG("CHEATER\n");
+        throttled = 1;
+    }
+    bucket->tokens = MAX(bucket->tokens - 1, -burst);
+
+    pthread_mutex_unlock(&shard->mutex);
+    return throttled;
 }
 
-void update_client_timestamp(client_info *client)
+void update_client_timestamp(const char *address)
 {
+    unsigned int hash = client_hash(address);
+    client_shard *shard = &client_infos[hash % CLIENT_SHARDS];
+    client_info *client;
     struct timeval tim;
-    pthread_mutex_lock(&client_infos.mutex);
+
     gettimeofday(&tim, NULL);
-    memcpy(&client->last_take_time, &tim, sizeof(struct timeval));
-    pthread_mutex_unlock(&client_infos.mutex);
+    pthread_mutex_lock(&shard->mutex);
+    if((client = find_client(shard, hash, address)) != NULL) {
+        client->last_take_time = tim;
+        client->last_seen = tim.tv_sec;
+    }
+    pthread_mutex_unlock(&shard->mutex);
 }
 #endif
 
+/* cleanup handler, releases a mutex held while the thread got cancelled */
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+static void free_frame(void *arg)
+{
+    shared_frame *frame = arg;
+
+    if(frame != NULL)
+        free(frame->data);
+    free(frame);
+}
+
 /******************************************************************************
-Description.: Send a complete HTTP response and a single JPG-frame.
-Input Value.: fildescriptor fd to send the answer to
+Description.: Drops a reference to a frame. The last reference keeps the frame
+              as spare for the watcher, so the buffers are not allocated for
+              every single frame.
+Input Value.: * input_number: the input the frame belongs to
+              * frame..: the frame
 Return Value: -
 ******************************************************************************/
-void send_snapshot(cfd *context_fd, int input_number)
+static void release_frame(int input_number, shared_frame *frame)
 {
-    unsigned char *frame = NULL;
-    int frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    input_watcher *watcher = &watchers[input_number];
+
+    pthread_mutex_lock(&watcher->mutex);
+    if(--frame->refcount == 0) {
+        if(watcher->spare == NULL)
+            watcher->spare = frame;
+        else
+            free_frame(frame);
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+}
+
+/******************************************************************************
+Description.: Waits until the watcher published a frame newer than sequence
+              and takes a reference to it
+Input Value.: * input_number: the input
+              * sequence: the last frame the caller got, it is updated
+Return Value: the frame, release it with release_frame(), or NULL if no
+              frame arrived within a second or the server stops
+******************************************************************************/
+static shared_frame *wait_frame(int input_number, unsigned long *sequence)
+{
+    input_watcher *watcher = &watchers[input_number];
+    shared_frame *frame = NULL;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+
+    pthread_mutex_lock(&watcher->mutex);
+    watcher->waiting++;
+    while(!pglobal->stop && (watcher->current == NULL || watcher->current->sequence <= *sequence)) {
+        if(pthread_cond_timedwait(&watcher->update, &watcher->mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+    watcher->waiting--;
+    if(!pglobal->stop && watcher->current != NULL && watcher->current->sequence > *sequence) {
+        frame = watcher->current;
+        frame->refcount++;
+        *sequence = frame->sequence;
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+
+    return frame;
+}
+
+/*
+ * the plugin a client gets frames from was unloaded, wait_frame() would
+ * return the frames of the next plugin loaded into the slot
+ */
+static int input_gone(int input_number, unsigned int generation)
+{
+    return pglobal->in[input_number].generation != generation;
+}
+
+/* sequence number of the last published frame, wait_frame() returns newer ones */
+static unsigned long frame_sequence(int input_number)
+{
+    unsigned long sequence;
 
-    /* wait for a fresh frame */
-    pthread_mutex_lock(&pglobal->in[input_number].db);
-    pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+    pthread_mutex_lock(&watchers[input_number].mutex);
+    sequence = watchers[input_number].frames;
+    pthread_mutex_unlock(&watchers[input_number].mutex);
+    return sequence;
+}
 
-    /* read buffer */
-    frame_size = pglobal->in[input_number].size;
+/******************************************************************************
+Description.: Hands out the frame in the size a client asked for. The frames
+              are scaled in steps of 1/8 to the largest size not wider than
+              requested, every size is made only once per frame no matter
+              how many clients want it.
+Input Value.: * input_number: the input the frame belongs to
+              * frame..: the frame, the caller keeps its reference
+              * width..: the requested width
+Return Value: a new reference to the scaled frame, or to the original one if
+              it is small enough already or can not be scaled
+******************************************************************************/
+static shared_frame *scale_frame(int input_number, shared_frame *frame, int width)
+{
+    input_watcher *watcher = &watchers[input_number];
+    int scale;
+
+    for(scale = 8; scale > 1 && (frame->width * scale + 7) / 8 > width; scale--);
+
+    #ifndef NO_LIBJPEG
+    if(scale < 8 && frame->width > 0) {
+        scaled_variant *variant = &watcher->scaled[scale];
+        shared_frame *scaled = NULL, *previous = NULL;
+        int size;
+
+        pthread_mutex_lock(&variant->mutex);
+
+        pthread_mutex_lock(&watcher->mutex);
+        if(variant->current != NULL && variant->current->sequence == frame->sequence) {
+            /* another client scaled this frame already */
+            scaled = variant->current;
+            scaled->refcount++;
+            pthread_mutex_unlock(&watcher->mutex);
+            pthread_mutex_unlock(&variant->mutex);
+            return scaled;
+        }
+        if(variant->current != NULL && variant->current->refcount == 1) {
+            /* no client holds the last scaled frame, reuse its buffer */
+            scaled = variant->current;
+        } else {
+            previous = variant->current;
+        }
+        variant->current = NULL;
+        pthread_mutex_unlock(&watcher->mutex);
+
+        if(previous != NULL)
+            release_frame(input_number, previous);
+
+        if(scaled == NULL)
+            scaled = calloc(1, sizeof(shared_frame));
+
+        if(scaled != NULL && (size = jpeg_scale(frame->data, frame->size, scale, SCALE_QUALITY, &scaled->data, &scaled->capacity)) > 0) {
+            scaled->sequence = frame->sequence;
+            scaled->input_sequence = frame->input_sequence;
+            scaled->timestamp = frame->timestamp;
+            scaled->capture_time = frame->capture_time;
+            scaled->size = size;
+            scaled->width = scaled->height = 0;
+            jpeg_dimensions(scaled->data, scaled->size, &scaled->width, &scaled->height);
+
+            /* one reference for the variant, one for the caller */
+            scaled->refcount = 2;
+            variant->current = scaled;
+            pthread_mutex_unlock(&variant->mutex);
+            return scaled;
+        }
+
+        DBG("could not scale the frame, sending it unscaled\n");
+        free_frame(scaled);
+        pthread_mutex_unlock(&variant->mutex);
+    }
+    #endif
 
-    /* allocate a buffer for this single frame */
-    if((frame = malloc(frame_size + 1)) == NULL) {
-        free(frame);
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
-        send_error(context_fd->fd, 500, "not enough memory");
+    pthread_mutex_lock(&watcher->mutex);
+    frame->refcount++;
+    pthread_mutex_unlock(&watcher->mutex);
+    return frame;
+}
+
+/******************************************************************************
+Description.: Paces the frames sent to a client which asked for a lower frame
+              rate. The due time advances by whole periods, so the rate is
+              kept even if the frames of the input do not fit it exactly.
+Input Value.: * frame..: the frame to send or to skip
+              * fps....: requested frames per second, 0 sends every frame
+              * due....: capture time the next frame is due, starts with 0
+Return Value: 1 if the frame should be sent, 0 if it should be skipped
+******************************************************************************/
+static int frame_due(shared_frame *frame, double fps, double *due)
+{
+    double captured = frame->capture_time.tv_sec + frame->capture_time.tv_nsec / 1000000000.0;
+
+    if(fps <= 0)
+        return 1;
+    /* a little early is fine, the next frame may come much later */
+    if(captured < *due - 0.25 / fps)
+        return 0;
+
+    *due += 1 / fps;
+    if(*due <= captured)
+        *due = captured + 1 / fps;
+    return 1;
+}
+
+/******************************************************************************
+Description.: Lets a client which asked for a lower frame rate sleep until
+              its next frame is due. It does not wait for the frames it
+              would skip, so the input does not compress them for it.
+Input Value.: * fps....: requested frames per second, 0 does not sleep
+              * due....: capture time the next frame is due
+Return Value: -
+******************************************************************************/
+static void sleep_until_due(double fps, double due)
+{
+    struct timespec now;
+    double wait;
+
+    if(fps <= 0)
         return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wait = due - 0.25 / fps - (now.tv_sec + now.tv_nsec / 1000000000.0);
+    if(wait > 0)
+        usleep(MIN(wait, 1) * 1000000);
+}
+
+/******************************************************************************
+Description.: Reads the fps= and width= parameters of a request
+Input Value.: * req....: the request
+Return Value: * fps....: requested frame rate, 0 if not given
+              * width..: requested width, 0 if not given
+******************************************************************************/
+static void frame_options(request *req, double *fps, int *width)
+{
+    char *value;
+    int len;
+
+    *fps = 0;
+    *width = 0;
+    if(req == NULL)
+        return;
+    if((value = query_value(req->query_string, "fps", &len)) != NULL)
+        *fps = MAX(strtod(value, NULL), 0);
+    if((value = query_value(req->query_string, "width", &len)) != NULL)
+        *width = MAX(atoi(value), 0);
+}
+
+/******************************************************************************
+Description.: Waits for the next frame of the input and copies it into the
+              given shared frame, the frame is freed if the thread gets
+              cancelled while it waits. This runs in its own function so the
+              cleanup handlers do not share a stack frame with the locals the
+              watcher carries from one frame to the next.
+Input Value.: in is the input, watcher the watcher of that input, frame the
+              frame to fill and generation the last seen generation of the
+              plugin slot, it gets updated
+Return Value: 1 if the plugin was unloaded from the slot since the last frame,
+              0 otherwise
+******************************************************************************/
+static int copy_frame(input *in, input_watcher *watcher, shared_frame *frame, unsigned int *generation)
+{
+    int wanted, unloaded;
+
+    pthread_cleanup_push(free_frame, frame);
+
+    /* wait for fresh frames */
+    pthread_mutex_lock(&in->db);
+    pthread_cleanup_push(unlock_mutex, &in->db);
+    pthread_cond_wait(&in->db_update, &in->db);
+    unloaded = (in->generation != *generation);
+    *generation = in->generation;
+
+    /* an uncompressed frame is compressed only if a client waits for it */
+    pthread_mutex_lock(&watcher->mutex);
+    wanted = !in->raw || watcher->waiting > 0;
+    pthread_mutex_unlock(&watcher->mutex);
+
+    /* check if framebuffer is large enough, increase it if necessary */
+    frame->size = 0;
+    if(wanted) {
+        input_frame(in);
+        if(in->size > frame->capacity) {
+            unsigned char *tmp;
+
+            DBG("increasing buffer size to %d\n", in->size);
+            if((tmp = realloc(frame->data, in->size + TEN_K)) != NULL) {
+                frame->data = tmp;
+                frame->capacity = in->size + TEN_K;
+            }
+        }
+        if(in->size > 0 && in->size <= frame->capacity) {
+            memcpy(frame->data, in->buf, in->size);
+            frame->size = in->size;
+        }
+    }
+    frame->timestamp = in->timestamp;
+    frame->capture_time = in->capture_time;
+    frame->input_sequence = in->sequence;
+    frame->width = frame->height = 0;
+
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(0);
+
+    return unloaded;
+}
+
+/******************************************************************************
+Description.: Copies each frame of one input plugin once and hands it to all
+              clients of all server instances. The clients no longer copy
+              the frame under the lock of the input, a slow client just gets
+              the most recent frame when it is ready for the next one.
+              The frames are counted for the statistics as well.
+Input Value.: arg is the number of the input
+Return Value: always NULL
+******************************************************************************/
+static void *watcher_thread(void *arg)
+{
+    int input_number = (int)(long)arg;
+    input_watcher *watcher = &watchers[input_number];
+    input *in = &pglobal->in[input_number];
+    shared_frame *frame, *previous;
+    struct timeval now;
+    int unloaded;
+    unsigned int generation = in->generation;
+    unsigned long window_frames = 0;
+    struct timeval window_start;
+
+    pglobal->thread_start(Dest_Output, watcher_output, "watcher");
+    gettimeofday(&window_start, NULL);
+
+    while(!pglobal->stop) {
+        /* reuse a frame no client holds any more */
+        pthread_mutex_lock(&watcher->mutex);
+        frame = watcher->spare;
+        watcher->spare = NULL;
+        pthread_mutex_unlock(&watcher->mutex);
+
+        if(frame == NULL && (frame = calloc(1, sizeof(shared_frame))) == NULL) {
+            DBG("could not allocate memory\n");
+            usleep(100 * 1000);
+            continue;
+        }
+
+        unloaded = copy_frame(in, watcher, frame, &generation);
+
+        /* the plugin was unloaded from the slot, nobody gets its last frame any more */
+        if(unloaded) {
+            pthread_mutex_lock(&watcher->mutex);
+            previous = watcher->current;
+            watcher->current = NULL;
+            watcher->fps = 0;
+            pthread_cond_broadcast(&watcher->update);
+            pthread_mutex_unlock(&watcher->mutex);
+            if(previous != NULL)
+                release_frame(input_number, previous);
+        }
+
+        /* clients which ask for a smaller picture need the size of the frame */
+        jpeg_dimensions(frame->data, frame->size, &frame->width, &frame->height);
+
+        gettimeofday(&now, NULL);
+        window_frames++;
+
+        pthread_mutex_lock(&watcher->mutex);
+        watcher->frames++;
+        watcher->last_frame = now;
+        if(now.tv_sec - window_start.tv_sec >= 1) {
+            double elapsed = (now.tv_sec - window_start.tv_sec) +
+                             (now.tv_usec - window_start.tv_usec) / 1000000.0;
+            watcher->fps = window_frames / elapsed;
+            window_frames = 0;
+            window_start = now;
+        }
+
+        if(frame->size == 0) {
+            /* nobody wanted the frame or not enough memory, keep the previous frame */
+            watcher->spare = frame;
+            pthread_mutex_unlock(&watcher->mutex);
+            continue;
+        }
+
+        /* publish the frame, the watcher holds one reference itself */
+        frame->sequence = watcher->frames;
+        frame->refcount = 1;
+        previous = watcher->current;
+        watcher->current = frame;
+        pthread_cond_broadcast(&watcher->update);
+        pthread_mutex_unlock(&watcher->mutex);
+
+        if(previous != NULL)
+            release_frame(input_number, previous);
     }
-    /* copy v4l2_buffer timeval to user space */
-    timestamp = pglobal->in[input_number].timestamp;
 
-    memcpy(frame, pglobal->in[input_number].buf, frame_size);
-    DBG("got frame (size: %d kB)\n", frame_size / 1024);
+    return NULL;
+}
 
-    pthread_mutex_unlock(&pglobal->in[input_number].db);
+/******************************************************************************
+Description.: Allocates the watchers and JSON caches for all plugin slots,
+              including the free ones, all servers share them
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void alloc_tables(void)
+{
+    int i, j;
+
+    watchers = calloc(pglobal->inmax + 1, sizeof(input_watcher));
+    input_json = calloc(pglobal->inmax + 1, sizeof(json_cache));
+    output_json = calloc(pglobal->outmax + 1, sizeof(json_cache));
+    if(watchers == NULL || input_json == NULL || output_json == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(i = 0; i < pglobal->inmax; i++) {
+        pthread_mutex_init(&watchers[i].mutex, NULL);
+        pthread_cond_init(&watchers[i].update, NULL);
+        for(j = 0; j < LENGTH_OF(watchers[i].scaled); j++)
+            pthread_mutex_init(&watchers[i].scaled[j].mutex, NULL);
+        pthread_mutex_init(&input_json[i].mutex, NULL);
+    }
+    for(i = 0; i < pglobal->outmax; i++)
+        pthread_mutex_init(&output_json[i].mutex, NULL);
+}
+
+/******************************************************************************
+Description.: Starts the watcher threads when the first server starts
+Input Value.: id of the output which starts them
+Return Value: -
+******************************************************************************/
+void start_watchers(int id)
+{
+    int i;
+
+    pthread_mutex_lock(&events_mutex);
+    if(watchers == NULL)
+        alloc_tables();
+    if(watcher_users++ == 0) {
+        watcher_output = id;
+        /* the free slots are watched as well, an input may be added later */
+        for(i = 0; i < pglobal->inmax; i++) {
+            if(pthread_create(&watchers[i].thread, NULL, watcher_thread, (void *)(long)i) != 0) {
+                DBG("could not start the watcher of input %d\n", i);
+                continue;
+            }
+            watchers[i].running = 1;
+        }
+    }
+    pthread_mutex_unlock(&events_mutex);
+}
+
+/******************************************************************************
+Description.: Stops the watcher threads when the last server stops. Frames
+              still held by clients are freed when they release them.
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void stop_watchers(void)
+{
+    shared_frame *current;
+    int i;
+
+    pthread_mutex_lock(&events_mutex);
+    if(--watcher_users == 0) {
+        for(i = 0; i < pglobal->inmax; i++) {
+            if(!watchers[i].running)
+                continue;
+            pthread_cancel(watchers[i].thread);
+            pthread_join(watchers[i].thread, NULL);
+            watchers[i].running = 0;
+
+            pthread_mutex_lock(&watchers[i].mutex);
+            current = watchers[i].current;
+            watchers[i].current = NULL;
+            free_frame(watchers[i].spare);
+            watchers[i].spare = NULL;
+            pthread_mutex_unlock(&watchers[i].mutex);
+
+            if(current != NULL)
+                release_frame(i, current);
+        }
+    }
+    pthread_mutex_unlock(&events_mutex);
+}
+
+/******************************************************************************
+Description.: Adds or removes a streaming client of an input
+Input Value.: * input_number: the input
+              * delta..: 1 when a stream starts, -1 when it ends
+Return Value: -
+******************************************************************************/
+static void count_stream_client(int input_number, int delta)
+{
+    pthread_mutex_lock(&watchers[input_number].mutex);
+    watchers[input_number].clients += delta;
+    pthread_mutex_unlock(&watchers[input_number].mutex);
+
+    /* the watcher takes every frame, but only the clients need them */
+    input_demand(&pglobal->in[input_number], delta);
+}
+
+/******************************************************************************
+Description.: Wakes up the event streams, e.g. because a control was set
+Input Value.: -
+Return Value: -
+******************************************************************************/
+void notify_events(void)
+{
+    pthread_mutex_lock(&events_mutex);
+    pthread_cond_broadcast(&events_update);
+    pthread_mutex_unlock(&events_mutex);
+}
+
+/******************************************************************************
+Description.: Appends a "control" event with the current values of all
+              controls of a plugin
+Input Value.: * sb.....: string to append to
+              * dest...: 0 for input plugins, 1 for output plugins
+              * plugin.: the plugin number
+              * controls, count: the controls of the plugin
+Return Value: -
+******************************************************************************/
+static void render_control_event(strbuf *sb, int dest, int plugin, control *controls, int count)
+{
+    int i;
+
+    strbuf_printf(sb,
+            "event: control\n"
+            "data: {\"dest\": \"%d\", \"plugin\": \"%d\", \"controls\": [",
+            dest, plugin);
+    for(i = 0; controls != NULL && i < count; i++) {
+        strbuf_printf(sb, "%s{\"id\": \"%d\", \"group\": \"%d\", \"value\": \"%d\"}",
+                (i > 0) ? ", " : "",
+                controls[i].ctrl.id, controls[i].group, controls[i].value);
+    }
+    strbuf_printf(sb, "]}\n\n");
+}
+
+/******************************************************************************
+Description.: Appends a "stats" event with the frame rate and the number of
+              streaming clients of each input and the number of connections
+Input Value.: * sb.....: string to append to
+              * now....: current time
+Return Value: -
+******************************************************************************/
+static void render_stats_event(strbuf *sb, struct timeval *now)
+{
+    const char *separator = "";
+    int i;
+
+    strbuf_printf(sb,
+            "event: stats\n"
+            "data: {\"inputs\": [");
+    for(i = 0; i < pglobal->incnt; i++) {
+        input_watcher *watcher = &watchers[i];
+        double fps;
+
+        if(pglobal->in[i].state == PLUGIN_FREE)
+            continue;
+        pthread_mutex_lock(&watcher->mutex);
+        /* the rate is only updated when frames arrive */
+        fps = (now->tv_sec - watcher->last_frame.tv_sec > 2) ? 0 : watcher->fps;
+        strbuf_printf(sb, "%s{\"id\": \"%d\", \"fps\": \"%.1f\", \"frames\": \"%lu\", \"clients\": \"%d\", "
+                "\"captured\": \"%lu\", \"encoded\": \"%lu\"}",
+                separator, i, fps, watcher->frames, watcher->clients,
+                pglobal->in[i].sequence, pglobal->in[i].encoded);
+        pthread_mutex_unlock(&watcher->mutex);
+        separator = ", ";
+    }
+    strbuf_printf(sb, "], \"connections\": \"%d\"}\n\n", connections);
+}
+
+/******************************************************************************
+Description.: Sends a stream of server-sent events. The current values of
+              all controls are sent when the stream starts and again when a
+              control of a plugin changed. Once per second the frame rates
+              and client counts follow as "stats" event.
+Input Value.: * context_fd: the connected client
+Return Value: -
+******************************************************************************/
+void send_events(cfd *context_fd)
+{
+    char buffer[BUFFER_SIZE] = {0};
+    unsigned int *in_version, *out_version;
+    struct timeval now, next_stats = {0};
+    struct timespec deadline;
+    strbuf sb = {0};
+    int i;
+
+    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
+            "Access-Control-Allow-Origin: *\r\n" \
+            STD_HEADER \
+            "Content-Type: text/event-stream\r\n" \
+            "\r\n");
+    if(write(context_fd->fd, buffer, strlen(buffer)) < 0)
+        return;
+
+    /* plugins may be added while the stream runs */
+    in_version = calloc(pglobal->inmax + pglobal->outmax + 1, sizeof(unsigned int));
+    if(in_version == NULL)
+        return;
+    out_version = in_version + pglobal->inmax;
+
+    /* make sure everything is sent once */
+    for(i = 0; i < pglobal->inmax; i++)
+        in_version[i] = pglobal->in[i].controls_version - 1;
+    for(i = 0; i < pglobal->outmax; i++)
+        out_version[i] = pglobal->out[i].controls_version - 1;
+
+    while(!pglobal->stop) {
+        sb.length = 0;
+
+        pglobal->plugins_lock();
+        for(i = 0; i < pglobal->incnt; i++) {
+            if(in_version[i] == pglobal->in[i].controls_version)
+                continue;
+            in_version[i] = pglobal->in[i].controls_version;
+            render_control_event(&sb, 0, i, pglobal->in[i].in_parameters, pglobal->in[i].parametercount);
+        }
+        for(i = 0; i < pglobal->outcnt; i++) {
+            if(out_version[i] == pglobal->out[i].controls_version)
+                continue;
+            out_version[i] = pglobal->out[i].controls_version;
+            render_control_event(&sb, 1, i, pglobal->out[i].out_parameters, pglobal->out[i].parametercount);
+        }
+        pglobal->plugins_unlock();
+
+        gettimeofday(&now, NULL);
+        if(timercmp(&now, &next_stats, >=)) {
+            render_stats_event(&sb, &now);
+            next_stats = now;
+            next_stats.tv_sec += 1;
+        }
+
+        if(sb.length > 0 && write(context_fd->fd, sb.data, sb.length) < 0)
+            break;
+
+        /* sleep until a control changes or the next stats are due */
+        deadline.tv_sec = next_stats.tv_sec;
+        deadline.tv_nsec = next_stats.tv_usec * 1000;
+        pthread_mutex_lock(&events_mutex);
+        pthread_cond_timedwait(&events_update, &events_mutex, &deadline);
+        pthread_mutex_unlock(&events_mutex);
+    }
+
+    free(in_version);
+    strbuf_free(&sb);
+}
+
+/******************************************************************************
+Description.: Send a complete HTTP response and a single JPG-frame.
+Input Value.: fildescriptor fd to send the answer to
+              req may ask for a smaller picture with width=
+Return Value: -
+******************************************************************************/
+void send_snapshot(cfd *context_fd, int input_number, request *req)
+{
+    shared_frame *frame = NULL, *scaled;
+    unsigned long sequence = frame_sequence(input_number);
+    unsigned int generation = pglobal->in[input_number].generation;
+    char buffer[BUFFER_SIZE] = {0};
+    double fps;
+    int width;
+
+    frame_options(req, &fps, &width);
+
+    /* wait for a fresh frame, an input which captures on demand starts now */
+    input_demand(&pglobal->in[input_number], 1);
+    while(!pglobal->stop && !input_gone(input_number, generation) &&
+          (frame = wait_frame(input_number, &sequence)) == NULL);
+    input_demand(&pglobal->in[input_number], -1);
+    if(frame == NULL)
+        return;
+    DBG("got frame (size: %d kB)\n", frame->size / 1024);
+
+    if(width > 0) {
+        scaled = scale_frame(input_number, frame, width);
+        release_frame(input_number, frame);
+        frame = scaled;
+    }
 
     #ifdef MANAGMENT
-    update_client_timestamp(context_fd->client);
+    update_client_timestamp(context_fd->address);
     #endif
 
     /* write the response */
@@ -437,30 +1092,35 @@ void send_snapshot(cfd *context_fd, int input_number)
             "Access-Control-Allow-Origin: *\r\n" \
             STD_HEADER \
             "Content-type: image/jpeg\r\n" \
-            "X-Timestamp: %d.%06d\r\n" \
-            "\r\n", (int) timestamp.tv_sec, (int) timestamp.tv_usec);
+            FRAME_HEADER \
+            "\r\n", FRAME_HEADER_VALUES(frame));
 
     /* send header and image now */
     if (write(context_fd->fd, buffer, strlen(buffer)) < 0 ||
-        write(context_fd->fd, frame, frame_size) < 0) {
-        free(frame);
-        return;
+        write(context_fd->fd, frame->data, frame->size) < 0) {
+        DBG("write failed, done anyway\n");
     }
 
-    free(frame);
+    release_frame(input_number, frame);
 }
 
 /******************************************************************************
 Description.: Send a complete HTTP response and a stream of JPG-frames.
 Input Value.: fildescriptor fd to send the answer to
+              req may ask for a lower frame rate with fps= and for smaller
+              pictures with width=
 Return Value: -
 ******************************************************************************/
-void send_stream(cfd *context_fd, int input_number)
+void send_stream(cfd *context_fd, int input_number, request *req)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
+    shared_frame *frame, *scaled;
+    unsigned long sequence = frame_sequence(input_number);
+    unsigned int generation = pglobal->in[input_number].generation;
     char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    double fps, due = 0;
+    int width, rc;
+
+    frame_options(req, &fps, &width);
 
     DBG("preparing header\n");
     sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
@@ -471,46 +1131,33 @@ void send_stream(cfd *context_fd, int input_number)
             "--" BOUNDARY "\r\n");
 
     if(write(context_fd->fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
         return;
     }
 
     DBG("Headers send, sending stream now\n");
 
-    while(!pglobal->stop) {
+    while(!pglobal->stop && !input_gone(input_number, generation)) {
 
         /* wait for fresh frames */
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
-
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
-
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(context_fd->fd, 500, "not enough memory");
-                return;
-            }
+        sleep_until_due(fps, due);
+        if((frame = wait_frame(input_number, &sequence)) == NULL)
+            continue;
+        DBG("got frame (size: %d kB)\n", frame->size / 1024);
 
-            frame = tmp;
+        /* skipping is cheap, the frame was not scaled yet */
+        if(!frame_due(frame, fps, &due)) {
+            release_frame(input_number, frame);
+            continue;
         }
 
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
-
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
-
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        if(width > 0) {
+            scaled = scale_frame(input_number, frame, width);
+            release_frame(input_number, frame);
+            frame = scaled;
+        }
 
         #ifdef MANAGMENT
-        update_client_timestamp(context_fd->client);
+        update_client_timestamp(context_fd->address);
         #endif
 
         /*
@@ -520,20 +1167,146 @@ void send_stream(cfd *context_fd, int input_number)
          */
         sprintf(buffer, "Content-Type: image/jpeg\r\n" \
                 "Content-Length: %d\r\n" \
-                "X-Timestamp: %d.%06d\r\n" \
-                "\r\n", frame_size, (int)timestamp.tv_sec, (int)timestamp.tv_usec);
+                FRAME_HEADER \
+                "\r\n", frame->size, FRAME_HEADER_VALUES(frame));
         DBG("sending intemdiate header\n");
-        if(write(context_fd->fd, buffer, strlen(buffer)) < 0) break;
+        rc = write(context_fd->fd, buffer, strlen(buffer));
 
         DBG("sending frame\n");
-        if(write(context_fd->fd, frame, frame_size) < 0) break;
+        if(rc >= 0)
+            rc = write(context_fd->fd, frame->data, frame->size);
+
+        release_frame(input_number, frame);
+        if(rc < 0) break;
 
         DBG("sending boundary\n");
         sprintf(buffer, "\r\n--" BOUNDARY "\r\n");
         if(write(context_fd->fd, buffer, strlen(buffer)) < 0) break;
     }
+}
 
-    free(frame);
+/******************************************************************************
+Description.: Streams the frames over a WebSocket. Each frame is one binary
+              message, the JPEG data follows a header of four 32 bit big
+              endian values: sequence number, capture time in seconds and
+              microseconds and the size of the JPEG data.
+              If the client asked for a window of N frames it has to send
+              the sequence number of each frame it finished as text message.
+              Frames are skipped while N frames are not acknowledged, so a
+              slow client gets fewer but current frames.
+Input Value.: * context_fd: the connected client
+              * input_number: the input to stream
+              * req....: the request, it carries the handshake
+Return Value: -
+******************************************************************************/
+void send_ws(cfd *context_fd, int input_number, request *req)
+{
+    char buffer[BUFFER_SIZE] = {0}, accept[WS_ACCEPT_LENGTH];
+    char *key = request_header(req, "Sec-WebSocket-Key");
+    char *upgrade = request_header(req, "Upgrade");
+    char *value;
+    unsigned char payload[126];
+    unsigned long sequence = frame_sequence(input_number), acked;
+    unsigned long unacked[WS_MAX_WINDOW];   /* sequence numbers of the frames sent, oldest first */
+    int first = 0, pending = 0;
+    unsigned int generation = pglobal->in[input_number].generation;
+    uint32_t header[4];
+    shared_frame *frame, *scaled;
+    struct timeval tv;
+    fd_set fds;
+    double fps, due = 0;
+    int window = 0, width, len, opcode, rc;
+
+    if(key == NULL || upgrade == NULL || strcasecmp(upgrade, "websocket") != 0) {
+        send_error(context_fd->fd, 400, "WebSocket handshake expected");
+        return;
+    }
+    if((value = query_value(req->query_string, "window", &len)) != NULL)
+        window = MIN(MAX(atoi(value), 0), WS_MAX_WINDOW);
+    frame_options(req, &fps, &width);
+
+    ws_accept_key(key, accept);
+    sprintf(buffer, "HTTP/1.1 101 Switching Protocols\r\n" \
+            "Upgrade: websocket\r\n" \
+            "Connection: Upgrade\r\n" \
+            "Sec-WebSocket-Accept: %s\r\n" \
+            "\r\n", accept);
+    if(write(context_fd->fd, buffer, strlen(buffer)) < 0)
+        return;
+
+    DBG("WebSocket established, window: %d\n", window);
+
+    while(!pglobal->stop && !input_gone(input_number, generation)) {
+        sleep_until_due(fps, due);
+        frame = wait_frame(input_number, &sequence);
+
+        /* handle the messages the client sent in the meantime */
+        while(1) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
+            FD_ZERO(&fds);
+            FD_SET(context_fd->fd, &fds);
+            if(select(context_fd->fd + 1, &fds, NULL, NULL, &tv) <= 0)
+                break;
+
+            if((len = ws_read_frame(context_fd->fd, &opcode, payload, sizeof(payload))) < 0 || opcode == WS_CLOSE) {
+                DBG("WebSocket closed by the client\n");
+                ws_write_frame(context_fd->fd, WS_CLOSE, NULL, 0, NULL, 0);
+                if(frame != NULL)
+                    release_frame(input_number, frame);
+                return;
+            }
+
+            if(opcode == WS_PING) {
+                ws_write_frame(context_fd->fd, WS_PONG, NULL, 0, payload, len);
+            } else if(opcode == WS_TEXT) {
+                /* the acknowledgement covers this frame and all sent before it */
+                acked = strtoul((char *)payload, NULL, 10);
+                while(pending > 0 && unacked[first] <= acked) {
+                    first = (first + 1) % WS_MAX_WINDOW;
+                    pending--;
+                }
+            }
+        }
+
+        if(frame == NULL)
+            continue;
+
+        if(window > 0 && pending >= window) {
+            DBG("skipping frame %lu, %d frames are not acknowledged\n", frame->input_sequence, pending);
+            release_frame(input_number, frame);
+            continue;
+        }
+
+        if(!frame_due(frame, fps, &due)) {
+            release_frame(input_number, frame);
+            continue;
+        }
+
+        if(width > 0) {
+            scaled = scale_frame(input_number, frame, width);
+            release_frame(input_number, frame);
+            frame = scaled;
+        }
+
+        #ifdef MANAGMENT
+        update_client_timestamp(context_fd->address);
+        #endif
+
+        header[0] = htonl(frame->input_sequence);
+        header[1] = htonl(frame->timestamp.tv_sec);
+        header[2] = htonl(frame->timestamp.tv_usec);
+        header[3] = htonl(frame->size);
+        rc = ws_write_frame(context_fd->fd, WS_BINARY, header, sizeof(header), frame->data, frame->size);
+        if(window > 0) {
+            unacked[(first + pending) % WS_MAX_WINDOW] = frame->input_sequence;
+            pending++;
+        }
+
+        release_frame(input_number, frame);
+        if(rc < 0)
+            break;
+    }
 }
 
 #ifdef WXP_COMPAT
@@ -544,10 +1317,11 @@ Return Value: -
 ******************************************************************************/
 void send_stream_wxp(cfd *context_fd, int input_number)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
+    shared_frame *frame;
+    unsigned long sequence = frame_sequence(input_number);
+    unsigned int generation = pglobal->in[input_number].generation;
     char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    int rc;
 
     DBG("preparing header\n");
 
@@ -574,58 +1348,34 @@ void send_stream_wxp(cfd *context_fd, int input_number)
                     expDateBuffer);
 
     if(write(context_fd->fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
         return;
     }
 
     DBG("Headers send, sending stream now\n");
 
-    while(!pglobal->stop) {
+    while(!pglobal->stop && !input_gone(input_number, generation)) {
 
         /* wait for fresh frames */
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
-
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
-
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(context_fd->fd, 500, "not enough memory");
-                return;
-            }
-
-            frame = tmp;
-        }
-
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
+        if((frame = wait_frame(input_number, &sequence)) == NULL)
+            continue;
+        DBG("got frame (size: %d kB)\n", frame->size / 1024);
 
         #ifdef MANAGMENT
-        update_client_timestamp(context_fd->client);
+        update_client_timestamp(context_fd->address);
         #endif
 
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
-
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
-
         memset(buffer, 0, 50*sizeof(char));
-        sprintf(buffer, "mjpeg %07d12345", frame_size);
+        sprintf(buffer, "mjpeg %07d12345", frame->size);
         DBG("sending intemdiate header\n");
-        if(write(context_fd->fd, buffer, 50) < 0) break;
+        rc = write(context_fd->fd, buffer, 50);
 
         DBG("sending frame\n");
-        if(write(context_fd->fd, frame, frame_size) < 0) break;
-    }
+        if(rc >= 0)
+            rc = write(context_fd->fd, frame->data, frame->size);
 
-    free(frame);
+        release_frame(input_number, frame);
+        if(rc < 0) break;
+    }
 }
 #endif
 
@@ -669,6 +1419,13 @@ void send_error(int fd, int which, char *message)
                 "\r\n" \
                 "400: Not Found!\r\n" \
                 "%s", message);
+    } else if(which == 431) {
+        sprintf(buffer, "HTTP/1.0 431 Request Header Fields Too Large\r\n" \
+                "Content-type: text/plain\r\n" \
+                STD_HEADER \
+                "\r\n" \
+                "431: Request Header Fields Too Large!\r\n" \
+                "%s", message);
     } else if (which == 403) {
         sprintf(buffer, "HTTP/1.0 403 Forbidden\r\n" \
                 "Content-type: text/plain\r\n" \
@@ -867,6 +1624,7 @@ void command(int id, int fd, char *parameter)
     char buffer[BUFFER_SIZE] = {0};
     char *command = NULL, *svalue = NULL, *value, *command_id_string;
     int res = 0, ivalue = 0, command_id = -1,  len = 0;
+    int (*cmd)(int, unsigned int, unsigned int, int, char *);
 
     DBG("parameter is: %s\n", parameter);
 
@@ -973,32 +1731,42 @@ void command(int id, int fd, char *parameter)
     int plugin_no = 0; // default plugin no = 0 for compatibility reasons
     if((value = strstr(parameter, "plugin=")) != NULL) {
         value += strlen("plugin=");
-        len = strspn(value, "-1234567890");
+        len = strcspn(value, "&");
         if((svalue = strndup(value, len)) == NULL) {
             if(command != NULL) free(command);
             send_error(fd, 500, "could not allocate memory");
             LOG("could not allocate memory\n");
             return;
         }
-        plugin_no = MAX(MIN(strtol(svalue, NULL, 10), INT_MAX), INT_MIN);
+        /* inputs may also be addressed by their name */
+        if(dest == Dest_Input)
+            plugin_no = find_input(pglobal, svalue, len);
+        else
+            plugin_no = MAX(MIN(strtol(svalue, NULL, 10), INT_MAX), INT_MIN);
         DBG("The plugin number value converted value form string %s to integer %d\n", svalue, plugin_no);
     } else {
         value = NULL;
     }
 
+    /* the plugin must not be stopped or unloaded while its command runs */
+    pglobal->plugins_lock();
     switch(dest) {
     case Dest_Input:
-        if(plugin_no < pglobal->incnt) {
-            res = pglobal->in[plugin_no].cmd(plugin_no, command_id, group, ivalue, value);
+        if(plugin_no >= 0 && plugin_no < pglobal->incnt && (cmd = pglobal->in[plugin_no].cmd) != NULL) {
+            res = cmd(plugin_no, command_id, group, ivalue, value);
+            CONTROLS_CHANGED(&pglobal->in[plugin_no]);
+            notify_events();
         } else {
             DBG("Invalid plugin number: %d because only %d input plugins loaded", plugin_no,  pglobal->incnt-1);
         }
         break;
     case Dest_Output:
-        if(plugin_no < pglobal->outcnt) {
-            res = pglobal->out[plugin_no].cmd(plugin_no, command_id, group, ivalue, value);
+        if(plugin_no >= 0 && plugin_no < pglobal->outcnt && (cmd = pglobal->out[plugin_no].cmd) != NULL) {
+            res = cmd(plugin_no, command_id, group, ivalue, value);
+            CONTROLS_CHANGED(&pglobal->out[plugin_no]);
+            notify_events();
         } else {
-            DBG("Invalid plugin number: %d because only %d output plugins loaded", plugin_no,  pglobal->incnt-1);
+            DBG("Invalid plugin number: %d because only %d output plugins loaded", plugin_no,  pglobal->outcnt-1);
         }
         break;
     case Dest_Program:
@@ -1006,6 +1774,7 @@ void command(int id, int fd, char *parameter)
     default:
         fprintf(stderr, "Illegal command destination: %d\n", dest);
     }
+    pglobal->plugins_unlock();
 
     /* Send HTTP-response */
     sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
@@ -1022,6 +1791,66 @@ void command(int id, int fd, char *parameter)
     if(svalue != NULL) free(svalue);
 }
 
+/******************************************************************************
+Description.: Executes a command of the plugin management, for example
+              "?action=manage&cmd=add+input+lobby%3Dinput_testpicture.so".
+              The reply of the command is sent as plain text.
+Input Value.: * fd.......: filedescriptor to send HTTP response to.
+              * query....: the query string with the "cmd" parameter
+              * may_load.: the client may add or load plugins
+Return Value: -
+******************************************************************************/
+void manage(int fd, char *query, int may_load)
+{
+    char buffer[BUFFER_SIZE] = {0}, reply[4096], verb[8] = "", *cmd, *p;
+    int len, result;
+
+    if(pglobal->manage == NULL) {
+        send_error(fd, 501, "the plugins can not be managed");
+        return;
+    }
+    if((p = query_value(query, "cmd", &len)) == NULL) {
+        send_error(fd, 400, "the cmd parameter is missing");
+        return;
+    }
+    if((cmd = strndup(p, len)) == NULL) {
+        send_error(fd, 500, "could not allocate memory");
+        return;
+    }
+
+    /* spaces may be sent as "+" */
+    for(p = cmd; *p != '\0'; p++) {
+        if(*p == '+')
+            *p = ' ';
+    }
+    if(unescape(cmd) == -1) {
+        send_error(fd, 400, "could not properly unescape the cmd parameter");
+        free(cmd);
+        return;
+    }
+
+    sscanf(cmd, " %7s", verb);
+    if(!may_load && (strcmp(verb, "add") == 0 || strcmp(verb, "load") == 0)) {
+        send_error(fd, 403, "plugins are only added by servers with credentials");
+        free(cmd);
+        return;
+    }
+
+    DBG("plugin management command: \"%s\"\n", cmd);
+    result = pglobal->manage(cmd, reply, sizeof(reply));
+    free(cmd);
+    notify_events();
+
+    sprintf(buffer, "HTTP/1.0 %s\r\n" \
+            "Content-type: text/plain\r\n" \
+            STD_HEADER \
+            "Content-Length: %d\r\n" \
+            "\r\n", (result == 0) ? "200 OK" : "400 Bad Request", (int)strlen(reply));
+    if(write(fd, buffer, strlen(buffer)) < 0 || write(fd, reply, strlen(reply)) < 0) {
+        DBG("write failed, done anyway\n");
+    }
+}
+
 /******************************************************************************
 Description.: Serve a connected TCP-client. This thread function is called
               for each connect of a HTTP client like a webbrowser. It determines
@@ -1035,10 +1864,10 @@ Return Value: always NULL
 /* thread for clients that connected to this server */
 void *client_thread(void *arg)
 {
-    int cnt;
+    int i, len;
     char query_suffixed = 0;
     int input_number = 0;
-    char buffer[BUFFER_SIZE] = {0}, *pb = buffer;
+    char *pb, *value;
     iobuffer iobuf;
     request req;
     cfd lcfd; /* local-connected-file-descriptor */
@@ -1049,148 +1878,109 @@ void *client_thread(void *arg)
         free(arg);
     } else
         return NULL;
+    pglobal->thread_start(Dest_Output, lcfd.pc->id, "client");
 
     /* initializes the structures */
-    init_iobuffer(&iobuf);
     init_request(&req);
 
     /* What does the client want to receive? Read the request. */
-    memset(buffer, 0, sizeof(buffer));
-    if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
+    if((len = read_request(lcfd.fd, &iobuf, 5)) < 0) {
+        /* the client gets an answer, it would wait in vain for one otherwise */
+        if(len == -2) {
+            char message[64];
+
+            snprintf(message, sizeof(message), "The request header is larger than %d bytes", REQUEST_BUFFER - 1);
+            send_error(lcfd.fd, 431, message);
+        }
         close(lcfd.fd);
         return NULL;
     }
 
-    req.query_string = NULL;
-
-    /* determine what to deliver */
-    if(strstr(buffer, "GET /?action=snapshot") != NULL) {
-        req.type = A_SNAPSHOT;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    #ifdef WXP_COMPAT
-    } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".jpg") != NULL)) {
-        req.type = A_SNAPSHOT_WXP;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    #endif
-    } else if(strstr(buffer, "POST /stream") != NULL) {
-        req.type = A_STREAM;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    } else if(strstr(buffer, "GET /?action=stream") != NULL) {
-        req.type = A_STREAM;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    #ifdef WXP_COMPAT
-    } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".mjpg") != NULL)) {
-        req.type = A_STREAM_WXP;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    #endif
-    } else if(strstr(buffer, "GET /?action=take") != NULL) {
-        int len;
-        req.type = A_TAKE;
-        query_suffixed = 255;
-
-        /* advance by the length of known string */
-        if((pb = strstr(buffer, "GET /?action=take")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            query_suffixed = 0;
-            return NULL;
-        }
-        pb += strlen("GET /?action=take"); // a pb points to thestring after the first & after command
+    if(parse_request(&iobuf, &req) == -1 ||
+       (strcmp(req.method, "GET") != 0 && strcmp(req.method, "POST") != 0)) {
+        DBG("HTTP request seems to be malformed\n");
+        send_error(lcfd.fd, 400, "Malformed HTTP request");
+        close(lcfd.fd);
+        return NULL;
+    }
 
-        /* only accept certain characters */
-        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
-        }
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
+    /* determine what to deliver */
+    if(strcmp(req.path, "/") == 0 && (value = query_value(req.query_string, "action", &len)) != NULL) {
+        int name_len = strcspn(value, "_&");
 
-        if(unescape(req.parameter) == -1) {
-            free(req.parameter);
-            send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
-            LOG("could not properly unescape command parameter string\n");
-            close(lcfd.fd);
-            return NULL;
+        name_len = MIN(name_len, len);
+        for(i = 0; i < LENGTH_OF(actions); i++) {
+            if(strlen(actions[i].name) == name_len && strncmp(actions[i].name, value, name_len) == 0) {
+                req.type = actions[i].type;
+                break;
+            }
         }
-    } else if((strstr(buffer, "GET /input") != NULL) && (strstr(buffer, ".json") != NULL)) {
+        input_number = plugin_suffix(value, len);
+
+        /* commands get everything after the action as parameter */
+        req.parameter = value + len;
+    } else if(strcmp(req.method, "POST") == 0) {
+        if(strncmp(req.path, "/stream", strlen("/stream")) == 0) {
+            req.type = A_STREAM;
+            input_number = plugin_suffix(req.path, strlen(req.path));
+        }
+    #ifdef WXP_COMPAT
+    } else if(strncmp(req.path, "/cam", strlen("/cam")) == 0 && strstr(req.path, ".mjpg") != NULL) {
+        req.type = A_STREAM_WXP;
+        input_number = plugin_suffix(req.path, strlen(req.path)) - 1; // webcamxp adds offset to the camera number
+    } else if(strncmp(req.path, "/cam", strlen("/cam")) == 0 && strstr(req.path, ".jpg") != NULL) {
+        req.type = A_SNAPSHOT_WXP;
+        input_number = plugin_suffix(req.path, strlen(req.path)) - 1;
+    #endif
+    } else if(strncmp(req.path, "/input", strlen("/input")) == 0 && strstr(req.path, ".json") != NULL) {
         req.type = A_INPUT_JSON;
-        query_suffixed = 255;
-    } else if((strstr(buffer, "GET /output") != NULL) && (strstr(buffer, ".json") != NULL)) {
+        input_number = plugin_suffix(req.path, strlen(req.path));
+    } else if(strncmp(req.path, "/output", strlen("/output")) == 0 && strstr(req.path, ".json") != NULL) {
         req.type = A_OUTPUT_JSON;
-        query_suffixed = 255;
-    } else if(strstr(buffer, "GET /program.json") != NULL) {
+        input_number = plugin_suffix(req.path, strlen(req.path));
+    } else if(strcmp(req.path, "/program.json") == 0) {
         req.type = A_PROGRAM_JSON;
     #ifdef MANAGMENT
-    } else if(strstr(buffer, "GET /clients.json") != NULL) {
+    } else if(strcmp(req.path, "/clients.json") == 0) {
         req.type = A_CLIENTS_JSON;
     #endif
-    } else if(strstr(buffer, "GET /?action=command") != NULL) {
-        int len;
-        req.type = A_COMMAND;
-
-        /* advance by the length of known string */
-        if((pb = strstr(buffer, "GET /?action=command")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
-        }
-        pb += strlen("GET /?action=command"); // a pb points to thestring after the first & after command
+    }
 
-        /* only accept certain characters */
-        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
+    /* "input=" addresses an input by its number or name instead of the suffix */
+    if((req.type == A_SNAPSHOT || req.type == A_STREAM || req.type == A_WS || req.type == A_INPUT_JSON) &&
+       (value = query_value(req.query_string, "input", &len)) != NULL)
+        input_number = find_input(pglobal, value, len);
 
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
+    switch(req.type) {
+    case A_SNAPSHOT:
+    case A_SNAPSHOT_WXP:
+    case A_STREAM:
+    case A_STREAM_WXP:
+    case A_WS:
+        query_suffixed = 255;
+        #ifdef MANAGMENT
+        if (input_number >= 0 && input_number < pglobal->incnt &&
+            check_client_status(lcfd.address, input_number, lcfd.pc->conf.rate[input_number], lcfd.pc->conf.burst)) {
+            req.type = A_UNKNOWN;
+            send_error(lcfd.fd, 403, "frame already sent");
+            query_suffixed = 0;
         }
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
+        #endif
+        break;
+    case A_INPUT_JSON:
+    case A_OUTPUT_JSON:
+        query_suffixed = 255;
+        break;
+    case A_TAKE:
+        query_suffixed = 255;
+        /* fall through */
+    case A_COMMAND:
+        /* only accept certain characters */
+        pb = req.parameter;
+        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
+        pb[len] = '\0';
 
         if(unescape(req.parameter) == -1) {
-            free(req.parameter);
             send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
             LOG("could not properly unescape command parameter string\n");
             close(lcfd.fd);
@@ -1198,94 +1988,42 @@ void *client_thread(void *arg)
         }
 
         DBG("command parameter (len: %d): \"%s\"\n", len, req.parameter);
-    } else {
-        int len;
-
+        break;
+    case A_UNKNOWN:
         DBG("try to serve a file\n");
         req.type = A_FILE;
 
-        if((pb = strstr(buffer, "GET /")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
-        }
-
-        pb += strlen("GET /");
+        /* only accept flat file names, without any path */
+        pb = req.path + 1;
         len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890"), 0), 100);
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
-        }
-
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
 
         if (strstr(pb, ".cgi") != NULL) {
             req.type = A_CGI;
-            pb = strchr(pb, '?');
-            if (pb != NULL) {
-                pb++; // skip the ?
-                len = strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890=&");
-                req.query_string = malloc(len + 1);
-                if (req.query_string == NULL)
-                    exit(EXIT_FAILURE);
-                memset(req.query_string, 0, len + 1);
-                strncpy(req.query_string, pb, len);
+            if (req.query_string != NULL) {
+                req.query_string[strspn(req.query_string, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890=&")] = '\0';
             } else {
-                req.query_string = malloc(2);
-                if (req.query_string == NULL)
-                    exit(EXIT_FAILURE);
-                sprintf(req.query_string, " ");
+                req.query_string = " ";
             }
         }
+        pb[len] = '\0';
+        req.parameter = pb;
         DBG("parameter (len: %d): \"%s\"\n", len, req.parameter);
+        break;
+    default:
+        break;
     }
 
-    /*
-     * Since when we are working with multiple input plugins
-     * there are some url which could have a _[plugin number suffix]
-     * For compatibility reasons it could be left in that case the output will be
-     * generated from the 0. input plugin
-     */
     if(query_suffixed) {
-        char *sch = strchr(buffer, '_');
-        if(sch != NULL) {  // there is an _ in the url so the input number should be present
-            DBG("Suffix character: %s\n", sch + 1); // FIXME if more than 10 input plugin is added
-            char numStr[3];
-            memset(numStr, 0, 3);
-            strncpy(numStr, sch + 1, 1);
-            input_number = atoi(numStr);
-
-            if ((req.type == A_SNAPSHOT_WXP) || (req.type == A_STREAM_WXP)) { // webcamxp adds offset to the camera number
-                input_number--;
-            }
-        }
         DBG("plugin_no: %d\n", input_number);
     }
 
-    /*
-     * parse the rest of the HTTP-request
-     * the end of the request-header is marked by a single, empty line with "\r\n"
-     */
-    do {
-        memset(buffer, 0, sizeof(buffer));
-
-        if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-            free_request(&req);
-            close(lcfd.fd);
-            return NULL;
-        }
-
-        if(strcasestr(buffer, "User-Agent: ") != NULL) {
-            req.client = strdup(buffer + strlen("User-Agent: "));
-        } else if(strcasestr(buffer, "Authorization: Basic ") != NULL) {
-            req.credentials = strdup(buffer + strlen("Authorization: Basic "));
-            decodeBase64(req.credentials);
-            DBG("username:password: %s\n", req.credentials);
-        }
-
-    } while(cnt > 2 && !(buffer[0] == '\r' && buffer[1] == '\n'));
+    /* the interesting parts of the rest of the HTTP-request */
+    req.client = request_header(&req, "User-Agent");
+    if((value = request_header(&req, "Authorization")) != NULL && strncmp(value, "Basic ", strlen("Basic ")) == 0) {
+        req.credentials = value + strlen("Basic ");
+        decodeBase64(req.credentials);
+        DBG("username:password: %s\n", req.credentials);
+    }
 
     /* check for username and password if parameter -c was given */
     if(lcfd.pc->conf.credentials != NULL) {
@@ -1293,22 +2031,25 @@ void *client_thread(void *arg)
             DBG("access denied\n");
             send_error(lcfd.fd, 401, "username and password do not match to configuration");
             close(lcfd.fd);
-            free_request(&req);
             return NULL;
         }
         DBG("access granted\n");
     }
 
     /* now it's time to answer */
+    __sync_add_and_fetch(&connections, 1);
     if (query_suffixed) {
-        if (req.type == A_OUTPUT_JSON) {
-            if(!(input_number < pglobal->outcnt)) {
+        if (input_number < 0) {
+            send_error(lcfd.fd, 404, "Invalid plugin number");
+            req.type = A_UNKNOWN;
+        } else if (req.type == A_OUTPUT_JSON) {
+            if(!(input_number < pglobal->outcnt) || pglobal->out[input_number].state == PLUGIN_FREE) {
                 DBG("Output number: %d out of range (valid: 0..%d)\n", input_number, pglobal->outcnt-1);
                 send_error(lcfd.fd, 404, "Invalid output plugin number");
                 req.type = A_UNKNOWN;
             }
         } else {
-            if(!(input_number < pglobal->incnt)) {
+            if(!(input_number < pglobal->incnt) || pglobal->in[input_number].state == PLUGIN_FREE) {
                 DBG("Input number: %d out of range (valid: 0..%d)\n", input_number, pglobal->incnt-1);
                 send_error(lcfd.fd, 404, "Invalid input plugin number");
                 req.type = A_UNKNOWN;
@@ -1320,18 +2061,32 @@ void *client_thread(void *arg)
     case A_SNAPSHOT_WXP:
     case A_SNAPSHOT:
         DBG("Request for snapshot from input: %d\n", input_number);
-        send_snapshot(&lcfd, input_number);
+        send_snapshot(&lcfd, input_number, &req);
         break;
     case A_STREAM:
         DBG("Request for stream from input: %d\n", input_number);
-        send_stream(&lcfd, input_number);
+        count_stream_client(input_number, 1);
+        send_stream(&lcfd, input_number, &req);
+        count_stream_client(input_number, -1);
         break;
     #ifdef WXP_COMPAT
     case A_STREAM_WXP:
         DBG("Request for WXP compat stream from input: %d\n", input_number);
+        count_stream_client(input_number, 1);
         send_stream_wxp(&lcfd, input_number);
+        count_stream_client(input_number, -1);
         break;
     #endif
+    case A_WS:
+        DBG("Request for WebSocket stream from input: %d\n", input_number);
+        count_stream_client(input_number, 1);
+        send_ws(&lcfd, input_number, &req);
+        count_stream_client(input_number, -1);
+        break;
+    case A_EVENTS:
+        DBG("Request for the event stream\n");
+        send_events(&lcfd);
+        break;
     case A_COMMAND:
         if(lcfd.pc->conf.nocommands) {
             send_error(lcfd.fd, 501, "this server is configured to not accept commands");
@@ -1339,17 +2094,25 @@ void *client_thread(void *arg)
         }
         command(lcfd.pc->id, lcfd.fd, req.parameter);
         break;
+    case A_MANAGE:
+        if(lcfd.pc->conf.nocommands || !lcfd.pc->conf.management) {
+            send_error(lcfd.fd, 403, "this server is configured to not manage the plugins");
+            break;
+        }
+        /* loading a plugin loads any library, only an authenticated client may */
+        manage(lcfd.fd, req.query_string, lcfd.pc->conf.credentials != NULL);
+        break;
     case A_INPUT_JSON:
         DBG("Request for the Input plugin descriptor JSON file\n");
-        send_input_JSON(lcfd.fd, input_number);
+        send_input_JSON(lcfd.fd, input_number, request_header(&req, "If-None-Match"));
         break;
     case A_OUTPUT_JSON:
         DBG("Request for the Output plugin descriptor JSON file\n");
-        send_output_JSON(lcfd.fd, input_number);
+        send_output_JSON(lcfd.fd, input_number, request_header(&req, "If-None-Match"));
         break;
     case A_PROGRAM_JSON:
         DBG("Request for the program descriptor JSON file\n");
-        send_program_JSON(lcfd.fd);
+        send_program_JSON(lcfd.fd, request_header(&req, "If-None-Match"));
         break;
     #ifdef MANAGMENT
     case A_CLIENTS_JSON:
@@ -1370,6 +2133,7 @@ void *client_thread(void *arg)
     */
     case A_TAKE: {
         int i, ret = 0, found = 0;
+        pglobal->plugins_lock();
         for (i = 0; i<pglobal->outcnt; i++) {
             if (pglobal->out[i].name != NULL) {
                 if (strstr(pglobal->out[i].name, "FILE output plugin")) {
@@ -1386,11 +2150,12 @@ void *client_thread(void *arg)
                             len = strlen(filename);
                         else
                             len = (int)(fn - filename);
-                        filenamearg = (char*)calloc(len, sizeof(char));
+                        filenamearg = (char*)calloc(len + 1, sizeof(char));
                         memcpy(filenamearg, filename, len);
                         DBG("Filename = %s\n", filenamearg);
                         //int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int value, char *valueStr)
-                        ret = pglobal->out[i].cmd(i, OUT_FILE_CMD_TAKE, IN_CMD_GENERIC, 0, filenamearg);
+                        ret = (pglobal->out[i].cmd != NULL) ? pglobal->out[i].cmd(i, OUT_FILE_CMD_TAKE, IN_CMD_GENERIC, 0, filenamearg) : -1;
+                        free(filenamearg);
                     } else {
                         DBG("filename is not specified int the URL\n");
                         send_error(lcfd.fd, 404, "The &filename= must present for the take command in the URL");
@@ -1399,13 +2164,14 @@ void *client_thread(void *arg)
                 }
             }
         }
+        pglobal->plugins_unlock();
 
         if (found == 0) {
             LOG("FILE CHANGE TEST output plugin not loaded\n");
             send_error(lcfd.fd, 404, "FILE output plugin not loaded, taking snapshot not possible");
         } else {
             if (ret == 0) {
-                send_snapshot(&lcfd, input_number);
+                send_snapshot(&lcfd, input_number, &req);
             } else {
                 send_error(lcfd.fd, 404, "Taking snapshot failed!");
             }
@@ -1419,8 +2185,8 @@ void *client_thread(void *arg)
         DBG("unknown request\n");
     }
 
+    __sync_sub_and_fetch(&connections, 1);
     close(lcfd.fd);
-    free_request(&req);
 
     DBG("leaving HTTP client thread\n");
     return NULL;
@@ -1440,6 +2206,8 @@ void server_cleanup(void *arg)
 
     for(i = 0; i < MAX_SD_LEN; i++)
         close(pcontext->sd[i]);
+
+    stop_watchers();
 }
 
 /******************************************************************************
@@ -1464,6 +2232,7 @@ void *server_thread(void *arg)
 
     context *pcontext = arg;
     pglobal = pcontext->pglobal;
+    pglobal->thread_start(Dest_Output, pcontext->id, "server");
 
     /* set cleanup handler to cleanup resources */
     pthread_cleanup_push(server_cleanup, pcontext);
@@ -1483,15 +2252,11 @@ void *server_thread(void *arg)
         pcontext->sd[i] = -1;
 
     #ifdef MANAGMENT
-    if (pthread_mutex_init(&client_infos.mutex, NULL)) {
-        perror("Mutex initialization failed");
-        exit(EXIT_FAILURE);
-    }
-
-    client_infos.client_count = 0;
-    client_infos.infos = NULL;
+    init_clients();
     #endif
 
+    start_watchers(pcontext->id);
+
     /* open sockets for server (1 socket / address family) */
     i = 0;
     for(aip2 = aip; aip2 != NULL; aip2 = aip2->ai_next) {
@@ -1584,10 +2349,13 @@ void *server_thread(void *arg)
 
                 if(getnameinfo((struct sockaddr *)&client_addr, addr_len, name, sizeof(name), NULL, 0, NI_NUMERICHOST) == 0) {
                     DBG("serving client: %s\n", name);
+                } else {
+                    strcpy(name, "unknown");
                 }
 
                 #if defined(MANAGMENT)
-                pcfd->client = add_client(name);
+                snprintf(pcfd->address, sizeof(pcfd->address), "%s", name);
+                add_client(pcfd->address, pcontext->conf.client_ttl);
                 #endif
 
                 if(pthread_create(&client, NULL, &client_thread, pcfd) != 0) {
@@ -1608,176 +2376,144 @@ void *server_thread(void *arg)
 }
 
 /******************************************************************************
-Description.: Send a JSON file which is contains information about the input plugin's
-              acceptable parameters
-Input Value.: fildescriptor fd to send the answer to
-Return Value: -
+Description.: Appends formatted text to a growable string, the storage is
+              doubled whenever it gets too small
+Input Value.: * sb.....: the string, zero initialized before the first use
+              * format.: printf style format and arguments
+Return Value: 0 on success, -1 if memory could not be allocated
 ******************************************************************************/
-void send_input_JSON(int fd, int input_number)
+int strbuf_printf(strbuf *sb, const char *format, ...)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
-    int i;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
+    va_list args;
+    int len;
 
-    DBG("Serving the input plugin %d descriptor JSON file\n", input_number);
+    while(1) {
+        va_start(args, format);
+        len = vsnprintf(sb->data + sb->length, sb->size - sb->length, format, args);
+        va_end(args);
+
+        if(len < 0)
+            return -1;
+        if(sb->data != NULL && sb->length + len < sb->size)
+            break;
+
+        size_t size = MAX(sb->size * 2, BUFFER_SIZE);
+        while(size <= sb->length + len)
+            size *= 2;
+
+        char *data = realloc(sb->data, size);
+        if(data == NULL) {
+            DBG("Realloc failed: %s\n", strerror(errno));
+            return -1;
+        }
+        sb->data = data;
+        sb->size = size;
+    }
+
+    sb->length += len;
+    return 0;
+}
+
+void strbuf_free(strbuf *sb)
+{
+    free(sb->data);
+    memset(sb, 0, sizeof(strbuf));
+}
 
+/******************************************************************************
+Description.: Appends the JSON description of a list of controls
+Input Value.: * sb.....: string to append to
+              * controls: the controls, may be NULL
+              * count..: number of controls
+              * dest...: 0 for input plugins, 1 for output plugins
+Return Value: -
+******************************************************************************/
+static void render_controls_JSON(strbuf *sb, control *controls, int count, int dest)
+{
+    int i, j;
 
-    sprintf(buffer + strlen(buffer),
+    strbuf_printf(sb,
             "{\n"
             "\"controls\": [\n");
-    if(pglobal->in[input_number].in_parameters != NULL) {
-        for(i = 0; i < pglobal->in[input_number].parametercount; i++) {
-
-            char *menuString = NULL;
-            if(pglobal->in[input_number].in_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                if(pglobal->in[input_number].in_parameters[i].menuitems != NULL) {
-                    int j, k = 1;
-                    for(j = pglobal->in[input_number].in_parameters[i].ctrl.minimum; j <= pglobal->in[input_number].in_parameters[i].ctrl.maximum; j++) {
-                        char *tempName = NULL; // temporary storage for name sanity checking
-
-                        int prevSize = 0;
-                        int itemLength = strlen((char*)&pglobal->in[input_number].in_parameters[i].menuitems[j].name);
-                        tempName = (char*)calloc(itemLength + 1, sizeof(char));  // allocate space for the sanity checking
-                        if (tempName == NULL) {
-                            DBG("Realloc/calloc failed: %s\n", strerror(errno));
-                            return;
-                        }
-
-                        check_JSON_string((char*)&pglobal->in[input_number].in_parameters[i].menuitems[j].name, tempName); // sanity check the string after non printable characters
-
-                        itemLength += strlen("\"\": \"\"");
-
-                        if (menuString == NULL) {
-                            menuString = calloc(itemLength + 5, sizeof(char));
-                        } else {
-                            menuString = realloc(menuString, (strlen(menuString) + itemLength + 5) * (sizeof(char)));
-                        }
-
-                        if (menuString == NULL) {
-                            DBG("Realloc/calloc failed: %s\n", strerror(errno));
-                            return;
-                        }
-                        prevSize = strlen(menuString);
-
-                        if(j != pglobal->in[input_number].in_parameters[i].ctrl.maximum) {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\", ", j , tempName);
-                        } else {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\"", j , tempName);
-                        }
-                        k++;
-                        free(tempName);
-                    }
-                }
-            }
 
-            sprintf(buffer + strlen(buffer),
-                    "{\n"
-                    "\"name\": \"%s\",\n"
-                    "\"id\": \"%d\",\n"
-                    "\"type\": \"%d\",\n"
-                    "\"min\": \"%d\",\n"
-                    "\"max\": \"%d\",\n"
-                    "\"step\": \"%d\",\n"
-                    "\"default\": \"%d\",\n"
-                    "\"value\": \"%d\",\n"
-                    "\"dest\": \"0\",\n"
-                    "\"flags\": \"%d\",\n"
-                    "\"group\": \"%d\"",
-                    pglobal->in[input_number].in_parameters[i].ctrl.name,
-                    pglobal->in[input_number].in_parameters[i].ctrl.id,
-                    pglobal->in[input_number].in_parameters[i].ctrl.type,
-                    pglobal->in[input_number].in_parameters[i].ctrl.minimum,
-                    pglobal->in[input_number].in_parameters[i].ctrl.maximum,
-                    pglobal->in[input_number].in_parameters[i].ctrl.step,
-                    pglobal->in[input_number].in_parameters[i].ctrl.default_value,
-                    pglobal->in[input_number].in_parameters[i].value,
-                    // 0 is the code of the input plugin
-                    pglobal->in[input_number].in_parameters[i].ctrl.flags,
-                    pglobal->in[input_number].in_parameters[i].group
-                   );
+    if(controls == NULL) {
+        DBG("The plugin has no paramters\n");
+        count = 0;
+    }
 
-            // append the menu object to the menu typecontrols
-            if(pglobal->in[input_number].in_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                sprintf(buffer + strlen(buffer),
-                        ",\n"
-                        "\"menu\": {%s}\n"
-                        "}",
-                        menuString);
-            } else {
-                sprintf(buffer + strlen(buffer),
-                        "\n"
-                        "}");
+    for(i = 0; i < count; i++) {
+        strbuf_printf(sb,
+                "{\n"
+                "\"name\": \"%s\",\n"
+                "\"id\": \"%d\",\n"
+                "\"type\": \"%d\",\n"
+                "\"min\": \"%d\",\n"
+                "\"max\": \"%d\",\n"
+                "\"step\": \"%d\",\n"
+                "\"default\": \"%d\",\n"
+                "\"value\": \"%d\",\n"
+                "\"dest\": \"%d\",\n"
+                "\"flags\": \"%d\",\n"
+                "\"group\": \"%d\"",
+                controls[i].ctrl.name,
+                controls[i].ctrl.id,
+                controls[i].ctrl.type,
+                controls[i].ctrl.minimum,
+                controls[i].ctrl.maximum,
+                controls[i].ctrl.step,
+                controls[i].ctrl.default_value,
+                controls[i].value,
+                dest,
+                controls[i].ctrl.flags,
+                controls[i].group
+               );
+
+        // append the menu object to the menu typecontrols
+        if(controls[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
+            strbuf_printf(sb, ",\n\"menu\": {");
+            if(controls[i].menuitems != NULL) {
+                for(j = controls[i].ctrl.minimum; j <= controls[i].ctrl.maximum; j++) {
+                    char name[sizeof(controls[i].menuitems[j].name) + 1] = {0};
+
+                    // sanity check the string after non printable characters
+                    check_JSON_string((char*)&controls[i].menuitems[j].name, name);
+                    strbuf_printf(sb, "\"%d\": \"%s\"%s", j, name,
+                            (j != controls[i].ctrl.maximum) ? ", " : "");
+                }
             }
+            strbuf_printf(sb, "}\n}");
+        } else {
+            strbuf_printf(sb, "\n}");
+        }
 
-            if(i != (pglobal->in[input_number].parametercount - 1)) {
-                sprintf(buffer + strlen(buffer), ",\n");
-            }
-            free(menuString);
+        if(i != (count - 1)) {
+            strbuf_printf(sb, ",\n");
         }
-    } else {
-        DBG("The input plugin has no paramters\n");
     }
-    sprintf(buffer + strlen(buffer),
-            "\n],\n"
-            /*"},\n"*/);
 
-    sprintf(buffer + strlen(buffer),
-            //"{\n"
-            "\"formats\": [\n");
-    if(pglobal->in[input_number].in_formats != NULL) {
-        for(i = 0; i < pglobal->in[input_number].formatCount; i++) {
-            char *resolutionsString = NULL;
-            int resolutionsStringLength = 0;
-            int j = 0;
-            for(j = 0; j < pglobal->in[input_number].in_formats[i].resolutionCount; j++) {
-                char buffer_num[6];
-                memset(buffer_num, '\0', 6);
-                // JSON format example:
-                // {"0": "320x240", "1": "640x480", "2": "960x720"}
-                sprintf(buffer_num, "%d", j);
-                resolutionsStringLength += strlen(buffer_num);
-                sprintf(buffer_num, "%d", pglobal->in[input_number].in_formats[i].supportedResolutions[j].width);
-                resolutionsStringLength += strlen(buffer_num);
-                sprintf(buffer_num, "%d", pglobal->in[input_number].in_formats[i].supportedResolutions[j].height);
-                resolutionsStringLength += strlen(buffer_num);
-                if(j != (pglobal->in[input_number].in_formats[i].resolutionCount - 1)) {
-                    resolutionsStringLength += (strlen("\"\": \"x\", ") + 5);
-                    if (resolutionsString == NULL)
-                        resolutionsString = calloc(resolutionsStringLength, sizeof(char*));
-                    else
-                        resolutionsString = realloc(resolutionsString, resolutionsStringLength * sizeof(char*));
-                    if (resolutionsString == NULL) {
-                        DBG("Realloc/calloc failed\n");
-                        return;
-                    }
+    strbuf_printf(sb, "\n]");
+}
 
-                    sprintf(resolutionsString + strlen(resolutionsString),
-                            "\"%d\": \"%dx%d\", ",
-                            j,
-                            pglobal->in[input_number].in_formats[i].supportedResolutions[j].width,
-                            pglobal->in[input_number].in_formats[i].supportedResolutions[j].height);
-                } else {
-                    resolutionsStringLength += (strlen("\"\": \"x\"")+5);
-                    if (resolutionsString == NULL)
-                        resolutionsString = calloc(resolutionsStringLength, sizeof(char*));
-                    else
-                        resolutionsString = realloc(resolutionsString, resolutionsStringLength * sizeof(char*));
-                    if (resolutionsString == NULL) {
-                        DBG("Realloc/calloc failed\n");
-                        return;
-                    }
-                    sprintf(resolutionsString + strlen(resolutionsString),
-                            "\"%d\": \"%dx%d\"",
-                            j,
-                            pglobal->in[input_number].in_formats[i].supportedResolutions[j].width,
-                            pglobal->in[input_number].in_formats[i].supportedResolutions[j].height);
-                }
-            }
+/******************************************************************************
+Description.: Renders the JSON description of the input plugin's acceptable
+              parameters and formats
+Input Value.: * sb.....: string to append to
+              * input_number: the input plugin
+Return Value: -
+******************************************************************************/
+static void render_input_JSON(strbuf *sb, int input_number)
+{
+    input *in = &pglobal->in[input_number];
+    int i, j;
+
+    render_controls_JSON(sb, in->in_parameters, in->parametercount, 0);
 
-            sprintf(buffer + strlen(buffer),
+    strbuf_printf(sb,
+            ",\n"
+            "\"formats\": [\n");
+    if(in->in_formats != NULL) {
+        for(i = 0; i < in->formatCount; i++) {
+            strbuf_printf(sb,
                     "{\n"
                     "\"id\": \"%d\",\n"
                     "\"name\": \"%s\",\n"
@@ -1788,117 +2524,276 @@ void send_input_JSON(int fd, int input_number)
                     "\"emulated\": \"%s\",\n"
 #endif
                     "\"current\": \"%s\",\n"
-                    "\"resolutions\": {%s}\n"
+                    "\"resolutions\": {"
                     ,
-                    pglobal->in[input_number].in_formats[i].format.index,
-                    pglobal->in[input_number].in_formats[i].format.description,
+                    in->in_formats[i].format.index,
+                    in->in_formats[i].format.description,
 #ifdef V4L2_FMT_FLAG_COMPRESSED
-                    pglobal->in[input_number].in_formats[i].format.flags & V4L2_FMT_FLAG_COMPRESSED ? "true" : "false",
+                    in->in_formats[i].format.flags & V4L2_FMT_FLAG_COMPRESSED ? "true" : "false",
 #endif
 #ifdef V4L2_FMT_FLAG_EMULATED
-                    pglobal->in[input_number].in_formats[i].format.flags & V4L2_FMT_FLAG_EMULATED ? "true" : "false",
+                    in->in_formats[i].format.flags & V4L2_FMT_FLAG_EMULATED ? "true" : "false",
 #endif
-                    pglobal->in[input_number].in_formats[i].currentResolution != -1 ? "true" : "false",
-                    resolutionsString
+                    in->in_formats[i].currentResolution != -1 ? "true" : "false"
                    );
 
-            if(pglobal->in[input_number].in_formats[i].currentResolution != -1) {
-                sprintf(buffer + strlen(buffer),
+            // JSON format example:
+            // {"0": "320x240", "1": "640x480", "2": "960x720"}
+            for(j = 0; j < in->in_formats[i].resolutionCount; j++) {
+                strbuf_printf(sb,
+                        "\"%d\": \"%dx%d\"%s",
+                        j,
+                        in->in_formats[i].supportedResolutions[j].width,
+                        in->in_formats[i].supportedResolutions[j].height,
+                        (j != (in->in_formats[i].resolutionCount - 1)) ? ", " : "");
+            }
+            strbuf_printf(sb, "}\n");
+
+            if(in->in_formats[i].currentResolution != -1) {
+                strbuf_printf(sb,
                         ",\n\"currentResolution\": \"%d\"\n",
-                        pglobal->in[input_number].in_formats[i].currentResolution
+                        in->in_formats[i].currentResolution
                        );
             }
 
-            if(i != (pglobal->in[input_number].formatCount - 1)) {
-                sprintf(buffer + strlen(buffer), "},\n");
+            if(i != (in->formatCount - 1)) {
+                strbuf_printf(sb, "},\n");
             } else {
-                sprintf(buffer + strlen(buffer), "}\n");
+                strbuf_printf(sb, "}\n");
             }
-
-            free(resolutionsString);
         }
     }
-    sprintf(buffer + strlen(buffer),
+    strbuf_printf(sb,
             "\n]\n"
             "}\n");
-    i = strlen(buffer);
-
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the control JSON file\n");
-    }
 }
 
-
-void send_program_JSON(int fd)
+/******************************************************************************
+Description.: Renders the JSON description of the output plugin's acceptable
+              parameters
+Input Value.: * sb.....: string to append to
+              * output_number: the output plugin
+Return Value: -
+******************************************************************************/
+static void render_output_JSON(strbuf *sb, int output_number)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
-    int i, k;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
+    output *out = &pglobal->out[output_number];
 
-    DBG("Serving the program descriptor JSON file\n");
+    render_controls_JSON(sb, out->out_parameters, out->parametercount, 1);
+    strbuf_printf(sb,
+            "\n"
+            "}\n");
+}
+
+/******************************************************************************
+Description.: Renders the threads of a plugin with the CPU they ran on last,
+              the CPU time they used and their share of a CPU since the
+              previous rendering
+Input Value.: * sb.....: string to append to
+              * dest...: Dest_Input or Dest_Output
+              * id.....: the number of the plugin
+Return Value: -
+******************************************************************************/
+static void render_threads_JSON(strbuf *sb, command_dest dest, int id)
+{
+    plugin_thread *list;
+    int i, count;
+
+    list = malloc(MAX_LISTED_THREADS * sizeof(plugin_thread));
+    count = (list != NULL) ? pglobal->thread_list(dest, id, list, MAX_LISTED_THREADS) : 0;
+
+    strbuf_printf(sb, "\"threads\": [");
+    for(i = 0; i < count; i++) {
+        char name[sizeof(list[i].name)] = {0};
+
+        check_JSON_string(list[i].name, name);
+        strbuf_printf(sb,
+                "%s\n{\"tid\": %d, \"name\": \"%s\", \"cpu\": %d, \"cpu_time\": %.2f, \"usage\": %.1f}",
+                (i > 0) ? "," : "",
+                list[i].tid,
+                name,
+                list[i].cpu,
+                list[i].cpu_time,
+                list[i].usage);
+    }
+    strbuf_printf(sb, "]");
+    free(list);
+}
 
+/******************************************************************************
+Description.: Renders the JSON description of the loaded plugins
+Input Value.: * sb.....: string to append to
+              * unused.: -
+Return Value: -
+******************************************************************************/
+static void render_program_JSON(strbuf *sb, int unused)
+{
+    static const char *states[] = { "free", "loaded", "running", "stopped" };
+    const char *separator = "";
+    int k;
 
-    sprintf(buffer + strlen(buffer),
+    strbuf_printf(sb,
             "{\n"
-            /*"\"program\": [\n"
-            "{\n"*/
             "\"inputs\":[\n");
     for(k = 0; k < pglobal->incnt; k++) {
-        sprintf(buffer + strlen(buffer),
-                "{\n"
+        /* the slots of unloaded plugins are skipped */
+        if(pglobal->in[k].state == PLUGIN_FREE)
+            continue;
+        strbuf_printf(sb,
+                "%s{\n"
                 "\"id\": \"%d\",\n"
                 "\"name\": \"%s\",\n"
+                "\"label\": \"%s\",\n"
+                "\"state\": \"%s\",\n"
                 "\"plugin\": \"%s\",\n"
-                "\"args\": \"%s\"\n"
-                "}",
+                "\"args\": \"%s\",\n",
+                separator,
                 pglobal->in[k].param.id,
                 pglobal->in[k].name,
+                (pglobal->in[k].label != NULL) ? pglobal->in[k].label : "",
+                states[pglobal->in[k].state],
                 pglobal->in[k].plugin,
                 pglobal->in[k].param.parameters);
-        if(k != (pglobal->incnt - 1))
-            sprintf(buffer + strlen(buffer), ", \n");
-        else
-            sprintf(buffer + strlen(buffer), "\n");
-    }
-    sprintf(buffer + strlen(buffer),
-            /*"]\n"
-            "}\n"
-            "]\n"*/
-            "],\n");
-    sprintf(buffer + strlen(buffer),
+        render_threads_JSON(sb, Dest_Input, k);
+        strbuf_printf(sb, "\n}");
+        separator = ", \n";
+    }
+    separator = "";
+    strbuf_printf(sb,
+            "\n],\n"
             "\"outputs\":[\n");
     for(k = 0; k < pglobal->outcnt; k++) {
-        sprintf(buffer + strlen(buffer),
-                "{\n"
+        if(pglobal->out[k].state == PLUGIN_FREE)
+            continue;
+        strbuf_printf(sb,
+                "%s{\n"
                 "\"id\": \"%d\",\n"
                 "\"name\": \"%s\",\n"
+                "\"state\": \"%s\",\n"
                 "\"plugin\": \"%s\",\n"
-                "\"args\": \"%s\"\n"
-                "}",
+                "\"args\": \"%s\",\n",
+                separator,
                 pglobal->out[k].param.id,
                 pglobal->out[k].name,
+                states[pglobal->out[k].state],
                 pglobal->out[k].plugin,
                 pglobal->out[k].param.parameters);
-        if(k != (pglobal->outcnt - 1))
-            sprintf(buffer + strlen(buffer), ", \n");
-        else
-            sprintf(buffer + strlen(buffer), "\n");
+        render_threads_JSON(sb, Dest_Output, k);
+        strbuf_printf(sb, "\n}");
+        separator = ", \n";
+    }
+    strbuf_printf(sb,
+            "\n]}\n");
+}
+
+/******************************************************************************
+Description.: Serves a JSON document from its cache. The document is only
+              rendered again if the version changed, e.g. because a control
+              of the plugin was set. The ETag is derived from the content, a
+              client which already has the current document gets a 304.
+Input Value.: * fd.....: fildescriptor to send the answer to
+              * cache..: the cache of this document
+              * version: current version of the data the document is made of
+              * render.: function which renders the document
+              * number.: plugin number passed to render
+              * if_none_match: the ETag the client sent or NULL
+Return Value: -
+******************************************************************************/
+static void send_cached_JSON(int fd, json_cache *cache, unsigned int version,
+                             void (*render)(strbuf *, int), int number,
+                             const char *if_none_match)
+{
+    char header[BUFFER_SIZE];
+    char *body = NULL;
+    size_t length = 0;
+    int not_modified;
+
+    pthread_mutex_lock(&cache->mutex);
+    if(!cache->valid || cache->version != version) {
+        unsigned int hash = 2166136261u;
+        size_t i;
+
+        DBG("rendering JSON document version %u\n", version);
+        cache->body.length = 0;
+        /* the plugins can not free their controls while they are rendered */
+        pglobal->plugins_lock();
+        render(&cache->body, number);
+        pglobal->plugins_unlock();
+
+        for(i = 0; i < cache->body.length; i++) {
+            hash ^= (unsigned char)cache->body.data[i];
+            hash *= 16777619u;
+        }
+        snprintf(cache->etag, sizeof(cache->etag), "\"%08x\"", hash);
+        cache->version = version;
+        cache->valid = (cache->body.data != NULL);
+    }
+
+    not_modified = (if_none_match != NULL && strcmp(if_none_match, cache->etag) == 0);
+    if(!not_modified && cache->valid && (body = malloc(cache->body.length)) != NULL) {
+        length = cache->body.length;
+        memcpy(body, cache->body.data, length);
+    }
+
+    snprintf(header, sizeof(header),
+            "HTTP/1.0 %s\r\n"
+            "Content-type: %s\r\n"
+            "Connection: close\r\n"
+            "Server: MJPG-Streamer/0.2\r\n"
+            "Cache-Control: no-cache\r\n"
+            "ETag: %s\r\n"
+            "Content-Length: %lu\r\n"
+            "\r\n",
+            not_modified ? "304 Not Modified" : "200 OK",
+            "application/x-javascript",
+            cache->etag,
+            (unsigned long)length);
+    pthread_mutex_unlock(&cache->mutex);
+
+    if(!not_modified && body == NULL) {
+        send_error(fd, 500, "could not allocate memory");
+        return;
     }
-    sprintf(buffer + strlen(buffer),
-            /*"]\n"
-            "}\n"
-            "]\n"*/
-            "]}\n");
-    i = strlen(buffer);
 
     /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the program JSON file\n");
+    if(write(fd, header, strlen(header)) < 0 ||
+       (length > 0 && write(fd, body, length) < 0)) {
+        DBG("unable to serve the JSON file\n");
     }
+    free(body);
+}
+
+/******************************************************************************
+Description.: Send a JSON file which is contains information about the input plugin's
+              acceptable parameters
+Input Value.: * fd.....: fildescriptor to send the answer to
+              * input_number: the input plugin
+              * if_none_match: ETag of the document the client already has
+Return Value: -
+******************************************************************************/
+void send_input_JSON(int fd, int input_number, const char *if_none_match)
+{
+    DBG("Serving the input plugin %d descriptor JSON file\n", input_number);
+    send_cached_JSON(fd, &input_json[input_number], pglobal->in[input_number].controls_version,
+                     render_input_JSON, input_number, if_none_match);
+}
+
+/******************************************************************************
+Description.: Send a JSON file which is contains information about the loaded
+              plugins and their arguments
+Input Value.: * fd.....: fildescriptor to send the answer to
+              * if_none_match: ETag of the document the client already has
+Return Value: -
+******************************************************************************/
+void send_program_JSON(int fd, const char *if_none_match)
+{
+    struct timespec now;
+
+    /* the CPU time of the threads changes all the time, it is updated every second */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    DBG("Serving the program descriptor JSON file\n");
+    send_cached_JSON(fd, &program_json, pglobal->plugins_version * 65599u + (unsigned int)now.tv_sec,
+                     render_program_JSON, 0, if_none_match);
 }
 
 /******************************************************************************
@@ -1923,154 +2818,70 @@ void check_JSON_string(char *source, char *destination)
 /******************************************************************************
 Description.: Send a JSON file which is contains information about the output plugin's
               acceptable parameters
-Input Value.: fildescriptor fd to send the answer to
+Input Value.: * fd.....: fildescriptor to send the answer to
+              * output_number: the output plugin
+              * if_none_match: ETag of the document the client already has
 Return Value: -
 ******************************************************************************/
-void send_output_JSON(int fd, int input_number)
+void send_output_JSON(int fd, int output_number, const char *if_none_match)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
-    int i;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
-
-    DBG("Serving the output plugin %d descriptor JSON file\n", input_number);
-
-    sprintf(buffer + strlen(buffer),
-            "{\n"
-            "\"controls\": [\n");
-    if(pglobal->out[input_number].out_parameters != NULL) {
-        for(i = 0; i < pglobal->out[input_number].parametercount; i++) {
-            char *menuString = calloc(0, 0);
-            if(pglobal->out[input_number].out_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                if(pglobal->out[input_number].out_parameters[i].menuitems != NULL) {
-                    int j, k = 1;
-                    for(j = pglobal->out[input_number].out_parameters[i].ctrl.minimum; j <= pglobal->out[input_number].out_parameters[i].ctrl.maximum; j++) {
-                        int prevSize = strlen(menuString);
-                        int itemLength = strlen((char*)&pglobal->out[input_number].out_parameters[i].menuitems[j].name)  + strlen("\"\": \"\"");
-                        if (menuString == NULL) {
-                            menuString = calloc(itemLength, sizeof(char));
-                        } else {
-                            menuString = realloc(menuString, (strlen(menuString) + itemLength) * (sizeof(char)));
-                        }
-
-                        if (menuString == NULL) {
-                            DBG("Realloc/calloc failed: %s\n", strerror(errno));
-                            return;
-                        }
-
-                        if(j != pglobal->out[input_number].out_parameters[i].ctrl.maximum) {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\", ", j , (char*)&pglobal->out[input_number].out_parameters[i].menuitems[j].name);
-                        } else {
-                            sprintf(menuString + prevSize, "\"%d\": \"%s\"", j , (char*)&pglobal->out[input_number].out_parameters[i].menuitems[j].name);
-                        }
-                        k++;
-                    }
-                }
-            }
-
-            sprintf(buffer + strlen(buffer),
-                    "{\n"
-                    "\"name\": \"%s\",\n"
-                    "\"id\": \"%d\",\n"
-                    "\"type\": \"%d\",\n"
-                    "\"min\": \"%d\",\n"
-                    "\"max\": \"%d\",\n"
-                    "\"step\": \"%d\",\n"
-                    "\"default\": \"%d\",\n"
-                    "\"value\": \"%d\",\n"
-                    "\"dest\": \"1\",\n"
-                    "\"flags\": \"%d\",\n"
-                    "\"group\": \"%d\"",
-                    pglobal->out[input_number].out_parameters[i].ctrl.name,
-                    pglobal->out[input_number].out_parameters[i].ctrl.id,
-                    pglobal->out[input_number].out_parameters[i].ctrl.type,
-                    pglobal->out[input_number].out_parameters[i].ctrl.minimum,
-                    pglobal->out[input_number].out_parameters[i].ctrl.maximum,
-                    pglobal->out[input_number].out_parameters[i].ctrl.step,
-                    pglobal->out[input_number].out_parameters[i].ctrl.default_value,
-                    pglobal->out[input_number].out_parameters[i].value,
-                    // 1 is the code of the output plugin
-                    pglobal->out[input_number].out_parameters[i].ctrl.flags,
-                    pglobal->out[input_number].out_parameters[i].group
-                   );
-
-            if(pglobal->out[input_number].out_parameters[i].ctrl.type == V4L2_CTRL_TYPE_MENU) {
-                sprintf(buffer + strlen(buffer),
-                        ",\n"
-                        "\"menu\": {%s}\n"
-                        "}",
-                        menuString);
-            } else {
-                sprintf(buffer + strlen(buffer),
-                        "\n"
-                        "}");
-            }
-
-            if(i != (pglobal->out[input_number].parametercount - 1)) {
-                sprintf(buffer + strlen(buffer), ",\n");
-            }
-            free(menuString);
-        }
-    } else {
-        DBG("The output plugin %d has no paramters\n", input_number);
-    }
-    sprintf(buffer + strlen(buffer),
-            "\n]\n"
-            /*"},\n"*/);
-
-    sprintf(buffer + strlen(buffer),
-            "}\n");
-    i = strlen(buffer);
-
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
-        DBG("unable to serve the control JSON file\n");
-    }
+    DBG("Serving the output plugin %d descriptor JSON file\n", output_number);
+    send_cached_JSON(fd, &output_json[output_number], pglobal->out[output_number].controls_version,
+                     render_output_JSON, output_number, if_none_match);
 }
 
 #ifdef MANAGMENT
 void send_clients_JSON(int fd)
 {
-    char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
+    char header[BUFFER_SIZE];
+    strbuf sb = {0};
     unsigned long i = 0 ;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
+    int first = 1;
 
     DBG("Serving the clients JSON file\n");
 
-    sprintf(buffer + strlen(buffer),
+    strbuf_printf(&sb,
             "{\n"
             "\"clients\": [\n");
 
-    for (; i<client_infos.client_count; i++) {
-        sprintf(buffer + strlen(buffer),
-            "{\n"
-            "\"address\": \"%s\",\n"
-            "\"timestamp\": %ld\n"
-            "}\n",
-            client_infos.infos[i]->address,
-            (unsigned long)client_infos.infos[i]->last_take_time.tv_sec);
-
-        if(i != (client_infos.client_count - 1)) {
-            sprintf(buffer + strlen(buffer), ",\n");
+    for (; i < CLIENT_SHARDS; i++) {
+        client_shard *shard = &client_infos[i];
+        client_info *client;
+        int bucket;
+
+        pthread_mutex_lock(&shard->mutex);
+        for (bucket = 0; bucket < CLIENT_BUCKETS; bucket++) {
+            for (client = shard->buckets[bucket]; client != NULL; client = client->next) {
+                strbuf_printf(&sb,
+                    "%s{\n"
+                    "\"address\": \"%s\",\n"
+                    "\"timestamp\": %ld\n"
+                    "}\n",
+                    first ? "" : ",\n",
+                    client->address,
+                    (unsigned long)client->last_take_time.tv_sec);
+                first = 0;
+            }
         }
+        pthread_mutex_unlock(&shard->mutex);
     }
 
-    sprintf(buffer + strlen(buffer),
-            "]");
+    if (strbuf_printf(&sb, "]\n}\n") < 0) {
+        strbuf_free(&sb);
+        send_error(fd, 500, "could not allocate memory");
+        return;
+    }
 
-    sprintf(buffer + strlen(buffer),
-            "\n}\n");
-    i = strlen(buffer);
+    sprintf(header, "HTTP/1.0 200 OK\r\n" \
+            "Content-type: %s\r\n" \
+            STD_HEADER \
+            "\r\n", "application/x-javascript");
 
     /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
+    if(write(fd, header, strlen(header)) < 0 || write(fd, sb.data, sb.length) < 0) {
         DBG("unable to serve the control JSON file\n");
     }
+    strbuf_free(&sb);
 }
 #endif
 
@@ -20,7 +20,8 @@
 #                                                                              #
 *******************************************************************************/
 
-#define IO_BUFFER 256
+#define REQUEST_BUFFER 4096
+#define MAX_HEADERS 32
 #define BUFFER_SIZE 1024
 
 /* the boundary is used for the M-JPEG stream, it separates the multipart stream of pictures */
@@ -49,11 +50,29 @@
     "Pragma: no-cache\r\n" \
     "Expires: Mon, 3 Jan 2000 12:34:56 GMT\r\n"
 
+/*
+ * Headers describing a single frame: the wall clock time and the
+ * CLOCK_MONOTONIC time of the capture and the sequence number of the input.
+ * The monotonic time allows to measure intervals even if the clock is adjusted.
+ */
+#define FRAME_HEADER "X-Timestamp: %ld.%06ld\r\n" \
+    "X-Capture-Monotonic: %ld.%06ld\r\n" \
+    "X-Frame-Sequence: %lu\r\n"
+#define FRAME_HEADER_VALUES(frame) (long)(frame)->timestamp.tv_sec, (long)(frame)->timestamp.tv_usec, \
+    (long)(frame)->capture_time.tv_sec, (long)((frame)->capture_time.tv_nsec / 1000), \
+    (frame)->input_sequence
+
 /*
  * Maximum number of server sockets (i.e. protocol families) to listen.
  */
 #define MAX_SD_LEN 50
 
+/* the most frames a WebSocket client may have unacknowledged, see send_ws() */
+#define WS_MAX_WINDOW 64
+
+/* program.json lists at most this many threads of a plugin */
+#define MAX_LISTED_THREADS 256
+
 /*
  * Only the following fileypes are supported.
  *
@@ -94,29 +113,107 @@ typedef enum {
     A_INPUT_JSON,
     A_OUTPUT_JSON,
     A_PROGRAM_JSON,
+    A_EVENTS,
+    A_WS,
+    A_MANAGE,
     #ifdef MANAGMENT
     A_CLIENTS_JSON
     #endif
 } answer_t;
 
+/* maps the value of the "action" query parameter to the answer */
+typedef struct {
+    const char *name;
+    answer_t type;
+} action_t;
+
+/* a header field of the request, both point into the iobuffer */
+typedef struct {
+    char *name;
+    char *value;
+} header;
+
 /*
  * the client sends information with each request
  * this structure is used to store the important parts
  */
 typedef struct {
     answer_t type;
+    char *method;
+    char *path;
+    char *query_string;
     char *parameter;
     char *client;
     char *credentials;
-    char *query_string;
+    header headers[MAX_HEADERS];
+    int header_count;
 } request;
 
 /* the iobuffer structure is used to read from the HTTP-client */
 typedef struct {
-    int level;              /* how full is the buffer */
-    char buffer[IO_BUFFER]; /* the data */
+    int level;                   /* how full is the buffer */
+    int header_length;           /* length of the request header */
+    char buffer[REQUEST_BUFFER]; /* the data */
 } iobuffer;
 
+/* a copy of an input frame, shared by all clients which send it */
+typedef struct {
+    int refcount;               /* protected by the mutex of the watcher */
+    unsigned long sequence;     /* counted by the watcher */
+    unsigned long input_sequence; /* the frame number the input plugin assigned */
+    struct timeval timestamp;
+    struct timespec capture_time;
+    int width;                  /* of the picture, 0 if unknown */
+    int height;
+    unsigned char *data;
+    int size;
+    int capacity;
+} shared_frame;
+
+/*
+ * the frames of an input scaled down to scale/8 of their size, the first
+ * client which wants a frame in this size scales it, all others share it
+ */
+typedef struct {
+    pthread_mutex_t mutex;      /* held while a frame is scaled */
+    shared_frame *current;
+} scaled_variant;
+
+/*
+ * the watcher of an input plugin copies every frame once and hands it out to
+ * the clients, it keeps the frame statistics reported by the event stream
+ */
+typedef struct {
+    pthread_t thread;
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t update;      /* signals a new current frame */
+    shared_frame *current;
+    shared_frame *spare;        /* released frame, its buffer is reused */
+    unsigned long frames;       /* frames received since the start */
+    struct timeval last_frame;
+    double fps;                 /* measured over about one second */
+    int clients;                /* clients streaming this input */
+    int waiting;                /* clients waiting in wait_frame() */
+    scaled_variant scaled[8];   /* indexed by the scale in eighths */
+} input_watcher;
+
+/* growable string, used to render the JSON answers */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t size;
+} strbuf;
+
+/* rendered JSON document, it is rendered again when the version changes */
+typedef struct {
+    pthread_mutex_t mutex;
+    int valid;
+    unsigned int version;
+    strbuf body;
+    char etag[16];
+} json_cache;
+
 /* store configuration for each server instance */
 typedef struct {
     int port;
@@ -124,6 +221,12 @@ typedef struct {
     char *credentials;
     char *www_folder;
     char nocommands;
+    char management;                /* ?action=manage is allowed, "add" only with credentials */
+    #ifdef MANAGMENT
+    double *rate;                   /* frames per second for each client and input, 0 means unlimited */
+    double burst;                   /* size of the token bucket */
+    int client_ttl;
+    #endif
 } config;
 
 /* context of each server thread */
@@ -139,20 +242,41 @@ typedef struct {
 
 
 #if defined(MANAGMENT)
+/*
+ * the clients are kept in a hash table which is split into shards, each
+ * shard has its own lock so lookups from different clients rarely contend
+ */
+#define CLIENT_SHARDS 16
+#define CLIENT_BUCKETS 64   /* per shard */
+
+/* clients which did not request anything for this many seconds are removed */
+#define DEFAULT_CLIENT_TTL 60
+
+/* tokens are refilled with the configured rate */
+typedef struct {
+    double tokens;
+    struct timeval refill;
+} token_bucket;
+
 /*
  * this struct is used to hold information from the clients address, and last picture take time
+ * every input has its own token bucket, they are allocated along with the client
  */
 typedef struct _client_info {
     struct _client_info *next;
     char *address;
+    unsigned int hash;
     struct timeval last_take_time;
+    time_t last_seen;
+    token_bucket bucket[];
 } client_info;
 
-struct {
-    client_info **infos;
+typedef struct {
+    client_info *buckets[CLIENT_BUCKETS];
     unsigned int client_count;
+    time_t last_sweep;
     pthread_mutex_t mutex;
-} client_infos;
+} client_shard;
 
 #endif
 
@@ -164,24 +288,41 @@ typedef struct {
     context *pc;
     int fd;
     #ifdef MANAGMENT
-    client_info *client;
+    char address[NI_MAXHOST];
     #endif
 } cfd;
 
 
 
+/* the request parser, see request.c */
+void init_iobuffer(iobuffer *iobuf);
+void init_request(request *req);
+int read_request(int fd, iobuffer *iobuf, int timeout);
+int parse_request(iobuffer *iobuf, request *req);
+char *request_header(request *req, const char *name);
+char *query_value(char *query, const char *name, int *len);
+
 /* prototypes */
 void *server_thread(void *arg);
 void send_error(int fd, int which, char *message);
-void send_output_JSON(int fd, int plugin_number);
-void send_input_JSON(int fd, int plugin_number);
-void send_program_JSON(int fd);
+void send_output_JSON(int fd, int plugin_number, const char *if_none_match);
+void send_input_JSON(int fd, int plugin_number, const char *if_none_match);
+void send_program_JSON(int fd, const char *if_none_match);
+void start_watchers(int id);
+void stop_watchers(void);
+void notify_events(void);
+void send_events(cfd *context_fd);
+void send_ws(cfd *context_fd, int input_number, request *req);
+void manage(int fd, char *query, int may_load);
+int strbuf_printf(strbuf *sb, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void strbuf_free(strbuf *sb);
 void check_JSON_string(char *source, char *destination);
 
 #ifdef MANAGMENT
-client_info *add_client(char *address);
-int check_client_status(client_info *client);
-void update_client_timestamp(client_info *client);
+void init_clients(void);
+void add_client(const char *address, int ttl);
+int check_client_status(const char *address, int input, double rate, double burst);
+void update_client_timestamp(const char *address);
 void send_clients_JSON(int fd);
 #endif
 
@@ -0,0 +1,178 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+#include "jpeg_scale.h"
+
+/******************************************************************************
+Description.: Reads the size of the picture from the start of frame marker,
+              this is much cheaper than asking libjpeg to parse the header
+Input Value.: * data...: the JPEG data
+              * size...: length of the data
+Return Value: 0 if the size was found, -1 otherwise
+              * width..: width of the picture
+              * height.: height of the picture
+******************************************************************************/
+int jpeg_dimensions(const unsigned char *data, int size, int *width, int *height)
+{
+    int i = 2;
+
+    if(size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return -1;
+
+    while(i + 4 <= size) {
+        int marker, length;
+
+        if(data[i] != 0xFF)
+            return -1;
+        marker = data[i + 1];
+        if(marker == 0xFF) {
+            /* fill byte */
+            i++;
+            continue;
+        }
+        length = (data[i + 2] << 8) | data[i + 3];
+
+        /* SOF0 to SOF15, except DHT (C4), JPG (C8) and DAC (CC) */
+        if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if(i + 9 > size)
+                return -1;
+            *height = (data[i + 5] << 8) | data[i + 6];
+            *width = (data[i + 7] << 8) | data[i + 8];
+            return 0;
+        }
+
+        /* the entropy coded data starts after SOS, the size must be known by now */
+        if(marker == 0xDA)
+            return -1;
+        i += 2 + length;
+    }
+
+    return -1;
+}
+
+#ifndef NO_LIBJPEG
+struct scale_error {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+/* the default handler of libjpeg exits the process, return to jpeg_scale() instead */
+static void scale_error_exit(j_common_ptr cinfo)
+{
+    longjmp(((struct scale_error *)cinfo->err)->jump, 1);
+}
+#endif
+
+/******************************************************************************
+Description.: Scales a JPEG picture down by scale/8. The decoder of libjpeg
+              does the scaling in the DCT domain, so the picture is never
+              decoded at full size, and the scanlines are encoded again as
+              they arrive. The colors stay in YCbCr, so there is no color
+              conversion in either direction.
+Input Value.: * data...: the JPEG data
+              * size...: length of the data
+              * scale..: 1 to 8, the size of the result in eighths
+              * quality: quality of the encoder
+              * dst....: buffer for the result, it is replaced if it is too
+                         small or NULL
+              * capacity: size of the buffer, it is updated as well
+Return Value: size of the scaled picture or -1 on errors
+******************************************************************************/
+int jpeg_scale(const unsigned char *data, int size, int scale, int quality, unsigned char **dst, int *capacity)
+{
+#ifdef NO_LIBJPEG
+    return -1;
+#else
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct cinfo;
+    struct scale_error err;
+    unsigned char *out = *dst;
+    unsigned long out_size = (*dst != NULL) ? *capacity : 0;
+    JSAMPROW volatile row = NULL;
+
+    dinfo.err = jpeg_std_error(&err.pub);
+    cinfo.err = &err.pub;
+    err.pub.error_exit = scale_error_exit;
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&cinfo);
+
+    if(setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        free(row);
+        /* the buffer libjpeg allocated for a larger picture */
+        if(out != *dst)
+            free(out);
+        return -1;
+    }
+
+    jpeg_mem_src(&dinfo, (unsigned char *)data, size);
+    jpeg_read_header(&dinfo, TRUE);
+    dinfo.scale_num = scale;
+    dinfo.scale_denom = 8;
+    dinfo.dct_method = JDCT_IFAST;
+    dinfo.do_fancy_upsampling = FALSE;
+    if(dinfo.jpeg_color_space == JCS_YCbCr)
+        dinfo.out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(&dinfo);
+
+    cinfo.image_width = dinfo.output_width;
+    cinfo.image_height = dinfo.output_height;
+    cinfo.input_components = dinfo.output_components;
+    cinfo.in_color_space = dinfo.out_color_space;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.dct_method = JDCT_IFAST;
+    jpeg_mem_dest(&cinfo, &out, &out_size);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    if((row = malloc(dinfo.output_width * dinfo.output_components)) == NULL)
+        longjmp(err.jump, 1);
+
+    while(dinfo.output_scanline < dinfo.output_height) {
+        JSAMPROW rows[1] = { row };
+
+        jpeg_read_scanlines(&dinfo, rows, 1);
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    free(row);
+
+    /* libjpeg allocated a larger buffer, it does not free the one it got */
+    if(out != *dst) {
+        free(*dst);
+        *dst = out;
+        *capacity = out_size;
+    }
+
+    return out_size;
+#endif
+}
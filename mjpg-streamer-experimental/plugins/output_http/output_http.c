@@ -28,6 +28,7 @@
 #include <signal.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <getopt.h>
@@ -43,9 +44,9 @@
 
 #define OUTPUT_PLUGIN_NAME "HTTP output plugin"
 /*
- * keep context for each server
+ * keep context for each server, indexed by the output number
  */
-context servers[MAX_OUTPUT_PLUGINS];
+context *servers;
 
 /******************************************************************************
 Description.: print help for this plugin to stdout
@@ -64,6 +65,15 @@ void help(void)
 	    " [-l ] --listen ]........: Listen on Hostname / IP\n" \
             " [-c | --credentials ]...: ask for \"username:password\" on connect\n" \
             " [-n | --nocommands ]....: disable execution of commands\n"
+            " [-m | --manage ]........: allow to manage the plugins with ?action=manage,\n"
+            "                           adding plugins needs --credentials as well\n"
+#ifdef MANAGMENT
+            " [-r | --rate ]..........: snapshots per second and client, a comma\n"
+            "                           separated list sets a rate for each input,\n"
+            "                           0 disables the limit (default: 1)\n"
+            " [-b | --burst ].........: snapshots a client may fetch in a row (default: 1)\n"
+            " [-t | --ttl ]...........: forget clients idle for this many seconds\n"
+#endif
             " ---------------------------------------------------------------\n");
 }
 
@@ -82,14 +92,26 @@ int output_init(output_parameter *param, int id)
     int i;
     int  port;
     char *credentials, *www_folder, *hostname = NULL;
-    char nocommands;
+    char nocommands, management;
+    #ifdef MANAGMENT
+    char *rate = NULL, *next;
+    double burst = 1;
+    int client_ttl = DEFAULT_CLIENT_TTL;
+    #endif
 
     DBG("output #%02d\n", param->id);
 
+    /* outputs may be added later, there is a context for every slot */
+    if(servers == NULL && (servers = calloc(param->global->outmax, sizeof(context))) == NULL) {
+        OPRINT("could not allocate memory\n");
+        return 1;
+    }
+
     port = htons(8080);
     credentials = NULL;
     www_folder = NULL;
     nocommands = 0;
+    management = 0;
 
     param->argv[0] = OUTPUT_PLUGIN_NAME;
 
@@ -115,6 +137,16 @@ int output_init(output_parameter *param, int id)
             {"www", required_argument, 0, 0},
             {"n", no_argument, 0, 0},
             {"nocommands", no_argument, 0, 0},
+            {"m", no_argument, 0, 0},
+            {"manage", no_argument, 0, 0},
+            #ifdef MANAGMENT
+            {"r", required_argument, 0, 0},
+            {"rate", required_argument, 0, 0},
+            {"b", required_argument, 0, 0},
+            {"burst", required_argument, 0, 0},
+            {"t", required_argument, 0, 0},
+            {"ttl", required_argument, 0, 0},
+            #endif
             {0, 0, 0, 0}
         };
 
@@ -175,8 +207,60 @@ int output_init(output_parameter *param, int id)
             DBG("case 10,11\n");
             nocommands = 1;
             break;
+
+            /* m, manage */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            management = 1;
+            break;
+
+            #ifdef MANAGMENT
+            /* r, rate */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            rate = optarg;
+            break;
+
+            /* b, burst */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            burst = MAX(atof(optarg), 1);
+            break;
+
+            /* t, ttl */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            client_ttl = MAX(atoi(optarg), 1);
+            break;
+            #endif
+        }
+    }
+
+    #ifdef MANAGMENT
+    if((servers[param->id].conf.rate = calloc(param->global->inmax + 1, sizeof(double))) == NULL) {
+        OPRINT("could not allocate memory\n");
+        return 1;
+    }
+
+    /* every input without an own entry gets the last rate of the list */
+    servers[param->id].conf.rate[0] = 1;
+    for(i = 0, next = rate; i < param->global->inmax; i++) {
+        if(next != NULL) {
+            double value = strtod(next, &next);
+
+            servers[param->id].conf.rate[i] = MAX(value, 0);
+            next = (*next == ',') ? next + 1 : NULL;
+        } else if(i > 0) {
+            servers[param->id].conf.rate[i] = servers[param->id].conf.rate[i - 1];
         }
     }
+    servers[param->id].conf.burst = burst;
+    servers[param->id].conf.client_ttl = client_ttl;
+    #endif
 
     servers[param->id].id = param->id;
     servers[param->id].pglobal = param->global;
@@ -185,12 +269,19 @@ int output_init(output_parameter *param, int id)
     servers[param->id].conf.credentials = credentials;
     servers[param->id].conf.www_folder = www_folder;
     servers[param->id].conf.nocommands = nocommands;
+    servers[param->id].conf.management = management;
 
     OPRINT("www-folder-path......: %s\n", (www_folder == NULL) ? "disabled" : www_folder);
     OPRINT("HTTP TCP port........: %d\n", ntohs(port));
     OPRINT("HTTP Listen Address..: %s\n", hostname);
     OPRINT("username:password....: %s\n", (credentials == NULL) ? "disabled" : credentials);
     OPRINT("commands.............: %s\n", (nocommands) ? "disabled" : "enabled");
+    OPRINT("plugin management....: %s\n", (!management || nocommands) ? "disabled" :
+           (credentials == NULL) ? "enabled, without adding plugins" : "enabled");
+    #ifdef MANAGMENT
+    OPRINT("client rate limit....: %s per second, burst %.0f\n", (rate == NULL) ? "1" : rate, burst);
+    OPRINT("client ttl...........: %d s\n", client_ttl);
+    #endif
 
     param->global->out[id].name = malloc((strlen(OUTPUT_PLUGIN_NAME) + 1) * sizeof(char));
     sprintf(param->global->out[id].name, OUTPUT_PLUGIN_NAME);
@@ -201,8 +292,8 @@ int output_init(output_parameter *param, int id)
 /******************************************************************************
 Description.: this will stop the server thread, client threads
               will not get cleaned properly, because they run detached and
-              no pointer is kept. This is not a huge issue, because this
-              funtion is intended to clean up the biggest mess on shutdown.
+              no pointer is kept. The server thread is joined, so the port
+              is free again when the output is started again.
 Input Value.: id determines which server instance to send commands to
 Return Value: always 0
 ******************************************************************************/
@@ -211,6 +302,7 @@ int output_stop(int id)
 
     DBG("will cancel server thread #%02d\n", id);
     pthread_cancel(servers[id].threadID);
+    pthread_join(servers[id].threadID, NULL);
 
     return 0;
 }
@@ -226,7 +318,6 @@ int output_run(int id)
 
     /* create thread and pass context to thread function */
     pthread_create(&(servers[id].threadID), NULL, server_thread, &(servers[id]));
-    pthread_detach(servers[id].threadID);
 
     return 0;
 }
@@ -0,0 +1,231 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * The parser of the HTTP requests. It does not depend on the rest of the
+ * server, so bench/http_parse.c can feed it any input.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "../../mjpg_streamer.h"
+#include "../../utils.h"
+
+#include "httpd.h"
+
+/******************************************************************************
+Description.: initializes the iobuffer structure properly
+Input Value.: pointer to already allocated iobuffer
+Return Value: iobuf
+******************************************************************************/
+void init_iobuffer(iobuffer *iobuf)
+{
+    iobuf->buffer[0] = '\0';
+    iobuf->level = 0;
+    iobuf->header_length = 0;
+}
+
+/******************************************************************************
+Description.: initializes the request structure properly
+Input Value.: pointer to already allocated req
+Return Value: req
+******************************************************************************/
+void init_request(request *req)
+{
+    memset(req, 0, sizeof(request));
+    req->type = A_UNKNOWN;
+}
+
+/******************************************************************************
+Description.: Read the complete request header of a client into the iobuffer.
+              Reading stops at the empty line which ends the header, data
+              the client sent after it stays in the buffer.
+Input Value.: * fd.....: fildescriptor to read from
+              * iobuf..: the per connection buffer
+              * timeout: seconds to wait for more data
+Return Value: * iobuf..: buffer, level and header_length are set
+              * func().: length of the header, -1 in case of error or timeout,
+                         -2 if the header does not fit into the buffer
+******************************************************************************/
+int read_request(int fd, iobuffer *iobuf, int timeout)
+{
+    int rc, scanned = 0;
+    char *end, *end_crlf;
+    fd_set fds;
+    struct timeval tv;
+
+    init_iobuffer(iobuf);
+
+    while(iobuf->level < REQUEST_BUFFER - 1) {
+        /* select will return in case of timeout or new data arrived */
+        tv.tv_sec = timeout;
+        tv.tv_usec = 0;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if((rc = select(fd + 1, &fds, NULL, NULL, &tv)) <= 0) {
+            if(rc < 0)
+                exit(EXIT_FAILURE);
+
+            /* this must be a timeout */
+            return -1;
+        }
+
+        /*
+         * there should be at least one byte, because select signalled it.
+         * But: It may happen (very seldomly), that the socket gets closed remotly between
+         * the select() and the following read.
+         */
+        if((rc = read(fd, iobuf->buffer + iobuf->level, REQUEST_BUFFER - 1 - iobuf->level)) <= 0) {
+            /* an error occured */
+            return -1;
+        }
+        iobuf->level += rc;
+        iobuf->buffer[iobuf->level] = '\0';
+
+        /* the header ends with an empty line, some clients omit the '\r' */
+        end = memmem(iobuf->buffer + scanned, iobuf->level - scanned, "\n\n", 2);
+        end_crlf = memmem(iobuf->buffer + scanned, iobuf->level - scanned, "\n\r\n", 3);
+        if(end_crlf != NULL && (end == NULL || end_crlf < end)) {
+            iobuf->header_length = end_crlf + 3 - iobuf->buffer;
+            return iobuf->header_length;
+        } else if(end != NULL) {
+            iobuf->header_length = end + 2 - iobuf->buffer;
+            return iobuf->header_length;
+        }
+
+        /* the terminator may be split across two reads */
+        scanned = MAX(iobuf->level - 2, 0);
+    }
+
+    DBG("request header does not fit into %d bytes\n", REQUEST_BUFFER);
+    return -2;
+}
+
+/******************************************************************************
+Description.: Split the request header in the iobuffer into the request line
+              and the header fields. Nothing gets copied or allocated, the
+              parts are terminated in place and the request points into the
+              buffer.
+Input Value.: * iobuf..: buffer filled by read_request()
+              * req....: request to fill
+Return Value: 0 if the request line is valid, -1 otherwise
+******************************************************************************/
+int parse_request(iobuffer *iobuf, request *req)
+{
+    char *line = iobuf->buffer, *end = iobuf->buffer + iobuf->header_length;
+    char *eol, *sp, *colon;
+
+    /* request line: METHOD SP TARGET [SP VERSION] */
+    if((eol = memchr(line, '\n', end - line)) == NULL)
+        return -1;
+    *eol = '\0';
+    if(eol > line && eol[-1] == '\r')
+        eol[-1] = '\0';
+
+    req->method = line;
+    if((sp = strchr(line, ' ')) == NULL)
+        return -1;
+    *sp = '\0';
+    req->path = sp + 1;
+    if((sp = strchr(req->path, ' ')) != NULL)
+        *sp = '\0';
+    if(req->path[0] != '/')
+        return -1;
+
+    if((sp = strchr(req->path, '?')) != NULL) {
+        *sp = '\0';
+        req->query_string = sp + 1;
+    }
+
+    /* header fields: NAME ":" [SP] VALUE, up to the empty line */
+    for(line = eol + 1; line < end; line = eol + 1) {
+        if((eol = memchr(line, '\n', end - line)) == NULL)
+            break;
+        *eol = '\0';
+        if(eol > line && eol[-1] == '\r')
+            eol[-1] = '\0';
+        if(*line == '\0')
+            break;
+
+        if((colon = strchr(line, ':')) == NULL || req->header_count == MAX_HEADERS)
+            continue;
+        *colon++ = '\0';
+        while(*colon == ' ' || *colon == '\t')
+            colon++;
+        req->headers[req->header_count].name = line;
+        req->headers[req->header_count].value = colon;
+        req->header_count++;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Look up a header field of the request
+Input Value.: * req....: the parsed request
+              * name...: field name, compared case insensitive
+Return Value: the value or NULL if the client did not send this field
+******************************************************************************/
+char *request_header(request *req, const char *name)
+{
+    int i;
+
+    for(i = 0; i < req->header_count; i++) {
+        if(strcasecmp(req->headers[i].name, name) == 0)
+            return req->headers[i].value;
+    }
+    return NULL;
+}
+
+/******************************************************************************
+Description.: Look up a parameter of the query string
+Input Value.: * query..: the query string, may be NULL
+              * name...: parameter name
+              * len....: receives the length of the value
+Return Value: pointer to the (not terminated) value or NULL if not found
+******************************************************************************/
+char *query_value(char *query, const char *name, int *len)
+{
+    int name_len = strlen(name);
+
+    while(query != NULL && *query != '\0') {
+        int param_len = strcspn(query, "&");
+
+        if(param_len > name_len && strncmp(query, name, name_len) == 0 && query[name_len] == '=') {
+            *len = param_len - name_len - 1;
+            return query + name_len + 1;
+        }
+
+        query += param_len;
+        if(*query == '&')
+            query++;
+    }
+    return NULL;
+}
@@ -0,0 +1,244 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "websocket.h"
+
+#define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+/******************************************************************************
+Description.: SHA-1 as described in RFC 3174. The WebSocket handshake needs it
+              and it is not worth a dependency on a crypto library.
+Input Value.: * data...: the message
+              * length.: length of the message, up to 119 bytes
+Return Value: * digest.: the 20 bytes of the hash
+******************************************************************************/
+static void sha1(const unsigned char *data, size_t length, unsigned char *digest)
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    unsigned char message[128] = {0};
+    size_t blocks = (length + 8) / 64 + 1;
+    uint64_t bits = (uint64_t)length * 8;
+    size_t block;
+    int i;
+
+    /* the message is padded with a 1 bit, zeros and its length in bits */
+    memcpy(message, data, length);
+    message[length] = 0x80;
+    for(i = 0; i < 8; i++)
+        message[blocks * 64 - 1 - i] = bits >> (i * 8);
+
+    for(block = 0; block < blocks; block++) {
+        const unsigned char *chunk = message + block * 64;
+        uint32_t w[80], a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f, k, temp;
+
+        for(i = 0; i < 16; i++)
+            w[i] = (uint32_t)chunk[i * 4] << 24 | chunk[i * 4 + 1] << 16 | chunk[i * 4 + 2] << 8 | chunk[i * 4 + 3];
+        for(i = 16; i < 80; i++)
+            w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        for(i = 0; i < 80; i++) {
+            if(i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if(i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if(i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            temp = ROL(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = ROL(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for(i = 0; i < 20; i++)
+        digest[i] = h[i / 4] >> (24 - (i % 4) * 8);
+}
+
+/******************************************************************************
+Description.: Calculates the Sec-WebSocket-Accept value for the key the client
+              sent, it is the base64 encoded SHA-1 of the key and a fixed GUID
+Input Value.: * key....: value of the Sec-WebSocket-Key header
+Return Value: * accept.: buffer of WS_ACCEPT_LENGTH bytes for the result
+******************************************************************************/
+void ws_accept_key(const char *key, char *accept)
+{
+    static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned char message[64 + sizeof(guid)], digest[21] = {0};
+    size_t key_length = strnlen(key, 64);
+    int i, j;
+
+    memcpy(message, key, key_length);
+    memcpy(message + key_length, guid, sizeof(guid) - 1);
+    sha1(message, key_length + sizeof(guid) - 1, digest);
+
+    /* 20 bytes become 27 characters and one padding character */
+    for(i = 0, j = 0; i < 20; i += 3) {
+        uint32_t triple = digest[i] << 16 | digest[i + 1] << 8 | (i + 2 < 20 ? digest[i + 2] : 0);
+
+        accept[j++] = base64[(triple >> 18) & 0x3F];
+        accept[j++] = base64[(triple >> 12) & 0x3F];
+        accept[j++] = base64[(triple >> 6) & 0x3F];
+        accept[j++] = (i + 2 < 20) ? base64[triple & 0x3F] : '=';
+    }
+    accept[j] = '\0';
+}
+
+/******************************************************************************
+Description.: Sends one unmasked frame to the client. The payload consists of
+              an optional header and the data, both are sent with one call.
+Input Value.: * fd.....: the connected client
+              * opcode.: WS_BINARY, WS_TEXT, ...
+              * header.: first part of the payload, may be NULL
+              * header_length: its length
+              * data...: second part of the payload, may be NULL
+              * length.: its length
+Return Value: 0 on success, -1 if writing failed
+******************************************************************************/
+int ws_write_frame(int fd, int opcode, const void *header, size_t header_length, const void *data, size_t length)
+{
+    unsigned char frame_header[10];
+    uint64_t payload_length = header_length + length;
+    struct iovec iov[3];
+    size_t size = 0;
+    ssize_t rc;
+    int i, count = 0;
+
+    frame_header[0] = 0x80 | opcode; /* FIN, no fragmentation */
+    if(payload_length < 126) {
+        frame_header[1] = payload_length;
+        size = 2;
+    } else if(payload_length <= 0xFFFF) {
+        frame_header[1] = 126;
+        frame_header[2] = payload_length >> 8;
+        frame_header[3] = payload_length;
+        size = 4;
+    } else {
+        frame_header[1] = 127;
+        for(i = 0; i < 8; i++)
+            frame_header[2 + i] = payload_length >> (56 - i * 8);
+        size = 10;
+    }
+
+    iov[count].iov_base = frame_header;
+    iov[count++].iov_len = size;
+    if(header_length > 0) {
+        iov[count].iov_base = (void *)header;
+        iov[count++].iov_len = header_length;
+    }
+    if(length > 0) {
+        iov[count].iov_base = (void *)data;
+        iov[count++].iov_len = length;
+    }
+    size += payload_length;
+
+    /* writev may send less than everything, continue where it stopped */
+    for(i = 0; i < count;) {
+        if((rc = writev(fd, iov + i, count - i)) <= 0)
+            return -1;
+        size -= rc;
+        while(i < count && (size_t)rc >= iov[i].iov_len) {
+            rc -= iov[i].iov_len;
+            i++;
+        }
+        if(i < count) {
+            iov[i].iov_base = (char *)iov[i].iov_base + rc;
+            iov[i].iov_len -= rc;
+        }
+    }
+
+    return 0;
+}
+
+/* reads exactly length bytes */
+static int read_all(int fd, unsigned char *buffer, size_t length)
+{
+    ssize_t rc;
+
+    while(length > 0) {
+        if((rc = read(fd, buffer, length)) <= 0)
+            return -1;
+        buffer += rc;
+        length -= rc;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: Reads one frame from the client and removes the masking.
+              Clients are only expected to send short messages, larger frames
+              are treated as error.
+Input Value.: * fd.....: the connected client
+              * max_length: size of the payload buffer
+Return Value: * opcode.: opcode of the frame
+              * payload: the unmasked payload, zero terminated
+              * func().: length of the payload or -1 in case of an error
+******************************************************************************/
+int ws_read_frame(int fd, int *opcode, unsigned char *payload, size_t max_length)
+{
+    unsigned char header[2], mask[4];
+    uint64_t length;
+    size_t i;
+
+    if(read_all(fd, header, 2) < 0)
+        return -1;
+
+    *opcode = header[0] & 0x0F;
+    length = header[1] & 0x7F;
+    if(length == 126) {
+        unsigned char extended[2];
+        if(read_all(fd, extended, 2) < 0)
+            return -1;
+        length = extended[0] << 8 | extended[1];
+    } else if(length == 127) {
+        return -1;
+    }
+
+    /* frames of the client must be masked */
+    if(!(header[1] & 0x80) || length >= max_length)
+        return -1;
+    if(read_all(fd, mask, 4) < 0 || read_all(fd, payload, length) < 0)
+        return -1;
+
+    for(i = 0; i < length; i++)
+        payload[i] ^= mask[i % 4];
+    payload[length] = '\0';
+
+    return length;
+}
@@ -0,0 +1,40 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+
+/* opcodes of the WebSocket frames, RFC 6455 section 5.2 */
+#define WS_TEXT   0x1
+#define WS_BINARY 0x2
+#define WS_CLOSE  0x8
+#define WS_PING   0x9
+#define WS_PONG   0xA
+
+/* length of the Sec-WebSocket-Accept value including the terminating zero */
+#define WS_ACCEPT_LENGTH 29
+
+void ws_accept_key(const char *key, char *accept);
+int ws_write_frame(int fd, int opcode, const void *header, size_t header_length, const void *data, size_t length);
+int ws_read_frame(int fd, int *opcode, unsigned char *payload, size_t max_length);
+
+#endif
@@ -67,6 +67,7 @@ static pthread_t worker;
 static globals *pglobal;
 static int fd, max_frame_size;
 static unsigned char *frame = NULL;
+static unsigned char first_run = 1;
 static char *command = NULL;
 static int input_number = 0;
 
@@ -89,6 +90,12 @@ void help(void)
             " ---------------------------------------------------------------\n");
 }
 
+/* cleanup handler, releases a mutex held while the thread got cancelled */
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
 /******************************************************************************
 Description.: clean up allocated resources
 Input Value.: unused argument
@@ -96,8 +103,6 @@ Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
-
     if(!first_run) {
         DBG("already cleaned up resources\n");
         return;
@@ -106,8 +111,12 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
+    /* this plugin does not take frames any more, see output_run() */
+    input_demand(&pglobal->in[input_number], -1);
+
     if(frame != NULL) {
         free(frame);
+        frame = NULL;
     }
     close(fd);
 }
@@ -124,6 +133,8 @@ void *worker_thread(void *arg)
     char buffer1[1024] = {0};
     unsigned char *tmp_framebuffer = NULL;
 
+    pglobal->thread_start(Dest_Output, (int)(long)arg, "sender");
+
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
@@ -158,9 +169,12 @@ void *worker_thread(void *arg)
 
         DBG("waiting for fresh frame\n");
         pthread_mutex_lock(&pglobal->in[input_number].db);
+        pthread_cleanup_push(unlock_mutex, &pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        pthread_cleanup_pop(0);
 
         /* read buffer */
+        input_frame(&pglobal->in[input_number]);
         frame_size = pglobal->in[input_number].size;
 
         /* check if buffer for frame is large enough, increase it if necessary */
@@ -248,6 +262,14 @@ int output_init(output_parameter *param)
 {
     int i;
 
+    /* the library stays loaded after a removal, start from the defaults */
+    first_run = 1;
+    frame = NULL;
+    max_frame_size = 0;
+    command = NULL;
+    input_number = 0;
+    port = 554;
+
     param->argv[0] = OUTPUT_PLUGIN_NAME;
 
     /* show all parameters for DBG purposes */
@@ -322,6 +344,7 @@ int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -332,9 +355,11 @@ Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
+    /* this plugin takes every frame, an input which captures on demand keeps running */
+    input_demand(&pglobal->in[input_number], 1);
+
     DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    pthread_create(&worker, 0, worker_thread, (void *)(long)id);
     return 0;
 }
 
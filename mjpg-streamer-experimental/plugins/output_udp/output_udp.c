@@ -60,6 +60,7 @@ static globals *pglobal;
 static int fd, delay, max_frame_size;
 static char *folder = "/tmp";
 static unsigned char *frame = NULL;
+static unsigned char first_run = 1;
 static char *command = NULL;
 static int input_number = 0;
 
@@ -85,6 +86,12 @@ void help(void)
             " ---------------------------------------------------------------\n");
 }
 
+/* cleanup handler, releases a mutex held while the thread got cancelled */
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
 /******************************************************************************
 Description.: clean up allocated resources
 Input Value.: unused argument
@@ -92,8 +99,6 @@ Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
-
     if(!first_run) {
         DBG("already cleaned up resources\n");
         return;
@@ -102,8 +107,12 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
+    /* this plugin does not take frames any more, see output_run() */
+    input_demand(&pglobal->in[input_number], -1);
+
     if(frame != NULL) {
         free(frame);
+        frame = NULL;
     }
     close(fd);
 }
@@ -120,6 +129,8 @@ void *worker_thread(void *arg)
     char buffer1[1024] = {0};
     unsigned char *tmp_framebuffer = NULL;
 
+    pglobal->thread_start(Dest_Output, (int)(long)arg, "sender");
+
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
@@ -154,9 +165,12 @@ void *worker_thread(void *arg)
 
         DBG("waiting for fresh frame\n");
         pthread_mutex_lock(&pglobal->in[input_number].db);
+        pthread_cleanup_push(unlock_mutex, &pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        pthread_cleanup_pop(0);
 
         /* read buffer */
+        input_frame(&pglobal->in[input_number]);
         frame_size = pglobal->in[input_number].size;
 
         /* check if buffer for frame is large enough, increase it if necessary */
@@ -250,6 +264,14 @@ int output_init(output_parameter *param)
     int i;
 
     delay = 0;
+    /* the library stays loaded after a removal, start from the defaults */
+    first_run = 1;
+    frame = NULL;
+    max_frame_size = 0;
+    folder = "/tmp";
+    command = NULL;
+    input_number = 0;
+    port = 0;
 
     param->argv[0] = OUTPUT_PLUGIN_NAME;
 
@@ -362,6 +384,7 @@ int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -372,9 +395,11 @@ Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
+    /* this plugin takes every frame, an input which captures on demand keeps running */
+    input_demand(&pglobal->in[input_number], 1);
+
     DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    pthread_create(&worker, 0, worker_thread, (void *)(long)id);
     return 0;
 }
 
@@ -39,6 +39,7 @@
 static pthread_t worker;
 static globals *pglobal;
 static unsigned char *frame = NULL;
+static unsigned char first_run = 1;
 static int input_number = 0;
 
 /******************************************************************************
@@ -53,6 +54,12 @@ void help(void)
             " ---------------------------------------------------------------\n");
 }
 
+/* cleanup handler, releases a mutex held while the thread got cancelled */
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
 /******************************************************************************
 Description.: clean up allocated resources
 Input Value.: unused argument
@@ -60,8 +67,6 @@ Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
-
     if(!first_run) {
         DBG("already cleaned up resources\n");
         return;
@@ -70,7 +75,11 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
+    /* this plugin does not take frames any more, see output_run() */
+    input_demand(&pglobal->in[input_number], -1);
+
     free(frame);
+    frame = NULL;
     SDL_Quit();
 }
 
@@ -257,6 +266,8 @@ void *worker_thread(void *arg)
     SDL_Surface *screen = NULL, *image = NULL;
     decompressed_image rgbimage;
 
+    pglobal->thread_start(Dest_Output, (int)(long)arg, "viewer");
+
     /* initialze the buffer for the decompressed image */
     rgbimage.buffersize = 0;
     rgbimage.buffer = NULL;
@@ -279,9 +290,12 @@ void *worker_thread(void *arg)
     while(!pglobal->stop) {
         DBG("waiting for fresh frame\n");
         pthread_mutex_lock(&pglobal->in[input_number].db);
+        pthread_cleanup_push(unlock_mutex, &pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        pthread_cleanup_pop(0);
 
         /* read buffer */
+        input_frame(&pglobal->in[input_number]);
         frame_size = pglobal->in[input_number].size;
         memcpy(frame, pglobal->in[input_number].buf, frame_size);
 
@@ -344,6 +358,11 @@ int output_init(output_parameter *param)
 {
     int i;
 
+    /* a removed viewer leaves its state in the library, which stays loaded */
+    first_run = 1;
+    frame = NULL;
+    input_number = 0;
+
     param->argv[0] = OUTPUT_PLUGIN_NAME;
 
     /* show all parameters for DBG purposes */
@@ -410,6 +429,7 @@ int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -420,9 +440,11 @@ Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
+    /* this plugin takes every frame, an input which captures on demand keeps running */
+    input_demand(&pglobal->in[input_number], 1);
+
     DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    pthread_create(&worker, 0, worker_thread, (void *)(long)id);
     return 0;
 }
 
@@ -37,6 +37,7 @@
 #include <syslog.h>
 #include <dirent.h>
 #include <netinet/in.h>
+#include <limits.h>
 #include <zmq.h>
 
 #include <linux/types.h>          /* for videodev2.h */
@@ -51,19 +52,53 @@
 #define OUTPUT_PLUGIN_NAME "UDPSERVER output plugin"
 
 #define MAX_ZMQ_BUFFER_SIZE 10
+#define MAX_ZMQ_CREDITS 256
+#define MAX_ZMQ_IDENTITY 256
+
+/* how frames are distributed to the peers */
+enum zmq_mode {
+    ZMQ_MODE_PUB,       // every subscriber gets every frame
+    ZMQ_MODE_PUSH,      // round robin to the connected PULL workers
+    ZMQ_MODE_ROUTER,    // each frame goes to one worker which asked for it
+};
+
+static const struct {
+    const char *k;
+    const int v;
+} zmq_modes[] = {
+    { "pub", ZMQ_MODE_PUB },
+    { "push", ZMQ_MODE_PUSH },
+    { "router", ZMQ_MODE_ROUTER },
+};
 
 static pthread_t worker;
 static globals *pglobal;
 static int fd, ringbuffer_size = -1, ringbuffer_exceed = 0, max_frame_size;
 static char *folder = "/tmp";
 static unsigned char *frame = NULL;
+static unsigned char first_run = 1;
 static unsigned char *frames[MAX_ZMQ_BUFFER_SIZE];
+static int frame_sizes[MAX_ZMQ_BUFFER_SIZE];
 static char *command = NULL;
 static int input_number = 0;
 static char *mjpgFileName = NULL;
 static char *zmqAddress = NULL;
 static int zmqBufferSize = 3;
 static int zmqBufferPos = 0;
+static int zmqZeroCopy = 0;
+static int zmqBatchTime = 0;              // ms, 0 means count based batching only
+static struct timespec batch_deadline;
+static int zmqMode = ZMQ_MODE_PUB;
+static int zmqHwm = -1;
+static int plugin_id = 0;
+static unsigned long long sent_frames = 0, dropped_frames = 0;
+
+/* ROUTER mode: one entry per frame a worker asked for */
+static struct {
+    unsigned char identity[MAX_ZMQ_IDENTITY];
+    size_t len;
+} credits[MAX_ZMQ_CREDITS];
+static int credit_head = 0, credit_count = 0;
 static Pb__Package pbPackage = PB__PACKAGE__INIT; // Package
 
 static void *context;
@@ -88,11 +123,25 @@ void help(void)
             " [-f | --folder ]........: folder to save pictures\n" \
             " [-m | --mjpeg ].........: save the frames to an mjpg file \n" \
             " [-i | --input ].........: read frames from the specified input plugin\n" \
+            " [-a | --address ].......: ZMQ address to bind the publisher to\n" \
+            " [-b | --buffer_size ]...: number of frames to send per message (max %d)\n" \
+            " [-t | --batch_time ]....: send a batch at the latest after this many ms\n" \
+            " [-z | --zerocopy ]......: send a protobuf header and the frames as raw\n" \
+            "                           message parts without repacking them\n" \
+            " [-M | --mode ]..........: socket type: pub (default), push or router\n" \
+            "                           push and router hand each batch to one worker\n" \
+            " [-w | --hwm ]...........: send high water mark of the socket\n" \
             " The following arguments are takes effect only if the current mode is not MJPG\n" \
             " [-s | --size ]..........: size of ring buffer (max number of pictures to hold)\n" \
             " [-e | --exceed ]........: allow ringbuffer to exceed limit by this amount\n" \
             " [-c | --command ].......: execute command after saving picture\n"\
-            " ---------------------------------------------------------------\n");
+            " ---------------------------------------------------------------\n", MAX_ZMQ_BUFFER_SIZE);
+}
+
+/* cleanup handler, releases a mutex held while the thread got cancelled */
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
 }
 
 /******************************************************************************
@@ -102,7 +151,6 @@ Return Value: -
 ******************************************************************************/
 void worker_cleanup(void *arg)
 {
-    static unsigned char first_run = 1;
     int i;
 
     if (mjpgFileName != NULL) {
@@ -117,9 +165,14 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up ressources allocated by worker thread\n");
 
-    if(frame != NULL) {
-        free(frame);
+    /* this plugin does not take frames any more, see output_run() */
+    input_demand(&pglobal->in[input_number], -1);
+
+    for (i = 0; i < MAX_ZMQ_BUFFER_SIZE; ++i) {
+        free(frames[i]);
+        frames[i] = NULL;
     }
+    frame = NULL;
     close(fd);
 
     // cleanup zmq
@@ -135,6 +188,7 @@ void worker_cleanup(void *arg)
         free(pbPackage.frame[i]);
     }
     free(pbPackage.frame);
+    pbPackage.frame = NULL;
 }
 
 /******************************************************************************
@@ -228,6 +282,197 @@ void maintain_ringbuffer(int size)
     free(namelist);
 }
 
+/******************************************************************************
+Description.: releases a frame handed over to ZMQ by zmq_msg_init_data
+Input Value.: data is the frame buffer, hint is unused
+Return Value: -
+******************************************************************************/
+static void free_frame(void *data, void *hint)
+{
+    free(data);
+}
+
+/******************************************************************************
+Description.: packs the pending frames into one protobuf message and sends it
+Input Value.: count is the number of pending frames
+Return Value: 0 if the message was queued, -1 if it was dropped
+******************************************************************************/
+static int send_protobuf_batch(int count)
+{
+    char topic[] = "frames";
+    unsigned len;
+
+    /* allocate enough memory to store a serialized string */
+    if ((buf == NULL) || (bufferSize < (max_frame_size * zmqBufferSize + 20)))
+    {
+        bufferSize = (max_frame_size * zmqBufferSize + 20);
+        buf = realloc(buf, bufferSize);
+        if (buf == NULL) {
+            LOG("Not enough memory");
+            return -1;
+        }
+    }
+
+    DBG("transmitting ZMQ: %d frames\n", count);
+    /* pack protobuf data */
+    pbPackage.n_frame = count;
+    len = pb__package__get_packed_size(&pbPackage);
+    DBG("packing data: %i %i", max_frame_size, len);
+    pb__package__pack(&pbPackage, buf);
+    pbPackage.n_frame = zmqBufferSize;
+
+    DBG("sending data");
+    // send data using zmq
+    if ((zmq_send(publisher, topic, strlen(topic), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1) || (zmq_send(publisher, buf, len, 0) == -1)) {
+        DBG("ZMQ Transmission failure");
+        return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: sends the pending frames as one multipart message: the topic,
+              a protobuf header carrying the timestamps (with empty blobs)
+              and one part per frame. The frame buffers are handed over to
+              ZMQ, which frees them once they are transmitted to all peers.
+Input Value.: count is the number of pending frames
+Return Value: 0 if the message was queued, -1 if it was dropped
+******************************************************************************/
+static int send_zerocopy_batch(int count)
+{
+    char topic[] = "frames";
+    unsigned char header[64 * MAX_ZMQ_BUFFER_SIZE];
+    unsigned len;
+    zmq_msg_t msg;
+    int i, failed = 0;
+
+    DBG("transmitting ZMQ (zero copy): %d frames\n", count);
+    pbPackage.n_frame = count;
+    len = pb__package__get_packed_size(&pbPackage);
+    pb__package__pack(&pbPackage, header);
+    pbPackage.n_frame = zmqBufferSize;
+
+    if ((zmq_send(publisher, topic, strlen(topic), ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1) || (zmq_send(publisher, header, len, ZMQ_SNDMORE) == -1)) {
+        DBG("ZMQ Transmission failure");
+        failed = 1;
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (failed) {
+            free(frames[i]);
+        } else if (zmq_msg_init_data(&msg, frames[i], frame_sizes[i], free_frame, NULL) == -1) {
+            DBG("zmq_msg_init_data failed");
+            free(frames[i]);
+            failed = 1;
+        } else if (zmq_msg_send(&msg, publisher, (i < count - 1) ? ZMQ_SNDMORE : 0) == -1) {
+            /* closing the message releases the frame through free_frame() */
+            DBG("ZMQ Transmission failure");
+            zmq_msg_close(&msg);
+            failed = 1;
+        }
+        frames[i] = NULL;
+    }
+    frame = NULL;
+    return failed ? -1 : 0;
+}
+
+/******************************************************************************
+Description.: ROUTER mode: reads the pending requests of the workers without
+              blocking. Every message a worker sends is one credit, the
+              content is ignored.
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void collect_credits(void)
+{
+    unsigned char identity[MAX_ZMQ_IDENTITY], scratch[64];
+    int more, len, slot;
+    size_t more_size;
+
+    while ((len = zmq_recv(publisher, identity, sizeof(identity), ZMQ_DONTWAIT)) != -1) {
+        /* drop the rest of the request */
+        do {
+            more = 0;
+            more_size = sizeof(more);
+            zmq_getsockopt(publisher, ZMQ_RCVMORE, &more, &more_size);
+            if (more && zmq_recv(publisher, scratch, sizeof(scratch), ZMQ_DONTWAIT) == -1) {
+                more = 0;
+            }
+        } while (more);
+
+        if (len > MAX_ZMQ_IDENTITY || credit_count == MAX_ZMQ_CREDITS) {
+            DBG("ignoring worker request\n");
+            continue;
+        }
+
+        slot = (credit_head + credit_count) % MAX_ZMQ_CREDITS;
+        memcpy(credits[slot].identity, identity, len);
+        credits[slot].len = len;
+        credit_count++;
+    }
+}
+
+/******************************************************************************
+Description.: ROUTER mode: addresses the next message to a ready worker by
+              sending its identity as first part
+Input Value.: -
+Return Value: 0 if a worker was found, -1 if no worker is ready
+******************************************************************************/
+static int address_ready_worker(void)
+{
+    int slot;
+
+    collect_credits();
+    while (credit_count > 0) {
+        slot = credit_head;
+        credit_head = (credit_head + 1) % MAX_ZMQ_CREDITS;
+        credit_count--;
+
+        /* with ZMQ_ROUTER_MANDATORY this fails for workers which went away */
+        if (zmq_send(publisher, credits[slot].identity, credits[slot].len, ZMQ_SNDMORE | ZMQ_DONTWAIT) != -1) {
+            return 0;
+        }
+        DBG("worker not reachable: %s\n", zmq_strerror(zmq_errno()));
+    }
+    return -1;
+}
+
+/******************************************************************************
+Description.: sends the pending frames and keeps the delivery statistics
+Input Value.: count is the number of pending frames
+Return Value: -
+******************************************************************************/
+static void send_batch(int count)
+{
+    int rc = -1, i;
+
+    if (zmqMode != ZMQ_MODE_ROUTER || address_ready_worker() == 0) {
+        if (zmqZeroCopy) {
+            rc = send_zerocopy_batch(count);
+        } else {
+            rc = send_protobuf_batch(count);
+        }
+    } else if (zmqZeroCopy) {
+        /* nobody asked for it, the frames still belong to us */
+        for (i = 0; i < count; ++i) {
+            free(frames[i]);
+            frames[i] = NULL;
+        }
+        frame = NULL;
+    }
+
+    if (rc == 0) {
+        sent_frames += count;
+    } else {
+        dropped_frames += count;
+        DBG("dropped %d frames, %llu in total\n", count, dropped_frames);
+    }
+
+    pglobal->out[plugin_id].out_parameters[2].value = (int)sent_frames;
+    pglobal->out[plugin_id].out_parameters[3].value = (int)dropped_frames;
+    CONTROLS_CHANGED(&pglobal->out[plugin_id]);
+}
+
 /******************************************************************************
 Description.: this is the main worker thread
               it loops forever, grabs a fresh frame and stores it to file
@@ -240,6 +485,9 @@ void *worker_thread(void *arg)
     char buffer1[1024] = {0}, buffer2[1024] = {0};
     unsigned long long counter = 0;
     unsigned char *tmp_framebuffer = NULL;
+    int router_mandatory = 1;
+
+    pglobal->thread_start(Dest_Output, (int)(long)arg, "sender");
 
     //  Prepare our context and publisher
     //char zmqAddress[20];
@@ -248,17 +496,33 @@ void *worker_thread(void *arg)
     }
 
     context = zmq_ctx_new ();
-    publisher = zmq_socket (context, ZMQ_PUB);
+    switch (zmqMode) {
+    case ZMQ_MODE_PUSH:
+        publisher = zmq_socket (context, ZMQ_PUSH);
+        break;
+    case ZMQ_MODE_ROUTER:
+        publisher = zmq_socket (context, ZMQ_ROUTER);
+        zmq_setsockopt (publisher, ZMQ_ROUTER_MANDATORY, &router_mandatory, sizeof(router_mandatory));
+        break;
+    default:
+        publisher = zmq_socket (context, ZMQ_PUB);
+        break;
+    }
     //snprintf(zmqAddress, 20u, "epgm://eth0;239.1.1.1:%i", zmqPort);
 
+    if (zmqHwm >= 0 && zmq_setsockopt (publisher, ZMQ_SNDHWM, &zmqHwm, sizeof(zmqHwm)) == -1) {
+        LOG("Couldn't set the high water mark.\n");
+    }
+
     if (zmq_bind (publisher, zmqAddress) == -1) {
         LOG("Couldn't create zmq socket.\n");
     }
 
-    unsigned len;                      // Length of serialized data
-    char topic[] = "frames";
     struct timeval timestamp;
-    int i;
+    struct timespec capture_time;
+    unsigned long sequence;
+    struct timespec now;
+    int i, wait_rc;
 
     buf = NULL;
     for (i = 0; i < MAX_ZMQ_BUFFER_SIZE; ++i)
@@ -284,16 +548,39 @@ void *worker_thread(void *arg)
         DBG("waiting for fresh frame\n");
 
         pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+        if (zmqBatchTime > 0 && zmqBufferPos > 0 && mjpgFileName == NULL) {
+            /* do not hold back a partial batch longer than the batching window */
+            pthread_cleanup_push(unlock_mutex, &pglobal->in[input_number].db);
+            wait_rc = pthread_cond_timedwait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db, &batch_deadline);
+            pthread_cleanup_pop(0);
+            if (wait_rc == ETIMEDOUT) {
+                pthread_mutex_unlock(&pglobal->in[input_number].db);
+                send_batch(zmqBufferPos);
+                zmqBufferPos = 0;
+                continue;
+            }
+        } else {
+            pthread_cleanup_push(unlock_mutex, &pglobal->in[input_number].db);
+            pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+            pthread_cleanup_pop(0);
+        }
 
         /* read buffer */
+        input_frame(&pglobal->in[input_number]);
         frame_size = pglobal->in[input_number].size;
 
         /* set the right frame to store the data */
         frame = frames[zmqBufferPos];
 
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if((frame_size > max_frame_size) || (frame == NULL)) {
+        if (zmqZeroCopy && mjpgFileName == NULL) {
+            /* each frame gets its own buffer, ZMQ takes ownership of it when sending */
+            if((frame = malloc(frame_size)) == NULL) {
+                pthread_mutex_unlock(&pglobal->in[input_number].db);
+                LOG("not enough memory\n");
+                return NULL;
+            }
+        } else if((frame_size > max_frame_size) || (frame == NULL)) {
+            /* check if buffer for frame is large enough, increase it if necessary */
             DBG("increasing buffer size to %d\n", frame_size);
 
             if (frame_size > max_frame_size) {
@@ -312,14 +599,17 @@ void *worker_thread(void *arg)
             frame = tmp_framebuffer;
         }
 
-        /* copy v4l2_buffer timeval to user space */
+        /* copy the stamps of the frame */
         timestamp = pglobal->in[input_number].timestamp;
+        capture_time = pglobal->in[input_number].capture_time;
+        sequence = pglobal->in[input_number].sequence;
 
         /* copy frame to our local buffer now */
         memcpy(frame, pglobal->in[input_number].buf, frame_size);
 
         /* resync again with the frame buffer */
         frames[zmqBufferPos] = frame;
+        frame_sizes[zmqBufferPos] = frame_size;
 
         /* allow others to access the global buffer again */
         pthread_mutex_unlock(&pglobal->in[input_number].db);
@@ -330,38 +620,36 @@ void *worker_thread(void *arg)
 
             begin = clock();
 
-            /* allocate enough memory to store a serialized string */
-            if ((buf == NULL) || (bufferSize < (max_frame_size * zmqBufferSize + 20)))
-            {
-                bufferSize = (max_frame_size * zmqBufferSize + 20);
-                buf = realloc(buf, bufferSize);
-                if (buf == NULL) {
-                    LOG("Not enough memory");
-                }
-            }
-
-            /* fill protobuf data */
+            /* fill protobuf data, in zero copy mode the frames travel as separate parts */
             pbPackage.frame[zmqBufferPos]->timestamp_unix = (u_int32_t)time(NULL);
             pbPackage.frame[zmqBufferPos]->timestamp_s = (u_int32_t)timestamp.tv_sec;
             pbPackage.frame[zmqBufferPos]->timestamp_us = (u_int32_t)timestamp.tv_usec;
-            pbPackage.frame[zmqBufferPos]->blob.data = frame;
-            pbPackage.frame[zmqBufferPos]->blob.len = frame_size;
+            pbPackage.frame[zmqBufferPos]->blob.data = zmqZeroCopy ? NULL : frame;
+            pbPackage.frame[zmqBufferPos]->blob.len = zmqZeroCopy ? 0 : frame_size;
+            pbPackage.frame[zmqBufferPos]->has_sequence = 1;
+            pbPackage.frame[zmqBufferPos]->sequence = sequence;
+            pbPackage.frame[zmqBufferPos]->has_capture_monotonic_us = 1;
+            pbPackage.frame[zmqBufferPos]->capture_monotonic_us = capture_time.tv_sec * 1000000ULL + capture_time.tv_nsec / 1000;
+
+            clock_gettime(CLOCK_REALTIME, &now);
+            if (zmqBufferPos == 0) {
+                /* first frame of a batch opens the batching window */
+                batch_deadline.tv_sec = now.tv_sec + zmqBatchTime / 1000;
+                batch_deadline.tv_nsec = now.tv_nsec + (zmqBatchTime % 1000) * 1000000L;
+                if (batch_deadline.tv_nsec >= 1000000000L) {
+                    batch_deadline.tv_sec++;
+                    batch_deadline.tv_nsec -= 1000000000L;
+                }
+            }
 
             zmqBufferPos++;
 
-            if (zmqBufferPos == zmqBufferSize)
+            if ((zmqBufferPos == zmqBufferSize) ||
+                (zmqBatchTime > 0 && (now.tv_sec > batch_deadline.tv_sec ||
+                                      (now.tv_sec == batch_deadline.tv_sec && now.tv_nsec >= batch_deadline.tv_nsec))))
             {
                 DBG("transmitting ZMQ: %lld\n", counter);
-                /* pack protobuf data */
-                len = pb__package__get_packed_size(&pbPackage);
-                DBG("packing data: %i %i", max_frame_size, len);
-                pb__package__pack(&pbPackage, buf);
-
-                DBG("sending data");
-                // send data using zmq
-                if ((zmq_send(publisher, topic, strlen(topic), ZMQ_SNDMORE) == -1) || (zmq_send(publisher, buf, len, 0) == -1)) {
-                    DBG("ZMQ Transmission failure");
-                }
+                send_batch(zmqBufferPos);
 
                 zmqBufferPos = 0;
             }
@@ -439,6 +727,27 @@ int output_init(output_parameter *param, int id)
 {
 	int i;
     pglobal = param->global;
+
+    /* the library stays loaded after a removal, a new instance starts from the defaults */
+    first_run = 1;
+    frame = NULL;
+    max_frame_size = 0;
+    folder = "/tmp";
+    ringbuffer_size = -1;
+    ringbuffer_exceed = 0;
+    command = NULL;
+    input_number = 0;
+    mjpgFileName = NULL;
+    zmqAddress = NULL;
+    zmqBufferSize = 3;
+    zmqBufferPos = 0;
+    zmqZeroCopy = 0;
+    zmqBatchTime = 0;
+    zmqMode = ZMQ_MODE_PUB;
+    zmqHwm = -1;
+    sent_frames = dropped_frames = 0;
+    credit_head = credit_count = 0;
+
     pglobal->out[id].name = malloc((1+strlen(OUTPUT_PLUGIN_NAME))*sizeof(char));
     sprintf(pglobal->out[id].name, "%s", OUTPUT_PLUGIN_NAME);
     DBG("OUT plugin %d name: %s\n", id, pglobal->out[id].name);
@@ -471,6 +780,14 @@ int output_init(output_parameter *param, int id)
             {"address", required_argument, 0, 0},
             {"b", required_argument, 0, 0},
             {"buffer_size", required_argument, 0, 0},
+            {"t", required_argument, 0, 0},
+            {"batch_time", required_argument, 0, 0},
+            {"z", no_argument, 0, 0},
+            {"zerocopy", no_argument, 0, 0},
+            {"M", required_argument, 0, 0},
+            {"mode", required_argument, 0, 0},
+            {"w", required_argument, 0, 0},
+            {"hwm", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -541,9 +858,48 @@ int output_init(output_parameter *param, int id)
             DBG("case 14,15\n");
             zmqBufferSize = atoi(optarg);
             break;
+            /* batch_time */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            zmqBatchTime = MAX(atoi(optarg), 0);
+            break;
+            /* zerocopy */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            zmqZeroCopy = 1;
+            break;
+            /* mode */
+        case 20:
+        case 21:
+            DBG("case 20,21\n");
+            for (i = 0; i < LENGTH_OF(zmq_modes); i++) {
+                if (strcasecmp(zmq_modes[i].k, optarg) == 0) {
+                    zmqMode = zmq_modes[i].v;
+                    break;
+                }
+            }
+            if (i == LENGTH_OF(zmq_modes)) {
+                OPRINT("ERROR: unknown mode %s\n", optarg);
+                help();
+                return 1;
+            }
+            break;
+            /* hwm */
+        case 22:
+        case 23:
+            DBG("case 22,23\n");
+            zmqHwm = atoi(optarg);
+            break;
         }
     }
 
+    if(zmqBufferSize < 1 || zmqBufferSize > MAX_ZMQ_BUFFER_SIZE) {
+        OPRINT("ERROR: the buffer size must be between 1 and %d\n", MAX_ZMQ_BUFFER_SIZE);
+        return 1;
+    }
+
     if(!(input_number < pglobal->incnt)) {
         OPRINT("ERROR: the %d input_plugin number is too much only %d plugins loaded\n", input_number, param->global->incnt);
         return 1;
@@ -551,6 +907,15 @@ int output_init(output_parameter *param, int id)
 
     OPRINT("output folder.....: %s\n", folder);
     OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
+    OPRINT("frames per batch.: %d\n", zmqBufferSize);
+    if (zmqBatchTime > 0) {
+        OPRINT("batching window..: %d ms\n", zmqBatchTime);
+    }
+    OPRINT("zero copy........: %s\n", zmqZeroCopy ? "enabled" : "disabled");
+    OPRINT("socket mode......: %s\n", zmq_modes[zmqMode].k);
+    if (zmqHwm >= 0) {
+        OPRINT("high water mark..: %d\n", zmqHwm);
+    }
     if  (mjpgFileName == NULL) {
         if(ringbuffer_size > 0) {
             OPRINT("ringbuffer size...: %d to %d\n", ringbuffer_size, ringbuffer_size + ringbuffer_exceed);
@@ -570,9 +935,10 @@ int output_init(output_parameter *param, int id)
         free(fnBuffer);
     }
 
-    param->global->out[id].parametercount = 2;
+    plugin_id = id;
+    param->global->out[id].parametercount = 4;
 
-    param->global->out[id].out_parameters = (control*) calloc(2, sizeof(control));
+    param->global->out[id].out_parameters = (control*) calloc(4, sizeof(control));
 
     control take_ctrl;
 	take_ctrl.group = IN_CMD_GENERIC;
@@ -606,6 +972,29 @@ int output_init(output_parameter *param, int id)
 
 	param->global->out[id].out_parameters[1] = filename_ctrl;
 
+    control sent_ctrl;
+	sent_ctrl.group = IN_CMD_GENERIC;
+	sent_ctrl.menuitems = NULL;
+	sent_ctrl.value = 0;
+	sent_ctrl.class_id = 0;
+
+	sent_ctrl.ctrl.id = OUT_ZMQ_CMD_SENT;
+	sent_ctrl.ctrl.type = V4L2_CTRL_TYPE_INTEGER;
+	sent_ctrl.ctrl.flags = V4L2_CTRL_FLAG_READ_ONLY;
+	strcpy((char*) sent_ctrl.ctrl.name, "Frames sent");
+	sent_ctrl.ctrl.minimum = 0;
+	sent_ctrl.ctrl.maximum = INT_MAX;
+	sent_ctrl.ctrl.step = 1;
+	sent_ctrl.ctrl.default_value = 0;
+
+	param->global->out[id].out_parameters[2] = sent_ctrl;
+
+    control dropped_ctrl = sent_ctrl;
+	dropped_ctrl.ctrl.id = OUT_ZMQ_CMD_DROPPED;
+	strcpy((char*) dropped_ctrl.ctrl.name, "Frames dropped");
+
+	param->global->out[id].out_parameters[3] = dropped_ctrl;
+
 
     return 0;
 }
@@ -619,6 +1008,7 @@ int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -629,9 +1019,11 @@ Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
+    /* this plugin takes every frame, an input which captures on demand keeps running */
+    input_demand(&pglobal->in[input_number], 1);
+
     DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    pthread_create(&worker, 0, worker_thread, (void *)(long)id);
     return 0;
 }
 
@@ -655,6 +1047,7 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
                                         return -1;
                                     }
                                     /* read buffer */
+                                    input_frame(&pglobal->in[input_number]);
                                     frame_size = pglobal->in[input_number].size;
 
                                     /* check if buffer for frame is large enough, increase it if necessary */
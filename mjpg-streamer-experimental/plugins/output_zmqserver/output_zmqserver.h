@@ -3,5 +3,7 @@
 
 #define OUT_FILE_CMD_TAKE           1
 #define OUT_FILE_CMD_FILENAME       2
+#define OUT_ZMQ_CMD_SENT            3
+#define OUT_ZMQ_CMD_DROPPED         4
 
 #endif
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+#
+# Measures the latency of an mjpg-streamer stream. Start the server with
+#
+#   mjpg_streamer -i 'input_testpicture.so -d 40 --latency' -o 'output_http.so'
+#
+# every frame then contains a JPEG comment with the time it was emitted, which
+# is compared with the time the frame arrived here. Both have to run on the
+# same host or on hosts with synchronized clocks.
+#
+# Exits with 1 if the median latency exceeds --max-ms, so it can be used in CI.
+
+import argparse
+import re
+import statistics
+import sys
+import time
+import urllib.request
+
+PROBE = re.compile(rb"mjpg-streamer probe seq=(\d+) emitted=(\d+)\.(\d{6})")
+
+
+def frames(url, timeout):
+    """yields the parts of a multipart stream"""
+    stream = urllib.request.urlopen(url, timeout=timeout)
+    while True:
+        length = None
+        while True:
+            line = stream.readline()
+            if not line:
+                return
+            line = line.strip()
+            if line.lower().startswith(b"content-length:"):
+                length = int(line.split(b":")[1])
+            elif line == b"" and length is not None:
+                break
+        yield stream.read(length)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("url", nargs="?", default="http://127.0.0.1:8080/?action=stream")
+    parser.add_argument("-n", "--frames", type=int, default=100, help="frames to measure")
+    parser.add_argument("--max-ms", type=float, help="fail if the median latency is higher")
+    args = parser.parse_args()
+
+    latencies = []
+    last = None
+    lost = 0
+    for data in frames(args.url, 10):
+        received = time.time()
+        match = PROBE.search(data[:256])
+        if match is None:
+            sys.exit("frame without probe comment, is input_testpicture running with --latency?")
+        sequence = int(match.group(1))
+        emitted = int(match.group(2)) + int(match.group(3)) / 1000000.0
+        if last is not None and sequence > last + 1:
+            lost += sequence - last - 1
+        last = sequence
+        latencies.append((received - emitted) * 1000)
+        if len(latencies) >= args.frames:
+            break
+
+    if not latencies:
+        sys.exit("no frames received")
+
+    latencies.sort()
+    median = statistics.median(latencies)
+    print("frames %d, skipped %d, latency ms: min %.1f median %.1f p95 %.1f max %.1f" % (
+        len(latencies), lost, latencies[0], median,
+        latencies[int(len(latencies) * 0.95) - 1 if len(latencies) > 1 else 0], latencies[-1]))
+
+    if args.max_ms is not None and median > args.max_ms:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,478 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * The placement of the plugin threads: the options --cpus, --sched, --nice
+ * and --thread_name in the specification of a plugin are taken out before
+ * the plugin sees its parameters. Each thread of the plugin applies them
+ * when it starts, e.g. to pin the capture to an isolated core and keep the
+ * many HTTP clients away from it. The threads are remembered, so their CPU
+ * time can be shown in program.json.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "utils.h"
+#include "mjpg_streamer.h"
+#include "threads.h"
+
+struct _thread_settings {
+    cpu_set_t cpus;
+    int pin;            // cpus is set
+    int policy;         // -1 to leave the policy alone
+    int priority;
+    int nice;
+    int renice;         // nice is set
+    char *name;         // the first part of the names of the threads
+    int warned;         // the missing permission was reported already
+};
+
+/* a thread which called thread_start() */
+typedef struct {
+    int tid;            // 0 if the entry is free
+    command_dest dest;
+    int id;
+    char name[16];
+    double cpu_time;    // at the previous listing
+    struct timespec sampled;
+    double usage;
+} thread_entry;
+
+static globals *pglobal;
+
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_entry *threads;
+static int thread_count;
+static pthread_key_t thread_key;
+
+/******************************************************************************
+Description.: parses a list of CPUs like "2", "0,2" or "2-3"
+Input Value.: s is the list
+              cpus receives the CPUs
+Return Value: 0 if ok, -1 if the list is malformed
+******************************************************************************/
+static int parse_cpus(const char *s, cpu_set_t *cpus)
+{
+    char *end;
+    long first, last;
+
+    CPU_ZERO(cpus);
+    do {
+        first = strtol(s, &end, 10);
+        if(end == s || first < 0)
+            return -1;
+        last = first;
+        if(*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if(end == s || last < first)
+                return -1;
+        }
+        if(last >= CPU_SETSIZE)
+            return -1;
+        for(; first <= last; first++)
+            CPU_SET(first, cpus);
+        s = end + 1;
+    } while(*end == ',');
+
+    return (*end == '\0') ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: parses a scheduling policy like "fifo:50", "rr:10", "other",
+              "batch" or "idle"
+Input Value.: s is the policy
+              settings receives the policy and its priority
+Return Value: 0 if ok, -1 if the policy is unknown or the priority invalid
+******************************************************************************/
+static int parse_sched(const char *s, struct _thread_settings *settings)
+{
+    static const struct {
+        const char *name;
+        int policy;
+    } policies[] = {
+        { "other", SCHED_OTHER },
+        { "batch", SCHED_BATCH },
+        { "idle", SCHED_IDLE },
+        { "fifo", SCHED_FIFO },
+        { "rr", SCHED_RR }
+    };
+    size_t length = strcspn(s, ":");
+    char *end;
+    int i;
+
+    for(i = 0; i < (int)LENGTH_OF(policies); i++) {
+        if(strlen(policies[i].name) == length && strncmp(policies[i].name, s, length) == 0)
+            break;
+    }
+    if(i == LENGTH_OF(policies))
+        return -1;
+    settings->policy = policies[i].policy;
+    settings->priority = 0;
+
+    if(s[length] == ':') {
+        settings->priority = strtol(s + length + 1, &end, 10);
+        if(end == s + length + 1 || *end != '\0')
+            return -1;
+    }
+    if(settings->priority < sched_get_priority_min(settings->policy) ||
+       settings->priority > sched_get_priority_max(settings->policy))
+        return -1;
+    return 0;
+}
+
+/******************************************************************************
+Description.: tells if a parameter is one of the thread options
+Input Value.: option is the parameter
+Return Value: 1 if it is
+******************************************************************************/
+static int is_thread_option(const char *option)
+{
+    return strcmp(option, "--cpus") == 0 || strcmp(option, "--sched") == 0 ||
+           strcmp(option, "--nice") == 0 || strcmp(option, "--thread_name") == 0;
+}
+
+/******************************************************************************
+Description.: takes the thread options out of the parameters of a plugin
+Input Value.: settings receives the options or NULL if there are none, the
+              old settings are freed
+              argc and argv are the parameters as split by the core, the
+              options are removed from them if they are all valid
+Return Value: 0 if ok, -1 if an option is malformed
+******************************************************************************/
+int thread_options(struct _thread_settings **settings, int *argc, char **argv)
+{
+    struct _thread_settings *s;
+    const char *option, *value;
+    char *end;
+    int i, j, ok;
+
+    thread_settings_free(*settings);
+    *settings = NULL;
+
+    s = calloc(1, sizeof(*s));
+    if(s == NULL)
+        return -1;
+    s->policy = -1;
+
+    for(i = 1; i < *argc; i++) {
+        option = argv[i];
+        if(!is_thread_option(option))
+            continue;
+        value = (i + 1 < *argc) ? argv[++i] : "";
+
+        if(strcmp(option, "--cpus") == 0) {
+            ok = (parse_cpus(value, &s->cpus) == 0);
+            s->pin = 1;
+        } else if(strcmp(option, "--sched") == 0) {
+            ok = (parse_sched(value, s) == 0);
+        } else if(strcmp(option, "--nice") == 0) {
+            s->nice = strtol(value, &end, 10);
+            ok = (end != value && *end == '\0' && s->nice >= -20 && s->nice <= 19);
+            s->renice = 1;
+        } else {
+            /* the names are listed in program.json, like the labels of the inputs */
+            ok = (*value != '\0');
+            for(j = 0; value[j] != '\0'; j++) {
+                if(!isalnum((unsigned char)value[j]) && value[j] != '-' && value[j] != '_')
+                    ok = 0;
+            }
+            free(s->name);
+            s->name = strdup(value);
+        }
+
+        if(!ok) {
+            LOG("ERROR: invalid value for %s: \"%s\"\n", option, value);
+            thread_settings_free(s);
+            return -1;
+        }
+    }
+
+    /* all options are valid, so they are removed */
+    for(i = 1, j = 1; i < *argc; i++) {
+        if(!is_thread_option(argv[i])) {
+            argv[j++] = argv[i];
+            continue;
+        }
+        free(argv[i]);
+        if(i + 1 < *argc)
+            free(argv[++i]);
+    }
+    for(i = j; i < *argc; i++)
+        argv[i] = NULL;
+    *argc = j;
+
+    if(!s->pin && s->policy < 0 && !s->renice && s->name == NULL) {
+        free(s);
+        return 0;
+    }
+    *settings = s;
+    return 0;
+}
+
+/******************************************************************************
+Description.: frees the settings thread_options() created
+Input Value.: settings are the settings, may be NULL
+Return Value: -
+******************************************************************************/
+void thread_settings_free(struct _thread_settings *settings)
+{
+    if(settings == NULL)
+        return;
+    free(settings->name);
+    free(settings);
+}
+
+/******************************************************************************
+Description.: reads the name, the CPU and the CPU time of a thread of this
+              process from /proc
+Input Value.: tid is the thread
+              name receives the name, it has 16 characters
+              cpu receives the CPU it ran on last
+              cpu_time receives the seconds of CPU time it used
+Return Value: 0 if ok, -1 if the thread does not exist any more
+******************************************************************************/
+static int read_thread(int tid, char *name, int *cpu, double *cpu_time)
+{
+    char path[64], line[1024], *p, *token, *saveptr = NULL;
+    unsigned long long utime = 0, stime = 0;
+    size_t length;
+    FILE *file;
+    int field;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+    if((file = fopen(path, "r")) == NULL)
+        return -1;
+    length = fread(line, 1, sizeof(line) - 1, file);
+    fclose(file);
+    line[length] = '\0';
+
+    /* the name is in parentheses and may contain anything, even ")" */
+    if((p = strchr(line, '(')) == NULL || (token = strrchr(line, ')')) == NULL || token < p)
+        return -1;
+    length = MIN((size_t)(token - p - 1), 15);
+    memcpy(name, p + 1, length);
+    name[length] = '\0';
+
+    *cpu = -1;
+    for(field = 3, token = strtok_r(token + 1, " ", &saveptr); token != NULL;
+        field++, token = strtok_r(NULL, " ", &saveptr)) {
+        if(field == 14)
+            utime = strtoull(token, NULL, 10);
+        else if(field == 15)
+            stime = strtoull(token, NULL, 10);
+        else if(field == 39)
+            *cpu = atoi(token);
+    }
+    *cpu_time = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+    return 0;
+}
+
+/******************************************************************************
+Description.: forgets a thread when it leaves, it is the destructor of
+              thread_key and also runs if the thread is cancelled
+Input Value.: arg is the id of the thread
+Return Value: -
+******************************************************************************/
+static void unregister_thread(void *arg)
+{
+    int tid = (int)(long)arg, i;
+
+    pthread_mutex_lock(&threads_mutex);
+    for(i = 0; i < thread_count; i++) {
+        if(threads[i].tid == tid) {
+            threads[i].tid = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&threads_mutex);
+}
+
+/******************************************************************************
+Description.: remembers the calling thread
+Input Value.: dest, id identify the plugin, name is the name of the thread
+Return Value: -
+******************************************************************************/
+static void register_thread(command_dest dest, int id, const char *name)
+{
+    int tid = syscall(SYS_gettid), i, free_entry = -1;
+    thread_entry *entry;
+
+    pthread_mutex_lock(&threads_mutex);
+    for(i = 0; i < thread_count; i++) {
+        if(threads[i].tid == tid) {
+            free_entry = i;
+            break;
+        }
+        if(threads[i].tid == 0 && free_entry < 0)
+            free_entry = i;
+    }
+
+    if(free_entry < 0) {
+        entry = realloc(threads, (thread_count * 2 + 16) * sizeof(thread_entry));
+        if(entry == NULL) {
+            pthread_mutex_unlock(&threads_mutex);
+            return;
+        }
+        threads = entry;
+        memset(&threads[thread_count], 0, (thread_count + 16) * sizeof(thread_entry));
+        free_entry = thread_count;
+        thread_count = thread_count * 2 + 16;
+    }
+
+    entry = &threads[free_entry];
+    memset(entry, 0, sizeof(*entry));
+    entry->tid = tid;
+    entry->dest = dest;
+    entry->id = id;
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    pthread_mutex_unlock(&threads_mutex);
+
+    /* the entry is freed by unregister_thread() when the thread leaves */
+    pthread_setspecific(thread_key, (void *)(long)tid);
+}
+
+/******************************************************************************
+Description.: keeps the pointer to the global variables and creates the key
+              which forgets the threads when they leave
+Input Value.: param are the global variables
+Return Value: -
+******************************************************************************/
+void thread_init(globals *param)
+{
+    pglobal = param;
+    if(pthread_key_create(&thread_key, unregister_thread) != 0) {
+        fprintf(stderr, "could not create the key of the threads\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/******************************************************************************
+Description.: applies the thread options of a plugin to the calling thread,
+              names and remembers it. Threads created by this thread inherit
+              the CPUs and the priority until they call it themselves.
+Input Value.: dest and id identify the plugin
+              role is what the thread does, e.g. "capture" or "client"
+Return Value: -
+******************************************************************************/
+void thread_start(command_dest dest, int id, const char *role)
+{
+    struct _thread_settings *settings;
+    const char *label;
+    char prefix[16], name[16];
+    struct sched_param param;
+    int error = 0, length;
+
+    if(dest == Dest_Input) {
+        settings = pglobal->in[id].threads;
+        label = pglobal->in[id].label;
+        snprintf(prefix, sizeof(prefix), "in%d", id);
+    } else {
+        settings = pglobal->out[id].threads;
+        label = NULL;
+        snprintf(prefix, sizeof(prefix), "out%d", id);
+    }
+    if(settings != NULL && settings->name != NULL)
+        label = settings->name;
+    /* the kernel keeps 15 characters, the label is shortened so the role stays visible */
+    length = MAX((int)(sizeof(name) - 2 - strlen(role)), 0);
+    snprintf(name, sizeof(name), "%.*s/%s", length, (label != NULL) ? label : prefix, role);
+    pthread_setname_np(pthread_self(), name);
+
+    if(settings != NULL) {
+        if(settings->pin && pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &settings->cpus) != 0) {
+            LOG("could not place the thread %s on the CPUs given with --cpus\n", name);
+        }
+        if(settings->policy >= 0) {
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = settings->priority;
+            error = pthread_setschedparam(pthread_self(), settings->policy, &param);
+        }
+        if(error == 0 && settings->renice && setpriority(PRIO_PROCESS, syscall(SYS_gettid), settings->nice) != 0)
+            error = errno;
+        if(error != 0 && !settings->warned) {
+            settings->warned = 1;
+            LOG("could not change the priority of the thread %s: %s\n", name, strerror(error));
+        }
+    }
+
+    register_thread(dest, id, name);
+}
+
+/******************************************************************************
+Description.: lists the threads of a plugin with their CPU time
+Input Value.: dest and id identify the plugin
+              list receives up to max threads
+Return Value: the number of threads in list
+******************************************************************************/
+int thread_list(command_dest dest, int id, plugin_thread *list, int max)
+{
+    struct timespec now;
+    double cpu_time, seconds;
+    char name[16];
+    int i, count = 0, cpu;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&threads_mutex);
+    for(i = 0; i < thread_count && count < max; i++) {
+        thread_entry *entry = &threads[i];
+
+        if(entry->tid == 0 || entry->dest != dest || entry->id != id)
+            continue;
+        if(read_thread(entry->tid, name, &cpu, &cpu_time) != 0 || strcmp(name, entry->name) != 0) {
+            entry->tid = 0;
+            continue;
+        }
+
+        /* the usage is measured between two listings, but not shorter than 100 ms */
+        seconds = (now.tv_sec - entry->sampled.tv_sec) + (now.tv_nsec - entry->sampled.tv_nsec) / 1000000000.0;
+        if(entry->sampled.tv_sec != 0 && seconds >= 0.1) {
+            entry->usage = 100.0 * (cpu_time - entry->cpu_time) / seconds;
+        }
+        if(entry->sampled.tv_sec == 0 || seconds >= 0.1) {
+            entry->cpu_time = cpu_time;
+            entry->sampled = now;
+        }
+
+        list[count].tid = entry->tid;
+        memcpy(list[count].name, entry->name, sizeof(list[count].name));
+        list[count].cpu = cpu;
+        list[count].cpu_time = cpu_time;
+        list[count].usage = entry->usage;
+        count++;
+    }
+    pthread_mutex_unlock(&threads_mutex);
+    return count;
+}